@@ -0,0 +1,212 @@
+/*
+ * Reference reader for the shared memory area written by the export audio
+ * filter (--af=export). It follows the protocol described in af_export.h
+ * and prints one line per block with its timestamp and the peak level of
+ * each channel. It can run alongside any number of other readers.
+ *
+ * usage: af_export_reader [-n blocks] [-q] file
+ *   -n  exit after reading this many blocks
+ *   -q  only print the summary at exit
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "af_export.h"
+#include "osdep/atomics.h"
+
+struct reader {
+    const char *filename;
+    int fd;
+    uint8_t *area;
+    size_t size;
+    struct af_export_header hdr;  // copy of the constant part
+    uint64_t next;                // number of the next block to read
+    void *buf;                    // private copy of one block's samples
+
+    uint64_t read, skipped, torn;
+};
+
+static void close_file(struct reader *r)
+{
+    if (r->area)
+        munmap(r->area, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+    r->area = NULL;
+    r->fd = -1;
+    free(r->buf);
+    r->buf = NULL;
+}
+
+// Returns 0 on success, -1 if the file is not (yet) usable.
+static int open_file(struct reader *r)
+{
+    struct stat st;
+    r->fd = open(r->filename, O_RDONLY);
+    if (r->fd < 0 || fstat(r->fd, &st) < 0 ||
+        st.st_size < (off_t)sizeof(struct af_export_header))
+        goto fail;
+    r->size = st.st_size;
+    r->area = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (r->area == MAP_FAILED) {
+        r->area = NULL;
+        goto fail;
+    }
+    memcpy(&r->hdr, r->area, sizeof(r->hdr));
+    const struct af_export_header *h = &r->hdr;
+    if (h->magic != AF_EXPORT_MAGIC || h->version != AF_EXPORT_VERSION) {
+        fprintf(stderr, "%s: not an export file of a supported version\n",
+                r->filename);
+        goto fail;
+    }
+    // Left behind by a writer that has exited or replaced it
+    if (h->flags & AF_EXPORT_FLAG_CLOSED)
+        goto fail;
+    if (h->nch < 1 || h->nch > AF_EXPORT_MAX_CH || !h->nblocks ||
+        h->header_size + (uint64_t)h->nblocks * h->block_size > r->size ||
+        sizeof(struct af_export_block) + (uint64_t)h->nch *
+        h->block_samples * h->bytes_per_sample > h->block_size)
+        goto fail;
+    r->buf = malloc(h->block_size);
+    if (!r->buf)
+        goto fail;
+
+    printf("# %s: %"PRIu32" Hz, %"PRIu32" ch, %s, %"PRIu32" blocks of "
+           "%"PRIu32" samples, map", r->filename, h->rate, h->nch,
+           h->format == AF_EXPORT_FORMAT_FLOAT ? "float" : "s16",
+           h->nblocks, h->block_samples);
+    for (unsigned n = 0; n < h->nch; n++)
+        printf(" %d", h->channel_map[n]);
+    printf("\n");
+
+    // Start with the most recent complete block
+    const volatile struct af_export_header *sh = (void *)r->area;
+    r->next = sh->write_seq ? sh->write_seq - 1 : 0;
+    return 0;
+
+fail:
+    close_file(r);
+    return -1;
+}
+
+static const struct af_export_block *get_block(struct reader *r, uint64_t n)
+{
+    return (const void *)(r->area + r->hdr.header_size
+                          + (n % r->hdr.nblocks) * r->hdr.block_size);
+}
+
+/* Copy block r->next out of the shared area. Returns 1 on success, 0 if the
+ * block isn't complete yet, -1 if the writer had already overwritten it and
+ * -2 if it was overwritten while copying. */
+static int read_block(struct reader *r, double *pts)
+{
+    const struct af_export_block *blk = get_block(r, r->next);
+    uint64_t seq = blk->seq;
+    if (seq != AF_EXPORT_SEQ_DONE(r->next))
+        return seq > AF_EXPORT_SEQ_DONE(r->next) ? -1 : 0;
+    mp_memory_barrier();
+    *pts = blk->pts;
+    memcpy(r->buf, blk + 1, r->hdr.block_size - sizeof(*blk));
+    mp_memory_barrier();
+    return blk->seq == seq ? 1 : -2;
+}
+
+static void print_block(struct reader *r, double pts)
+{
+    const struct af_export_header *h = &r->hdr;
+    printf("%8"PRIu64" ", r->next);
+    if (pts == AF_EXPORT_NOPTS)
+        printf("      -     ");
+    else
+        printf("%11.6f ", pts);
+    for (unsigned ch = 0; ch < h->nch; ch++) {
+        double peak = 0;
+        for (unsigned i = 0; i < h->block_samples; i++) {
+            unsigned n = ch * h->block_samples + i;
+            double v = h->format == AF_EXPORT_FORMAT_FLOAT ?
+                       ((float *)r->buf)[n] : ((int16_t *)r->buf)[n] / 32768.0;
+            peak = fmax(peak, fabs(v));
+        }
+        printf(" %6.1f", peak > 0 ? 20 * log10(peak) : -INFINITY);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct reader r = { .fd = -1 };
+    uint64_t max_blocks = 0;
+    int quiet = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:q")) != -1) {
+        switch (opt) {
+        case 'n': max_blocks = strtoull(optarg, NULL, 0); break;
+        case 'q': quiet = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-n blocks] [-q] file\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-n blocks] [-q] file\n", argv[0]);
+        return 2;
+    }
+    r.filename = argv[optind];
+
+    while (!max_blocks || r.read < max_blocks) {
+        if (!r.area) {
+            if (open_file(&r) < 0) {
+                usleep(100000);
+                continue;
+            }
+        }
+        const volatile struct af_export_header *sh = (void *)r.area;
+        double pts;
+        int res = read_block(&r, &pts);
+        if (res > 0) {
+            if (!quiet)
+                print_block(&r, pts);
+            r.read++;
+            r.next++;
+        } else if (res < 0) {
+            // Lapped by the writer: continue with the newest block
+            uint64_t newest = sh->write_seq - 1;
+            r.torn += res == -2;
+            r.skipped += newest - r.next;
+            r.next = newest;
+        } else if (sh->flags & AF_EXPORT_FLAG_CLOSED) {
+            close_file(&r);
+        } else {
+            usleep(5000);
+        }
+    }
+    printf("# read %"PRIu64" blocks, skipped %"PRIu64", torn reads %"PRIu64
+           "\n", r.read, r.skipped, r.torn);
+    close_file(&r);
+    return 0;
+}
@@ -275,6 +275,19 @@ bool bstr_case_endswith(struct bstr s, struct bstr suffix)
     return end.len == suffix.len && bstrcasecmp(end, suffix) == 0;
 }
 
+unsigned int bstr_case_hash(struct bstr s)
+{
+    // FNV-1a over the ASCII lowercase characters
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < s.len; i++) {
+        unsigned char c = s.start[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
 struct bstr bstr_strip_ext(struct bstr str)
 {
     int dotpos = bstrrchr(str, '.');
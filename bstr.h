@@ -98,6 +98,8 @@ bool bstr_eatstart(struct bstr *s, struct bstr prefix);
 
 bool bstr_case_startswith(struct bstr s, struct bstr prefix);
 bool bstr_case_endswith(struct bstr s, struct bstr suffix);
+// Hash that is equal for strings that are equal with bstrcasecmp().
+unsigned int bstr_case_hash(struct bstr s);
 struct bstr bstr_strip_ext(struct bstr str);
 struct bstr bstr_get_ext(struct bstr s);
 
@@ -42,6 +42,8 @@ extern int stop_xscreensaver;
 
 extern int mp_msg_color;
 extern int mp_msg_module;
+extern int mp_msg_async;
+extern int mp_msg_rate_limit;
 
 /* defined in codec-cfg.c */
 extern char *codecs_file;
@@ -215,6 +217,7 @@ extern af_cfg_t af_cfg; // Audio filter configuration, defined in libmpcodecs/de
 const m_option_t audio_filter_conf[]={
     {"list", &af_cfg.list, CONF_TYPE_STRING_LIST, 0, 0, 0, NULL},
     {"force", &af_cfg.force, CONF_TYPE_INT, CONF_RANGE, 0, 7, NULL},
+    {"planar", &af_cfg.planar, CONF_TYPE_FLAG, 0, 0, 1, NULL},
     {NULL, NULL, 0, 0, 0, 0, NULL}
 };
 
@@ -329,6 +332,8 @@ const m_option_t common_opts[] = {
     {"msglevel", (void *) msgl_config, CONF_TYPE_SUBCONFIG, CONF_GLOBAL, 0, 0, NULL},
     {"msgcolor", &mp_msg_color, CONF_TYPE_FLAG, CONF_GLOBAL, 0, 1, NULL},
     {"msgmodule", &mp_msg_module, CONF_TYPE_FLAG, CONF_GLOBAL, 0, 1, NULL},
+    {"msgasync", &mp_msg_async, CONF_TYPE_FLAG, CONF_GLOBAL, 0, 1, NULL},
+    {"msgratelimit", &mp_msg_rate_limit, CONF_TYPE_INT, CONF_GLOBAL | CONF_MIN, 0, 0, NULL},
 #ifdef CONFIG_PRIORITY
     {"priority", &proc_priority, CONF_TYPE_STRING, 0, 0, 0, NULL},
 #endif
@@ -554,6 +559,7 @@ const m_option_t common_opts[] = {
     OPT_STRING("ass-border-color", ass_border_color, 0),
     OPT_STRING("ass-styles", ass_styles_file, 0),
     OPT_INTRANGE("ass-hinting", ass_hinting, 0, 0, 7),
+    OPT_INTRANGE("ass-prerender", ass_prerender, 0, 0, 100),
     {NULL, NULL, 0, 0, 0, 0, NULL}
 };
 
@@ -716,6 +722,9 @@ const m_option_t mplayer_opts[]={
     OPT_FLOATRANGE("hr-seek-demuxer-offset", hr_seek_demuxer_offset, 0, -9, 99),
     OPT_FLAG_CONSTANTS("no-autosync", autosync, 0, 0, -1),
     OPT_INTRANGE("autosync", autosync, 0, 0, 10000),
+    OPT_CHOICE("video-sync", video_sync, 0,
+               ({"audio", VIDEO_SYNC_AUDIO},
+                {"display-resample", VIDEO_SYNC_DISPLAY_RESAMPLE})),
 
     OPT_FLAG_ON("softsleep", softsleep, 0),
 
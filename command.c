@@ -863,6 +863,18 @@ static int mp_property_channels(m_option_t *prop, int action, void *arg,
     return m_property_int_ro(prop, action, arg, mpctx->sh_audio->channels);
 }
 
+/// Number of audio output buffer underruns (RO)
+static int mp_property_audio_underruns(m_option_t *prop, int action,
+                                       void *arg, MPContext *mpctx)
+{
+    int underruns;
+    if (!mpctx->ao || !mpctx->ao->initialized)
+        return M_PROPERTY_UNAVAILABLE;
+    if (ao_control(mpctx->ao, AOCONTROL_GET_UNDERRUNS, &underruns) != CONTROL_OK)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int_ro(prop, action, arg, underruns);
+}
+
 /// Balance (RW)
 static int mp_property_balance(m_option_t *prop, int action, void *arg,
                                MPContext *mpctx)
@@ -1371,6 +1383,114 @@ static int mp_property_vsync(m_option_t *prop, int action, void *arg,
     return m_property_flag(prop, action, arg, &vo_vsync);
 }
 
+/// Number of presented video frames (RO)
+static int mp_property_frames_presented(m_option_t *prop, int action,
+                                        void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int_ro(prop, action, arg,
+                             mpctx->frame_stats.presented);
+}
+
+/// Number of frames dropped by framedrop (RO)
+static int mp_property_frames_dropped(m_option_t *prop, int action,
+                                      void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int_ro(prop, action, arg, mpctx->frame_stats.dropped);
+}
+
+/// Number of frames presented more than one refresh interval late (RO)
+static int mp_property_frames_vsync_missed(m_option_t *prop, int action,
+                                           void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video || vo_refresh_rate <= 0)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int_ro(prop, action, arg,
+                             mpctx->frame_stats.vsync_missed);
+}
+
+/// Average and maximum lateness of frame presentation in seconds (RO)
+static int mp_property_frame_late(m_option_t *prop, int action, void *arg,
+                                  MPContext *mpctx)
+{
+    if (!mpctx->sh_video)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_float_ro(prop, action, arg,
+                               frame_stats_avg_late(&mpctx->frame_stats));
+}
+
+static int mp_property_frame_late_max(m_option_t *prop, int action,
+                                      void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_float_ro(prop, action, arg,
+                               mpctx->frame_stats.late_max);
+}
+
+/// Average and maximum frame interval jitter in seconds (RO)
+static int mp_property_frame_jitter(m_option_t *prop, int action, void *arg,
+                                    MPContext *mpctx)
+{
+    if (!mpctx->sh_video)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_float_ro(prop, action, arg,
+                               frame_stats_avg_jitter(&mpctx->frame_stats));
+}
+
+static int mp_property_frame_jitter_max(m_option_t *prop, int action,
+                                        void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_float_ro(prop, action, arg,
+                               mpctx->frame_stats.jitter_max);
+}
+
+/// Measured A/V drift with --video-sync=display-resample, in seconds (RO)
+static int mp_property_display_sync_drift(m_option_t *prop, int action,
+                                          void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video || !display_sync_active(mpctx))
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_float_ro(prop, action, arg, mpctx->display_sync_drift);
+}
+
+/// Audio speed correction with --video-sync=display-resample (RO)
+static int mp_property_display_sync_ratio(m_option_t *prop, int action,
+                                          void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video || !display_sync_active(mpctx))
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_float_ro(prop, action, arg, mpctx->display_sync_ratio);
+}
+
+/// Histograms of frame jitter and drop sequence lengths (RO)
+static int mp_property_frame_histogram(m_option_t *prop, int action,
+                                       void *arg, MPContext *mpctx)
+{
+    if (!mpctx->sh_video)
+        return M_PROPERTY_UNAVAILABLE;
+    switch (action) {
+    case M_PROPERTY_PRINT:
+    case M_PROPERTY_TO_STRING:
+        if (!arg)
+            return M_PROPERTY_ERROR;
+        if (strcmp(prop->name, "frame_jitter_histogram") == 0) {
+            *(char **)arg = frame_stats_jitter_histogram(NULL,
+                                                         &mpctx->frame_stats);
+        } else {
+            *(char **)arg = frame_stats_drop_histogram(NULL,
+                                                       &mpctx->frame_stats);
+        }
+        return M_PROPERTY_OK;
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
 /// Video codec tag (RO)
 static int mp_property_video_format(m_option_t *prop, int action,
                                     void *arg, MPContext *mpctx)
@@ -1738,6 +1858,8 @@ static const m_option_t mp_properties[] = {
       CONF_RANGE, -2, 65535, NULL },
     { "balance", mp_property_balance, CONF_TYPE_FLOAT,
       M_OPT_RANGE, -1, 1, NULL },
+    { "audio_underruns", mp_property_audio_underruns, CONF_TYPE_INT,
+      0, 0, 0, NULL },
 
     // Video
     { "fullscreen", mp_property_fullscreen, CONF_TYPE_FLAG,
@@ -1772,6 +1894,28 @@ static const m_option_t mp_properties[] = {
       M_OPT_RANGE, 0, 1, NULL },
     { "vsync", mp_property_vsync, CONF_TYPE_FLAG,
       M_OPT_RANGE, 0, 1, NULL },
+    { "frames_presented", mp_property_frames_presented, CONF_TYPE_INT,
+      0, 0, 0, NULL },
+    { "frames_dropped", mp_property_frames_dropped, CONF_TYPE_INT,
+      0, 0, 0, NULL },
+    { "frames_vsync_missed", mp_property_frames_vsync_missed, CONF_TYPE_INT,
+      0, 0, 0, NULL },
+    { "frame_late", mp_property_frame_late, CONF_TYPE_FLOAT,
+      0, 0, 0, NULL },
+    { "frame_late_max", mp_property_frame_late_max, CONF_TYPE_FLOAT,
+      0, 0, 0, NULL },
+    { "frame_jitter", mp_property_frame_jitter, CONF_TYPE_FLOAT,
+      0, 0, 0, NULL },
+    { "frame_jitter_max", mp_property_frame_jitter_max, CONF_TYPE_FLOAT,
+      0, 0, 0, NULL },
+    { "display_sync_drift", mp_property_display_sync_drift, CONF_TYPE_FLOAT,
+      0, 0, 0, NULL },
+    { "display_sync_ratio", mp_property_display_sync_ratio, CONF_TYPE_FLOAT,
+      0, 0, 0, NULL },
+    { "frame_jitter_histogram", mp_property_frame_histogram,
+      CONF_TYPE_STRING, 0, 0, 0, NULL },
+    { "frame_drop_histogram", mp_property_frame_histogram,
+      CONF_TYPE_STRING, 0, 0, 0, NULL },
     { "video_format", mp_property_video_format, CONF_TYPE_INT,
       0, 0, 0, NULL },
     { "video_codec", mp_property_video_codec, CONF_TYPE_STRING,
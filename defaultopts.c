@@ -55,6 +55,7 @@ void set_default_mplayer_options(struct MPOpts *opts)
 #endif
         .ass_font_scale = 1,
         .ass_vsfilter_aspect_compat = 1,
+        .ass_prerender = 8,
         .use_embedded_fonts = 1,
 
         .lavc_param = {
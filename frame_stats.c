@@ -0,0 +1,133 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <math.h>
+
+#include "talloc.h"
+#include "frame_stats.h"
+
+// in milliseconds
+static const int jitter_bounds[FRAME_STATS_JITTER_BUCKETS - 1] = {
+    1, 2, 4, 8, 16, 33,
+};
+
+// in frames
+static const int drop_bounds[FRAME_STATS_DROP_BUCKETS - 1] = {
+    1, 2, 4, 8,
+};
+
+static void add_to_hist(int *hist, const int *bounds, int num_buckets,
+                        double value)
+{
+    int n = 0;
+    while (n < num_buckets - 1 && value > bounds[n])
+        n++;
+    hist[n]++;
+}
+
+void frame_stats_reset(struct frame_stats *s)
+{
+    *s = (struct frame_stats) {0};
+}
+
+void frame_stats_discontinuity(struct frame_stats *s)
+{
+    s->last_intended = s->last_actual = 0;
+}
+
+static void end_drop_run(struct frame_stats *s)
+{
+    if (s->drop_run)
+        add_to_hist(s->drop_hist, drop_bounds, FRAME_STATS_DROP_BUCKETS,
+                    s->drop_run);
+    s->drop_run = 0;
+}
+
+void frame_stats_presented(struct frame_stats *s, int64_t intended,
+                           int64_t actual, double vsync_interval)
+{
+    end_drop_run(s);
+
+    double late = (actual - intended) * 1e-9;
+    s->presented++;
+    s->late_sum += late;
+    if (late > s->late_max)
+        s->late_max = late;
+    if (vsync_interval > 0 && late > vsync_interval)
+        s->vsync_missed++;
+
+    if (s->last_actual) {
+        double jitter = fabs(((actual - s->last_actual) -
+                              (intended - s->last_intended)) * 1e-9);
+        s->jitter_sum += jitter;
+        if (jitter > s->jitter_max)
+            s->jitter_max = jitter;
+        add_to_hist(s->jitter_hist, jitter_bounds, FRAME_STATS_JITTER_BUCKETS,
+                    jitter * 1e3);
+    }
+    s->last_intended = intended;
+    s->last_actual = actual;
+}
+
+void frame_stats_dropped(struct frame_stats *s)
+{
+    s->dropped++;
+    s->drop_run++;
+}
+
+double frame_stats_avg_late(struct frame_stats *s)
+{
+    return s->presented ? s->late_sum / s->presented : 0;
+}
+
+double frame_stats_avg_jitter(struct frame_stats *s)
+{
+    int64_t count = 0;
+    for (int n = 0; n < FRAME_STATS_JITTER_BUCKETS; n++)
+        count += s->jitter_hist[n];
+    return count ? s->jitter_sum / count : 0;
+}
+
+static char *format_hist(void *talloc_ctx, const int *hist, const int *bounds,
+                         int num_buckets, const char *unit)
+{
+    char *res = talloc_strdup(talloc_ctx, "");
+    for (int n = 0; n < num_buckets; n++) {
+        const char *sep = n ? " " : "";
+        if (n < num_buckets - 1) {
+            res = talloc_asprintf_append(res, "%s<=%d%s:%d", sep, bounds[n],
+                                         unit, hist[n]);
+        } else {
+            res = talloc_asprintf_append(res, "%s>%d%s:%d", sep,
+                                         bounds[n - 1], unit, hist[n]);
+        }
+    }
+    return res;
+}
+
+char *frame_stats_jitter_histogram(void *talloc_ctx, struct frame_stats *s)
+{
+    return format_hist(talloc_ctx, s->jitter_hist, jitter_bounds,
+                       FRAME_STATS_JITTER_BUCKETS, "ms");
+}
+
+char *frame_stats_drop_histogram(void *talloc_ctx, struct frame_stats *s)
+{
+    return format_hist(talloc_ctx, s->drop_hist, drop_bounds,
+                       FRAME_STATS_DROP_BUCKETS, "");
+}
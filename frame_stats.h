@@ -0,0 +1,75 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_FRAME_STATS_H
+#define MPLAYER_FRAME_STATS_H
+
+#include <stdint.h>
+
+// Upper bounds (in ms) of the jitter histogram buckets. The last bucket
+// collects everything above the last bound.
+#define FRAME_STATS_JITTER_BUCKETS 7
+// Upper bounds of the drop histogram buckets (length of a sequence of
+// consecutively dropped frames).
+#define FRAME_STATS_DROP_BUCKETS 5
+
+/* Presentation timing statistics. For each presented frame, the time at
+ * which the playloop intended the frame to be on screen is compared with
+ * the time vo_flip_page() actually returned. All times are from mp_time_ns().
+ */
+struct frame_stats {
+    int64_t presented;      // number of frames recorded
+    int64_t dropped;        // number of frames dropped by framedrop
+    int64_t vsync_missed;   // frames later than one display refresh interval
+
+    // lateness: actual - intended presentation time
+    double late_sum;
+    double late_max;
+    // jitter: difference between actual and intended interval between two
+    // consecutive frames
+    double jitter_sum;
+    double jitter_max;
+
+    int jitter_hist[FRAME_STATS_JITTER_BUCKETS];
+    int drop_hist[FRAME_STATS_DROP_BUCKETS];
+
+    // internal state
+    int drop_run;
+    int64_t last_intended;
+    int64_t last_actual;
+};
+
+void frame_stats_reset(struct frame_stats *s);
+// Forget the previous frame, e.g. after seeking, so that the time between
+// the frames is not taken as jitter.
+void frame_stats_discontinuity(struct frame_stats *s);
+// Record a presented frame. vsync_interval is the display refresh interval
+// in seconds, or 0 if unknown.
+void frame_stats_presented(struct frame_stats *s, int64_t intended,
+                           int64_t actual, double vsync_interval);
+void frame_stats_dropped(struct frame_stats *s);
+
+// Average lateness and jitter in seconds.
+double frame_stats_avg_late(struct frame_stats *s);
+double frame_stats_avg_jitter(struct frame_stats *s);
+
+// Return the histograms as human readable strings (talloc'ed).
+char *frame_stats_jitter_histogram(void *talloc_ctx, struct frame_stats *s);
+char *frame_stats_drop_histogram(void *talloc_ctx, struct frame_stats *s);
+
+#endif /* MPLAYER_FRAME_STATS_H */
@@ -44,6 +44,7 @@
 #include "m_option.h"
 #include "path.h"
 #include "talloc.h"
+#include "mpcommon.h"
 #include "options.h"
 #include "bstr.h"
 #include "stream/stream.h"
@@ -394,6 +395,10 @@ struct key_name modifier_names[] = {
 #define MP_MAX_CMD_FD 10
 #endif
 
+// Polling interval in ms for input sources which can't be waited on with
+// select() (and for all of them if select() is not available)
+#define MP_NO_SELECT_POLL_PERIOD 20
+
 struct input_fd {
     int fd;
     union {
@@ -414,6 +419,11 @@ struct input_fd {
 
 struct cmd_bind_section {
     struct cmd_bind *cmd_binds;
+    int num_binds;
+    // Open addressing hash table of indexes into cmd_binds, keyed by the key
+    // sequence; -1 marks free slots. The size is a power of 2.
+    int *bind_hash;
+    int bind_hash_size;
     bool is_builtin;
     char *section;
     struct cmd_bind_section *next;
@@ -480,6 +490,7 @@ static const m_option_t input_conf[] = {
     OPT_STRING("js-dev", input.js_dev, CONF_GLOBAL),
     OPT_STRING("ar-dev", input.ar_dev, CONF_GLOBAL),
     OPT_STRING("file", input.in_file, CONF_GLOBAL),
+    OPT_STRING("ipc", input.ipc_path, CONF_GLOBAL),
     OPT_MAKE_FLAGS("default-bindings", input.default_bindings, CONF_GLOBAL),
     { NULL, NULL, 0, 0, 0, 0, NULL}
 };
@@ -951,24 +962,56 @@ static int read_wakeup(void *ctx, int fd)
 }
 
 
-static char *find_bind_for_key(const struct cmd_bind *binds, int n, int *keys)
+static unsigned int hash_keys(const int *keys, int n)
 {
-    int j;
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < n; i++)
+        h = (h ^ keys[i]) * 16777619u;
+    return h;
+}
 
-    if (n <= 0)
-        return NULL;
-    for (j = 0; binds[j].cmd != NULL; j++) {
-        int found = 1, s;
-        for (s = 0; s < n && binds[j].input[s] != 0; s++) {
-            if (binds[j].input[s] != keys[s]) {
-                found = 0;
-                break;
-            }
-        }
-        if (found && binds[j].input[s] == 0 && s == n)
-            break;
+static int num_keys(const int *keys)
+{
+    int n = 0;
+    while (n < MP_MAX_KEY_DOWN && keys[n])
+        n++;
+    return n;
+}
+
+// Return the slot of the binding for the key sequence keys[0..n) in the
+// section's hash table, or the free slot where it would be inserted.
+static int *find_bind_slot(struct cmd_bind_section *bs, int n, const int *keys)
+{
+    unsigned int mask = bs->bind_hash_size - 1;
+    for (unsigned int i = hash_keys(keys, n) & mask; ; i = (i + 1) & mask) {
+        int *slot = &bs->bind_hash[i];
+        if (*slot < 0)
+            return slot;
+        const struct cmd_bind *bind = &bs->cmd_binds[*slot];
+        if (num_keys(bind->input) == n
+                && memcmp(bind->input, keys, n * sizeof(int)) == 0)
+            return slot;
+    }
+}
+
+static void rehash_binds(struct cmd_bind_section *bs, int size)
+{
+    talloc_free(bs->bind_hash);
+    bs->bind_hash = talloc_array(bs, int, size);
+    bs->bind_hash_size = size;
+    memset(bs->bind_hash, -1, size * sizeof(int));
+    for (int i = 0; i < bs->num_binds; i++) {
+        const int *input = bs->cmd_binds[i].input;
+        *find_bind_slot(bs, num_keys(input), input) = i;
     }
-    return binds[j].cmd;
+}
+
+static char *find_bind_for_key(struct cmd_bind_section *bs, int n, int *keys)
+{
+    if (n <= 0 || n > MP_MAX_KEY_DOWN || !bs->num_binds)
+        return NULL;
+    int i = *find_bind_slot(bs, n, keys);
+    return i < 0 ? NULL : bs->cmd_binds[i].cmd;
 }
 
 static struct cmd_bind_section *get_bind_section(struct input_ctx *ictx,
@@ -995,6 +1038,9 @@ static struct cmd_bind_section *get_bind_section(struct input_ctx *ictx,
         bind_section = ictx->cmd_bind_sections;
     }
     bind_section->cmd_binds = NULL;
+    bind_section->num_binds = 0;
+    bind_section->bind_hash = NULL;
+    bind_section->bind_hash_size = 0;
     bind_section->section = talloc_strdup(bind_section, section);
     bind_section->is_builtin = builtin;
     bind_section->next = NULL;
@@ -1006,8 +1052,7 @@ static char *section_find_bind_for_key(struct input_ctx *ictx,
                                        int n, int *keys)
 {
     struct cmd_bind_section *bs = get_bind_section(ictx, builtin, section);
-    const struct cmd_bind *binds = bs->cmd_binds;
-    return binds ? find_bind_for_key(binds, n, keys) : NULL;
+    return find_bind_for_key(bs, n, keys);
 }
 
 static mp_cmd_t *get_cmd_from_keys(struct input_ctx *ictx, int n, int *keys)
@@ -1123,11 +1168,16 @@ static mp_cmd_t *interpret_key(struct input_ctx *ictx, int code)
     return ret;
 }
 
+static bool autorepeat_pending(struct input_ctx *ictx)
+{
+    return ictx->ar_rate > 0 && ictx->ar_state >= 0 && ictx->num_key_down > 0
+        && !(ictx->key_down[ictx->num_key_down - 1] & MP_NO_REPEAT_KEY);
+}
+
 static mp_cmd_t *check_autorepeat(struct input_ctx *ictx)
 {
     // No input : autorepeat ?
-    if (ictx->ar_rate > 0 && ictx->ar_state >= 0 && ictx->num_key_down > 0
-        && !(ictx->key_down[ictx->num_key_down - 1] & MP_NO_REPEAT_KEY)) {
+    if (autorepeat_pending(ictx)) {
         unsigned int t = GetTimer();
         // First time : wait delay
         if (ictx->ar_state == 0
@@ -1209,7 +1259,8 @@ static void read_key_fd(struct input_ctx *ictx, struct input_fd *key_fd)
 }
 
 /**
- * \param time time to wait at most for an event in milliseconds
+ * \param time time to wait at most for an event in milliseconds, or
+ *             negative to wait without timeout
  */
 static void read_events(struct input_ctx *ictx, int time)
 {
@@ -1316,7 +1367,39 @@ int mp_input_queue_cmd(struct input_ctx *ictx, mp_cmd_t *cmd)
     return 1;
 }
 
+/* Limit the time (in ms, negative means no limit) to wait for events so
+ * that the next key autorepeat is generated in time and input sources
+ * without select() support are polled.
+ */
+static int adjust_max_wait_time(struct input_ctx *ictx, int time)
+{
+    if (autorepeat_pending(ictx)) {
+        unsigned int t = GetTimer();
+        int wait;
+        if (ictx->ar_state == 0)
+            wait = ictx->ar_delay - (int)((t - ictx->last_key_down) / 1000);
+        else
+            wait = 1000 / ictx->ar_rate - (int)((t - ictx->last_ar) / 1000);
+        wait = FFMAX(wait, 0);
+        time = time < 0 ? wait : FFMIN(time, wait);
+    }
+    bool need_poll = false;
+#ifndef HAVE_POSIX_SELECT
+    need_poll = true;
+#endif
+    for (int i = 0; i < ictx->num_key_fd; i++)
+        need_poll |= ictx->key_fds[i].no_select && !ictx->key_fds[i].dead;
+    for (int i = 0; i < ictx->num_cmd_fd; i++)
+        need_poll |= ictx->cmd_fds[i].no_select && !ictx->cmd_fds[i].dead;
+    if (need_poll)
+        time = time < 0 ? MP_NO_SELECT_POLL_PERIOD
+                        : FFMIN(time, MP_NO_SELECT_POLL_PERIOD);
+    return time;
+}
+
 /**
+ * \param time time to wait at most for an event in milliseconds, or
+ *             negative to wait until an event arrives
  * \param peek_only when set, the returned command stays in the queue.
  * Do not free the returned cmd whe you set this!
  */
@@ -1327,6 +1410,7 @@ mp_cmd_t *mp_input_get_cmd(struct input_ctx *ictx, int time, int peek_only)
 
     if (ictx->control_cmd_queue.first || ictx->key_cmd_queue.first)
         time = 0;
+    time = adjust_max_wait_time(ictx, time);
     read_all_events(ictx, time);
     struct mp_cmd *ret;
     struct cmd_queue *queue = &ictx->control_cmd_queue;
@@ -1431,8 +1515,7 @@ static int get_input_from_name(char *name, int *keys)
 static void bind_keys(struct input_ctx *ictx, bool builtin,
                       const int keys[MP_MAX_KEY_DOWN + 1], bstr command)
 {
-    int i = 0, j;
-    struct cmd_bind *bind = NULL;
+    struct cmd_bind *bind;
     struct cmd_bind_section *bind_section = NULL;
     char *section = NULL;
 
@@ -1447,27 +1530,30 @@ static void bind_keys(struct input_ctx *ictx, bool builtin,
     bind_section = get_bind_section(ictx, builtin, section);
     talloc_free(section);
 
-    if (bind_section->cmd_binds) {
-        for (i = 0; bind_section->cmd_binds[i].cmd != NULL; i++) {
-            for (j = 0; bind_section->cmd_binds[i].input[j] == keys[j] && keys[j] != 0; j++)
-                /* NOTHING */;
-            if (keys[j] == 0 && bind_section->cmd_binds[i].input[j] == 0 ) {
-                bind = &bind_section->cmd_binds[i];
-                break;
-            }
-        }
-    }
+    // Keep the hash table at most half full
+    if ((bind_section->num_binds + 1) * 2 > bind_section->bind_hash_size)
+        rehash_binds(bind_section, FFMAX(bind_section->bind_hash_size * 2, 64));
 
-    if (!bind) {
-        bind_section->cmd_binds = talloc_realloc(bind_section,
-                                                 bind_section->cmd_binds,
-                                                 struct cmd_bind, i + 2);
-        memset(&bind_section->cmd_binds[i], 0, 2 * sizeof(struct cmd_bind));
-        bind = &bind_section->cmd_binds[i];
+    int n = num_keys(keys);
+    int *slot = find_bind_slot(bind_section, n, keys);
+    if (*slot >= 0) {
+        bind = &bind_section->cmd_binds[*slot];
+    } else {
+        int num = bind_section->num_binds;
+        if (num == MP_TALLOC_ELEMS(bind_section->cmd_binds)) {
+            bind_section->cmd_binds = talloc_realloc(bind_section,
+                                                     bind_section->cmd_binds,
+                                                     struct cmd_bind,
+                                                     FFMAX(num * 2, 16));
+        }
+        bind = &bind_section->cmd_binds[num];
+        memset(bind, 0, sizeof(*bind));
+        memcpy(bind->input, keys, n * sizeof(int));
+        *slot = num;
+        bind_section->num_binds++;
     }
     talloc_free(bind->cmd);
     bind->cmd = bstrdup0(bind_section->cmd_binds, command);
-    memcpy(bind->input, keys, (MP_MAX_KEY_DOWN + 1) * sizeof(int));
 }
 
 static int parse_config(struct input_ctx *ictx, bool builtin, bstr data)
@@ -228,8 +228,9 @@ int mp_input_get_key_from_name(const char *name);
 int mp_input_queue_cmd(struct input_ctx *ictx, struct mp_cmd *cmd);
 
 /* Return next available command, or sleep up to "time" ms if none is
- * available. If "peek_only" is true return a reference to the command
- * but leave it queued.
+ * available. A negative "time" sleeps until an event arrives (or
+ * mp_input_wakeup() is called). If "peek_only" is true return a reference
+ * to the command but leave it queued.
  */
 struct mp_cmd *mp_input_get_cmd(struct input_ctx *ictx, int time,
                                 int peek_only);
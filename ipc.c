@@ -0,0 +1,1055 @@
+/*
+ * JSON IPC server.
+ *
+ * Clients connect to a Unix socket and send requests as JSON, one per line:
+ *
+ *   { "command": ["get_property", "time-pos"], "request_id": 1 }
+ *
+ * and get one reply line per request line:
+ *
+ *   { "request_id": 1, "error": "success", "data": 12.5 }
+ *
+ * A line can also contain an array of requests, which are run in order and
+ * answered with one array of replies. Besides the property commands
+ * below, "command" can be any input command ("seek", "loadfile", ...).
+ *
+ * Clients can subscribe to property changes with
+ * ["observe_property", <id>, <name>]. The current value is sent right away
+ * and after that whenever it changes, as
+ *
+ *   { "event": "property-change", "id": <id>, "name": <name>, "data": ... }
+ *
+ * Socket I/O runs in a separate thread, which only moves data between the
+ * sockets and per-client buffers. Requests are run by the playloop through
+ * mp_ipc_update(), at the same point as other input commands.
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "libavutil/common.h"
+
+#include "talloc.h"
+#include "mp_msg.h"
+#include "mpcommon.h"
+#include "bstr.h"
+#include "m_option.h"
+#include "m_property.h"
+#include "command.h"
+#include "input/input.h"
+#include "mp_core.h"
+#include "osdep/timer.h"
+#include "ipc.h"
+
+// A client sending a longer line without newline is disconnected. Reading
+// from a client also pauses while this much of its input is not processed.
+#define MAX_LINE (1 << 20)
+// A client not reading its replies and events is disconnected when this
+// much output is pending
+#define MAX_PENDING_OUTPUT (4 << 20)
+#define MAX_JSON_DEPTH 32
+// Lines taken from each client per mp_ipc_update() call. If more are
+// buffered, the playloop is woken up again after this iteration, so that
+// a client sending many requests can't stall playback.
+#define MAX_LINES_PER_UPDATE 16
+// Observed properties are read at most this often (in ns)
+#define OBSERVE_INTERVAL 50000000
+
+struct ipc_client {
+    int id;
+    int fd;
+    // Set when the connection failed or should be dropped. The I/O thread
+    // then closes and frees the client; nothing else frees clients.
+    bool dead;
+    // Received data not yet taken by the main thread
+    char *in;
+    int in_len;
+    // Data not yet written to the socket
+    char *out;
+    int out_len;
+};
+
+struct ipc_observer {
+    int client_id;
+    long long id;
+    char *name;
+    char *value;        // last sent value as JSON, NULL before the first
+};
+
+struct mp_ipc {
+    struct MPContext *mpctx;
+    char *path;
+    int listen_fd;
+    // Identity of the socket file bound at path
+    dev_t sock_dev;
+    ino_t sock_ino;
+    int wakeup_pipe[2];
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    // Protected by lock
+    bool quit;
+    struct ipc_client **clients;
+    int num_clients;
+    int next_client_id;
+    // Clients freed since the last mp_ipc_update()
+    int *closed;
+    int num_closed;
+    // If not 0, the I/O thread wakes up the playloop at this time
+    int64_t wakeup_time;
+
+    // Only used by the main thread
+    struct ipc_observer *observers;
+    int num_observers;
+    int64_t last_observe;
+};
+
+// ---------------------------------------------------------------------------
+// JSON
+
+enum json_type {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+};
+
+struct json_node {
+    enum json_type type;
+    char *key;                  // name in the parent object
+    bool flag;
+    double num;
+    char *str;
+    struct json_node *items;    // array elements or object members
+    int num_items;
+};
+
+static int parse_hex4(const char *s, uint32_t *res)
+{
+    *res = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = s[i];
+        int v = c >= '0' && c <= '9' ? c - '0' :
+                c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (v < 0)
+            return -1;
+        *res = *res * 16 + v;
+    }
+    return 0;
+}
+
+static int parse_json_string(void *ta, char **src, char **dst)
+{
+    char *s = *src;
+    if (*s != '"')
+        return -1;
+    s++;
+    char *res = talloc_strdup(ta, "");
+    for (;;) {
+        size_t n = strcspn(s, "\"\\");
+        res = talloc_strndup_append_buffer(res, s, n);
+        s += n;
+        if (*s == '"')
+            break;
+        if (*s != '\\')
+            return -1;
+        s++;
+        char c;
+        switch (*s++) {
+        case '"':  c = '"'; break;
+        case '\\': c = '\\'; break;
+        case '/':  c = '/'; break;
+        case 'b':  c = '\b'; break;
+        case 'f':  c = '\f'; break;
+        case 'n':  c = '\n'; break;
+        case 'r':  c = '\r'; break;
+        case 't':  c = '\t'; break;
+        case 'u': {
+            uint32_t cp, low;
+            if (parse_hex4(s, &cp) < 0)
+                return -1;
+            s += 4;
+            // UTF-16 surrogate pair
+            if (cp >= 0xD800 && cp < 0xDC00 && s[0] == '\\' && s[1] == 'u'
+                && parse_hex4(s + 2, &low) == 0
+                && low >= 0xDC00 && low < 0xE000)
+            {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                s += 6;
+            }
+            char data[8], *p = data;
+            uint8_t tmp;
+            PUT_UTF8(cp, tmp, *p++ = tmp;);
+            res = talloc_strndup_append_buffer(res, data, p - data);
+            continue;
+        }
+        default:
+            return -1;
+        }
+        res = talloc_strndup_append_buffer(res, &c, 1);
+    }
+    *src = s + 1;
+    *dst = res;
+    return 0;
+}
+
+static int parse_json(void *ta, char **src, struct json_node *dst, int depth)
+{
+    char *s = *src + strspn(*src, " \t\r\n");
+    *dst = (struct json_node){0};
+    if (depth > MAX_JSON_DEPTH)
+        return -1;
+
+    if (*s == '[' || *s == '{') {
+        bool object = *s == '{';
+        char term = object ? '}' : ']';
+        dst->type = object ? JSON_OBJECT : JSON_ARRAY;
+        s += 1 + strspn(s + 1, " \t\r\n");
+        if (*s == term) {
+            *src = s + 1;
+            return 0;
+        }
+        for (;;) {
+            struct json_node item;
+            char *key = NULL;
+            if (object) {
+                s += strspn(s, " \t\r\n");
+                if (parse_json_string(ta, &s, &key) < 0)
+                    return -1;
+                s += strspn(s, " \t\r\n");
+                if (*s++ != ':')
+                    return -1;
+            }
+            if (parse_json(ta, &s, &item, depth + 1) < 0)
+                return -1;
+            item.key = key;
+            MP_TARRAY_APPEND(ta, dst->items, dst->num_items, item);
+            s += strspn(s, " \t\r\n");
+            if (*s == term)
+                break;
+            if (*s++ != ',')
+                return -1;
+        }
+        *src = s + 1;
+        return 0;
+    }
+    if (*s == '"') {
+        dst->type = JSON_STRING;
+        if (parse_json_string(ta, &s, &dst->str) < 0)
+            return -1;
+    } else if (strncmp(s, "true", 4) == 0 || strncmp(s, "false", 5) == 0) {
+        dst->type = JSON_BOOL;
+        dst->flag = *s == 't';
+        s += dst->flag ? 4 : 5;
+    } else if (strncmp(s, "null", 4) == 0) {
+        dst->type = JSON_NULL;
+        s += 4;
+    } else if (*s && strchr("-0123456789", *s)) {
+        char *end;
+        dst->type = JSON_NUMBER;
+        dst->num = strtod(s, &end);
+        if (end == s)
+            return -1;
+        s = end;
+    } else {
+        return -1;
+    }
+    *src = s;
+    return 0;
+}
+
+static struct json_node *json_get(struct json_node *obj, const char *key)
+{
+    if (obj->type != JSON_OBJECT)
+        return NULL;
+    for (int n = 0; n < obj->num_items; n++) {
+        if (strcmp(obj->items[n].key, key) == 0)
+            return &obj->items[n];
+    }
+    return NULL;
+}
+
+static char *append_json_string(char *out, const char *s)
+{
+    out = talloc_strdup_append_buffer(out, "\"");
+    for (;;) {
+        size_t n = 0;
+        while (s[n] && s[n] != '"' && s[n] != '\\' && (unsigned char)s[n] >= 32)
+            n++;
+        out = talloc_strndup_append_buffer(out, s, n);
+        s += n;
+        if (!*s)
+            break;
+        if (*s == '"' || *s == '\\')
+            out = talloc_asprintf_append_buffer(out, "\\%c", *s);
+        else
+            out = talloc_asprintf_append_buffer(out, "\\u%04x", *s);
+        s++;
+    }
+    return talloc_strdup_append_buffer(out, "\"");
+}
+
+static char *append_json_number(char *out, double num)
+{
+    if (!isfinite(num))
+        return talloc_strdup_append_buffer(out, "null");
+    if (num == (long long)num && fabs(num) < 1e15)
+        return talloc_asprintf_append_buffer(out, "%lld", (long long)num);
+    return talloc_asprintf_append_buffer(out, "%.17g", num);
+}
+
+static char *append_json(char *out, struct json_node *node)
+{
+    switch (node->type) {
+    case JSON_NULL:
+        return talloc_strdup_append_buffer(out, "null");
+    case JSON_BOOL:
+        return talloc_strdup_append_buffer(out, node->flag ? "true" : "false");
+    case JSON_NUMBER:
+        return append_json_number(out, node->num);
+    case JSON_STRING:
+        return append_json_string(out, node->str);
+    case JSON_ARRAY:
+    case JSON_OBJECT: {
+        bool object = node->type == JSON_OBJECT;
+        out = talloc_strdup_append_buffer(out, object ? "{" : "[");
+        for (int n = 0; n < node->num_items; n++) {
+            if (n)
+                out = talloc_strdup_append_buffer(out, ",");
+            if (object) {
+                out = append_json_string(out, node->items[n].key);
+                out = talloc_strdup_append_buffer(out, ":");
+            }
+            out = append_json(out, &node->items[n]);
+        }
+        return talloc_strdup_append_buffer(out, object ? "}" : "]");
+    }
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// I/O thread
+
+// Write as much pending output as possible. Must be called with the lock.
+static void flush_client(struct ipc_client *client)
+{
+    while (client->out_len) {
+        ssize_t r = send(client->fd, client->out, client->out_len,
+                         MSG_NOSIGNAL);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                client->dead = true;
+            return;
+        }
+        memmove(client->out, client->out + r, client->out_len - r);
+        client->out_len -= r;
+    }
+}
+
+static void accept_clients(struct mp_ipc *ipc)
+{
+    for (;;) {
+        int fd = accept(ipc->listen_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        pthread_mutex_lock(&ipc->lock);
+        struct ipc_client *client = talloc_ptrtype(ipc, client);
+        *client = (struct ipc_client){
+            .id = ipc->next_client_id++,
+            .fd = fd,
+        };
+        MP_TARRAY_APPEND(ipc, ipc->clients, ipc->num_clients, client);
+        pthread_mutex_unlock(&ipc->lock);
+        mp_msg(MSGT_CPLAYER, MSGL_V, "[ipc] Client %d connected.\n",
+               client->id);
+    }
+}
+
+static void read_client(struct mp_ipc *ipc, struct ipc_client *client)
+{
+    char buf[4096];
+    bool dead = false;
+    while (!dead) {
+        pthread_mutex_lock(&ipc->lock);
+        bool full = client->in_len >= MAX_LINE;
+        pthread_mutex_unlock(&ipc->lock);
+        if (full)
+            break;
+        ssize_t r = read(client->fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        pthread_mutex_lock(&ipc->lock);
+        if (r <= 0) {
+            client->dead = true;
+        } else if (memchr(buf, '\0', r)) {
+            mp_msg(MSGT_CPLAYER, MSGL_WARN, "[ipc] Client %d sent a NUL "
+                   "byte, disconnecting.\n", client->id);
+            client->dead = true;
+        } else {
+            size_t size = talloc_get_size(client->in);
+            if (client->in_len + r > size)
+                client->in = talloc_realloc_size(client, client->in,
+                                        FFMAX(size * 2, client->in_len + r));
+            memcpy(client->in + client->in_len, buf, r);
+            client->in_len += r;
+            if (client->in_len >= MAX_LINE
+                && !memchr(client->in, '\n', client->in_len))
+            {
+                mp_msg(MSGT_CPLAYER, MSGL_WARN, "[ipc] Client %d sent a "
+                       "too long line, disconnecting.\n", client->id);
+                client->dead = true;
+            }
+        }
+        dead = client->dead;
+        pthread_mutex_unlock(&ipc->lock);
+    }
+    mp_input_wakeup(ipc->mpctx->input);
+}
+
+static void *ipc_thread(void *arg)
+{
+    struct mp_ipc *ipc = arg;
+    struct pollfd *fds = NULL;
+    struct ipc_client **polled = NULL;
+
+    pthread_mutex_lock(&ipc->lock);
+    while (!ipc->quit) {
+        for (int n = 0; n < ipc->num_clients; n++) {
+            struct ipc_client *client = ipc->clients[n];
+            if (!client->dead)
+                continue;
+            close(client->fd);
+            MP_TARRAY_APPEND(ipc, ipc->closed, ipc->num_closed, client->id);
+            talloc_free(client);
+            ipc->clients[n--] = ipc->clients[--ipc->num_clients];
+            mp_input_wakeup(ipc->mpctx->input);
+        }
+
+        int num = ipc->num_clients;
+        fds = talloc_realloc(ipc, fds, struct pollfd, num + 2);
+        polled = talloc_realloc(ipc, polled, struct ipc_client *, num);
+        fds[0] = (struct pollfd){ .fd = ipc->wakeup_pipe[0], .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = ipc->listen_fd, .events = POLLIN };
+        int num_fds = 2;
+        for (int n = 0; n < num; n++) {
+            struct ipc_client *client = ipc->clients[n];
+            polled[num_fds - 2] = client;
+            fds[num_fds++] = (struct pollfd){
+                .fd = client->fd,
+                .events = (client->in_len < MAX_LINE ? POLLIN : 0)
+                          | (client->out_len ? POLLOUT : 0),
+            };
+        }
+        int timeout = -1;
+        if (ipc->wakeup_time) {
+            int64_t wait = ipc->wakeup_time - mp_time_ns();
+            timeout = wait > 0 ? (wait + 999999) / 1000000 : 0;
+        }
+        pthread_mutex_unlock(&ipc->lock);
+
+        // Clients are freed only by this thread, so polled[] stays valid
+        // without the lock.
+        if (poll(fds, num_fds, timeout) < 0 && errno != EINTR) {
+            mp_msg(MSGT_CPLAYER, MSGL_ERR, "[ipc] poll() failed: %s\n",
+                   strerror(errno));
+            pthread_mutex_lock(&ipc->lock);
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(ipc->wakeup_pipe[0], buf, sizeof(buf)) > 0);
+        }
+        pthread_mutex_lock(&ipc->lock);
+        if (ipc->wakeup_time && ipc->wakeup_time <= mp_time_ns()) {
+            ipc->wakeup_time = 0;
+            mp_input_wakeup(ipc->mpctx->input);
+        }
+        pthread_mutex_unlock(&ipc->lock);
+        if (fds[1].revents & POLLIN)
+            accept_clients(ipc);
+        for (int n = 2; n < num_fds; n++) {
+            struct ipc_client *client = polled[n - 2];
+            if (fds[n].revents & (POLLIN | POLLHUP | POLLERR))
+                read_client(ipc, client);
+            if (fds[n].revents & POLLOUT) {
+                pthread_mutex_lock(&ipc->lock);
+                if (!client->dead)
+                    flush_client(client);
+                pthread_mutex_unlock(&ipc->lock);
+            }
+        }
+        pthread_mutex_lock(&ipc->lock);
+    }
+    pthread_mutex_unlock(&ipc->lock);
+    talloc_free(fds);
+    talloc_free(polled);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Requests (main thread)
+
+static struct ipc_client *find_client(struct mp_ipc *ipc, int id)
+{
+    for (int n = 0; n < ipc->num_clients; n++) {
+        if (ipc->clients[n]->id == id)
+            return ipc->clients[n];
+    }
+    return NULL;
+}
+
+/* Queue data for sending, writing it right away if possible. Returns false
+ * if the client is gone or being disconnected.
+ */
+static bool send_client(struct mp_ipc *ipc, int id, const char *data,
+                        int len)
+{
+    pthread_mutex_lock(&ipc->lock);
+    struct ipc_client *client = find_client(ipc, id);
+    bool alive = client && !client->dead;
+    if (alive) {
+        bool was_empty = !client->out_len;
+        client->out = talloc_realloc_size(client, client->out,
+                                          client->out_len + len);
+        memcpy(client->out + client->out_len, data, len);
+        client->out_len += len;
+        if (was_empty)
+            flush_client(client);
+        if (client->out_len > MAX_PENDING_OUTPUT) {
+            mp_msg(MSGT_CPLAYER, MSGL_WARN, "[ipc] Client %d is not reading "
+                   "its replies, disconnecting.\n", client->id);
+            client->dead = true;
+        }
+        // Let the I/O thread wait for the socket to become writable, or
+        // close it. If output was already pending, it is waiting already.
+        if ((was_empty && client->out_len) || client->dead)
+            write(ipc->wakeup_pipe[1], &(char){0}, 1);
+        alive = !client->dead;
+    }
+    pthread_mutex_unlock(&ipc->lock);
+    return alive;
+}
+
+static const char *property_error(int r)
+{
+    switch (r) {
+    case M_PROPERTY_UNAVAILABLE:
+        return "property unavailable";
+    case M_PROPERTY_NOT_IMPLEMENTED:
+        return "not implemented";
+    case M_PROPERTY_UNKNOWN:
+        return "property not found";
+    case M_PROPERTY_DISABLED:
+        return "property disabled";
+    }
+    return "error";
+}
+
+/* Append the value of the property as JSON. Flags and numbers are sent as
+ * JSON booleans and numbers, everything else as the string representation
+ * of the property. Returns a property error code.
+ */
+static int append_property(struct MPContext *mpctx, char **out,
+                           const char *name, bool as_string)
+{
+    const struct m_option *opt;
+    union m_option_value val = {0};
+    int r;
+
+    if (!as_string && !strchr(name, '/')
+        && mp_property_do(name, M_PROPERTY_GET_TYPE, &opt, mpctx) > 0)
+    {
+        const struct m_option_type *type = opt->type;
+        if (type == CONF_TYPE_FLAG || type == CONF_TYPE_INT
+            || type == CONF_TYPE_INT64 || type == CONF_TYPE_FLOAT
+            || type == CONF_TYPE_DOUBLE || type == CONF_TYPE_TIME)
+        {
+            r = mp_property_do(name, M_PROPERTY_GET, &val, mpctx);
+            if (r <= 0)
+                return r;
+            if (type == CONF_TYPE_FLAG)
+                *out = talloc_strdup_append_buffer(*out,
+                                val.flag > opt->min ? "true" : "false");
+            else if (type == CONF_TYPE_INT)
+                *out = append_json_number(*out, val.int_);
+            else if (type == CONF_TYPE_INT64)
+                *out = append_json_number(*out, val.int64);
+            else if (type == CONF_TYPE_FLOAT)
+                *out = append_json_number(*out, val.float_);
+            else
+                *out = append_json_number(*out, val.double_);
+            return M_PROPERTY_OK;
+        }
+    }
+    char *str = NULL;
+    r = mp_property_do(name, M_PROPERTY_TO_STRING, &str, mpctx);
+    if (r <= 0)
+        return r;
+    *out = append_json_string(*out, str ? str : "");
+    talloc_free(str);
+    return M_PROPERTY_OK;
+}
+
+// Text of a command argument or property value given as JSON
+static char *json_arg(void *ta, struct json_node *node, bool flag_words)
+{
+    switch (node->type) {
+    case JSON_STRING:
+        return node->str;
+    case JSON_NUMBER:
+        return append_json_number(talloc_strdup(ta, ""), node->num);
+    case JSON_BOOL:
+        if (flag_words)
+            return node->flag ? "yes" : "no";
+        return node->flag ? "1" : "0";
+    default:
+        return NULL;
+    }
+}
+
+static struct ipc_observer *find_observer(struct mp_ipc *ipc, int client_id,
+                                          long long id)
+{
+    for (int n = 0; n < ipc->num_observers; n++) {
+        struct ipc_observer *o = &ipc->observers[n];
+        if (o->client_id == client_id && o->id == id)
+            return o;
+    }
+    return NULL;
+}
+
+static void remove_observer(struct mp_ipc *ipc, struct ipc_observer *o)
+{
+    talloc_free(o->name);
+    talloc_free(o->value);
+    int n = o - ipc->observers;
+    memmove(o, o + 1, (ipc->num_observers - n - 1) * sizeof(*o));
+    ipc->num_observers--;
+}
+
+// Run the command and append the error and data fields of the reply.
+static void run_request(struct mp_ipc *ipc, int client_id, void *ta,
+                        struct json_node *cmd, char **out)
+{
+    struct MPContext *mpctx = ipc->mpctx;
+    const char *error = "success";
+    int nargs = cmd ? cmd->num_items : 0;
+    struct json_node *args = cmd ? cmd->items : NULL;
+    char *data = NULL;
+
+    if (!cmd || cmd->type != JSON_ARRAY || !nargs
+        || args[0].type != JSON_STRING)
+    {
+        error = "invalid request";
+        goto done;
+    }
+    const char *name = args[0].str;
+
+    if (strcmp(name, "get_property") == 0
+        || strcmp(name, "get_property_string") == 0)
+    {
+        if (nargs != 2 || args[1].type != JSON_STRING) {
+            error = "invalid parameter";
+            goto done;
+        }
+        data = talloc_strdup(ta, "");
+        int r = append_property(mpctx, &data, args[1].str,
+                                strcmp(name, "get_property_string") == 0);
+        if (r <= 0) {
+            error = property_error(r);
+            data = NULL;
+        }
+    } else if (strcmp(name, "set_property") == 0) {
+        char *value = nargs == 3 ? json_arg(ta, &args[2], true) : NULL;
+        if (!value || args[1].type != JSON_STRING) {
+            error = "invalid parameter";
+            goto done;
+        }
+        int r = mp_property_do(args[1].str, M_PROPERTY_PARSE, value, mpctx);
+        if (r <= 0)
+            error = property_error(r);
+    } else if (strcmp(name, "observe_property") == 0) {
+        if (nargs != 3 || args[1].type != JSON_NUMBER
+            || args[2].type != JSON_STRING)
+        {
+            error = "invalid parameter";
+            goto done;
+        }
+        struct ipc_observer *o = find_observer(ipc, client_id, args[1].num);
+        if (o)
+            remove_observer(ipc, o);
+        MP_TARRAY_APPEND(ipc, ipc->observers, ipc->num_observers,
+                         (struct ipc_observer){
+                             .client_id = client_id,
+                             .id = args[1].num,
+                             .name = talloc_strdup(ipc, args[2].str),
+                         });
+    } else if (strcmp(name, "unobserve_property") == 0) {
+        struct ipc_observer *o = NULL;
+        if (nargs == 2 && args[1].type == JSON_NUMBER)
+            o = find_observer(ipc, client_id, args[1].num);
+        if (!o) {
+            error = "invalid parameter";
+            goto done;
+        }
+        remove_observer(ipc, o);
+    } else {
+        // Input command; build the text form for the command parser
+        char *str = talloc_strdup(ta, name);
+        for (int n = 1; n < nargs; n++) {
+            char *arg = json_arg(ta, &args[n], false);
+            if (!arg) {
+                error = "invalid parameter";
+                goto done;
+            }
+            str = talloc_strdup_append_buffer(str, " \"");
+            for (char *p = arg; *p; p++) {
+                if (*p == '"' || *p == '\\')
+                    str = talloc_strdup_append_buffer(str, "\\");
+                str = talloc_strndup_append_buffer(str, p, 1);
+            }
+            str = talloc_strdup_append_buffer(str, "\"");
+        }
+        struct mp_cmd *mpcmd = mp_input_parse_cmd(str);
+        if (!mpcmd) {
+            error = "invalid command";
+            goto done;
+        }
+        run_command(mpctx, mpcmd);
+        mp_cmd_free(mpcmd);
+    }
+
+done:
+    *out = talloc_strdup_append_buffer(*out, "\"error\":");
+    *out = append_json_string(*out, error);
+    if (data)
+        *out = talloc_asprintf_append_buffer(*out, ",\"data\":%s", data);
+}
+
+static void handle_request(struct mp_ipc *ipc, int client_id, void *ta,
+                           struct json_node *req, char **out)
+{
+    *out = talloc_strdup_append_buffer(*out, "{");
+    struct json_node *id = json_get(req, "request_id");
+    if (id) {
+        *out = talloc_strdup_append_buffer(*out, "\"request_id\":");
+        *out = append_json(*out, id);
+        *out = talloc_strdup_append_buffer(*out, ",");
+    }
+    run_request(ipc, client_id, ta, json_get(req, "command"), out);
+    *out = talloc_strdup_append_buffer(*out, "}");
+}
+
+// Returns false if the client is gone.
+static bool handle_line(struct mp_ipc *ipc, int client_id, char *line)
+{
+    void *ta = talloc_new(NULL);
+    char *out = talloc_strdup(ta, "");
+    struct json_node req;
+    char *s = line;
+    if (parse_json(ta, &s, &req, 0) < 0 || s[strspn(s, " \t\r")]) {
+        out = talloc_strdup_append_buffer(out,
+                                          "{\"error\":\"invalid JSON\"}");
+    } else if (req.type == JSON_ARRAY) {
+        out = talloc_strdup_append_buffer(out, "[");
+        for (int n = 0; n < req.num_items; n++) {
+            if (n)
+                out = talloc_strdup_append_buffer(out, ",");
+            handle_request(ipc, client_id, ta, &req.items[n], &out);
+        }
+        out = talloc_strdup_append_buffer(out, "]");
+    } else {
+        handle_request(ipc, client_id, ta, &req, &out);
+    }
+    out = talloc_strdup_append_buffer(out, "\n");
+    bool alive = send_client(ipc, client_id, out, strlen(out));
+    talloc_free(ta);
+    return alive;
+}
+
+static void update_observers(struct mp_ipc *ipc)
+{
+    void *ta = talloc_new(NULL);
+    // Values already read in this update, so that a property observed by
+    // several clients is read only once
+    struct value { const char *name; char *value; } *cache = NULL;
+    int num_cache = 0;
+
+    for (int n = 0; n < ipc->num_observers; n++) {
+        struct ipc_observer *o = &ipc->observers[n];
+        char *value = NULL;
+        int i;
+        for (i = 0; i < num_cache; i++) {
+            if (strcmp(cache[i].name, o->name) == 0) {
+                value = cache[i].value;
+                break;
+            }
+        }
+        if (i == num_cache) {
+            value = talloc_strdup(ta, "");
+            if (append_property(ipc->mpctx, &value, o->name, false) <= 0)
+                value = talloc_strdup(ta, "null");
+            MP_TARRAY_APPEND(ta, cache, num_cache,
+                             (struct value){ o->name, value });
+        }
+        if (o->value && strcmp(o->value, value) == 0)
+            continue;
+        talloc_free(o->value);
+        o->value = talloc_strdup(ipc, value);
+        char *ev = talloc_asprintf(ta, "{\"event\":\"property-change\","
+                                   "\"id\":%lld,\"name\":", o->id);
+        ev = append_json_string(ev, o->name);
+        ev = talloc_asprintf_append_buffer(ev, ",\"data\":%s}\n", value);
+        send_client(ipc, o->client_id, ev, strlen(ev));
+    }
+    talloc_free(ta);
+}
+
+void mp_ipc_update(struct mp_ipc *ipc)
+{
+    if (!ipc)
+        return;
+
+    // Take the complete lines received so far, up to MAX_LINES_PER_UPDATE
+    // from each client
+    struct received { int id; char *data; int len; } *received = NULL;
+    int num_received = 0;
+    bool more = false;
+    void *ta = talloc_new(NULL);
+
+    pthread_mutex_lock(&ipc->lock);
+    int *closed = talloc_steal(ta, ipc->closed);
+    int num_closed = ipc->num_closed;
+    ipc->closed = NULL;
+    ipc->num_closed = 0;
+    for (int n = 0; n < ipc->num_clients; n++) {
+        struct ipc_client *client = ipc->clients[n];
+        if (client->dead)
+            continue;
+        int len = 0;
+        for (int i = 0; i < MAX_LINES_PER_UPDATE; i++) {
+            char *end = memchr(client->in + len, '\n', client->in_len - len);
+            if (!end)
+                break;
+            len = end - client->in + 1;
+        }
+        if (!len)
+            continue;
+        more |= !!memchr(client->in + len, '\n', client->in_len - len);
+        // Reading was paused; resume it
+        if (client->in_len >= MAX_LINE && client->in_len - len < MAX_LINE)
+            write(ipc->wakeup_pipe[1], &(char){0}, 1);
+        MP_TARRAY_APPEND(ta, received, num_received, (struct received){
+            client->id, talloc_memdup(ta, client->in, len), len});
+        memmove(client->in, client->in + len, client->in_len - len);
+        client->in_len -= len;
+    }
+    pthread_mutex_unlock(&ipc->lock);
+
+    for (int n = 0; n < num_closed; n++) {
+        mp_msg(MSGT_CPLAYER, MSGL_V, "[ipc] Client %d disconnected.\n",
+               closed[n]);
+        for (int i = ipc->num_observers - 1; i >= 0; i--) {
+            if (ipc->observers[i].client_id == closed[n])
+                remove_observer(ipc, &ipc->observers[i]);
+        }
+    }
+
+    for (int n = 0; n < num_received; n++) {
+        // Lines contain no NUL bytes, read_client() rejects them
+        char *line = received[n].data;
+        char *data_end = line + received[n].len;
+        while (line < data_end) {
+            char *end = memchr(line, '\n', data_end - line);
+            *end = '\0';
+            if (line[strspn(line, " \t\r")]
+                && !handle_line(ipc, received[n].id, line))
+                break;
+            line = end + 1;
+        }
+    }
+    talloc_free(ta);
+
+    if (more)
+        mp_input_wakeup(ipc->mpctx->input);
+
+    // During playback this is called for every frame, or more often.
+    // Changes seen at the next call or by the timer set up here are still
+    // sent, at most OBSERVE_INTERVAL late.
+    if (ipc->num_observers) {
+        int64_t now = mp_time_ns();
+        if (now - ipc->last_observe >= OBSERVE_INTERVAL) {
+            ipc->last_observe = now;
+            update_observers(ipc);
+        } else {
+            pthread_mutex_lock(&ipc->lock);
+            if (!ipc->wakeup_time) {
+                ipc->wakeup_time = ipc->last_observe + OBSERVE_INTERVAL;
+                write(ipc->wakeup_pipe[1], &(char){0}, 1);
+            }
+            pthread_mutex_unlock(&ipc->lock);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+// Check whether addr is a socket file nobody is listening on anymore
+static bool stale_socket(struct sockaddr_un *addr)
+{
+    struct stat st;
+    if (lstat(addr->sun_path, &st) < 0 || !S_ISSOCK(st.st_mode))
+        return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    bool stale = connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0 &&
+                 errno == ECONNREFUSED;
+    close(fd);
+    errno = EADDRINUSE;
+    return stale;
+}
+
+static int destroy_ipc(void *ptr)
+{
+    struct mp_ipc *ipc = ptr;
+    for (int n = 0; n < ipc->num_clients; n++)
+        close(ipc->clients[n]->fd);
+    if (ipc->listen_fd >= 0) {
+        close(ipc->listen_fd);
+        // Another instance may have replaced the socket in the meantime
+        struct stat st;
+        if (lstat(ipc->path, &st) == 0 && st.st_dev == ipc->sock_dev &&
+            st.st_ino == ipc->sock_ino)
+            unlink(ipc->path);
+    }
+    for (int n = 0; n < 2; n++) {
+        if (ipc->wakeup_pipe[n] >= 0)
+            close(ipc->wakeup_pipe[n]);
+    }
+    pthread_mutex_destroy(&ipc->lock);
+    return 0;
+}
+
+struct mp_ipc *mp_ipc_init(struct MPContext *mpctx, const char *path)
+{
+    if (!path || !path[0])
+        return NULL;
+
+    struct mp_ipc *ipc = talloc_ptrtype(NULL, ipc);
+    *ipc = (struct mp_ipc){
+        .mpctx = mpctx,
+        .path = talloc_strdup(ipc, path),
+        .listen_fd = -1,
+        .wakeup_pipe = {-1, -1},
+    };
+    pthread_mutex_init(&ipc->lock, NULL);
+    talloc_set_destructor(ipc, destroy_ipc);
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        mp_msg(MSGT_CPLAYER, MSGL_ERR, "[ipc] Socket path too long: %s\n",
+               path);
+        goto error;
+    }
+    strcpy(addr.sun_path, path);
+
+    if (pipe(ipc->wakeup_pipe) < 0)
+        goto error;
+    for (int n = 0; n < 2; n++) {
+        fcntl(ipc->wakeup_pipe[n], F_SETFL,
+              fcntl(ipc->wakeup_pipe[n], F_GETFL) | O_NONBLOCK);
+        fcntl(ipc->wakeup_pipe[n], F_SETFD, FD_CLOEXEC);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        goto socket_error;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        // Replace a socket left behind by an instance that is gone, but
+        // never remove anything else that happens to be at the path
+        if (errno != EADDRINUSE || !stale_socket(&addr) || unlink(path) < 0 ||
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            goto socket_error;
+        }
+    }
+    ipc->listen_fd = fd;
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        ipc->sock_dev = st.st_dev;
+        ipc->sock_ino = st.st_ino;
+    }
+    if (listen(fd, 10) < 0)
+        goto socket_error;
+
+    if (pthread_create(&ipc->thread, NULL, ipc_thread, ipc)) {
+        mp_msg(MSGT_CPLAYER, MSGL_ERR, "[ipc] Could not create thread.\n");
+        goto error;
+    }
+    mp_msg(MSGT_CPLAYER, MSGL_V, "[ipc] Listening on %s\n", path);
+    return ipc;
+
+socket_error:
+    mp_msg(MSGT_CPLAYER, MSGL_ERR, "[ipc] Could not create socket %s: %s\n",
+           path, strerror(errno));
+error:
+    talloc_free(ipc);
+    return NULL;
+}
+
+void mp_ipc_uninit(struct mp_ipc *ipc)
+{
+    if (!ipc)
+        return;
+    pthread_mutex_lock(&ipc->lock);
+    ipc->quit = true;
+    pthread_mutex_unlock(&ipc->lock);
+    write(ipc->wakeup_pipe[1], &(char){0}, 1);
+    pthread_join(ipc->thread, NULL);
+    talloc_free(ipc);
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_IPC_H
+#define MPLAYER_IPC_H
+
+#include "config.h"
+
+struct MPContext;
+struct mp_ipc;
+
+#ifdef CONFIG_IPC
+
+/* Start a JSON IPC server listening on the Unix socket path. Returns NULL
+ * if path is NULL or the socket could not be created.
+ */
+struct mp_ipc *mp_ipc_init(struct MPContext *mpctx, const char *path);
+void mp_ipc_uninit(struct mp_ipc *ipc);
+
+/* Run the requests received since the last call, and send property change
+ * events. Must be called from the playloop whenever it wakes up; incoming
+ * data wakes it up with mp_input_wakeup(). ipc can be NULL.
+ */
+void mp_ipc_update(struct mp_ipc *ipc);
+
+#else
+
+static inline struct mp_ipc *mp_ipc_init(struct MPContext *mpctx,
+                                         const char *path)
+{
+    return NULL;
+}
+static inline void mp_ipc_uninit(struct mp_ipc *ipc) {}
+static inline void mp_ipc_update(struct mp_ipc *ipc) {}
+
+#endif
+
+#endif /* MPLAYER_IPC_H */
@@ -37,6 +37,7 @@ extern af_info_t af_info_surround;
 extern af_info_t af_info_sub;
 extern af_info_t af_info_export;
 extern af_info_t af_info_volnorm;
+extern af_info_t af_info_loudness;
 extern af_info_t af_info_extrastereo;
 extern af_info_t af_info_lavcac3enc;
 extern af_info_t af_info_lavcresample;
@@ -64,6 +65,7 @@ static af_info_t* filter_list[]={
    &af_info_export,
 #endif
    &af_info_volnorm,
+   &af_info_loudness,
    &af_info_extrastereo,
    &af_info_lavcac3enc,
    &af_info_lavcresample,
@@ -272,6 +274,20 @@ static void af_print_filter_chain(af_stream_t* s)
     mp_msg(MSGT_AFILTER, MSGL_V, "\n");
 }
 
+// Check whether all filters starting with af accept planar float data,
+// up to the next format filter, which converts the layout like any other
+// format change (e.g. the one converting to the output format).
+static int planar_chain(af_instance_t* af)
+{
+  for(;af;af=af->next){
+    if(!strcmp(af->info->name,"format"))
+      return 1;
+    if(!(af->info->flags & AF_FLAGS_PLANAR))
+      return 0;
+  }
+  return 1;
+}
+
 // Warning:
 // A failed af_reinit() leaves the audio chain behind in a useless, broken
 // state (for example, format filters that were tentatively inserted stay
@@ -327,6 +343,12 @@ int af_reinit(af_stream_t* s, af_instance_t* af)
 	}
 	// Insert format filter
 	if((af->prev?af->prev->data->format:s->input.format) != in.format){
+	  // If requested and the rest of the chain can work on planar data,
+	  // do the layout change together with the sample format conversion
+	  // that is needed anyway
+	  if(s->cfg.planar && in.format == AF_FORMAT_FLOAT_NE &&
+	     planar_chain(af))
+	    in.format = AF_FORMAT_FLOATP;
 	  // Create format filter
 	  if(NULL == (new = af_prepend(s,af,"format")))
 	    return AF_ERROR;
@@ -394,6 +416,15 @@ void af_uninit(af_stream_t* s)
 static int fixup_output_format(af_stream_t* s)
 {
     af_instance_t* af = NULL;
+    // Audio outputs take interleaved data only
+    if (s->output.format == AF_FORMAT_UNKNOWN) {
+        if (AF_FORMAT_IS_PLANAR(s->last->data->format)) {
+            s->output.format = AF_FORMAT_FLOAT_NE;
+            s->output.bps = 4;
+        }
+    } else {
+        s->output.format &= ~AF_FORMAT_PLANAR;
+    }
     // Check number of output channels fix if not OK
     // If needed always inserted last -> easy to screw up other filters
     if(s->output.nch && s->last->data->nch!=s->output.nch){
@@ -555,6 +586,25 @@ int af_init(af_stream_t* s)
       if(AF_OK != af_reinit(s,af))
       	return -1;
     }
+    // The player adjusts the speed of the audio continuously to follow the
+    // video, so there must be a resampler even if the rates are equal
+    double ratio = 1;
+    if (opts->video_sync == VIDEO_SYNC_DISPLAY_RESAMPLE &&
+        !af_control_any_rev(s, AF_CONTROL_RESAMPLE_RATIO | AF_CONTROL_GET,
+                            &ratio)) {
+      int rate = s->last->data->rate;
+      if(!strcmp(s->first->info->name,"format"))
+        af = af_append(s,s->first,"lavcresample");
+      else
+        af = af_prepend(s,s->first,"lavcresample");
+      if(!af ||
+         AF_OK != af->control(af, AF_CONTROL_RESAMPLE_RATE | AF_CONTROL_SET,
+                              &rate) ||
+         AF_OK != af->control(af, AF_CONTROL_RESAMPLE_RATIO | AF_CONTROL_SET,
+                              &ratio) ||
+         AF_OK != af_reinit(s,af))
+        return -1;
+    }
     if (AF_OK != fixup_output_format(s)) {
       // Something is stuffed audio out will not work
       mp_msg(MSGT_AFILTER, MSGL_ERR, "[libaf] Unable to setup filter system can not"
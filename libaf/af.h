@@ -36,7 +36,11 @@ struct af_instance_s;
 #define AF_NCH 8
 #endif
 
-// Audio data chunk
+/* Audio data chunk
+ * Samples are normally interleaved. If format has AF_FORMAT_PLANAR set, the
+ * buffer contains all samples of the first channel, followed by all samples
+ * of the second channel and so on; each plane is len / nch bytes long.
+ */
 typedef struct af_data_s
 {
   void* audio;  // data buffer
@@ -51,6 +55,8 @@ typedef struct af_data_s
 // Flags used for defining the behavior of an audio filter
 #define AF_FLAGS_REENTRANT 	0x00000000
 #define AF_FLAGS_NOT_REENTRANT 	0x00000001
+// Filter accepts AF_FORMAT_FLOATP input and keeps the layout on output
+#define AF_FLAGS_PLANAR		0x00000002
 
 /* Audio filter information not specific for current instance, but for
    a specific filter */
@@ -104,6 +110,7 @@ typedef struct af_cfg_s{
   int force;	// Initialization type
   char** list;	/* list of names of filters that are added to filter
 		   list during first initialization of stream */
+  int planar;	// Allow planar float between filters that support it
 }af_cfg_t;
 
 // Current audio stream
@@ -299,6 +306,25 @@ int af_to_ms(int n, int* in, float* out, int rate);
  */
 int af_test_output(struct af_instance_s* af, af_data_t* out);
 
+/**
+ * \brief locate the samples of a channel in a buffer
+ * \param data audio data, interleaved or planar
+ * \param ch channel
+ * \param offset [out] index of the first sample of the channel
+ * \param stride [out] distance between two samples of the channel
+ * \return number of samples per channel
+ */
+int af_channel_stride(af_data_t *data, int ch, int *offset, int *stride);
+
+typedef float (*af_dot_product_t)(const float* a, const float* b, int len);
+
+/**
+ * \brief get the fastest dot product implementation for this CPU
+ * \return function computing the dot product of two float vectors; len
+ *         must be a multiple of 4, the vectors need not be aligned
+ */
+af_dot_product_t af_get_dot_product(void);
+
 /**
  * \brief soft clipping function using sin()
  * \param a input value
@@ -163,6 +163,12 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       }
     }
 
+    // Only interleaved data can be routed
+    if(AF_FORMAT_IS_PLANAR(((af_data_t*)arg)->format)){
+      ((af_data_t*)arg)->format = AF_FORMAT_FLOAT_NE;
+      return AF_FALSE;
+    }
+
     af->data->rate   = ((af_data_t*)arg)->rate;
     af->data->format = ((af_data_t*)arg)->format;
     af->data->bps    = ((af_data_t*)arg)->bps;
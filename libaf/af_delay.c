@@ -48,6 +48,12 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
   case AF_CONTROL_REINIT:{
     int i;
 
+    // Only interleaved data is supported
+    if(AF_FORMAT_IS_PLANAR(((af_data_t*)arg)->format)){
+      ((af_data_t*)arg)->format = AF_FORMAT_FLOAT_NE;
+      return AF_FALSE;
+    }
+
     // Free prevous delay queues
     for(i=0;i<af->data->nch;i++)
       free(s->q[i]);
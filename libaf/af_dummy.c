@@ -71,6 +71,6 @@ af_info_t af_info_dummy = {
     "dummy",
     "Anders",
     "",
-    AF_FLAGS_REENTRANT,
+    AF_FLAGS_REENTRANT | AF_FLAGS_PLANAR,
     af_open
 };
@@ -30,6 +30,7 @@
 #include <math.h>
 
 #include "af.h"
+#include "dsp.h"
 
 #define L   	2      // Storage for filter taps
 #define KM  	10     // Max number of bands
@@ -63,6 +64,7 @@ typedef struct af_equalizer_s
   float   a[KM][L];        	// A weights
   float   b[KM][L];	     	// B weights
   float   wq[AF_NCH][KM][L];  	// Circular buffer for W data
+  af_biquad_t bq;		// Band filters for more than two channels
   float   g[AF_NCH][KM];      	// Gain factor for each channel and band
   int     K; 		   	// Number of used eq bands
   int     channels;        	// Number of channels
@@ -81,6 +83,27 @@ static void bp2(float* a, float* b, float fc, float q){
   b[1] = -1.0050;
 }
 
+// Load the band filters and gains into the biquad bank
+static void update_filters(af_equalizer_t* s)
+{
+  int ch, k;
+  for(ch=0;ch<s->bq.channels;ch++){
+    for(k=0;k<s->K;k++){
+      float g = s->g[ch][k];
+      // y = x + g * (w + b1 * q1)
+      float c[AF_BIQUAD_COEFS] = {s->b[k][0], s->a[k][0], s->a[k][1],
+                                  1.0, g, 0.0, g * s->b[k][1]};
+      // the output gain is applied by the last band
+      if(k == s->K - 1){
+        int i;
+        for(i=3;i<AF_BIQUAD_COEFS;i++)
+          c[i] *= s->gain_factor;
+      }
+      af_biquad_set(&s->bq, ch, k, c);
+    }
+  }
+}
+
 // Initialization and runtime control
 static int control(struct af_instance_s* af, int cmd, void* arg)
 {
@@ -98,7 +121,9 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 
     af->data->rate   = ((af_data_t*)arg)->rate;
     af->data->nch    = ((af_data_t*)arg)->nch;
-    af->data->format = AF_FORMAT_FLOAT_NE;
+    // Planar input is processed as is
+    af->data->format = ((af_data_t*)arg)->format == AF_FORMAT_FLOATP ?
+                       AF_FORMAT_FLOATP : AF_FORMAT_FLOAT_NE;
     af->data->bps    = 4;
 
     // Calculate number of active filters
@@ -135,6 +160,15 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
         s->gain_factor=1;
     }
 
+    if(af->data->nch > 2 &&
+       (s->bq.channels != af->data->nch || s->bq.sections != s->K)){
+      if(af_biquad_init(&s->bq, af->data->nch, s->K)){
+        mp_msg(MSGT_AFILTER, MSGL_FATAL, "[equalizer] Out of memory\n");
+        return AF_ERROR;
+      }
+    }
+    update_filters(s);
+
     return af_test_output(af,arg);
   }
   case AF_CONTROL_COMMAND_LINE:{
@@ -159,6 +193,7 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 
     for(k = 0 ; k<KM ; k++)
       s->g[ch][k] = pow(10.0,clamp(gain[k],G_MIN,G_MAX)/20.0)-1.0;
+    update_filters(s);
 
     return AF_OK;
   }
@@ -181,8 +216,11 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 // Deallocate memory
 static void uninit(struct af_instance_s* af)
 {
-    free(af->data);
-    free(af->setup);
+  af_equalizer_t* s = af->setup;
+  free(af->data);
+  if(s)
+    af_biquad_free(&s->bq);
+  free(s);
 }
 
 // Filter data through filter
@@ -191,18 +229,28 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
   af_data_t*       c 	= data;			    	// Current working data
   af_equalizer_t*  s 	= (af_equalizer_t*)af->setup; 	// Setup
   uint32_t  	   ci  	= af->data->nch; 	    	// Index for channels
-  uint32_t	   nch 	= af->data->nch;   	    	// Number of channels
+
+  // The biquad bank only beats the scalar loop from more than two channels
+  if(ci > 2){
+    int offset, stride;
+    int len    = af_channel_stride(c, 0, &offset, &stride);
+    int chstep = AF_FORMAT_IS_PLANAR(c->format) ? len : 1;
+    af_biquad_process(&s->bq, c->audio, len, chstep, stride);
+    return c;
+  }
 
   while(ci--){
+    int		offset, stride;
+    int		len = af_channel_stride(c, ci, &offset, &stride);
     float*	g   = s->g[ci];      // Gain factor
-    float*	in  = ((float*)c->audio)+ci;
-    float*	out = ((float*)c->audio)+ci;
-    float* 	end = in + c->len/4; // Block loop end
+    float*	in  = ((float*)c->audio)+offset;
+    float*	out = ((float*)c->audio)+offset;
+    float* 	end = in + len*stride; // Block loop end
 
     while(in < end){
       register int	k  = 0;		// Frequency band index
       register float 	yt = *in; 	// Current input sample
-      in+=nch;
+      in+=stride;
 
       // Run the filters
       for(;k<s->K;k++){
@@ -218,7 +266,7 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
       }
       // Calculate output
       *out=yt*s->gain_factor;
-      out+=nch;
+      out+=stride;
     }
   }
   return c;
@@ -243,6 +291,6 @@ af_info_t af_info_equalizer = {
   "equalizer",
   "Anders",
   "",
-  AF_FLAGS_NOT_REENTRANT,
+  AF_FLAGS_NOT_REENTRANT | AF_FLAGS_PLANAR,
   af_open
 };
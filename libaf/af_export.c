@@ -1,11 +1,8 @@
 /*
  * This audio filter exports the incoming signal to other processes
- * using memory mapping. The memory mapped area contains a header:
- *   int nch,
- *   int size,
- *   unsigned long long counter (updated every time the  contents of
- *                               the area changes),
- * the rest is payload (non-interleaved).
+ * using memory mapping. The memory mapped area is a ring of blocks of
+ * non-interleaved samples with timestamps, which can be read by any number
+ * of processes without locking. See af_export.h for the layout.
  *
  * This file is part of MPlayer.
  *
@@ -33,31 +30,169 @@
 
 #include <sys/types.h>
 #include <sys/mman.h>
-#include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
 #include "af.h"
+#include "af_export.h"
 #include "path.h"
+#include "mpcommon.h"
+#include "osdep/atomics.h"
 
-#define DEF_SZ 512 // default buffer size (in samples)
+#define DEF_SZ 512 // default block size (in samples)
+#define DEF_BLOCKS 32 // default number of blocks in the ring
 #define SHARED_FILE "mplayer-af_export" /* default file name
 					   (relative to ~/.mplayer/ */
 
-#define SIZE_HEADER (2 * sizeof(int) + sizeof(unsigned long long))
+#define HEADER_SIZE 64 // sizeof(struct af_export_header) rounded up
 
 // Data for specific instances of this filter
 typedef struct af_export_s
 {
-  unsigned long long  count; // Used for sync
-  void* buf[AF_NCH]; 	// Buffers for storing the data before it is exported
-  int 	sz;	      	// Size of buffer in samples
-  int 	wi;  		// Write index
-  int	fd;           	// File descriptor to shared memory area
-  char* filename;      	// File to export data
-  uint8_t *mmap_area;  	// MMap shared area
+  uint64_t	count;		// Number of the block being written
+  int 		sz;		// Block size in samples
+  int 		nblocks;	// Number of blocks in the ring
+  int 		wi;		// Write index inside the current block
+  int		fd;		// File descriptor to shared memory area
+  char*		filename;	// File to export data
+  uint8_t*	mmap_area;	// MMap shared area
+  size_t	mapsize;	// Size of the mapped area
+  double	pts;		// Timestamp of the next incoming sample
 } af_export_t;
 
+static struct af_export_header *get_header(af_export_t *s)
+{
+  return (struct af_export_header *)s->mmap_area;
+}
+
+static struct af_export_block *get_block(af_export_t *s, uint64_t n)
+{
+  struct af_export_header *h = get_header(s);
+  return (struct af_export_block *)(s->mmap_area + h->header_size
+				    + (n % h->nblocks) * h->block_size);
+}
+
+/* Speaker positions for the channel orders used inside the player. Layouts
+   without a single well defined order are left as unknown. */
+static void set_channel_map(uint8_t *map, int nch)
+{
+  static const uint8_t maps[AF_EXPORT_MAX_CH + 1][AF_EXPORT_MAX_CH] = {
+    [1] = {AF_EXPORT_CH_FC},
+    [2] = {AF_EXPORT_CH_FL, AF_EXPORT_CH_FR},
+    [4] = {AF_EXPORT_CH_FL, AF_EXPORT_CH_FR, AF_EXPORT_CH_SL, AF_EXPORT_CH_SR},
+    [5] = {AF_EXPORT_CH_FL, AF_EXPORT_CH_FR, AF_EXPORT_CH_SL, AF_EXPORT_CH_SR,
+	   AF_EXPORT_CH_FC},
+    [6] = {AF_EXPORT_CH_FL, AF_EXPORT_CH_FR, AF_EXPORT_CH_SL, AF_EXPORT_CH_SR,
+	   AF_EXPORT_CH_FC, AF_EXPORT_CH_LFE},
+    [8] = {AF_EXPORT_CH_FL, AF_EXPORT_CH_FR, AF_EXPORT_CH_SL, AF_EXPORT_CH_SR,
+	   AF_EXPORT_CH_FC, AF_EXPORT_CH_LFE, AF_EXPORT_CH_BL, AF_EXPORT_CH_BR},
+  };
+  memset(map, AF_EXPORT_CH_UNKNOWN, AF_EXPORT_MAX_CH);
+  if(nch > 0 && nch <= AF_EXPORT_MAX_CH)
+    memcpy(map, maps[nch], AF_EXPORT_MAX_CH);
+}
+
+/* Tell readers of an area that it is gone and unmap it. The file itself is
+   left in place (it is replaced by the next one). */
+static void unmap_area(uint8_t *area, size_t mapsize, int fd)
+{
+  if(area){
+    ((struct af_export_header *)area)->flags |= AF_EXPORT_FLAG_CLOSED;
+    munmap(area, mapsize);
+  }
+  if(fd >= 0)
+    close(fd);
+}
+
+static void close_area(af_export_t *s)
+{
+  unmap_area(s->mmap_area, s->mapsize, s->fd);
+  s->mmap_area = NULL;
+  s->fd = -1;
+}
+
+/* Create a new shared area for the format in af->data. It is set up in a
+   temporary file that is renamed over the exported file when complete, so
+   readers never see a partially initialized header. The previous area is
+   marked closed only after the rename, so readers that reopen the file on
+   seeing the flag get the new one. */
+static int open_area(struct af_instance_s* af)
+{
+  af_export_t* s = af->setup;
+  af_data_t* d = af->data;
+  uint8_t* old_area = s->mmap_area;
+  size_t old_mapsize = s->mapsize;
+  int old_fd = s->fd;
+  s->mmap_area = NULL;
+  s->fd = -1;
+  size_t block_size = sizeof(struct af_export_block)
+		      + (size_t)s->sz * d->bps * d->nch;
+  block_size = (block_size + 15) & ~(size_t)15;
+  size_t mapsize = HEADER_SIZE + block_size * s->nblocks;
+
+  char *tmpname = malloc(strlen(s->filename) + 5);
+  if(!tmpname)
+    return AF_ERROR;
+  sprintf(tmpname, "%s.tmp", s->filename);
+
+  s->fd = open(tmpname, O_RDWR | O_CREAT | O_TRUNC, 0640);
+  if(s->fd < 0){
+    mp_msg(MSGT_AFILTER, MSGL_ERR, "[export] Could not open/create file: %s\n",
+	   tmpname);
+    free(tmpname);
+    return AF_ERROR;
+  }
+  if(ftruncate(s->fd, mapsize) < 0){
+    mp_msg(MSGT_AFILTER, MSGL_ERR, "[export] Could not resize file %s\n",
+	   tmpname);
+    goto fail;
+  }
+  s->mmap_area = mmap(0, mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, s->fd, 0);
+  if(s->mmap_area == MAP_FAILED){
+    s->mmap_area = NULL;
+    mp_msg(MSGT_AFILTER, MSGL_ERR, "[export] Could not mmap file %s\n",
+	   tmpname);
+    goto fail;
+  }
+  s->mapsize = mapsize;
+
+  // The file is zero filled, so all blocks are marked as not yet written
+  struct af_export_header *h = get_header(s);
+  h->magic		= AF_EXPORT_MAGIC;
+  h->version		= AF_EXPORT_VERSION;
+  h->header_size	= HEADER_SIZE;
+  h->format		= d->format == AF_FORMAT_FLOAT_NE ?
+			  AF_EXPORT_FORMAT_FLOAT : AF_EXPORT_FORMAT_S16;
+  h->bytes_per_sample	= d->bps;
+  h->rate		= d->rate;
+  h->nch		= d->nch;
+  h->block_samples	= s->sz;
+  h->block_size		= block_size;
+  h->nblocks		= s->nblocks;
+  set_channel_map(h->channel_map, d->nch);
+
+  if(rename(tmpname, s->filename) < 0){
+    mp_msg(MSGT_AFILTER, MSGL_ERR, "[export] Could not rename %s to %s\n",
+	   tmpname, s->filename);
+    goto fail;
+  }
+  free(tmpname);
+  unmap_area(old_area, old_mapsize, old_fd);
+
+  mp_msg(MSGT_AFILTER, MSGL_INFO, "[export] Exporting to file: %s "
+	 "(%d blocks of %d samples)\n", s->filename, s->nblocks, s->sz);
+
+  s->count = 0;
+  s->wi = 0;
+  return AF_OK;
+
+fail:
+  unlink(tmpname);
+  free(tmpname);
+  close_area(s);
+  unmap_area(old_area, old_mapsize, old_fd);
+  return AF_ERROR;
+}
 
 /* Initialization and runtime control
    af audio filter instance
@@ -69,67 +204,30 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
   af_export_t* s = af->setup;
   switch (cmd){
   case AF_CONTROL_REINIT:{
-    int i=0;
-    int mapsize;
-
-    // Free previous buffers
-    if (s->buf)
-      free(s->buf[0]);
-
-    // unmap previous area
-    if(s->mmap_area)
-      munmap(s->mmap_area, SIZE_HEADER + (af->data->bps*s->sz*af->data->nch));
-    // close previous file descriptor
-    if(s->fd)
-      close(s->fd);
-
-    // Accept only int16_t as input format (which sucks)
-    af->data->rate   = ((af_data_t*)arg)->rate;
-    af->data->nch    = ((af_data_t*)arg)->nch;
-    af->data->format = AF_FORMAT_S16_NE;
-    af->data->bps    = 2;
+    af_data_t* in = arg;
+
+    // Floating point input is exported as float, anything else as int16_t
+    af->data->rate   = in->rate;
+    af->data->nch    = in->nch;
+    if((in->format & AF_FORMAT_POINT_MASK) == AF_FORMAT_F){
+      af->data->format = AF_FORMAT_FLOAT_NE;
+      af->data->bps    = 4;
+    } else {
+      af->data->format = AF_FORMAT_S16_NE;
+      af->data->bps    = 2;
+    }
 
     // If buffer length isn't set, set it to the default value
     if(s->sz == 0)
       s->sz = DEF_SZ;
-
-    // Allocate new buffers (as one continuous block)
-    s->buf[0] = calloc(s->sz*af->data->nch, af->data->bps);
-    if(NULL == s->buf[0])
-      mp_msg(MSGT_AFILTER, MSGL_FATAL, "[export] Out of memory\n");
-    for(i = 1; i < af->data->nch; i++)
-      s->buf[i] = (uint8_t *)s->buf[0] + i*s->sz*af->data->bps;
-
-    // Init memory mapping
-    s->fd = open(s->filename, O_RDWR | O_CREAT | O_TRUNC, 0640);
-    mp_msg(MSGT_AFILTER, MSGL_INFO, "[export] Exporting to file: %s\n", s->filename);
-    if(s->fd < 0)
-      mp_msg(MSGT_AFILTER, MSGL_FATAL, "[export] Could not open/create file: %s\n",
-	     s->filename);
-
-    // header + buffer
-    mapsize = (SIZE_HEADER + (af->data->bps * s->sz * af->data->nch));
-
-    // grow file to needed size
-    for(i = 0; i < mapsize; i++){
-      char null = 0;
-      write(s->fd, (void*) &null, 1);
-    }
-
-    // mmap size
-    s->mmap_area = mmap(0, mapsize, PROT_READ|PROT_WRITE,MAP_SHARED, s->fd, 0);
-    if(s->mmap_area == NULL)
-      mp_msg(MSGT_AFILTER, MSGL_FATAL, "[export] Could not mmap file %s\n", s->filename);
-    mp_msg(MSGT_AFILTER, MSGL_INFO, "[export] Memory mapped to file: %s (%p)\n",
-	   s->filename, s->mmap_area);
-
-    // Initialize header
-    *((int*)s->mmap_area) = af->data->nch;
-    *((int*)s->mmap_area + 1) = s->sz * af->data->bps * af->data->nch;
-    msync(s->mmap_area, mapsize, MS_ASYNC);
-
-    // Use test_output to return FALSE if necessary
-    return af_test_output(af, (af_data_t*)arg);
+    if(s->nblocks == 0)
+      s->nblocks = DEF_BLOCKS;
+
+    // Only create the file once the format is final
+    int r = af_test_output(af, in);
+    if(r != AF_OK)
+      return r;
+    return open_area(af);
   }
   case AF_CONTROL_COMMAND_LINE:{
     int i=0;
@@ -151,21 +249,32 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
     memcpy(s->filename, str, i);
     s->filename[i] = 0;
 
-    sscanf(str + i + 1, "%d", &(s->sz));
+    if(str[i])
+      sscanf(str + i + 1, "%d:%d", &(s->sz), &(s->nblocks));
+
+    if((s->nblocks < 0) || (s->nblocks == 1) || (s->nblocks > 1024)){
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[export] Number of blocks must be"
+	     " between 2 and 1024\n");
+      return AF_ERROR;
+    }
 
     return af->control(af, AF_CONTROL_EXPORT_SZ | AF_CONTROL_SET, &s->sz);
   }
   case AF_CONTROL_EXPORT_SZ | AF_CONTROL_SET:
     s->sz = * (int *) arg;
-    if((s->sz <= 0) || (s->sz > 2048))
+    if((s->sz <= 0) || (s->sz > 2048)){
       mp_msg(MSGT_AFILTER, MSGL_ERR, "[export] Buffer size must be between"
 	      " 1 and 2048\n" );
+      return AF_ERROR;
+    }
 
     return AF_OK;
   case AF_CONTROL_EXPORT_SZ | AF_CONTROL_GET:
     *(int*) arg = s->sz;
     return AF_OK;
-
+  case AF_CONTROL_EXPORT_PTS | AF_CONTROL_SET:
+    s->pts = *(double *) arg;
+    return AF_OK;
   }
   return AF_UNKNOWN;
 }
@@ -180,15 +289,8 @@ static void uninit( struct af_instance_s* af )
 
   if(af->setup){
     af_export_t* s = af->setup;
-    if (s->buf)
-      free(s->buf[0]);
 
-    // Free mmaped area
-    if(s->mmap_area)
-      munmap(s->mmap_area, sizeof(af_export_t));
-
-    if(s->fd > -1)
-      close(s->fd);
+    close_area(s);
 
     free(s->filename);
 
@@ -197,6 +299,16 @@ static void uninit( struct af_instance_s* af )
   }
 }
 
+/* Copy len samples per channel from interleaved a to the planes starting
+   at b (plane stride sz samples) */
+#define COPY_PLANES(type) do {						\
+    const type* in = (const type *)a + i * nch;				\
+    type* out = (type *)b + s->wi;					\
+    for(ch = 0; ch < nch; ch++)						\
+      for(j = 0; j < n; j++)						\
+	out[ch * sz + j] = in[j * nch + ch];				\
+  } while(0)
+
 /* Filter data through filter
    af audio filter instance
    data audio data
@@ -205,39 +317,51 @@ static af_data_t* play( struct af_instance_s* af, af_data_t* data )
 {
   af_data_t*   	c   = data;	     // Current working data
   af_export_t* 	s   = af->setup;     // Setup for this instance
-  int16_t* 	a   = c->audio;	     // Incomming sound
+  uint8_t* 	a   = c->audio;	     // Incomming sound
   int 		nch = c->nch;	     // Number of channels
-  int		len = c->len/c->bps; // Number of sample in data chunk
-  int 		sz  = s->sz;         // buffer size (in samples)
-  int 		flag = 0;	     // Set to 1 if buffer is filled
-
-  int 		ch, i;
-
-  // Fill all buffers
-  for(ch = 0; ch < nch; ch++){
-    int 	wi = s->wi;    	 // Reset write index
-    int16_t* 	b  = s->buf[ch]; // Current buffer
-
-    // Copy data to export buffers
-    for(i = ch; i < len; i += nch){
-      b[wi++] = a[i];
-      if(wi >= sz){ // Don't write outside the end of the buffer
-	flag = 1;
-	break;
-      }
+  int		len = c->len/c->bps/nch; // Number of samples per channel
+  int 		sz  = s->sz;         // block size (in samples)
+  int 		i, j, ch;
+
+  if(!s->mmap_area)
+    return data;
+
+  struct af_export_header *h = get_header(s);
+
+  for(i = 0; i < len;){
+    struct af_export_block *blk = get_block(s, s->count);
+    int n = len - i < sz - s->wi ? len - i : sz - s->wi;
+
+    if(s->wi == 0){
+      // Start a new block: invalidate the slot before overwriting it
+      blk->seq = AF_EXPORT_SEQ_WRITING(s->count);
+      mp_memory_barrier();
+      blk->pts = s->pts == MP_NOPTS_VALUE ? AF_EXPORT_NOPTS
+		 : s->pts + (double)i / c->rate;
     }
-    s->wi = wi % s->sz;
-  }
 
-  // Export buffer to mmaped area
-  if(flag){
-    // update buffer in mapped area
-    memcpy(s->mmap_area + SIZE_HEADER, s->buf[0], sz * c->bps * nch);
-    s->count++; // increment counter (to sync)
-    memcpy(s->mmap_area + SIZE_HEADER - sizeof(s->count),
-	   &(s->count), sizeof(s->count));
+    uint8_t* b = (uint8_t *)(blk + 1);
+    if(c->bps == 4)
+      COPY_PLANES(uint32_t);
+    else
+      COPY_PLANES(int16_t);
+
+    s->wi += n;
+    i += n;
+    if(s->wi == sz){
+      // Publish the block
+      mp_memory_barrier();
+      blk->seq = AF_EXPORT_SEQ_DONE(s->count);
+      s->count++;
+      h->write_seq = s->count;
+      s->wi = 0;
+    }
   }
 
+  // Used if the next chunk comes without a timestamp
+  if(s->pts != MP_NOPTS_VALUE)
+    s->pts += (double)len / c->rate;
+
   // We don't modify data, just export it
   return data;
 }
@@ -258,6 +382,8 @@ static int af_open( af_instance_t* af )
     return AF_ERROR;
 
   ((af_export_t *)af->setup)->filename = get_path(SHARED_FILE);
+  ((af_export_t *)af->setup)->fd = -1;
+  ((af_export_t *)af->setup)->pts = MP_NOPTS_VALUE;
 
   return AF_OK;
 }
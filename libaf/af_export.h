@@ -0,0 +1,107 @@
+/*
+ * Shared memory layout written by the export audio filter.
+ *
+ * This header is also used by external programs reading the exported data
+ * (see TOOLS/af_export/), so it must not depend on anything but <stdint.h>.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_AF_EXPORT_H
+#define MPLAYER_AF_EXPORT_H
+
+#include <stdint.h>
+
+/* The file consists of a struct af_export_header followed by a ring of
+ * nblocks blocks of block_size bytes each. Every block starts with a
+ * struct af_export_block followed by nch planes of block_samples samples.
+ *
+ * There is a single writer and any number of readers, none of which take
+ * locks. Block number n (counting from 0) is stored in slot n % nblocks.
+ * Its seq field is AF_EXPORT_SEQ_WRITING(n) while the writer fills it and
+ * AF_EXPORT_SEQ_DONE(n) once it is complete. write_seq in the header is the
+ * number of completed blocks. To read block n:
+ *
+ *   1. read the block's seq, continue only if it is AF_EXPORT_SEQ_DONE(n)
+ *   2. full memory barrier, copy pts and samples out of the shared area
+ *   3. full memory barrier, read seq again
+ *
+ * If seq changed, the writer has lapped the reader and the copy is torn;
+ * skip ahead to a newer block (e.g. write_seq - 1).
+ *
+ * When the filter is reconfigured (format, channels or rate change) a new
+ * file is atomically renamed over the old one, and only then is
+ * AF_EXPORT_FLAG_CLOSED set in the old one. Readers seeing the flag must
+ * reopen the file, and will find the new one. The flag is also set when the
+ * player exits.
+ */
+
+#define AF_EXPORT_MAGIC   0x4541504d // "MPAE" read as little endian
+#define AF_EXPORT_VERSION 2
+
+#define AF_EXPORT_FLAG_CLOSED 1
+
+// sample formats, always in native byte order
+#define AF_EXPORT_FORMAT_S16   1
+#define AF_EXPORT_FORMAT_FLOAT 2
+
+#define AF_EXPORT_MAX_CH 8
+
+// speaker positions in channel_map
+#define AF_EXPORT_CH_UNKNOWN 0
+#define AF_EXPORT_CH_FL      1
+#define AF_EXPORT_CH_FR      2
+#define AF_EXPORT_CH_FC      3
+#define AF_EXPORT_CH_LFE     4
+#define AF_EXPORT_CH_SL      5  // surround/rear left
+#define AF_EXPORT_CH_SR      6  // surround/rear right
+#define AF_EXPORT_CH_BL      7  // rear left of 7.1
+#define AF_EXPORT_CH_BR      8  // rear right of 7.1
+
+#define AF_EXPORT_SEQ_WRITING(n) (2 * (uint64_t)(n) + 1)
+#define AF_EXPORT_SEQ_DONE(n)    (2 * (uint64_t)(n) + 2)
+
+// pts value of blocks with unknown timestamp
+#define AF_EXPORT_NOPTS (-1e300)
+
+struct af_export_header {
+    uint32_t magic;             // AF_EXPORT_MAGIC
+    uint32_t version;           // AF_EXPORT_VERSION
+    uint32_t header_size;       // offset of the first block in the file
+    volatile uint32_t flags;    // AF_EXPORT_FLAG_*
+    uint32_t format;            // AF_EXPORT_FORMAT_*
+    uint32_t bytes_per_sample;
+    uint32_t rate;              // sample rate in Hz
+    uint32_t nch;               // number of channels
+    uint32_t block_samples;     // samples per channel in a block
+    uint32_t block_size;        // bytes per block including its header
+    uint32_t nblocks;           // number of blocks in the ring
+    uint32_t reserved;
+    volatile uint64_t write_seq; // number of completed blocks
+    uint8_t channel_map[AF_EXPORT_MAX_CH]; // AF_EXPORT_CH_* for each channel
+};
+
+struct af_export_block {
+    volatile uint64_t seq;
+    // Playback timestamp of the first sample in the block, in seconds, or
+    // AF_EXPORT_NOPTS. It is the timestamp the samples had when entering the
+    // filter chain; the delay of filters before the export filter is not
+    // taken into account.
+    double pts;
+};
+
+#endif /* MPLAYER_AF_EXPORT_H */
@@ -30,6 +30,7 @@
 
 #include "config.h"
 #include "af.h"
+#include "convert.h"
 #include "mpbswap.h"
 #include "libvo/fastmemcpy.h"
 
@@ -56,6 +57,18 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data);
 static af_data_t* play_swapendian(struct af_instance_s* af, af_data_t* data);
 static af_data_t* play_float_s16(struct af_instance_s* af, af_data_t* data);
 static af_data_t* play_s16_float(struct af_instance_s* af, af_data_t* data);
+static af_data_t* play_s16_floatp(struct af_instance_s* af, af_data_t* data);
+static af_data_t* play_floatp_s16(struct af_instance_s* af, af_data_t* data);
+static af_data_t* play_layout(struct af_instance_s* af, af_data_t* data);
+static af_data_t* play_planar(struct af_instance_s* af, af_data_t* data);
+
+typedef struct af_format_s
+{
+  void* buf;		// Used when both sample format and layout change
+  int len;
+  int dither;		// Dither when converting float to 16 bit
+  uint32_t seed;	// State of the dither noise generator
+} af_format_t;
 
 // Helper functions to check sanity for input arguments
 
@@ -82,6 +95,12 @@ static int check_format(int format)
 	 af_fmt2str(format,buf,256));
     return AF_ERROR;
   }
+  if(AF_FORMAT_IS_PLANAR(format) && format != AF_FORMAT_FLOATP){
+    mp_msg(MSGT_AFILTER, MSGL_ERR, "[format] Planar layout is only supported"
+	   " for native endian float samples (%s)\n",
+	   af_fmt2str(format,buf,256));
+    return AF_ERROR;
+  }
   return AF_OK;
 }
 
@@ -118,8 +137,22 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 
     af->play = play; // set default
 
+    // Layout changes are done in a separate pass, unless a fused
+    // conversion is available (see below)
+    if ((af->data->format & AF_FORMAT_LAYOUT_MASK) !=
+	(data->format & AF_FORMAT_LAYOUT_MASK))
+    {
+	af->play = play_planar;
+	// look whether only the layout differs
+	if ((af->data->format & ~AF_FORMAT_LAYOUT_MASK) ==
+	    (data->format & ~AF_FORMAT_LAYOUT_MASK))
+	{
+	    mp_msg(MSGT_AFILTER, MSGL_V, "[format] Accelerated layout conversion only\n");
+	    af->play = play_layout;
+	}
+    }
     // look whether only endianness differences are there
-    if ((af->data->format & ~AF_FORMAT_END_MASK) ==
+    else if ((af->data->format & ~AF_FORMAT_END_MASK) ==
 	(data->format & ~AF_FORMAT_END_MASK))
     {
 	mp_msg(MSGT_AFILTER, MSGL_V, "[format] Accelerated endianness conversion only\n");
@@ -141,9 +174,35 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 	   af_fmt2str(af->data->format,buf2,256));
 	af->play = play_s16_float;
     }
+    if ((data->format == AF_FORMAT_S16_NE) &&
+	(af->data->format == AF_FORMAT_FLOATP))
+    {
+	mp_msg(MSGT_AFILTER, MSGL_V, "[format] Accelerated %s to %s conversion\n",
+	   af_fmt2str(data->format,buf1,256),
+	   af_fmt2str(af->data->format,buf2,256));
+	af->play = play_s16_floatp;
+    }
+    if ((data->format == AF_FORMAT_FLOATP) &&
+	(af->data->format == AF_FORMAT_S16_NE))
+    {
+	mp_msg(MSGT_AFILTER, MSGL_V, "[format] Accelerated %s to %s conversion\n",
+	   af_fmt2str(data->format,buf1,256),
+	   af_fmt2str(af->data->format,buf2,256));
+	af->play = play_floatp_s16;
+    }
     return AF_OK;
   }
   case AF_CONTROL_COMMAND_LINE:{
+    af_format_t* s = af->setup;
+    char* opt = strchr(arg, ':');
+    if (opt) {
+      if (strcmp(opt + 1, "dither")) {
+        mp_msg(MSGT_AFILTER, MSGL_ERR, "[format] Unknown option %s\n", opt + 1);
+        return AF_ERROR;
+      }
+      s->dither = 1;
+      *opt = '\0';
+    }
     int format = af_str2fmt_short(bstr0(arg));
     if (format == -1) {
       mp_msg(MSGT_AFILTER, MSGL_ERR, "[format] %s is not a valid format\n", (char *)arg);
@@ -170,22 +229,46 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 // Deallocate memory
 static void uninit(struct af_instance_s* af)
 {
+  af_format_t* s = af->setup;
   if (af->data)
       free(af->data->audio);
   free(af->data);
+  if (s)
+      free(s->buf);
+  free(s);
   af->setup = 0;
 }
 
-static af_data_t* play_swapendian(struct af_instance_s* af, af_data_t* data)
+// Make sure the layout conversion buffer can hold len bytes
+static void* layout_buffer(struct af_instance_s* af, int len)
+{
+  af_format_t* s = af->setup;
+  if (s->len < len) {
+    free(s->buf);
+    s->buf = malloc(len);
+    if (!s->buf) {
+      mp_msg(MSGT_AFILTER, MSGL_FATAL, "[format] Could not allocate memory\n");
+      s->len = 0;
+      return NULL;
+    }
+    s->len = len;
+  }
+  return s->buf;
+}
+
+static af_data_t* play_layout(struct af_instance_s* af, af_data_t* data)
 {
   af_data_t*   l   = af->data;	// Local data
   af_data_t*   c   = data;	// Current working data
-  int 	       len = c->len/c->bps; // Length in samples of current audio block
+  int 	       samples = c->len/4/c->nch; // Samples per channel
 
   if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
     return NULL;
 
-  endian(c->audio,l->audio,len,c->bps);
+  if (AF_FORMAT_IS_PLANAR(l->format))
+    af_deinterleave_32(c->audio, l->audio, c->nch, samples);
+  else
+    af_interleave_32(c->audio, l->audio, c->nch, samples);
 
   c->audio = l->audio;
   c->format = l->format;
@@ -193,18 +276,65 @@ static af_data_t* play_swapendian(struct af_instance_s* af, af_data_t* data)
   return c;
 }
 
+// Generic conversion combined with a layout change
+static af_data_t* play_planar(struct af_instance_s* af, af_data_t* data)
+{
+  af_data_t*   l   = af->data;	// Local data
+  af_data_t*   c   = data;	// Current working data
+  int 	       nch = c->nch;
+
+  if (AF_FORMAT_IS_PLANAR(c->format)) {
+    void* buf = layout_buffer(af, c->len);
+    if (!buf)
+      return NULL;
+    af_interleave_32(c->audio, buf, nch, c->len/4/nch);
+    c->audio = buf;
+    c->format &= ~AF_FORMAT_PLANAR;
+  }
+  if (!play(af, c))
+    return NULL;
+  if (AF_FORMAT_IS_PLANAR(l->format)) {
+    void* buf = layout_buffer(af, c->len);
+    if (!buf)
+      return NULL;
+    af_deinterleave_32(c->audio, buf, nch, c->len/4/nch);
+    c->audio = buf;
+  }
+  return c;
+}
+
+static af_data_t* play_swapendian(struct af_instance_s* af, af_data_t* data)
+{
+  af_data_t*   l   = af->data;	// Local data
+  af_data_t*   c   = data;	// Current working data
+  int 	       len = c->len/c->bps; // Length in samples of current audio block
+
+  // Swap in place, the input buffer is not needed anymore
+  endian(c->audio,c->audio,len,c->bps);
+
+  c->format = l->format;
+
+  return c;
+}
+
+// Float to 16 bit, with dithering if requested
+static void float2s16(af_format_t* s, float* in, int16_t* out, int len)
+{
+  if (s->dither)
+    af_float_to_s16_dither(in, out, len, &s->seed);
+  else
+    af_float_to_s16(in, out, len);
+}
+
 static af_data_t* play_float_s16(struct af_instance_s* af, af_data_t* data)
 {
   af_data_t*   l   = af->data;	// Local data
   af_data_t*   c   = data;	// Current working data
   int 	       len = c->len/4; // Length in samples of current audio block
 
-  if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
-    return NULL;
-
-  float2int(c->audio, l->audio, len, 2);
+  // The output is smaller than the input, so convert in place
+  float2s16(af->setup, c->audio, c->audio, len);
 
-  c->audio = l->audio;
   c->len = len*2;
   c->bps = 2;
   c->format = l->format;
@@ -221,7 +351,7 @@ static af_data_t* play_s16_float(struct af_instance_s* af, af_data_t* data)
   if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
     return NULL;
 
-  int2float(c->audio, l->audio, len, 2);
+  af_s16_to_float(c->audio, l->audio, len);
 
   c->audio = l->audio;
   c->len = len*4;
@@ -231,6 +361,53 @@ static af_data_t* play_s16_float(struct af_instance_s* af, af_data_t* data)
   return c;
 }
 
+static af_data_t* play_s16_floatp(struct af_instance_s* af, af_data_t* data)
+{
+  af_data_t*   l   = af->data;	// Local data
+  af_data_t*   c   = data;	// Current working data
+  int	       nch = c->nch;
+  int 	       samples = c->len/2/nch; // Samples per channel
+
+  float*       buf = layout_buffer(af, samples*nch*4);
+
+  if(!buf || AF_OK != RESIZE_LOCAL_BUFFER(af,data))
+    return NULL;
+
+  // Two vectorized passes are faster than one strided scalar pass
+  af_s16_to_float(c->audio, buf, samples*nch);
+  af_deinterleave_32((uint32_t*)buf, l->audio, nch, samples);
+
+  c->audio = l->audio;
+  c->len = samples*nch*4;
+  c->bps = 4;
+  c->format = l->format;
+
+  return c;
+}
+
+static af_data_t* play_floatp_s16(struct af_instance_s* af, af_data_t* data)
+{
+  af_data_t*   l   = af->data;	// Local data
+  af_data_t*   c   = data;	// Current working data
+  int	       nch = c->nch;
+  int 	       samples = c->len/4/nch; // Samples per channel
+
+  float*       buf = layout_buffer(af, samples*nch*4);
+
+  if(!buf || AF_OK != RESIZE_LOCAL_BUFFER(af,data))
+    return NULL;
+
+  af_interleave_32(c->audio, (uint32_t*)buf, nch, samples);
+  float2s16(af->setup, buf, l->audio, samples*nch);
+
+  c->audio = l->audio;
+  c->len = samples*nch*2;
+  c->bps = 2;
+  c->format = l->format;
+
+  return c;
+}
+
 // Filter data through filter
 static af_data_t* play(struct af_instance_s* af, af_data_t* data)
 {
@@ -267,7 +444,15 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
       to_alaw(c->audio, l->audio, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
       break;
     default:
-      float2int(c->audio, l->audio, len, l->bps);
+      // Only endianness or layout differ (handled around this function)
+      if((l->format&AF_FORMAT_POINT_MASK) == AF_FORMAT_F){
+	fast_memcpy(l->audio,c->audio,len*c->bps);
+	break;
+      }
+      if(l->bps == 2)
+	float2s16(af->setup, c->audio, l->audio, len);
+      else
+	float2int(c->audio, l->audio, len, l->bps);
       if((l->format&AF_FORMAT_SIGN_MASK) == AF_FORMAT_US)
 	si2us(l->audio,len,l->bps);
       break;
@@ -319,7 +504,8 @@ static int af_open(af_instance_t* af){
   af->play=play;
   af->mul=1;
   af->data=calloc(1,sizeof(af_data_t));
-  if(af->data == NULL)
+  af->setup=calloc(1,sizeof(af_format_t));
+  if(af->data == NULL || af->setup == NULL)
     return AF_ERROR;
   return AF_OK;
 }
@@ -482,16 +668,13 @@ static void float2int(float* in, void* out, int len, int bps)
       ((int8_t*)out)[i] = lrintf(127.0 * clamp(in[i], -1.0f, +1.0f));
     break;
   case(2):
-    for(i=0;i<len;i++)
-      ((int16_t*)out)[i] = lrintf(32767.0 * clamp(in[i], -1.0f, +1.0f));
+    af_float_to_s16(in, out, len);
     break;
   case(3):
-    for(i=0;i<len;i++)
-      store24bit(out, i, lrintf(2147483647.0 * clamp(in[i], -1.0f, +1.0f)));
+    af_float_to_s24(in, out, len);
     break;
   case(4):
-    for(i=0;i<len;i++)
-      ((int32_t*)out)[i] = lrintf(2147483647.0 * clamp(in[i], -1.0f, +1.0f));
+    af_float_to_s32(in, out, len);
     break;
   }
 }
@@ -505,16 +688,149 @@ static void int2float(void* in, float* out, int len, int bps)
       out[i]=(1.0/128.0)*((int8_t*)in)[i];
     break;
   case(2):
-    for(i=0;i<len;i++)
-      out[i]=(1.0/32768.0)*((int16_t*)in)[i];
+    af_s16_to_float(in, out, len);
     break;
   case(3):
-    for(i=0;i<len;i++)
-      out[i]=(1.0/2147483648.0)*((int32_t)load24bit(in, i));
+    af_s24_to_float(in, out, len);
     break;
   case(4):
-    for(i=0;i<len;i++)
-      out[i]=(1.0/2147483648.0)*((int32_t*)in)[i];
+    af_s32_to_float(in, out, len);
     break;
   }
 }
+
+
+#ifdef TEST
+
+/* Runs a 7.1 s16 -> volume -> equalizer -> s16 chain with the filters in
+   between working on interleaved and on planar float. The rest of libaf is
+   built without -DTEST:
+
+     gcc -O2 -DTEST -c libaf/af_format.c
+     gcc -O2 af_format.o libaf/af_volume.c libaf/af_equalizer.c \
+         libaf/filter.c libaf/window.c libaf/af_tools.c libaf/convert.c \
+         libaf/format.c bstr.c talloc.c -lm
+*/
+
+#include <time.h>
+
+CpuCaps gCpuCaps;
+
+// Stand-ins for the parts of the player the filters use
+void mp_msg(int mod, int lev, const char *format, ...)
+{
+}
+
+int af_lencalc(double mul, af_data_t* d)
+{
+  return d->len * mul + d->bps * d->nch + 1;
+}
+
+int af_resize_local_buffer(af_instance_t* af, af_data_t* data)
+{
+  int len = af_lencalc(af->mul, data);
+  free(af->data->audio);
+  af->data->audio = malloc(len);
+  af->data->len = len;
+  return af->data->audio ? AF_OK : AF_ERROR;
+}
+
+extern af_info_t af_info_volume;
+extern af_info_t af_info_equalizer;
+
+#define RATE    48000
+#define NCH     8
+#define SECONDS 20
+#define FILTERS 4
+
+/* Play SECONDS of audio in 0.1 second chunks. speed receives the
+   throughput of each filter and of the whole chain in multiples of
+   realtime, out the s16 output. */
+static void run_chain(int format, double* speed, int16_t* out)
+{
+  af_instance_t f[FILTERS] = {
+    {.info = &af_info_format},
+    {.info = &af_info_volume},
+    {.info = &af_info_equalizer},
+    {.info = &af_info_format},
+  };
+  af_cfg_t cfg = {.force = AF_INIT_FLOAT};
+  af_data_t in = {.rate = RATE, .nch = NCH, .format = AF_FORMAT_S16_NE,
+                  .bps = 2};
+  float vol[AF_NCH], gain[10] = {3, 2, 1, 0, -1, -2, -1, 0, 1, 2};
+  int chunk = RATE / 10 * NCH;
+  int16_t* buf = malloc(chunk * 2);
+  int s16 = AF_FORMAT_S16_NE;
+  clock_t cpu[FILTERS] = {0}, total = 0;
+  int i, n;
+
+  for (i = 0; i < FILTERS; i++)
+    f[i].info->open(&f[i]);
+  f[1].control(&f[1], AF_CONTROL_POST_CREATE, &cfg);
+  for (i = 0; i < AF_NCH; i++)
+    vol[i] = -3;
+  f[1].control(&f[1], AF_CONTROL_VOLUME_LEVEL | AF_CONTROL_SET, vol);
+  for (i = 0; i < NCH; i++) {
+    af_control_ext_t ext = {.arg = gain, .ch = i};
+    f[2].control(&f[2], AF_CONTROL_EQUALIZER_GAIN | AF_CONTROL_SET, &ext);
+  }
+
+  // Configure the chain the way af_reinit() does
+  f[0].control(&f[0], AF_CONTROL_FORMAT_FMT | AF_CONTROL_SET, &format);
+  f[3].control(&f[3], AF_CONTROL_FORMAT_FMT | AF_CONTROL_SET, &s16);
+  for (i = 0; i < FILTERS; i++) {
+    af_data_t d = i ? *f[i - 1].data : in;
+    f[i].control(&f[i], AF_CONTROL_REINIT, &d);
+  }
+
+  for (n = 0; n < SECONDS * 10; n++) {
+    af_data_t c = in;
+    for (i = 0; i < chunk; i++) {
+      double t = (double)(n * chunk + i) / NCH / RATE;
+      buf[i] = 16000 * sin(2 * M_PI * (100 + 200 * (i % NCH)) * t);
+    }
+    c.audio = buf;
+    c.len = chunk * 2;
+    for (i = 0; i < FILTERS; i++) {
+      clock_t start = clock();
+      f[i].play(&f[i], &c);
+      cpu[i] += clock() - start;
+    }
+    memcpy(out + n * chunk, c.audio, c.len);
+  }
+  for (i = 0; i < FILTERS; i++)
+    f[i].uninit(&f[i]);
+  free(buf);
+  for (i = 0; i < FILTERS; i++) {
+    speed[i] = SECONDS / ((double)cpu[i] / CLOCKS_PER_SEC);
+    total += cpu[i];
+  }
+  speed[FILTERS] = SECONDS / ((double)total / CLOCKS_PER_SEC);
+}
+
+int main(void)
+{
+  int16_t* out_il = malloc(SECONDS * RATE * NCH * 2);
+  int16_t* out_pl = malloc(SECONDS * RATE * NCH * 2);
+  static const char* names[FILTERS + 1] = {
+    "s16 -> float", "volume", "equalizer", "float -> s16", "whole chain"
+  };
+  double il[FILTERS + 1], pl[FILTERS + 1];
+  int i;
+
+  gCpuCaps.hasSSE = HAVE_SSE;
+  gCpuCaps.hasSSE2 = HAVE_SSE2;
+  run_chain(AF_FORMAT_FLOAT_NE, il, out_il);
+  run_chain(AF_FORMAT_FLOATP, pl, out_pl);
+  printf("7.1 48 kHz, multiples of realtime\n");
+  for (i = 0; i <= FILTERS; i++)
+    printf("%-12s interleaved %6.0fx  planar %6.0fx\n", names[i], il[i],
+           pl[i]);
+  printf("%s\n", memcmp(out_il, out_pl, SECONDS * RATE * NCH * 2)
+                 ? "output differs" : "same output");
+  free(out_il);
+  free(out_pl);
+  return 0;
+}
+
+#endif
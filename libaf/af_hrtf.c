@@ -68,6 +68,7 @@ typedef struct af_hrtf_s {
     /* Cyclic position on the ring buffer */
     int cyc_pos;
     int print_flag;
+    af_dot_product_t dot_product;
 } af_hrtf_t;
 
 /* Convolution on a ring buffer
@@ -77,17 +78,17 @@ typedef struct af_hrtf_s {
  *    sk:	convolution kernel
  *    offset:	offset on the ring buffer, can be
  */
-static float conv(const int nx, const int nk, const float *sx, const float *sk,
-		  const int offset)
+static float conv(af_dot_product_t dot, const int nx, const int nk,
+		  const float *sx, const float *sk, const int offset)
 {
     /* k = reminder of offset / nx */
     int k = offset >= 0 ? offset % nx : nx + (offset % nx);
 
     if(nk + k <= nx)
-	return af_filter_fir(nk, sx + k, sk);
+	return af_filter_fir(dot, nk, sx + k, sk);
     else
-	return af_filter_fir(nk + k - nx, sx, sk + nx - k) +
-	    af_filter_fir(nx - k, sx + k, sk);
+	return af_filter_fir(dot, nk + k - nx, sx, sk + nx - k) +
+	    af_filter_fir(dot, nx - k, sx + k, sk);
 }
 
 /* Detect when the impulse response starts (significantly) */
@@ -315,6 +316,7 @@ static int control(struct af_instance_s *af, int cmd, void* arg)
 	// after testing input set the real output format
 	af->data->nch = 2;
 	s->print_flag = 1;
+	s->dot_product = af_get_dot_product();
 	return test_output_res;
     case AF_CONTROL_COMMAND_LINE:
 	sscanf((char*)arg, "%c", &mode);
@@ -388,6 +390,7 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
     short *end = in + data->len / sizeof(short); // Loop end
     float common, left, right, diff, left_b, right_b;
     const int dblen = s->dlbuflen, hlen = s->hrflen, blen = s->basslen;
+    af_dot_product_t dot = s->dot_product;
 
     if(AF_OK != RESIZE_LOCAL_BUFFER(af, data))
 	return NULL;
@@ -459,7 +462,7 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
 	case HRTF_MIX_51:
 	case HRTF_MIX_MATRIX2CH:
 	   /* Mixer filter matrix */
-	   common = conv(dblen, hlen, s->cf, s->cf_ir, k + s->cf_o);
+	   common = conv(dot, dblen, hlen, s->cf, s->cf_ir, k + s->cf_o);
 	   if(s->matrix_mode) {
 	      /* In matrix decoding mode, the rear channel gain must be
 		 renormalized, as there is an additional channel. */
@@ -470,42 +473,42 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
 			    &(s->adapt_lrprr_gain), &(s->adapt_lrmrr_gain),
 			    s->lr, s->rr, NULL, NULL, s->cr);
 	      common +=
-		 conv(dblen, hlen, s->cr, s->cr_ir, k + s->cr_o) *
+		 conv(dot, dblen, hlen, s->cr, s->cr_ir, k + s->cr_o) *
 		 M1_76DB;
 	      left    =
-		 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-		   (conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-		    conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o)) *
+		 ( conv(dot, dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
+		   conv(dot, dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
+		   (conv(dot, dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
+		    conv(dot, dblen, hlen, s->rr, s->or_ir, k + s->or_o)) *
 		   M1_76DB + common);
 	      right   =
-		 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-		   (conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-		    conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o)) *
+		 ( conv(dot, dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
+		   conv(dot, dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
+		   (conv(dot, dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
+		    conv(dot, dblen, hlen, s->lr, s->or_ir, k + s->or_o)) *
 		   M1_76DB + common);
 	   } else {
 	      left    =
-		 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-		   conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-		   conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o) +
+		 ( conv(dot, dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
+		   conv(dot, dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
+		   conv(dot, dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
+		   conv(dot, dblen, hlen, s->rr, s->or_ir, k + s->or_o) +
 		   common);
 	      right   =
-		 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-		   conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-		   conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o) +
+		 ( conv(dot, dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
+		   conv(dot, dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
+		   conv(dot, dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
+		   conv(dot, dblen, hlen, s->lr, s->or_ir, k + s->or_o) +
 		   common);
 	   }
 	   break;
 	case HRTF_MIX_STEREO:
 	   left    =
-	      ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o));
+	      ( conv(dot, dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
+		conv(dot, dblen, hlen, s->rf, s->of_ir, k + s->of_o));
 	   right   =
-	      ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o));
+	      ( conv(dot, dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
+		conv(dot, dblen, hlen, s->lf, s->of_ir, k + s->of_o));
 	   break;
 	default:
 	    /* make gcc happy */
@@ -520,8 +523,8 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
 	   The bass will not have any real 3D perception, but that is
 	   OK (note at 180 Hz, the wavelength is about 2 m, and any
 	   spatial perception is impossible). */
-	left_b  = conv(dblen, blen, s->ba_l, s->ba_ir, k);
-	right_b = conv(dblen, blen, s->ba_r, s->ba_ir, k);
+	left_b  = conv(dot, dblen, blen, s->ba_l, s->ba_ir, k);
+	right_b = conv(dot, dblen, blen, s->ba_r, s->ba_ir, k);
 	left  += (1 - BASSCROSS) * left_b  + BASSCROSS * right_b;
 	right += (1 - BASSCROSS) * right_b + BASSCROSS * left_b;
 	/* Also mix the LFE channel (if available) */
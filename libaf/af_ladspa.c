@@ -36,16 +36,32 @@
 #include <dlfcn.h>
 #include <ladspa.h>
 
+#include "config.h"
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 /* ------------------------------------------------------------------------- */
 
 /* Local Includes */
 
 #include "af.h"
+#include "convert.h"
+#include "osdep/timer.h"
 
 /* ------------------------------------------------------------------------- */
 
 /* Filter specific data */
 
+struct af_ladspa_worker {
+    struct af_ladspa_s *setup;
+    int index;              /**< instance run by this thread */
+    LADSPA_Handle handle;
+#if HAVE_PTHREADS
+    pthread_t thread;
+#endif
+};
+
 typedef struct af_ladspa_s
 {
     int status;     /**< Status of the filter.
@@ -56,11 +72,6 @@ typedef struct af_ladspa_s
                      *   the data unchanged.
                      */
 
-    int activated;  /**< 0 or 1. Activate LADSPA filters only once, even
-                     *   if the buffers get resized, to avoid a stuttering
-                     *   filter.
-                     */
-
     char *file;
     char *label;
 
@@ -86,10 +97,33 @@ typedef struct af_ladspa_s
     float *outputcontrols;
 
     int nch;                /**< number of channels */
-    int bufsize;
-    float **inbufs;
-    float **outbufs;
+    int rate;
+    int bufsize;            /**< samples of inbuf/outbuf, all channels */
+    float *inbuf;           /**< planar copy of interleaved input */
+    float *outbuf;          /**< planar output */
     LADSPA_Handle *chhandles;
+    int ninstances;
+
+    /* statistics */
+    int64_t *instance_time; /**< per instance, in ns */
+    int64_t samples;        /**< samples per channel processed */
+    int blocks;             /**< to decide whether to use threads */
+    int64_t block_time;
+    int64_t block_samples;
+
+    /* worker threads, see af_ladspa_run() */
+    struct af_ladspa_worker *workers;
+    int nworkers;
+    int threads_failed;
+#if HAVE_PTHREADS
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;  /**< new block, or quit */
+    pthread_cond_t done;    /**< all workers finished the block */
+    int generation;         /**< incremented for every block */
+    int run_samples;
+    int pending;            /**< workers still running the block */
+    int quit;
+#endif
 
 } af_ladspa_t;
 
@@ -97,6 +131,7 @@ typedef struct af_ladspa_s
 
 static int af_open(af_instance_t *af);
 static int af_ladspa_malloc_failed(char*);
+static void af_ladspa_free_handles(af_ladspa_t *setup);
 
 /* ------------------------------------------------------------------------- */
 
@@ -107,7 +142,7 @@ af_info_t af_info_ladspa = {
     "ladspa",
     "Ivo van Poorten",
     "",
-    AF_FLAGS_REENTRANT,
+    AF_FLAGS_REENTRANT | AF_FLAGS_PLANAR,
     af_open
 };
 
@@ -496,11 +531,14 @@ static int control(struct af_instance_s *af, int cmd, void *arg) {
 
         if (!arg) return AF_ERROR;
 
-        /* accept FLOAT, let af_format do conversion */
+        /* accept FLOAT in either layout, let af_format do conversion */
 
         af->data->rate   = ((af_data_t*)arg)->rate;
         af->data->nch    = ((af_data_t*)arg)->nch;
-        af->data->format = AF_FORMAT_FLOAT_NE;
+        if (((af_data_t*)arg)->format == AF_FORMAT_FLOATP)
+            af->data->format = AF_FORMAT_FLOATP;
+        else
+            af->data->format = AF_FORMAT_FLOAT_NE;
         af->data->bps    = 4;
 
         /* arg->len is not set here yet, so init of buffers and connecting the
@@ -651,25 +689,15 @@ static int control(struct af_instance_s *af, int cmd, void *arg) {
  */
 
 static void uninit(struct af_instance_s *af) {
-    int i;
-
     free(af->data);
     if (af->setup) {
         af_ladspa_t *setup = (af_ladspa_t*) af->setup;
-        const LADSPA_Descriptor *pdes = setup->plugin_descriptor;
 
-        if (setup->myname) {
+        if (setup->myname)
             mp_msg(MSGT_AFILTER, MSGL_V, "%s: cleaning up\n", setup->myname);
-            free(setup->myname);
-        }
 
-        if (setup->chhandles) {
-            for(i=0; i<setup->nch; i+=setup->ninputs) {
-                if (pdes->deactivate) pdes->deactivate(setup->chhandles[i]);
-                if (pdes->cleanup) pdes->cleanup(setup->chhandles[i]);
-            }
-            free(setup->chhandles);
-        }
+        af_ladspa_free_handles(setup);
+        free(setup->myname);
 
         free(setup->file);
         free(setup->label);
@@ -680,17 +708,8 @@ static void uninit(struct af_instance_s *af) {
         free(setup->inputs);
         free(setup->outputs);
 
-        if (setup->inbufs) {
-            for(i=0; i<setup->nch; i++)
-                free(setup->inbufs[i]);
-            free(setup->inbufs);
-        }
-
-        if (setup->outbufs) {
-            for(i=0; i<setup->nch; i++)
-                free(setup->outbufs[i]);
-            free(setup->outbufs);
-        }
+        free(setup->inbuf);
+        free(setup->outbuf);
 
         if (setup->libhandle)
             dlclose(setup->libhandle);
@@ -702,173 +721,367 @@ static void uninit(struct af_instance_s *af) {
 
 /* ------------------------------------------------------------------------- */
 
-/** \brief Process chunk of audio data through the selected LADSPA Plugin.
- *
- * \param af    Pointer to audio filter instance
- * \param data  Pointer to chunk of audio data
+/** \brief Print the time spent in the plugin instances.
+ */
+
+static void af_ladspa_print_stats(af_ladspa_t *setup) {
+    int64_t total = 0;
+    int i;
+
+    if (!setup->samples || !setup->instance_time)
+        return;
+    double realtime = setup->samples * 1e9 / setup->rate;
+    for (i=0; i<setup->ninstances; i++)
+        total += setup->instance_time[i];
+    mp_msg(MSGT_AFILTER, MSGL_V, "%s: plugin time %.3f s, %.2f%% of realtime "
+           "(%d instances%s)\n", setup->myname, total * 1e-9,
+           100 * total / realtime, setup->ninstances,
+           setup->nworkers ? ", threaded" : "");
+    for (i=0; i<setup->ninstances && setup->ninstances > 1; i++)
+        mp_msg(MSGT_AFILTER, MSGL_V, "%s:   instance %d: %.2f%%\n",
+               setup->myname, i, 100 * setup->instance_time[i] / realtime);
+}
+
+/* ------------------------------------------------------------------------- */
+
+#if HAVE_PTHREADS
+static void af_ladspa_stop_workers(af_ladspa_t *setup) {
+    int i;
+
+    if (!setup->workers)
+        return;
+    pthread_mutex_lock(&setup->lock);
+    setup->quit = 1;
+    pthread_cond_broadcast(&setup->wakeup);
+    pthread_mutex_unlock(&setup->lock);
+    for (i=0; i<setup->nworkers; i++)
+        pthread_join(setup->workers[i].thread, NULL);
+    pthread_mutex_destroy(&setup->lock);
+    pthread_cond_destroy(&setup->wakeup);
+    pthread_cond_destroy(&setup->done);
+    free(setup->workers);
+    setup->workers = NULL;
+    setup->nworkers = 0;
+    setup->quit = 0;
+    /* new workers start waiting for generation 1 */
+    setup->generation = 0;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+/** \brief Destroy the plugin instances.
  *
- * \return      Either AF_ERROR or AF_OK
+ * Stops the worker threads first, since they hold the handles.
  */
 
-static af_data_t* play(struct af_instance_s *af, af_data_t *data) {
-    af_ladspa_t *setup = af->setup;
+static void af_ladspa_free_handles(af_ladspa_t *setup) {
     const LADSPA_Descriptor *pdes = setup->plugin_descriptor;
-    float *audio = (float*)data->audio;
-    int nsamples = data->len/4; /* /4 because it's 32-bit float */
-    int nch = data->nch;
-    int rate = data->rate;
-    int i, p;
+    int i;
 
-    if (setup->status !=AF_OK)
-        return data;
+    af_ladspa_print_stats(setup);
+#if HAVE_PTHREADS
+    af_ladspa_stop_workers(setup);
+#endif
 
-    /* See if it's the first call. If so, setup inbufs/outbufs, instantiate
-     * plugin, connect ports and activate plugin
-     */
+    if (setup->chhandles) {
+        for(i=0; i<setup->nch; i+=setup->ninputs) {
+            if (pdes->deactivate) pdes->deactivate(setup->chhandles[i]);
+            if (pdes->cleanup) pdes->cleanup(setup->chhandles[i]);
+        }
+        free(setup->chhandles);
+        setup->chhandles = NULL;
+    }
+    free(setup->instance_time);
+    setup->instance_time = NULL;
+}
 
-    /* 2004-12-07: Also check if the buffersize has to be changed!
-     *             data->len is not constant per se! re-init buffers.
-     */
+/* ------------------------------------------------------------------------- */
 
-    if ( (setup->bufsize != nsamples/nch) || (setup->nch != nch) ) {
+/** \brief Create, connect and activate the plugin instances.
+ *
+ * One instance is created per channel, or per pair of channels for stereo
+ * effects. The audio ports are connected in play(), because the buffers
+ * can move between calls.
+ *
+ * \return  Either AF_ERROR or AF_OK
+ */
 
-        /* if setup->nch==0, it's the first call, if not, something has
-         * changed and all previous mallocs have to be freed
-         */
+static int af_ladspa_create_handles(af_ladspa_t *setup, int nch, int rate) {
+    const LADSPA_Descriptor *pdes = setup->plugin_descriptor;
+    int i, p;
 
-        if (setup->nch != 0) {
-            mp_msg(MSGT_AFILTER, MSGL_DBG3, "%s: bufsize change; free old buffer\n",
-                                                                setup->myname);
+    setup->nch = nch;
+    setup->rate = rate;
+    setup->ninstances = (nch + setup->ninputs - 1) / setup->ninputs;
+    setup->chhandles = calloc(nch, sizeof(LADSPA_Handle));
+    setup->instance_time = calloc(setup->ninstances, sizeof(int64_t));
+    if (!setup->chhandles || !setup->instance_time) {
+        setup->nch = 0;
+        return af_ladspa_malloc_failed(setup->myname);
+    }
 
-            if(setup->inbufs) {
-                for(i=0; i<setup->nch; i++)
-                    free(setup->inbufs[i]);
-                free(setup->inbufs);
-            }
-            if(setup->outbufs) {
-                for(i=0; i<setup->nch; i++)
-                    free(setup->outbufs[i]);
-                free(setup->outbufs);
+    for(i=0; i<nch; i++) {
+        if (i % setup->ninputs) { /* stereo effect */
+            /* copy the handle from previous channel */
+            setup->chhandles[i] = setup->chhandles[i-1];
+            continue;
+        }
+
+        setup->chhandles[i] = pdes->instantiate(pdes, rate);
+        if (!setup->chhandles[i]) {
+            mp_msg(MSGT_AFILTER, MSGL_ERR, "%s: could not instantiate "
+                                           "plugin\n", setup->myname);
+            setup->nch = i;
+            return AF_ERROR;
+        }
+
+        /* connect controls */
+
+        for (p=0; p<setup->nports; p++) {
+            LADSPA_PortDescriptor d = pdes->PortDescriptors[p];
+            if (LADSPA_IS_PORT_CONTROL(d)) {
+                if (LADSPA_IS_PORT_INPUT(d)) {
+                    pdes->connect_port(setup->chhandles[i], p,
+                                            &(setup->inputcontrols[p]) );
+                } else {
+                    pdes->connect_port(setup->chhandles[i], p,
+                                            &(setup->outputcontrols[p]) );
+                }
             }
-        } /* everything is freed */
+        }
 
-        setup->bufsize = nsamples/nch;
-        setup->nch = nch;
+        if (pdes->activate)
+            pdes->activate(setup->chhandles[i]);
+    }
+    setup->samples = 0;
+    setup->blocks = 0;
+    setup->block_time = 0;
+    setup->block_samples = 0;
+    return AF_OK;
+}
 
-        setup->inbufs = calloc(nch, sizeof(float*));
-        setup->outbufs = calloc(nch, sizeof(float*));
+/* ------------------------------------------------------------------------- */
 
-        mp_msg(MSGT_AFILTER, MSGL_DBG3, "%s: bufsize = %d\n",
-                                        setup->myname, setup->bufsize);
+#if HAVE_PTHREADS
+/* Plugin instances of different channels do not share any state, so heavy
+ * plugins run one instance per worker thread. Instance 0 always runs on the
+ * calling thread.
+ */
 
-        for(i=0; i<nch; i++) {
-            setup->inbufs[i] = calloc(setup->bufsize, sizeof(float));
-            setup->outbufs[i] = calloc(setup->bufsize, sizeof(float));
-        }
+static void *af_ladspa_worker(void *arg) {
+    struct af_ladspa_worker *w = arg;
+    af_ladspa_t *setup = w->setup;
+    const LADSPA_Descriptor *pdes = setup->plugin_descriptor;
+    int generation = 0;
+
+    pthread_mutex_lock(&setup->lock);
+    while (1) {
+        while (setup->generation == generation && !setup->quit)
+            pthread_cond_wait(&setup->wakeup, &setup->lock);
+        if (setup->quit)
+            break;
+        generation = setup->generation;
+        int nsamples = setup->run_samples;
+        pthread_mutex_unlock(&setup->lock);
+
+        int64_t t = mp_time_ns();
+        pdes->run(w->handle, nsamples);
+        t = mp_time_ns() - t;
+
+        pthread_mutex_lock(&setup->lock);
+        setup->instance_time[w->index] += t;
+        if (--setup->pending == 0)
+            pthread_cond_signal(&setup->done);
+    }
+    pthread_mutex_unlock(&setup->lock);
+    return NULL;
+}
 
-        /* only on the first call, there are no handles. */
+static void af_ladspa_start_workers(af_ladspa_t *setup) {
+    int n = setup->ninstances - 1;
+    int i;
 
-        if (!setup->chhandles) {
-            setup->chhandles = calloc(nch, sizeof(LADSPA_Handle));
+    setup->workers = calloc(n, sizeof(*setup->workers));
+    if (!setup->workers)
+        return;
+    pthread_mutex_init(&setup->lock, NULL);
+    pthread_cond_init(&setup->wakeup, NULL);
+    pthread_cond_init(&setup->done, NULL);
+    for (i=0; i<n; i++) {
+        struct af_ladspa_worker *w = &setup->workers[i];
+        w->setup = setup;
+        w->index = i + 1;
+        w->handle = setup->chhandles[w->index * setup->ninputs];
+        if (pthread_create(&w->thread, NULL, af_ladspa_worker, w))
+            break;
+        setup->nworkers++;
+    }
+    if (setup->nworkers < n) {
+        /* run everything on the calling thread again */
+        mp_msg(MSGT_AFILTER, MSGL_WARN, "%s: could not start worker "
+                                        "threads\n", setup->myname);
+        af_ladspa_stop_workers(setup);
+        setup->threads_failed = 1;
+        return;
+    }
+    mp_msg(MSGT_AFILTER, MSGL_V, "%s: running %d instances in parallel\n",
+                                 setup->myname, setup->ninstances);
+}
+#endif
 
-            /* create handles
-             * for stereo effects, create one handle for two channels
-             */
+/* ------------------------------------------------------------------------- */
 
-            for(i=0; i<nch; i++) {
+/** \brief Run all plugin instances on one block of audio.
+ *
+ * Also measures the time spent in the plugin. If it is a significant part
+ * of the duration of the audio, the instances are moved to threads.
+ */
 
-                if (i % setup->ninputs) { /* stereo effect */
-                    /* copy the handle from previous channel */
-                    setup->chhandles[i] = setup->chhandles[i-1];
-                    continue;
-                }
+static void af_ladspa_run(af_ladspa_t *setup, int nsamples) {
+    const LADSPA_Descriptor *pdes = setup->plugin_descriptor;
+    int64_t start = mp_time_ns();
+    int i;
 
-                setup->chhandles[i] = pdes->instantiate(pdes, rate);
-            }
-        }
+#if HAVE_PTHREADS
+    if (setup->nworkers) {
+        pthread_mutex_lock(&setup->lock);
+        setup->run_samples = nsamples;
+        setup->pending = setup->nworkers;
+        setup->generation++;
+        pthread_cond_broadcast(&setup->wakeup);
+        pthread_mutex_unlock(&setup->lock);
+
+        pdes->run(setup->chhandles[0], nsamples);
+        setup->instance_time[0] += mp_time_ns() - start;
+
+        pthread_mutex_lock(&setup->lock);
+        while (setup->pending)
+            pthread_cond_wait(&setup->done, &setup->lock);
+        pthread_mutex_unlock(&setup->lock);
+        setup->samples += nsamples;
+        return;
+    }
+#endif
 
-        /* connect input/output ports for each channel/filter instance
-         *
-         * always (re)connect ports
-         */
+    for (i=0; i<setup->ninstances; i++) {
+        int64_t t = mp_time_ns();
+        pdes->run(setup->chhandles[i * setup->ninputs], nsamples);
+        setup->instance_time[i] += mp_time_ns() - t;
+    }
+    setup->samples += nsamples;
+
+#if HAVE_PTHREADS
+    /* Decide after a few blocks whether the plugin is heavy enough to be
+     * worth the synchronization: 10% of realtime or more. */
+    setup->block_time += mp_time_ns() - start;
+    setup->block_samples += nsamples;
+    if (setup->ninstances > 1 && !setup->threads_failed &&
+            ++setup->blocks == 16) {
+        double realtime = setup->block_samples * 1e9 / setup->rate;
+        if (setup->block_time > 0.1 * realtime)
+            af_ladspa_start_workers(setup);
+        setup->blocks = 0;
+        setup->block_time = 0;
+        setup->block_samples = 0;
+    }
+#endif
+}
 
-        for(i=0; i<nch; i++) {
-            pdes->connect_port(setup->chhandles[i],
-                               setup->inputs[i % setup->ninputs],
-                               setup->inbufs[i]);
-            pdes->connect_port(setup->chhandles[i],
-                               setup->outputs[i % setup->ninputs],
-                               setup->outbufs[i]);
-
-            /* connect (input) controls */
-
-            for (p=0; p<setup->nports; p++) {
-                LADSPA_PortDescriptor d = pdes->PortDescriptors[p];
-                if (LADSPA_IS_PORT_CONTROL(d)) {
-                    if (LADSPA_IS_PORT_INPUT(d)) {
-                        pdes->connect_port(setup->chhandles[i], p,
-                                                &(setup->inputcontrols[p]) );
-                    } else {
-                        pdes->connect_port(setup->chhandles[i], p,
-                                                &(setup->outputcontrols[p]) );
-                    }
-                }
-            }
+/* ------------------------------------------------------------------------- */
 
-            /* Activate filter (if it isn't already :) ) */
+/** \brief Process chunk of audio data through the selected LADSPA Plugin.
+ *
+ * Planar input is passed to the plugin directly, interleaved input is
+ * split into channels first.
+ *
+ * \param af    Pointer to audio filter instance
+ * \param data  Pointer to chunk of audio data
+ *
+ * \return      Either AF_ERROR or AF_OK
+ */
 
-            if (pdes->activate && !setup->activated && i % setup->ninputs == 0)
-                pdes->activate(setup->chhandles[i]);
+static af_data_t* play(struct af_instance_s *af, af_data_t *data) {
+    af_ladspa_t *setup = af->setup;
+    const LADSPA_Descriptor *pdes = setup->plugin_descriptor;
+    int nch = data->nch;
+    int nsamples = data->len/4/nch; /* per channel, 32-bit float */
+    int planar = AF_FORMAT_IS_PLANAR(data->format);
+    float *in, *out;
+    int i, p;
 
-        } /* All channels/filters done! except for... */
-        setup->activated = 1;
+    if (setup->status !=AF_OK)
+        return data;
 
-        /* Stereo effect with one channel left. Use same buffer for left
-         * and right. connect it to the second port.
-         */
+    /* (re)create the plugin instances on the first call and when the
+     * stream parameters change */
 
-        for (p = i; p % setup->ninputs; p++) {
-            pdes->connect_port(setup->chhandles[i-1],
-                               setup->inputs[p % setup->ninputs],
-                               setup->inbufs[i-1]);
-            pdes->connect_port(setup->chhandles[i-1],
-                               setup->outputs[p % setup->ninputs],
-                               setup->outbufs[i-1]);
-        } /* done! */
-
-    } /* setup for first call/change of bufsize is done.
-       * normal playing routine follows...
-       */
-
-    /* Right now, I use a separate input and output buffer.
-     * I could change this to in-place processing (inbuf==outbuf), but some
-     * ladspa filters are broken and are not able to handle that. This seems
-     * fast enough, so unless somebody complains, it stays this way :)
-     */
+    if (setup->nch != nch || setup->rate != data->rate) {
+        af_ladspa_free_handles(setup);
+        if (af_ladspa_create_handles(setup, nch, data->rate) != AF_OK) {
+            setup->status = AF_ERROR;
+            return data;
+        }
+    }
 
-    /* Fill inbufs */
+    /* data->len is not constant per se, grow the buffers if needed */
 
-    for (p=0; p<setup->bufsize; p++) {
-        for (i=0; i<nch; i++) {
-            setup->inbufs[i][p] = audio[p*nch + i];
+    if (setup->bufsize < nch * nsamples) {
+        mp_msg(MSGT_AFILTER, MSGL_DBG3, "%s: bufsize = %d\n",
+                                        setup->myname, nch * nsamples);
+        free(setup->inbuf);
+        free(setup->outbuf);
+        setup->inbuf = malloc(nch * nsamples * sizeof(float));
+        setup->outbuf = malloc(nch * nsamples * sizeof(float));
+        if (!setup->inbuf || !setup->outbuf) {
+            setup->bufsize = 0;
+            af_ladspa_malloc_failed(setup->myname);
+            return NULL;
         }
+        setup->bufsize = nch * nsamples;
     }
 
-    /* Run filter(s) */
+    /* Use a separate input and output buffer, some ladspa filters are
+     * broken and are not able to handle in-place processing.
+     */
 
-    for (i=0; i<nch; i+=setup->ninputs) {
-        pdes->run(setup->chhandles[i], setup->bufsize);
+    if (planar) {
+        in = data->audio;
+    } else {
+        af_deinterleave_32(data->audio, (uint32_t*)setup->inbuf, nch,
+                           nsamples);
+        in = setup->inbuf;
+    }
+    out = setup->outbuf;
+
+    for(i=0; i<nch; i++) {
+        pdes->connect_port(setup->chhandles[i],
+                           setup->inputs[i % setup->ninputs],
+                           in + i * nsamples);
+        pdes->connect_port(setup->chhandles[i],
+                           setup->outputs[i % setup->ninputs],
+                           out + i * nsamples);
     }
 
-    /* Extract outbufs */
+    /* Stereo effect with one channel left. Use same buffer for left
+     * and right. connect it to the second port.
+     */
 
-    for (p=0; p<setup->bufsize; p++) {
-        for (i=0; i<nch; i++) {
-            audio[p*nch + i] = setup->outbufs[i][p];
-        }
+    for (p = i; p % setup->ninputs; p++) {
+        pdes->connect_port(setup->chhandles[i-1],
+                           setup->inputs[p % setup->ninputs],
+                           in + (i-1) * nsamples);
+        pdes->connect_port(setup->chhandles[i-1],
+                           setup->outputs[p % setup->ninputs],
+                           out + (i-1) * nsamples);
     }
 
-    /* done */
+    af_ladspa_run(setup, nsamples);
+
+    if (planar)
+        data->audio = out;
+    else
+        af_interleave_32((uint32_t*)out, data->audio, nch, nsamples);
 
     return data;
 }
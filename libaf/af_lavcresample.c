@@ -22,18 +22,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include "config.h"
 #include "af.h"
 #include "libavcodec/avcodec.h"
 #include "libavutil/rational.h"
 
+// Output samples over which a ratio change is spread by av_resample
+#define COMPENSATION_DISTANCE (1 << 24)
+
 // Data for specific instances of this filter
 typedef struct af_resample_s{
     struct AVResampleContext *avrctx;
     int16_t *in[AF_NCH];
     int in_alloc;
     int index;
+    double ratio;       // sync correction, see AF_CONTROL_RESAMPLE_RATIO
+    int adaptive;       // ratio was set, stay in the chain at equal rates
 
     int filter_length;
     int linear;
@@ -58,14 +64,14 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 
   switch(cmd){
   case AF_CONTROL_REINIT:
-    if((af->data->rate == data->rate) || (af->data->rate == 0))
+    if((af->data->rate == data->rate && !s->adaptive) || (af->data->rate == 0))
         return AF_DETACH;
 
     af->data->nch    = data->nch;
     if (af->data->nch > AF_NCH) af->data->nch = AF_NCH;
     af->data->format = AF_FORMAT_S16_NE;
     af->data->bps    = 2;
-    af->mul = (double)af->data->rate / data->rate;
+    af->mul = (double)af->data->rate / data->rate / s->ratio;
     af->delay = af->data->nch * s->filter_length / min(af->mul, 1); // *bps*.5
 
     if (s->ctx_out_rate != af->data->rate || s->ctx_in_rate != data->rate || s->ctx_filter_size != s->filter_length ||
@@ -95,6 +101,17 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
   case AF_CONTROL_RESAMPLE_RATE | AF_CONTROL_SET:
     af->data->rate = *(int*)arg;
     return AF_OK;
+  case AF_CONTROL_RESAMPLE_RATIO | AF_CONTROL_SET:
+    if (*(double*)arg <= 0)
+        return AF_ERROR;
+    s->ratio = *(double*)arg;
+    s->adaptive = 1;
+    if (s->ctx_in_rate && s->ctx_out_rate)
+        af->mul = (double)s->ctx_out_rate / s->ctx_in_rate / s->ratio;
+    return AF_OK;
+  case AF_CONTROL_RESAMPLE_RATIO | AF_CONTROL_GET:
+    *(double*)arg = s->ratio;
+    return AF_OK;
   }
   return AF_UNKNOWN;
 }
@@ -157,6 +174,13 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
   }
   in_len += s->index;
 
+  /* Consume the input ratio times faster than nominal. The compensation
+   * is renewed on every call, so it never runs out. */
+  if(s->adaptive)
+      av_resample_compensate(s->avrctx,
+                             lrint((1 - s->ratio) * COMPENSATION_DISTANCE),
+                             COMPENSATION_DISTANCE);
+
   for(i=0; i<chans; i++){
       ret= av_resample(s->avrctx, tmp[i], s->in[i], &consumed, in_len, out_len, i+1 == chans);
   }
@@ -198,6 +222,7 @@ static int af_open(af_instance_t* af){
   s->filter_length= 16;
   s->cutoff= max(1.0 - 6.5/(s->filter_length+8), 0.80);
   s->phase_shift= 10;
+  s->ratio= 1.0;
 //  s->setup = RSMP_INT | FREQ_SLOPPY;
   af->setup=s;
   return AF_OK;
@@ -211,3 +236,92 @@ af_info_t af_info_lavcresample = {
   AF_FLAGS_REENTRANT,
   af_open
 };
+
+
+#ifdef TEST
+
+/* Measures the throughput of play() for common rate conversions. The rest
+   of libaf is built without -DTEST:
+
+     gcc -O2 -DTEST libaf/af_lavcresample.c libaf/af_tools.c \
+         -lavcodec -lavutil -lm
+*/
+
+#include <time.h>
+
+CpuCaps gCpuCaps;
+
+// Stand-ins for the parts of the player the filter uses
+void mp_msg(int mod, int lev, const char *format, ...)
+{
+}
+
+int af_lencalc(double mul, af_data_t* d)
+{
+  return d->len * mul + d->bps * d->nch + 1;
+}
+
+int af_resize_local_buffer(af_instance_t* af, af_data_t* data)
+{
+  int len = af_lencalc(af->mul, data);
+  free(af->data->audio);
+  af->data->audio = malloc(len);
+  af->data->len = len;
+  return af->data->audio ? AF_OK : AF_ERROR;
+}
+
+#define SECONDS 10
+
+/* Resample SECONDS of a sine in 0.1 second chunks. Returns the throughput
+   in multiples of realtime. */
+static double bench(int in_rate, int out_rate, double ratio, int nch)
+{
+  af_instance_t af = {0};
+  af_data_t in = {.rate = in_rate, .nch = nch, .format = AF_FORMAT_S16_NE,
+                  .bps = 2};
+  int chunk = in_rate / 10;
+  int16_t *buf = malloc(chunk * nch * 2);
+  clock_t cpu = 0;
+  int n, i, ch;
+
+  af_open(&af);
+  af.data->rate = out_rate;
+  if (ratio != 1.0)
+    control(&af, AF_CONTROL_RESAMPLE_RATIO | AF_CONTROL_SET, &ratio);
+  control(&af, AF_CONTROL_REINIT, &in);
+
+  for (n = 0; n < SECONDS * 10; n++) {
+    af_data_t d = in;
+    clock_t start;
+    for (i = 0; i < chunk; i++)
+      for (ch = 0; ch < nch; ch++)
+        buf[i * nch + ch] = 16384 * sin(2 * M_PI * (440 + 100 * ch) *
+                                        (n * chunk + i) / in_rate);
+    d.audio = buf;
+    d.len = chunk * nch * 2;
+    start = clock();
+    play(&af, &d);
+    cpu += clock() - start;
+  }
+  uninit(&af);
+  free(buf);
+  return SECONDS / ((double)cpu / CLOCKS_PER_SEC);
+}
+
+int main(void)
+{
+  static const int rates[][2] = {{44100, 48000}, {48000, 44100}};
+  static const int channels[] = {2, 6, 8};
+  int r, c;
+
+  printf("throughput in multiples of realtime\n");
+  for (r = 0; r < 2; r++)
+    for (c = 0; c < 3; c++)
+      printf("%d -> %d %dch %6.0fx\n", rates[r][0], rates[r][1],
+             channels[c], bench(rates[r][0], rates[r][1], 1.0, channels[c]));
+  printf("48000 -> 48000 2ch, ratio 1.001 %6.0fx\n",
+         bench(48000, 48000, 1.001, 2));
+  return 0;
+}
+
+#endif
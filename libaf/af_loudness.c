@@ -0,0 +1,470 @@
+/*
+ * Loudness normalization based on a measurement of the whole file.
+ *
+ * In scan mode the filter measures the integrated loudness (following EBU
+ * R128 / ITU-R BS.1770: K-weighting, 400 ms blocks with 75% overlap,
+ * absolute gate at -70 LUFS and relative gate at -10 LU) and the sample
+ * peak of the audio passing through it, and replaces the audio by a much
+ * shorter piece of silence so that the file is decoded as fast as the output
+ * allows. When the end of the file is reached the result is appended to a
+ * cache file.
+ *
+ * In normal mode the measurement of the file being played is looked up in
+ * the cache, and a constant gain bringing it to the target loudness is
+ * applied. As the gain is known before playback starts there is neither
+ * lookahead nor any adaption of the gain during playback.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "af.h"
+#include "path.h"
+#include "subopt-helper.h"
+
+#define CACHE_FILE "loudness_cache" // relative to ~/.mplayer/
+
+#define DEF_TARGET -18.0  // LUFS
+#define DEF_MAXGAIN 20.0  // dB
+
+// Histogram of block loudness used for gating, 0.1 LU per bin from HIST_MIN
+#define HIST_MIN -70.0
+#define HIST_STEP 0.1
+#define HIST_BINS 800
+
+// Number of 100 ms steps in a 400 ms gating block
+#define BLOCK_STEPS 4
+
+/* In scan mode, this many input samples are replaced by one output sample.
+   Producing no output at all would make the decoder read the whole file in
+   one go. */
+#define SCAN_SPEEDUP 32
+
+typedef struct af_loudness_s
+{
+  // options
+  int scan;
+  float target;
+  float maxgain;
+  int noclip;
+  char* cache;
+
+  char* key;                // file name as stored in the cache
+  long long size;           // file size, -1 if unknown
+  float gain;               // applied gain (linear)
+
+  // measurement
+  /* K-weighting filter, two sections of b0 b1 b2 a1 a2. It is computed in
+     double: the poles of the 38 Hz high pass are so close to 1 that float
+     coefficients misplace its corner at high sample rates. */
+  double kw[2][5];
+  double kw_state[AF_NCH][2][4]; // x[n-1] x[n-2] y[n-1] y[n-2]
+  int scan_frac;            // input samples not yet accounted for in output
+  int rate;                 // format the measurement was set up for
+  int nch;
+  float weight[AF_NCH];     // channel weights
+  int step_len;             // samples per channel in a 100 ms step
+  int step_pos;
+  double step_sum;          // weighted energy of the current step
+  double steps[BLOCK_STEPS];
+  int nsteps;
+  double hist_sum[HIST_BINS];
+  long long hist_count[HIST_BINS];
+  float peak;
+} af_loudness_t;
+
+static double energy_to_lufs(double e)
+{
+  return e > 0 ? -0.691 + 10 * log10(e) : -HUGE_VAL;
+}
+
+// K-weighting: high shelf followed by a high pass (BS.1770, given for any
+// sample rate as in libebur128)
+static void set_kweighting(af_loudness_t* s, int rate)
+{
+  double K, Q, a0;
+  double* c;
+
+  double Vh = pow(10.0, 3.999843853973347 / 20.0);
+  double Vb = pow(Vh, 0.4996667741545416);
+  Q = 0.7071752369554196;
+  K = tan(M_PI * 1681.974450955533 / rate);
+  a0 = 1.0 + K / Q + K * K;
+  c = s->kw[0];
+  c[0] = (Vh + Vb * K / Q + K * K) / a0;
+  c[1] = 2.0 * (K * K - Vh) / a0;
+  c[2] = (Vh - Vb * K / Q + K * K) / a0;
+  c[3] = 2.0 * (K * K - 1.0) / a0;
+  c[4] = (1.0 - K / Q + K * K) / a0;
+
+  Q = 0.5003270373238773;
+  K = tan(M_PI * 38.13547087602444 / rate);
+  a0 = 1.0 + K / Q + K * K;
+  c = s->kw[1];
+  c[0] = 1;
+  c[1] = -2;
+  c[2] = 1;
+  c[3] = 2.0 * (K * K - 1.0) / a0;
+  c[4] = (1.0 - K / Q + K * K) / a0;
+}
+
+/* Channel weights for the channel orders used inside the player: surround
+   channels are weighted +1.5 dB, LFE is ignored. */
+static void set_weights(af_loudness_t* s, int nch)
+{
+  int ch;
+  for(ch = 0; ch < AF_NCH; ch++)
+    s->weight[ch] = 1.0;
+  if(nch >= 5)
+    s->weight[2] = s->weight[3] = 1.41;
+  if(nch == 6 || nch == 8)
+    s->weight[5] = 0;
+  if(nch == 8)
+    s->weight[6] = s->weight[7] = 1.41;
+}
+
+static void add_step(af_loudness_t* s)
+{
+  int i;
+  memmove(s->steps, s->steps + 1, (BLOCK_STEPS - 1) * sizeof(double));
+  s->steps[BLOCK_STEPS - 1] = s->step_sum / s->step_len;
+  s->step_sum = 0;
+  s->step_pos = 0;
+  if(s->nsteps < BLOCK_STEPS)
+    s->nsteps++;
+  if(s->nsteps < BLOCK_STEPS)
+    return;
+
+  double e = 0;
+  for(i = 0; i < BLOCK_STEPS; i++)
+    e += s->steps[i];
+  e /= BLOCK_STEPS;
+  double l = energy_to_lufs(e);
+  if(l <= HIST_MIN) // absolute gate
+    return;
+  int bin = (l - HIST_MIN) / HIST_STEP;
+  if(bin >= HIST_BINS)
+    bin = HIST_BINS - 1;
+  s->hist_sum[bin] += e;
+  s->hist_count[bin]++;
+}
+
+static void measure(af_loudness_t* s, const float* a, int len, int nch)
+{
+  int i, ch, k;
+
+  for(i = 0; i < len * nch; i++){
+    float v = fabsf(a[i]);
+    if(v > s->peak)
+      s->peak = v;
+  }
+
+  for(i = 0; i < len; i++){
+    double sum = 0;
+    for(ch = 0; ch < nch; ch++){
+      double v = a[ch];
+      for(k = 0; k < 2; k++){
+        const double* c = s->kw[k];
+        double* q = s->kw_state[ch][k];
+        double y = c[0] * v + c[1] * q[0] + c[2] * q[1]
+                 - c[3] * q[2] - c[4] * q[3];
+        q[1] = q[0];
+        q[0] = v;
+        q[3] = q[2];
+        q[2] = y;
+        v = y;
+      }
+      sum += s->weight[ch] * v * v;
+    }
+    a += nch;
+    s->step_sum += sum;
+    if(++s->step_pos == s->step_len)
+      add_step(s);
+  }
+
+  // Let the filter state decay to zero in silence instead of to denormals
+  for(ch = 0; ch < nch; ch++)
+    for(k = 0; k < 2; k++)
+      for(i = 0; i < 4; i++)
+        if(fabs(s->kw_state[ch][k][i]) < 1e-30)
+          s->kw_state[ch][k][i] = 0;
+}
+
+// Integrated loudness of everything measured so far, -HUGE_VAL if nothing
+static double integrated_loudness(af_loudness_t* s)
+{
+  double sum = 0;
+  long long count = 0;
+  int i;
+
+  for(i = 0; i < HIST_BINS; i++){
+    sum += s->hist_sum[i];
+    count += s->hist_count[i];
+  }
+  if(!count)
+    return -HUGE_VAL;
+
+  // relative gate
+  double gate = energy_to_lufs(sum / count) - 10.0;
+  int first = ceil((gate - HIST_MIN) / HIST_STEP);
+  sum = 0;
+  count = 0;
+  for(i = first < 0 ? 0 : first; i < HIST_BINS; i++){
+    sum += s->hist_sum[i];
+    count += s->hist_count[i];
+  }
+  return count ? energy_to_lufs(sum / count) : -HUGE_VAL;
+}
+
+/* The cache is a text file with one line per measured file:
+     <integrated loudness in LUFS> <peak in dBFS> <file size> <file name>
+   Lines are only ever appended (with a single write, so several players
+   can scan at the same time); the last entry for a file wins. */
+static int cache_lookup(af_loudness_t* s, double* loudness, double* peak)
+{
+  char line[PATH_MAX + 64];
+  int found = 0;
+  FILE* f = fopen(s->cache, "r");
+  if(!f)
+    return 0;
+  while(fgets(line, sizeof(line), f)){
+    double l, p;
+    long long size;
+    int pos = 0;
+    line[strcspn(line, "\n")] = 0;
+    if(sscanf(line, "%lf %lf %lld %n", &l, &p, &size, &pos) < 3 || !pos)
+      continue;
+    if(size == s->size && !strcmp(line + pos, s->key)){
+      *loudness = l;
+      *peak = p;
+      found = 1;
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+static void cache_store(af_loudness_t* s, double loudness, double peak)
+{
+  char line[PATH_MAX + 64];
+  int len = snprintf(line, sizeof(line), "%.2f %.2f %lld %s\n", loudness,
+                     peak, s->size, s->key);
+  if(len >= sizeof(line) || strchr(s->key, '\n'))
+    return;
+  int fd = open(s->cache, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if(fd < 0 || write(fd, line, len) != len)
+    mp_msg(MSGT_AFILTER, MSGL_ERR, "[loudness] Could not write to %s\n",
+           s->cache);
+  if(fd >= 0)
+    close(fd);
+}
+
+static void reset_measurement(af_loudness_t* s)
+{
+  memset(s->kw_state, 0, sizeof(s->kw_state));
+  s->scan_frac = 0;
+  s->step_pos = 0;
+  s->step_sum = 0;
+  s->nsteps = 0;
+  memset(s->hist_sum, 0, sizeof(s->hist_sum));
+  memset(s->hist_count, 0, sizeof(s->hist_count));
+  s->peak = 0;
+}
+
+static void set_file(af_loudness_t* s, const char* filename)
+{
+  char path[PATH_MAX];
+  struct stat st;
+
+  free(s->key);
+  s->key = strdup(realpath(filename, path) ? path : filename);
+  s->size = stat(filename, &st) == 0 ? st.st_size : -1;
+
+  if(s->scan){
+    // Each file is measured separately
+    if(s->nch)
+      reset_measurement(s);
+    return;
+  }
+
+  double loudness, peak;
+  s->gain = 1.0;
+  if(!cache_lookup(s, &loudness, &peak)){
+    mp_msg(MSGT_AFILTER, MSGL_V, "[loudness] No measurement for %s, "
+           "not changing the volume.\n", s->key);
+    return;
+  }
+  double gain = s->target - loudness;
+  if(gain > s->maxgain)
+    gain = s->maxgain;
+  if(s->noclip && gain > -peak)
+    gain = -peak;
+  s->gain = pow(10.0, gain / 20.0);
+  mp_msg(MSGT_AFILTER, MSGL_V, "[loudness] %.2f LUFS, peak %.2f dBFS, "
+         "gain %.2f dB\n", loudness, peak, gain);
+}
+
+// Called when the file was played (scanned) to the end
+static void finish_scan(af_loudness_t* s)
+{
+  if(!s->scan || !s->key)
+    return;
+  double loudness = integrated_loudness(s);
+  double peak = s->peak > 0 ? 20 * log10(s->peak) : -HUGE_VAL;
+  if(loudness == -HUGE_VAL){
+    mp_msg(MSGT_AFILTER, MSGL_WARN, "[loudness] %s: too short or silent, "
+           "not stored.\n", s->key);
+    return;
+  }
+  mp_msg(MSGT_AFILTER, MSGL_INFO, "[loudness] %s: %.2f LUFS, peak %.2f dBFS\n",
+         s->key, loudness, peak);
+  cache_store(s, loudness, peak);
+}
+
+// Initialization and runtime control
+static int control(struct af_instance_s* af, int cmd, void* arg)
+{
+  af_loudness_t* s = af->setup;
+
+  switch(cmd){
+  case AF_CONTROL_REINIT:{
+    af_data_t* in = arg;
+
+    af->data->rate   = in->rate;
+    af->data->nch    = in->nch;
+    af->data->format = AF_FORMAT_FLOAT_NE;
+    af->data->bps    = 4;
+
+    if(s->scan)
+      af->mul = 1.0 / SCAN_SPEEDUP;
+    if(s->scan && (s->rate != in->rate || s->nch != in->nch)){
+      // A format change in the middle of the file restarts the measurement
+      set_kweighting(s, in->rate);
+      set_weights(s, in->nch);
+      s->step_len = (in->rate + 5) / 10;
+      s->rate = in->rate;
+      s->nch = in->nch;
+      reset_measurement(s);
+    }
+    return af_test_output(af, in);
+  }
+  case AF_CONTROL_COMMAND_LINE:{
+    char* cache = NULL;
+    const opt_t subopts[] = {
+      {"target",  OPT_ARG_FLOAT, &s->target,  NULL},
+      {"maxgain", OPT_ARG_FLOAT, &s->maxgain, NULL},
+      {"noclip",  OPT_ARG_BOOL,  &s->noclip,  NULL},
+      {"scan",    OPT_ARG_BOOL,  &s->scan,    NULL},
+      {"cache",   OPT_ARG_MSTRZ, &cache,      NULL},
+      {NULL}
+    };
+    if(subopt_parse(arg, subopts) != 0){
+      mp_msg(MSGT_AFILTER, MSGL_ERR, "[loudness] Invalid suboptions\n");
+      return AF_ERROR;
+    }
+    if(cache){
+      free(s->cache);
+      s->cache = cache;
+    }
+    return AF_OK;
+  }
+  case AF_CONTROL_LOUDNESS_FILE | AF_CONTROL_SET:
+    set_file(s, arg);
+    return AF_OK;
+  case AF_CONTROL_LOUDNESS_DONE | AF_CONTROL_SET:
+    finish_scan(s);
+    return AF_OK;
+  }
+  return AF_UNKNOWN;
+}
+
+// Deallocate memory
+static void uninit(struct af_instance_s* af)
+{
+  if(af->setup){
+    af_loudness_t* s = af->setup;
+    free(s->key);
+    free(s->cache);
+    free(af->setup);
+  }
+  free(af->data);
+}
+
+// Filter data through filter
+static af_data_t* play(struct af_instance_s* af, af_data_t* data)
+{
+  af_loudness_t* s = af->setup;
+  float* a = data->audio;
+  int nch = data->nch;
+  int len = data->len / 4 / nch;
+  int i;
+
+  if(s->scan){
+    measure(s, a, len, nch);
+    /* Output a short piece of silence, so that the decoder is asked for
+       more right away, but only for a bounded amount per call */
+    s->scan_frac += len;
+    len = s->scan_frac / SCAN_SPEEDUP;
+    s->scan_frac -= len * SCAN_SPEEDUP;
+    memset(a, 0, len * nch * sizeof(float));
+    data->len = len * nch * 4;
+    return data;
+  }
+
+  if(s->gain != 1.0)
+    for(i = 0; i < len * nch; i++)
+      a[i] *= s->gain;
+  return data;
+}
+
+// Allocate memory and set function pointers
+static int af_open(af_instance_t* af)
+{
+  af_loudness_t* s;
+  af->control = control;
+  af->uninit  = uninit;
+  af->play    = play;
+  af->mul     = 1;
+  af->data    = calloc(1, sizeof(af_data_t));
+  af->setup   = s = calloc(1, sizeof(af_loudness_t));
+  if(af->data == NULL || af->setup == NULL)
+    return AF_ERROR;
+  s->target  = DEF_TARGET;
+  s->maxgain = DEF_MAXGAIN;
+  s->gain    = 1.0;
+  s->size    = -1;
+  s->cache   = get_path(CACHE_FILE);
+  return AF_OK;
+}
+
+// Description of this filter
+af_info_t af_info_loudness = {
+  "Loudness normalization with cached per-file measurement",
+  "loudness",
+  "",
+  "",
+  AF_FLAGS_REENTRANT,
+  af_open
+};
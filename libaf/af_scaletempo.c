@@ -35,9 +35,13 @@
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "af.h"
 #include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavcodec/avfft.h"
 #include "subopt-helper.h"
 
 // Data for specific instances of this filter
@@ -69,6 +73,18 @@ typedef struct af_scaletempo_s
   void*   buf_pre_corr;
   void*   table_window;
   int     (*best_overlap_offset)(struct af_scaletempo_s* s);
+  // float correlation search (see best_overlap_offset_search)
+  int     use_int;
+  int     search_nch;
+  int     samples_corr;
+  int     search_copy;
+  float*  buf_search;
+  af_dot_product_t dot_product;
+  int     fft_bits;
+  RDFTContext* fft;
+  RDFTContext* ifft;
+  FFTSample* fft_corr;
+  FFTSample* fft_search;
   // command line
   float   scale_nominal;
   float   ms_stride;
@@ -117,38 +133,113 @@ static int fill_queue(struct af_instance_s* af, af_data_t* data, int offset)
 }
 
 #define UNROLL_PADDING (4*4)
+// largest transform av_rdft_init() supports
+#define MAX_FFT_BITS 16
 
-static int best_overlap_offset_float(af_scaletempo_t* s)
+// Convert frames of queued audio to float, summing channels together if
+// the search is done on fewer channels than the audio has.
+static void prepare_search(af_scaletempo_t* s, const void* in, float* out,
+                           int frames)
 {
-  float *pw, *po, *ppc, *search_start;
-  float best_corr = INT_MIN;
+  int nch   = s->num_channels;
+  int snch  = s->search_nch;
+  int group = nch / snch;
+  int f, c, k;
+  for (f=0; f<frames; f++) {
+    for (c=0; c<snch; c++) {
+      int idx = f * nch + c * group;
+      float v = 0;
+      for (k=0; k<group; k++) {
+        if (s->use_int)
+          v += ((const int16_t*)in)[idx + k];
+        else
+          v += ((const float*)in)[idx + k];
+      }
+      *out++ = v;
+    }
+  }
+}
+
+/* Cross correlation of the windowed overlap with the search region, done in
+ * the frequency domain: corr = IDFT(conj(DFT(pre_corr)) * DFT(search)).
+ * Only the lags that are multiples of the search channel count are used.
+ */
+static int best_offset_fft(af_scaletempo_t* s, const float* search)
+{
+  int n = 1 << s->fft_bits;
+  int len_search = s->samples_corr + (s->frames_search - 1) * s->search_nch;
+  FFTSample* a = s->fft_corr;
+  FFTSample* b = s->fft_search;
+  float best_corr = -INFINITY;
   int best_off = 0;
   int i, off;
 
-  pw  = s->table_window;
-  po  = s->buf_overlap;
-  po += s->num_channels;
-  ppc = s->buf_pre_corr;
-  for (i=s->num_channels; i<s->samples_overlap; i++) {
-    *ppc++ = *pw++ * *po++;
+  memcpy(a, s->buf_pre_corr, s->samples_corr * sizeof(float));
+  memset(a + s->samples_corr, 0, (n - s->samples_corr) * sizeof(float));
+  memcpy(b, search, len_search * sizeof(float));
+  memset(b + len_search, 0, (n - len_search) * sizeof(float));
+  av_rdft_calc(s->fft, a);
+  av_rdft_calc(s->fft, b);
+
+  // DC and Nyquist are real and packed into the first two values
+  b[0] *= a[0];
+  b[1] *= a[1];
+  for (i=2; i<n; i+=2) {
+    float re = a[i] * b[i]   + a[i+1] * b[i+1];
+    float im = a[i] * b[i+1] - a[i+1] * b[i];
+    b[i]   = re;
+    b[i+1] = im;
   }
+  av_rdft_calc(s->ifft, b);
 
-  search_start = (float*)s->buf_queue + s->num_channels;
   for (off=0; off<s->frames_search; off++) {
-    float corr = 0;
-    float* ps = search_start;
-    ppc = s->buf_pre_corr;
-    for (i=s->num_channels; i<s->samples_overlap; i++) {
-      corr += *ppc++ * *ps++;
-    }
+    float corr = b[off * s->search_nch];
     if (corr > best_corr) {
       best_corr = corr;
       best_off  = off;
     }
-    search_start += s->num_channels;
   }
+  return best_off;
+}
 
-  return best_off * 4 * s->num_channels;
+static int best_overlap_offset_search(af_scaletempo_t* s)
+{
+  float *pw, *ppc, *search;
+  float best_corr = -INFINITY;
+  int best_off = 0;
+  int i, off;
+
+  ppc = s->buf_pre_corr;
+  prepare_search(s, (int8_t*)s->buf_overlap + s->bytes_per_frame, ppc,
+                 s->samples_corr / s->search_nch);
+  pw = s->table_window;
+  for (i=0; i<s->samples_corr; i++)
+    ppc[i] *= pw[i];
+
+  if (s->search_copy) {
+    search = s->buf_search;
+    prepare_search(s, s->buf_queue, search,
+                   s->frames_search + s->samples_corr / s->search_nch);
+  } else {
+    search = (float*)s->buf_queue;
+  }
+  search += s->search_nch;
+
+  if (s->fft) {
+    best_off = best_offset_fft(s, search);
+  } else {
+    int len = (s->samples_corr + 3) & ~3;
+    for (off=0; off<s->frames_search; off++) {
+      float corr = s->dot_product(ppc, search, len);
+      if (corr > best_corr) {
+        best_corr = corr;
+        best_off  = off;
+      }
+      search += s->search_nch;
+    }
+  }
+
+  return best_off * s->bytes_per_frame;
 }
 
 static int best_overlap_offset_s16(af_scaletempo_t* s)
@@ -193,6 +284,18 @@ static int best_overlap_offset_s16(af_scaletempo_t* s)
   return best_off * 2 * s->num_channels;
 }
 
+static void free_fft(af_scaletempo_t* s)
+{
+  if (s->fft)
+    av_rdft_end(s->fft);
+  if (s->ifft)
+    av_rdft_end(s->ifft);
+  av_freep(&s->fft_corr);
+  av_freep(&s->fft_search);
+  s->fft = s->ifft = NULL;
+  s->fft_bits = 0;
+}
+
 static void output_overlap_float(af_scaletempo_t* s, void* buf_out,
 				  int bytes_off)
 {
@@ -369,11 +472,28 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       }
     }
 
+    s->bytes_per_frame = bps * nch;
+    s->num_channels    = nch;
+    s->use_int         = use_int;
+
     s->frames_search = (frames_overlap > 1) ? srate * s->ms_search : 0;
     if (s->frames_search <= 0) {
       s->best_overlap_offset = NULL;
+      free_fft(s);
     } else {
-      if (use_int) {
+      // Channels are summed for the search if there are more than two
+      int search_nch   = nch > 2 ? 1 : nch;
+      int samples_corr = (frames_overlap - 1) * search_nch;
+      int fft_bits     = 1;
+      int use_fft;
+      while ((1 << fft_bits) < samples_corr + (s->frames_search - 1) * search_nch)
+        fft_bits++;
+      // rough cost of 3 real FFTs compared to the direct correlation
+      use_fft = fft_bits <= MAX_FFT_BITS
+                && (int64_t)s->frames_search * samples_corr
+                   > 2 * (int64_t)(1 << fft_bits) * fft_bits;
+
+      if (use_int && search_nch == nch && !use_fft) {
         int64_t t = frames_overlap;
         int32_t n = 8589934588LL / (t * t);  // 4 * (2^31 - 1) / t^2
         int32_t* pw;
@@ -393,26 +513,57 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
         }
         s->best_overlap_offset = best_overlap_offset_s16;
       } else {
+        int samples_pad = (samples_corr + 3) & ~3;
         float* pw;
-        s->buf_pre_corr = realloc(s->buf_pre_corr, s->bytes_overlap);
-        s->table_window = realloc(s->table_window, s->bytes_overlap - nch * bps);
+        s->search_nch   = search_nch;
+        s->samples_corr = samples_corr;
+        s->buf_pre_corr = realloc(s->buf_pre_corr, samples_pad * sizeof(float));
+        s->table_window = realloc(s->table_window, samples_corr * sizeof(float));
         if(!s->buf_pre_corr || !s->table_window) {
           mp_msg(MSGT_AFILTER, MSGL_FATAL, "[scaletempo] Out of memory\n");
           return AF_ERROR;
         }
+        memset(s->buf_pre_corr, 0, samples_pad * sizeof(float));
         pw = s->table_window;
         for (i=1; i<frames_overlap; i++) {
           float v = i * (frames_overlap - i);
-          for (j=0; j<nch; j++) {
+          for (j=0; j<search_nch; j++) {
             *pw++ = v;
           }
         }
-        s->best_overlap_offset = best_overlap_offset_float;
+        // float input is searched in place, everything else is converted
+        s->search_copy = use_int || search_nch != nch;
+        if (s->search_copy) {
+          int len = (frames_overlap + s->frames_search) * search_nch + 4;
+          s->buf_search = realloc(s->buf_search, len * sizeof(float));
+          if (!s->buf_search) {
+            mp_msg(MSGT_AFILTER, MSGL_FATAL, "[scaletempo] Out of memory\n");
+            return AF_ERROR;
+          }
+          memset(s->buf_search, 0, len * sizeof(float));
+        }
+        s->dot_product = af_get_dot_product();
+        s->best_overlap_offset = best_overlap_offset_search;
       }
-    }
 
-    s->bytes_per_frame = bps * nch;
-    s->num_channels    = nch;
+      if (s->best_overlap_offset == best_overlap_offset_s16)
+        use_fft = 0;
+      if (!use_fft || fft_bits != s->fft_bits)
+        free_fft(s);
+      if (use_fft && !s->fft) {
+        s->fft_bits   = fft_bits;
+        s->fft        = av_rdft_init(fft_bits, DFT_R2C);
+        s->ifft       = av_rdft_init(fft_bits, IDFT_C2R);
+        s->fft_corr   = av_malloc((1 << fft_bits) * sizeof(FFTSample));
+        s->fft_search = av_malloc((1 << fft_bits) * sizeof(FFTSample));
+        if (!s->fft || !s->ifft || !s->fft_corr || !s->fft_search) {
+          // the direct search works without the FFT
+          mp_msg(MSGT_AFILTER, MSGL_WARN, "[scaletempo] Could not set up "
+                 "FFT, using direct search\n");
+          free_fft(s);
+        }
+      }
+    }
 
     s->bytes_queue
       = (s->frames_search + frames_stride + frames_overlap) * bps * nch;
@@ -421,20 +572,22 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       mp_msg(MSGT_AFILTER, MSGL_FATAL, "[scaletempo] Out of memory\n");
       return AF_ERROR;
     }
+    memset(s->buf_queue + s->bytes_queue, 0, UNROLL_PADDING);
 
     s->bytes_queued = 0;
     s->bytes_to_slide = 0;
 
     mp_msg (MSGT_AFILTER, MSGL_DBG2, "[scaletempo] "
             "%.2f stride_in, %i stride_out, %i standing, "
-            "%i overlap, %i search, %i queue, %s mode\n",
+            "%i overlap, %i search, %i queue, %s mode, %s search\n",
             s->frames_stride_scaled,
             (int)(s->bytes_stride / nch / bps),
             (int)(s->bytes_standing / nch / bps),
             (int)(s->bytes_overlap / nch / bps),
             s->frames_search,
             (int)(s->bytes_queue / nch / bps),
-            (use_int?"s16":"float"));
+            (use_int?"s16":"float"),
+            (s->fft?"fft":"direct"));
 
     return af_test_output(af, (af_data_t*)arg);
   }
@@ -538,8 +691,10 @@ static void uninit(struct af_instance_s* af)
   free(s->buf_queue);
   free(s->buf_overlap);
   free(s->buf_pre_corr);
+  free(s->buf_search);
   free(s->table_blend);
   free(s->table_window);
+  free_fft(s);
   free(af->setup);
 }
 
@@ -576,3 +731,118 @@ af_info_t af_info_scaletempo = {
   AF_FLAGS_REENTRANT,
   af_open
 };
+
+
+#ifdef TEST
+
+/* The rest of libaf is built without -DTEST:
+
+     gcc -O2 -DTEST libaf/af_scaletempo.c libaf/af_tools.c \
+         -lavcodec -lavutil -lm
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+CpuCaps gCpuCaps;
+
+// Stand-ins for the parts of the player the filter uses
+void mp_msg(int mod, int lev, const char *format, ...)
+{
+}
+
+char *mp_gtext(const char *string)
+{
+  return (char *)string;
+}
+
+int subopt_parse(char const * const str, const opt_t * opts)
+{
+  return 0;
+}
+
+#define RATE    48000
+#define SECONDS 20
+
+/* Run SECONDS of audio through the filter in 0.1 second chunks. Returns the
+   CPU time per second of input audio in milliseconds. */
+static double bench(int nch, int use_int, float speed, float ms_search,
+                    int fft, int8_t* out, int* out_len)
+{
+  af_instance_t af = {0};
+  af_data_t in = {.rate = RATE, .nch = nch,
+                  .format = use_int ? AF_FORMAT_S16_NE : AF_FORMAT_FLOAT_NE,
+                  .bps = use_int ? 2 : 4};
+  int chunk = RATE / 10 * nch;
+  int8_t* buf = malloc(chunk * in.bps);
+  af_scaletempo_t* s;
+  clock_t start, cpu = 0;
+  int i, n;
+
+  af_open(&af);
+  s = af.setup;
+  s->scale = s->speed = speed;
+  s->ms_search = ms_search;
+  control(&af, AF_CONTROL_REINIT, &in);
+  if (!fft)
+    free_fft(s);
+
+  *out_len = 0;
+  for (n = 0; n < SECONDS * 10; n++) {
+    af_data_t d = in;
+    // a few drifting tones in every channel
+    for (i = 0; i < chunk; i++) {
+      double t = (double)(n * chunk + i) / nch / RATE;
+      float v = 0.3 * sin(2 * M_PI * (220 + 10 * t) * t + i % nch)
+              + 0.2 * sin(2 * M_PI * 331 * t)
+              + 0.1 * sin(2 * M_PI * (1500 - 20 * t) * t);
+      if (use_int)
+        ((int16_t*)buf)[i] = v * 32767;
+      else
+        ((float*)buf)[i] = v;
+    }
+    d.audio = buf;
+    d.len = chunk * in.bps;
+    start = clock();
+    play(&af, &d);
+    cpu += clock() - start;
+    memcpy(out + *out_len, d.audio, d.len);
+    *out_len += d.len;
+  }
+  uninit(&af);
+  free(buf);
+  return 1000.0 * cpu / CLOCKS_PER_SEC / SECONDS;
+}
+
+int main(void)
+{
+  static const int channels[] = {2, 6, 8};
+  static const float speeds[] = {1.5, 2.0};
+  static const float searches[] = {14, 30};
+  int8_t* out_direct = malloc(SECONDS * RATE * 8 * 4);
+  int8_t* out_fft = malloc(SECONDS * RATE * 8 * 4);
+  int a, b, c, f;
+
+  gCpuCaps.hasSSE = HAVE_SSE;
+  printf("ms of CPU per second of 48 kHz audio\n");
+  for (f = 0; f < 2; f++)
+    for (c = 0; c < 3; c++)
+      for (a = 0; a < 2; a++)
+        for (b = 0; b < 2; b++) {
+          int len_direct, len_fft;
+          double direct = bench(channels[c], f, speeds[a], searches[b], 0,
+                                out_direct, &len_direct);
+          double fft = bench(channels[c], f, speeds[a], searches[b], 1,
+                             out_fft, &len_fft);
+          printf("%-5s %dch %.1fx search %2.0f ms: direct %6.2f  fft %6.2f  "
+                 "%s\n", f ? "s16" : "float", channels[c], speeds[a],
+                 searches[b], direct, fft,
+                 len_direct == len_fft && !memcmp(out_direct, out_fft, len_fft)
+                 ? "same output" : "output differs");
+        }
+  free(out_direct);
+  free(out_fft);
+  return 0;
+}
+
+#endif
@@ -45,16 +45,8 @@
 #define L  32    // Length of fir filter
 #define LD 65536 // Length of delay buffer
 
-// 32 Tap fir filter loop unrolled
-#define FIR(x,w,y) \
-  y = ( w[0] *x[0] +w[1] *x[1] +w[2] *x[2] +w[3] *x[3]  \
-      + w[4] *x[4] +w[5] *x[5] +w[6] *x[6] +w[7] *x[7]  \
-      + w[8] *x[8] +w[9] *x[9] +w[10]*x[10]+w[11]*x[11] \
-      + w[12]*x[12]+w[13]*x[13]+w[14]*x[14]+w[15]*x[15] \
-      + w[16]*x[16]+w[17]*x[17]+w[18]*x[18]+w[19]*x[19] \
-      + w[20]*x[20]+w[21]*x[21]+w[22]*x[22]+w[23]*x[23] \
-      + w[24]*x[24]+w[25]*x[25]+w[26]*x[26]+w[27]*x[27] \
-      + w[28]*x[28]+w[29]*x[29]+w[30]*x[30]+w[31]*x[31])
+// 32 Tap fir filter
+#define FIR(x,w,y) y = af_filter_fir(s->dot_product, L, w, x)
 
 // Add to circular queue macro + update index
 #ifdef SPLITREAR
@@ -83,6 +75,7 @@ typedef struct af_surround_s
   int i;       	 // Position in circular buffer
   int wi;	 // Write index for delay queue
   int ri;	 // Read index for delay queue
+  af_dot_product_t dot_product;
 }af_surround_t;
 
 // Initialization and runtime control
@@ -101,6 +94,7 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       mp_msg(MSGT_AFILTER, MSGL_ERR, "[surround] Only stereo input is supported.\n");
       return AF_DETACH;
     }
+    s->dot_product = af_get_dot_product();
     // Surround filer coefficients
     fc = 2.0 * 7000.0/(float)af->data->rate;
     if (-1 == af_filter_design_fir(L, s->w, &fc, LP|HAMMING, 0)){
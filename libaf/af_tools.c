@@ -18,6 +18,7 @@
 
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
 #include "af.h"
 
 /* Convert to gain value from dB. Returns AF_OK if of and AF_ERROR if
@@ -97,6 +98,19 @@ int af_test_output(struct af_instance_s* af, af_data_t* out)
   return AF_OK;
 }
 
+int af_channel_stride(af_data_t *data, int ch, int *offset, int *stride)
+{
+  int samples = data->len / data->bps / data->nch;
+  if(AF_FORMAT_IS_PLANAR(data->format)){
+    *offset = ch * samples;
+    *stride = 1;
+  } else {
+    *offset = ch;
+    *stride = data->nch;
+  }
+  return samples;
+}
+
 /* Soft clipping, the sound of a dream, thanks to Jon Wattes
    post to Musicdsp.org */
 float af_softclip(float a)
@@ -108,3 +122,53 @@ float af_softclip(float a)
     else
 	return sin(a);
 }
+
+static float dot_product_c(const float* a, const float* b, int len)
+{
+  float c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+  int i;
+  for (i=0; i<len; i+=4) {
+    c0 += a[i+0] * b[i+0];
+    c1 += a[i+1] * b[i+1];
+    c2 += a[i+2] * b[i+2];
+    c3 += a[i+3] * b[i+3];
+  }
+  return (c0 + c1) + (c2 + c3);
+}
+
+#if HAVE_SSE
+static float dot_product_sse(const float* a, const float* b, int len)
+{
+  float corr;
+  intptr_t i = -4 * (intptr_t)len;
+  __asm__ volatile(
+    "xorps      %%xmm0, %%xmm0 \n"
+    "1: \n"
+    "movups    (%2,%0), %%xmm1 \n"
+    "movups    (%3,%0), %%xmm2 \n"
+    "mulps      %%xmm2, %%xmm1 \n"
+    "addps      %%xmm1, %%xmm0 \n"
+    "add           $16, %0 \n"
+    "jl 1b \n"
+    "movhlps    %%xmm0, %%xmm1 \n"
+    "addps      %%xmm1, %%xmm0 \n"
+    "movaps     %%xmm0, %%xmm1 \n"
+    "shufps $1, %%xmm1, %%xmm1 \n"
+    "addss      %%xmm1, %%xmm0 \n"
+    "movss      %%xmm0, %1 \n"
+    :"+&r"(i), "=m"(corr)
+    :"r"(a+len), "r"(b+len)
+    :"memory"
+  );
+  return corr;
+}
+#endif
+
+af_dot_product_t af_get_dot_product(void)
+{
+#if HAVE_SSE
+  if (gCpuCaps.hasSSE)
+    return dot_product_sse;
+#endif
+  return dot_product_c;
+}
@@ -69,7 +69,8 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
     af->data->rate   = ((af_data_t*)arg)->rate;
     af->data->nch    = ((af_data_t*)arg)->nch;
 
-    if(s->fast && (((af_data_t*)arg)->format != (AF_FORMAT_FLOAT_NE))){
+    if(s->fast && (((af_data_t*)arg)->format != (AF_FORMAT_FLOAT_NE)) &&
+       (((af_data_t*)arg)->format != (AF_FORMAT_FLOATP))){
       af->data->format = AF_FORMAT_S16_NE;
       af->data->bps    = 2;
     }
@@ -79,7 +80,9 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       float t = 2.0-cos(x);
       s->time = 1.0 - (t - sqrt(t*t - 1));
       mp_msg(MSGT_AFILTER, MSGL_DBG2, "[volume] Forgetting factor = %0.5f\n",s->time);
-      af->data->format = AF_FORMAT_FLOAT_NE;
+      // Planar input is processed as is
+      af->data->format = ((af_data_t*)arg)->format == AF_FORMAT_FLOATP ?
+                         AF_FORMAT_FLOATP : AF_FORMAT_FLOAT_NE;
       af->data->bps    = 4;
     }
     return af_test_output(af,(af_data_t*)arg);
@@ -159,15 +162,17 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
       }
     }
   }
-  // Machine is fast and data is floating point
-  else if(af->data->format == (AF_FORMAT_FLOAT_NE)){
+  // Machine is fast and data is floating point (interleaved or planar)
+  else{
     float*   	a   	= (float*)c->audio;	// Audio data
-    int       	len 	= c->len/4;		// Number of samples
     for (int ch = 0; ch < nch; ch++) {
       // Volume control (fader)
       if(s->enable[ch]){
 	float	t   = 1.0 - s->time;
-	for(i=ch;i<len;i+=nch){
+	int	offset, stride;
+	int	len = af_channel_stride(c, ch, &offset, &stride);
+	int	end = offset + len*stride;
+	for(i=offset;i<end;i+=stride){
 	  register float x 	= a[i];
 	  register float pow 	= x*x;
 	  // Check maximum power value
@@ -221,6 +226,6 @@ af_info_t af_info_volume = {
     "volume",
     "Anders",
     "",
-    AF_FLAGS_NOT_REENTRANT,
+    AF_FLAGS_NOT_REENTRANT | AF_FLAGS_PLANAR,
     af_open
 };
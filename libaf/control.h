@@ -133,6 +133,10 @@ typedef struct af_control_ext_s{
 // Set resampling accuracy
 #define AF_CONTROL_RESAMPLE_ACCURACY	0x00000300 | AF_CONTROL_FILTER_SPECIFIC
 
+/* Set how much faster than nominal the input is consumed, arg is a
+   double (1.0 = nominal). Used to continuously correct sync. */
+#define AF_CONTROL_RESAMPLE_RATIO	0x00000500 | AF_CONTROL_FILTER_SPECIFIC
+
 // Format
 
 #define AF_CONTROL_FORMAT_FMT		0x00000400 | AF_CONTROL_FILTER_SPECIFIC
@@ -236,6 +240,9 @@ typedef struct af_control_ext_s{
 // Export
 #define AF_CONTROL_EXPORT_SZ            0x00003000 | AF_CONTROL_FILTER_SPECIFIC
 
+// Timestamp of the next audio passed to the filter chain, arg is double*
+#define AF_CONTROL_EXPORT_PTS           0x00003700 | AF_CONTROL_FILTER_SPECIFIC
+
 
 // ExtraStereo Multiplier
 #define AF_CONTROL_ES_MUL		0x00003100 | AF_CONTROL_FILTER_SPECIFIC
@@ -254,4 +261,11 @@ typedef struct af_control_ext_s{
 #define AF_CONTROL_PLAYBACK_SPEED	0x00003500 | AF_CONTROL_FILTER_SPECIFIC
 #define AF_CONTROL_SCALETEMPO_AMOUNT	0x00003600 | AF_CONTROL_FILTER_SPECIFIC
 
+// Loudness
+
+// Name of the file being played, arg is char*
+#define AF_CONTROL_LOUDNESS_FILE	0x00003800 | AF_CONTROL_FILTER_SPECIFIC
+// The file was played to the end, arg is NULL
+#define AF_CONTROL_LOUDNESS_DONE	0x00003900 | AF_CONTROL_FILTER_SPECIFIC
+
 #endif /* MPLAYER_CONTROL_H */
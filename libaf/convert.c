@@ -0,0 +1,611 @@
+/*
+ * sample format conversion and layout kernels
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "cpudetect.h"
+#include "convert.h"
+
+static inline float clip_float(float x)
+{
+    return x > 1.0f ? 1.0f : x < -1.0f ? -1.0f : x;
+}
+
+static void float_to_s16_c(const float *in, int16_t *out, int len)
+{
+    for (int i = 0; i < len; i++)
+        out[i] = lrintf(32767.0 * clip_float(in[i]));
+}
+
+static void s16_to_float_c(const int16_t *in, float *out, int len)
+{
+    for (int i = 0; i < len; i++)
+        out[i] = (1.0 / 32768.0) * in[i];
+}
+
+static void float_to_s32_c(const float *in, int32_t *out, int len)
+{
+    for (int i = 0; i < len; i++)
+        out[i] = lrint(2147483647.0 * clip_float(in[i]));
+}
+
+static void s32_to_float_c(const int32_t *in, float *out, int len)
+{
+    for (int i = 0; i < len; i++)
+        out[i] = (1.0 / 2147483648.0) * in[i];
+}
+
+// 24 bit samples are packed into 3 bytes in native byte order
+static void float_to_s24_c(const float *in, uint8_t *out, int len)
+{
+    for (int i = 0; i < len; i++) {
+        uint32_t v = lrint(2147483647.0 * clip_float(in[i]));
+#if BYTE_ORDER == BIG_ENDIAN
+        out[3 * i]     = v >> 24;
+        out[3 * i + 1] = v >> 16;
+        out[3 * i + 2] = v >> 8;
+#else
+        out[3 * i]     = v >> 8;
+        out[3 * i + 1] = v >> 16;
+        out[3 * i + 2] = v >> 24;
+#endif
+    }
+}
+
+static void s24_to_float_c(const uint8_t *in, float *out, int len)
+{
+    for (int i = 0; i < len; i++) {
+        const uint8_t *p = in + 3 * i;
+#if BYTE_ORDER == BIG_ENDIAN
+        uint32_t v = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8);
+#else
+        uint32_t v = (p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24);
+#endif
+        out[i] = (1.0 / 2147483648.0) * (int32_t)v;
+    }
+}
+
+#if HAVE_SSE2
+static const float __attribute__((aligned(16)))
+    one[4]      = { 1.0, 1.0, 1.0, 1.0 },
+    minus_one[4] = { -1.0, -1.0, -1.0, -1.0 },
+    s16_max[4]  = { 32767.0, 32767.0, 32767.0, 32767.0 },
+    s16_inv[4]  = { 1.0 / 32768, 1.0 / 32768, 1.0 / 32768, 1.0 / 32768 },
+    s32_max[4]  = { 2147483648.0, 2147483648.0, 2147483648.0, 2147483648.0 },
+    s32_inv[4]  = { 1.0 / 2147483648.0, 1.0 / 2147483648.0,
+                    1.0 / 2147483648.0, 1.0 / 2147483648.0 };
+
+// len must be a multiple of 8
+static void float_to_s16_sse2(const float *in, int16_t *out, int len)
+{
+    intptr_t i = -(intptr_t)len;
+    __asm__ volatile(
+        "movaps        %3, %%xmm2 \n"
+        "movaps        %4, %%xmm3 \n"
+        "movaps        %5, %%xmm4 \n"
+        "1: \n"
+        "movups      (%1,%0,4), %%xmm0 \n"
+        "movups    16(%1,%0,4), %%xmm1 \n"
+        "minps     %%xmm2, %%xmm0 \n"
+        "minps     %%xmm2, %%xmm1 \n"
+        "maxps     %%xmm3, %%xmm0 \n"
+        "maxps     %%xmm3, %%xmm1 \n"
+        "mulps     %%xmm4, %%xmm0 \n"
+        "mulps     %%xmm4, %%xmm1 \n"
+        "cvtps2dq  %%xmm0, %%xmm0 \n"
+        "cvtps2dq  %%xmm1, %%xmm1 \n"
+        "packssdw  %%xmm1, %%xmm0 \n"
+        "movdqu    %%xmm0, (%2,%0,2) \n"
+        "add           $8, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i)
+        : "r"(in + len), "r"(out + len),
+          "m"(*one), "m"(*minus_one), "m"(*s16_max)
+        : "memory"
+    );
+}
+
+// len must be a multiple of 8
+static void s16_to_float_sse2(const int16_t *in, float *out, int len)
+{
+    intptr_t i = -(intptr_t)len;
+    __asm__ volatile(
+        "movaps        %3, %%xmm2 \n"
+        "1: \n"
+        "movdqu    (%1,%0,2), %%xmm0 \n"
+        "movdqa    %%xmm0, %%xmm1 \n"
+        "punpcklwd %%xmm0, %%xmm0 \n"
+        "punpckhwd %%xmm1, %%xmm1 \n"
+        "psrad        $16, %%xmm0 \n"
+        "psrad        $16, %%xmm1 \n"
+        "cvtdq2ps  %%xmm0, %%xmm0 \n"
+        "cvtdq2ps  %%xmm1, %%xmm1 \n"
+        "mulps     %%xmm2, %%xmm0 \n"
+        "mulps     %%xmm2, %%xmm1 \n"
+        "movups    %%xmm0,   (%2,%0,4) \n"
+        "movups    %%xmm1, 16(%2,%0,4) \n"
+        "add           $8, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i)
+        : "r"(in + len), "r"(out + len), "m"(*s16_inv)
+        : "memory"
+    );
+}
+
+/* len must be a multiple of 4. cvtps2dq returns 0x80000000 for 2^31, so
+ * that case is turned into 0x7fffffff by xoring with the compare mask. */
+static void float_to_s32_sse2(const float *in, int32_t *out, int len)
+{
+    intptr_t i = -(intptr_t)len;
+    __asm__ volatile(
+        "movaps        %3, %%xmm2 \n"
+        "movaps        %4, %%xmm3 \n"
+        "movaps        %5, %%xmm4 \n"
+        "1: \n"
+        "movups    (%1,%0,4), %%xmm0 \n"
+        "minps     %%xmm2, %%xmm0 \n"
+        "maxps     %%xmm3, %%xmm0 \n"
+        "mulps     %%xmm4, %%xmm0 \n"
+        "movaps    %%xmm0, %%xmm1 \n"
+        "cmpnltps  %%xmm4, %%xmm1 \n"
+        "cvtps2dq  %%xmm0, %%xmm0 \n"
+        "pxor      %%xmm1, %%xmm0 \n"
+        "movdqu    %%xmm0, (%2,%0,4) \n"
+        "add           $4, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i)
+        : "r"(in + len), "r"(out + len),
+          "m"(*one), "m"(*minus_one), "m"(*s32_max)
+        : "memory"
+    );
+}
+
+// len must be a multiple of 4
+static void s32_to_float_sse2(const int32_t *in, float *out, int len)
+{
+    intptr_t i = -(intptr_t)len;
+    __asm__ volatile(
+        "movaps        %3, %%xmm2 \n"
+        "1: \n"
+        "movdqu    (%1,%0,4), %%xmm0 \n"
+        "cvtdq2ps  %%xmm0, %%xmm0 \n"
+        "mulps     %%xmm2, %%xmm0 \n"
+        "movups    %%xmm0, (%2,%0,4) \n"
+        "add           $4, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i)
+        : "r"(in + len), "r"(out + len), "m"(*s32_inv)
+        : "memory"
+    );
+}
+
+/* len must be a multiple of 4. Converts to s32 like float_to_s32_sse2, then
+ * packs the upper 3 bytes of each sample; writes exactly 3 * len bytes. */
+static void float_to_s24_sse2(const float *in, uint8_t *out, int len)
+{
+    intptr_t i = -(intptr_t)len;
+    __asm__ volatile(
+        "movaps        %3, %%xmm2 \n"
+        "movaps        %4, %%xmm3 \n"
+        "movaps        %5, %%xmm4 \n"
+        "1: \n"
+        "movups    (%2,%0,4), %%xmm0 \n"
+        "minps     %%xmm2, %%xmm0 \n"
+        "maxps     %%xmm3, %%xmm0 \n"
+        "mulps     %%xmm4, %%xmm0 \n"
+        "movaps    %%xmm0, %%xmm1 \n"
+        "cmpnltps  %%xmm4, %%xmm1 \n"
+        "cvtps2dq  %%xmm0, %%xmm0 \n"
+        "pxor      %%xmm1, %%xmm0 \n"
+        // [a b c d] -> a | b << 24, c | d << 24 in the two qwords
+        "psrld         $8, %%xmm0 \n"
+        "movdqa    %%xmm0, %%xmm1 \n"
+        "psllq        $32, %%xmm1 \n"
+        "psrlq        $32, %%xmm1 \n"
+        "psrlq        $32, %%xmm0 \n"
+        "psllq        $24, %%xmm0 \n"
+        "por       %%xmm1, %%xmm0 \n"
+        // bytes 0-5 and 8-13 -> 0-11
+        "movdqa    %%xmm0, %%xmm1 \n"
+        "psrldq        $8, %%xmm1 \n"
+        "movdqa    %%xmm1, %%xmm5 \n"
+        "psllq        $48, %%xmm5 \n"
+        "por       %%xmm5, %%xmm0 \n"
+        "psrldq        $2, %%xmm1 \n"
+        "movq      %%xmm0,  (%1) \n"
+        "movd      %%xmm1, 8(%1) \n"
+        "add          $12, %1 \n"
+        "add           $4, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i), "+&r"(out)
+        : "r"(in + len), "m"(*one), "m"(*minus_one), "m"(*s32_max)
+        : "memory"
+    );
+}
+
+/* len must be a multiple of 4, and 4 more bytes after the 3 * len input
+ * bytes must be readable. */
+static void s24_to_float_sse2(const uint8_t *in, float *out, int len)
+{
+    intptr_t i = -(intptr_t)len;
+    __asm__ volatile(
+        "movaps        %3, %%xmm4 \n"
+        "1: \n"
+        // dwords at byte offsets 0, 3, 6 and 9
+        "movdqu       (%1), %%xmm0 \n"
+        "movdqa    %%xmm0, %%xmm1 \n"
+        "movdqa    %%xmm0, %%xmm2 \n"
+        "movdqa    %%xmm0, %%xmm3 \n"
+        "psrldq        $3, %%xmm1 \n"
+        "psrldq        $6, %%xmm2 \n"
+        "psrldq        $9, %%xmm3 \n"
+        "punpckldq %%xmm1, %%xmm0 \n"
+        "punpckldq %%xmm3, %%xmm2 \n"
+        "punpcklqdq %%xmm2, %%xmm0 \n"
+        "pslld         $8, %%xmm0 \n"
+        "cvtdq2ps  %%xmm0, %%xmm0 \n"
+        "mulps     %%xmm4, %%xmm0 \n"
+        "movups    %%xmm0, (%2,%0,4) \n"
+        "add          $12, %1 \n"
+        "add           $4, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i), "+&r"(in)
+        : "r"(out + len), "m"(*s32_inv)
+        : "memory"
+    );
+}
+#endif
+
+#if HAVE_SSE
+
+/* Stereo planar -> interleaved for the first n of samples values per
+ * channel, n must be a multiple of 4 */
+static void interleave_2ch_sse(const uint32_t *in, uint32_t *out, int n,
+                               int samples)
+{
+    intptr_t i = -(intptr_t)n;
+    __asm__ volatile(
+        "1: \n"
+        "movups    (%1,%0,4), %%xmm0 \n"
+        "movups    (%2,%0,4), %%xmm1 \n"
+        "movaps    %%xmm0, %%xmm2 \n"
+        "unpcklps  %%xmm1, %%xmm0 \n"
+        "unpckhps  %%xmm1, %%xmm2 \n"
+        "movups    %%xmm0,   (%3,%0,8) \n"
+        "movups    %%xmm2, 16(%3,%0,8) \n"
+        "add           $4, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i)
+        : "r"(in + n), "r"(in + samples + n), "r"(out + 2 * n)
+        : "memory"
+    );
+}
+
+// Stereo interleaved -> planar, same arguments as above
+static void deinterleave_2ch_sse(const uint32_t *in, uint32_t *out, int n,
+                                 int samples)
+{
+    intptr_t i = -(intptr_t)n;
+    __asm__ volatile(
+        "1: \n"
+        "movups      (%1,%0,8), %%xmm0 \n"
+        "movups    16(%1,%0,8), %%xmm1 \n"
+        "movaps    %%xmm0, %%xmm2 \n"
+        "shufps $0x88, %%xmm1, %%xmm0 \n"
+        "shufps $0xdd, %%xmm1, %%xmm2 \n"
+        "movups    %%xmm0, (%2,%0,4) \n"
+        "movups    %%xmm2, (%3,%0,4) \n"
+        "add           $4, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i)
+        : "r"(in + 2 * n), "r"(out + n), "r"(out + samples + n)
+        : "memory"
+    );
+}
+#endif
+
+void af_float_to_s16(const float *in, int16_t *out, int len)
+{
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2 && len >= 8) {
+        int n = len & ~7;
+        float_to_s16_sse2(in, out, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+#endif
+    float_to_s16_c(in, out, len);
+}
+
+void af_s16_to_float(const int16_t *in, float *out, int len)
+{
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2 && len >= 8) {
+        int n = len & ~7;
+        s16_to_float_sse2(in, out, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+#endif
+    s16_to_float_c(in, out, len);
+}
+
+void af_float_to_s32(const float *in, int32_t *out, int len)
+{
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2 && len >= 4) {
+        int n = len & ~3;
+        float_to_s32_sse2(in, out, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+#endif
+    float_to_s32_c(in, out, len);
+}
+
+void af_s32_to_float(const int32_t *in, float *out, int len)
+{
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2 && len >= 4) {
+        int n = len & ~3;
+        s32_to_float_sse2(in, out, n);
+        in += n;
+        out += n;
+        len -= n;
+    }
+#endif
+    s32_to_float_c(in, out, len);
+}
+
+void af_float_to_s24(const float *in, uint8_t *out, int len)
+{
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2 && len >= 4) {
+        int n = len & ~3;
+        float_to_s24_sse2(in, out, n);
+        in += n;
+        out += 3 * n;
+        len -= n;
+    }
+#endif
+    float_to_s24_c(in, out, len);
+}
+
+void af_s24_to_float(const uint8_t *in, float *out, int len)
+{
+#if HAVE_SSE2
+    // The kernel reads 4 bytes past the last sample it converts
+    if (gCpuCaps.hasSSE2 && len >= 6) {
+        int n = (len - 2) & ~3;
+        s24_to_float_sse2(in, out, n);
+        in += 3 * n;
+        out += n;
+        len -= n;
+    }
+#endif
+    s24_to_float_c(in, out, len);
+}
+
+void af_float_to_s16_dither(const float *in, int16_t *out, int len,
+                            uint32_t *seed)
+{
+    uint32_t r = *seed;
+    for (int i = 0; i < len; i++) {
+        // Difference of two uniform values in [0, 1) is triangular in (-1, 1)
+        r = r * 1664525 + 1013904223;
+        int32_t a = r >> 8;
+        r = r * 1664525 + 1013904223;
+        int32_t b = r >> 8;
+        float d = (a - b) * (1.0f / 16777216.0f);
+        float v = 32767.0f * clip_float(in[i]) + d;
+        out[i] = lrintf(v > 32767.0f ? 32767.0f : v < -32768.0f ? -32768.0f : v);
+    }
+    *seed = r;
+}
+
+void af_interleave_32(const uint32_t *in, uint32_t *out, int nch, int samples)
+{
+    int start = 0;
+#if HAVE_SSE
+    if (nch == 2 && gCpuCaps.hasSSE) {
+        start = samples & ~3;
+        if (start)
+            interleave_2ch_sse(in, out, start, samples);
+    }
+#endif
+    for (int ch = 0; ch < nch; ch++) {
+        const uint32_t *src = in + ch * samples;
+        uint32_t *dst = out + ch;
+        for (int i = start; i < samples; i++)
+            dst[i * nch] = src[i];
+    }
+}
+
+void af_deinterleave_32(const uint32_t *in, uint32_t *out, int nch,
+                        int samples)
+{
+    int start = 0;
+#if HAVE_SSE
+    if (nch == 2 && gCpuCaps.hasSSE) {
+        start = samples & ~3;
+        if (start)
+            deinterleave_2ch_sse(in, out, start, samples);
+    }
+#endif
+    for (int ch = 0; ch < nch; ch++) {
+        const uint32_t *src = in + ch;
+        uint32_t *dst = out + ch * samples;
+        for (int i = start; i < samples; i++)
+            dst[i] = src[i * nch];
+    }
+}
+
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+CpuCaps gCpuCaps;
+
+#define SAMPLES (1024 * 1024 + 6)
+#define RUNS 50
+
+static double bench(void (*fn)(void *, void *), void *in, void *out)
+{
+    clock_t start = clock();
+    for (int n = 0; n < RUNS; n++)
+        fn(in, out);
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+    // seconds of 48 kHz stereo audio converted per second
+    return (double)SAMPLES * RUNS / 96000 / secs;
+}
+
+static void run_f2s16(void *in, void *out)
+{
+    af_float_to_s16(in, out, SAMPLES);
+}
+
+static void run_s162f(void *in, void *out)
+{
+    af_s16_to_float(in, out, SAMPLES);
+}
+
+static void run_f2s32(void *in, void *out)
+{
+    af_float_to_s32(in, out, SAMPLES);
+}
+
+static void run_s322f(void *in, void *out)
+{
+    af_s32_to_float(in, out, SAMPLES);
+}
+
+static void run_f2s24(void *in, void *out)
+{
+    af_float_to_s24(in, out, SAMPLES);
+}
+
+static void run_s242f(void *in, void *out)
+{
+    af_s24_to_float(in, out, SAMPLES);
+}
+
+static void run_il(void *in, void *out)
+{
+    af_interleave_32(in, out, 2, SAMPLES / 2);
+}
+
+static void run_dil(void *in, void *out)
+{
+    af_deinterleave_32(in, out, 2, SAMPLES / 2);
+}
+
+static void run_dither(void *in, void *out)
+{
+    uint32_t seed = 0;
+    af_float_to_s16_dither(in, out, SAMPLES, &seed);
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(void *, void *);
+    int insize, outsize;
+} tests[] = {
+    { "float -> s16",    run_f2s16,  4, 2 },
+    { "s16 -> float",    run_s162f,  2, 4 },
+    { "float -> s32",    run_f2s32,  4, 4 },
+    { "s32 -> float",    run_s322f,  4, 4 },
+    { "float -> s24",    run_f2s24,  4, 3 },
+    { "s24 -> float",    run_s242f,  3, 4 },
+    { "interleave",      run_il,     4, 4 },
+    { "deinterleave",    run_dil,    4, 4 },
+    { "float -> s16 dithered", run_dither, 4, 2 },
+};
+
+int main(void)
+{
+    float *in = malloc(SAMPLES * 4);
+    void *out_c = malloc(SAMPLES * 4), *out_simd = malloc(SAMPLES * 4);
+    int errors = 0;
+
+    srand(1);
+    for (int i = 0; i < SAMPLES; i++)
+        in[i] = 2.5 * rand() / RAND_MAX - 1.25;
+    in[0] = 1.0;
+    in[1] = -1.0;
+
+    for (int t = 0; t < sizeof(tests) / sizeof(tests[0]); t++) {
+        // Integer input is made from the float input so it covers the range
+        int32_t *iin = (int32_t *)malloc(SAMPLES * 4);
+        if (tests[t].insize == 2)
+            af_float_to_s16(in, (int16_t *)iin, SAMPLES);
+        else if (tests[t].insize == 3)
+            af_float_to_s24(in, (uint8_t *)iin, SAMPLES);
+        else if (tests[t].fn == run_s322f)
+            af_float_to_s32(in, iin, SAMPLES);
+        else
+            memcpy(iin, in, SAMPLES * 4);
+
+        gCpuCaps.hasSSE = gCpuCaps.hasSSE2 = 0;
+        double c = bench(tests[t].fn, iin, out_c);
+        gCpuCaps.hasSSE = HAVE_SSE;
+        gCpuCaps.hasSSE2 = HAVE_SSE2;
+        double simd = bench(tests[t].fn, iin, out_simd);
+
+        int mismatch = 0;
+        if (tests[t].outsize == 3) {
+            // compare the upper 24 bits, allowing an off-by-one
+            for (int i = 0; i < SAMPLES; i++) {
+                int32_t a = 0, b = 0;
+                memcpy((char *)&a + 1, (uint8_t *)out_c + 3 * i, 3);
+                memcpy((char *)&b + 1, (uint8_t *)out_simd + 3 * i, 3);
+                if (abs((a >> 8) - (b >> 8)) > 1)
+                    mismatch++;
+            }
+        }
+        int n = tests[t].outsize == 3 ? 0 : SAMPLES * tests[t].outsize / 4;
+        for (int i = 0; i < n; i++) {
+            int32_t a = ((int32_t *)out_c)[i], b = ((int32_t *)out_simd)[i];
+            // allow an off-by-one in the low bit of 32 bit results
+            if (a != b && !(tests[t].outsize == 4 && abs(a - b) <= 256))
+                mismatch++;
+        }
+        errors += mismatch;
+        printf("%-22s C %8.0fx  SIMD %8.0fx realtime  %s\n", tests[t].name,
+               c, simd, mismatch ? "MISMATCH" : "ok");
+        free(iin);
+    }
+    free(in);
+    free(out_c);
+    free(out_simd);
+    return !!errors;
+}
+
+#endif
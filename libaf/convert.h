@@ -0,0 +1,54 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_AF_CONVERT_H
+#define MPLAYER_AF_CONVERT_H
+
+#include <stdint.h>
+
+/* Sample conversion kernels shared by the audio filters. All lengths are
+ * in samples. The SIMD versions are selected at runtime; the results are
+ * the same as the C versions except for the rounding of the lowest bit in
+ * the 32 bit conversions.
+ *
+ * Float samples are in the range [-1, 1] and are clipped when converted to
+ * integers. Conversion from float to an integer of the same or a smaller
+ * size may be done in place (in == out).
+ */
+
+void af_float_to_s16(const float *in, int16_t *out, int len);
+void af_s16_to_float(const int16_t *in, float *out, int len);
+void af_float_to_s32(const float *in, int32_t *out, int len);
+void af_s32_to_float(const int32_t *in, float *out, int len);
+// 24 bit samples packed into 3 bytes, native byte order
+void af_float_to_s24(const float *in, uint8_t *out, int len);
+void af_s24_to_float(const uint8_t *in, float *out, int len);
+
+/* Same as af_float_to_s16, but adds triangular (TPDF) dither of +-1 LSB
+ * before rounding. *seed is the state of the noise generator and is
+ * updated; any value is fine as the initial state. */
+void af_float_to_s16_dither(const float *in, int16_t *out, int len,
+                            uint32_t *seed);
+
+/* Conversion between planar (nch blocks of samples values each) and
+ * interleaved layout of 4 byte samples. in and out must not overlap. */
+void af_interleave_32(const uint32_t *in, uint32_t *out, int nch, int samples);
+void af_deinterleave_32(const uint32_t *in, uint32_t *out, int nch,
+                        int samples);
+
+#endif /* MPLAYER_AF_CONVERT_H */
@@ -20,32 +20,175 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include "af.h"
 #include "dsp.h"
 
 /******************************************************************************
 *  FIR filter implementations
 ******************************************************************************/
 
-/* C implementation of FIR filter y=w*x
+/* FIR filter y=w*x
 
-   n number of filter taps, where mod(n,4)==0
+   n number of filter taps
    w filter taps
    x input signal must be a circular buffer which is indexed backwards
+
+   The taps are processed 4 at a time with the SIMD dot product dot, the
+   rest one by one.
 */
-inline FLOAT_TYPE af_filter_fir(register unsigned int n, const FLOAT_TYPE* w,
-                                const FLOAT_TYPE* x)
+FLOAT_TYPE af_filter_fir(af_dot_product_t dot, unsigned int n,
+                         const FLOAT_TYPE* w, const FLOAT_TYPE* x)
 {
-  register FLOAT_TYPE y; // Output
-  y = 0.0;
-  do{
-    n--;
-    y+=w[n]*x[n];
-  }while(n != 0);
+  unsigned int n4 = n & ~3;
+  FLOAT_TYPE y = 0.0;
+  if(n4)
+    y = dot(w, x, n4);
+  for(;n4<n;n4++)
+    y+=w[n4]*x[n4];
   return y;
 }
 
+/******************************************************************************
+*  Biquad filter bank
+******************************************************************************/
+
+static void biquad_run_c(FLOAT_TYPE* x, const FLOAT_TYPE* c, FLOAT_TYPE* q,
+                         int sections)
+{
+  int i,j;
+  for(i=0;i<sections;i++){
+    for(j=0;j<4;j++){
+      FLOAT_TYPE w = c[j]*x[j] + c[4+j]*q[j] + c[8+j]*q[4+j];
+      FLOAT_TYPE y = c[12+j]*x[j] + c[16+j]*w + c[20+j]*q[j] + c[24+j]*q[4+j];
+      q[4+j] = q[j];
+      q[j]   = w;
+      x[j]   = y;
+    }
+    c += 4*AF_BIQUAD_COEFS;
+    q += 8;
+  }
+}
+
+#if HAVE_SSE
+static void biquad_run_sse(FLOAT_TYPE* x, const FLOAT_TYPE* c, FLOAT_TYPE* q,
+                           int sections)
+{
+  __asm__ volatile(
+    "movups      (%3), %%xmm0 \n" // x
+    "1: \n"
+    "movups      (%1), %%xmm1 \n" // q0
+    "movups    16(%1), %%xmm2 \n" // q1
+    "movups      (%0), %%xmm3 \n"
+    "mulps     %%xmm0, %%xmm3 \n"
+    "movups    16(%0), %%xmm4 \n"
+    "mulps     %%xmm1, %%xmm4 \n"
+    "addps     %%xmm4, %%xmm3 \n"
+    "movups    32(%0), %%xmm4 \n"
+    "mulps     %%xmm2, %%xmm4 \n"
+    "addps     %%xmm4, %%xmm3 \n" // w
+    "movups    48(%0), %%xmm5 \n"
+    "mulps     %%xmm0, %%xmm5 \n"
+    "movups    64(%0), %%xmm4 \n"
+    "mulps     %%xmm3, %%xmm4 \n"
+    "addps     %%xmm4, %%xmm5 \n"
+    "movups    80(%0), %%xmm4 \n"
+    "mulps     %%xmm1, %%xmm4 \n"
+    "addps     %%xmm4, %%xmm5 \n"
+    "movups    96(%0), %%xmm4 \n"
+    "mulps     %%xmm2, %%xmm4 \n"
+    "addps     %%xmm4, %%xmm5 \n" // y
+    "movups    %%xmm1, 16(%1) \n"
+    "movups    %%xmm3,   (%1) \n"
+    "movaps    %%xmm5, %%xmm0 \n"
+    "add         $112, %0 \n"
+    "add          $32, %1 \n"
+    "dec           %2 \n"
+    "jnz 1b \n"
+    "movups    %%xmm0,   (%3) \n"
+    :"+&r"(c), "+&r"(q), "+&r"(sections)
+    :"r"(x)
+    :"memory"
+  );
+}
+#endif
+
+int af_biquad_init(af_biquad_t* bq, int channels, int sections)
+{
+  int groups = (channels + 3) / 4;
+  af_biquad_free(bq);
+  bq->channels = channels;
+  bq->sections = sections;
+  bq->run = biquad_run_c;
+#if HAVE_SSE
+  if(gCpuCaps.hasSSE)
+    bq->run = biquad_run_sse;
+#endif
+  // An empty bank passes data through unchanged
+  if(!channels || !sections)
+    return 0;
+  bq->coef  = calloc(groups * sections * AF_BIQUAD_COEFS * 4, sizeof(FLOAT_TYPE));
+  bq->state = calloc(groups * sections * 2 * 4, sizeof(FLOAT_TYPE));
+  if(!bq->coef || !bq->state)
+    return -1;
+  return 0;
+}
+
+void af_biquad_free(af_biquad_t* bq)
+{
+  free(bq->coef);
+  free(bq->state);
+  bq->coef = bq->state = NULL;
+  bq->channels = bq->sections = 0;
+}
+
+void af_biquad_reset(af_biquad_t* bq)
+{
+  if(bq->state)
+    memset(bq->state, 0, ((bq->channels + 3) / 4) * bq->sections * 2 * 4 *
+           sizeof(FLOAT_TYPE));
+}
+
+void af_biquad_set(af_biquad_t* bq, int ch, int section, const FLOAT_TYPE* c)
+{
+  FLOAT_TYPE* p = bq->coef + ((ch / 4) * bq->sections + section) *
+                  AF_BIQUAD_COEFS * 4 + ch % 4;
+  int i;
+  for(i=0;i<AF_BIQUAD_COEFS;i++)
+    p[i*4] = c[i];
+}
+
+void af_biquad_process(af_biquad_t* bq, FLOAT_TYPE* data, int frames,
+                       int chstep, int stride)
+{
+  int groups = (bq->channels + 3) / 4;
+  int g,i,j;
+  if(!bq->sections)
+    return;
+  for(g=0;g<groups;g++){
+    const FLOAT_TYPE* c = bq->coef + g * bq->sections * AF_BIQUAD_COEFS * 4;
+    FLOAT_TYPE* q = bq->state + g * bq->sections * 2 * 4;
+    int lanes = min(bq->channels - g * 4, 4);
+    FLOAT_TYPE* p = data + g * 4 * chstep;
+    FLOAT_TYPE x[4] = {0};
+    for(i=0;i<frames;i++){
+      for(j=0;j<lanes;j++)
+        x[j] = p[j*chstep];
+      bq->run(x, c, q, bq->sections);
+      for(j=0;j<lanes;j++)
+        p[j*chstep] = x[j];
+      p += stride;
+    }
+    // Flush denormals, which are extremely slow on most FPUs
+    for(j=0;j<bq->sections*2*4;j++)
+      if(fabs(q[j]) < 1e-30)
+        q[j] = 0;
+  }
+}
+
 /******************************************************************************
 *  FIR filter design
 ******************************************************************************/
@@ -358,3 +501,158 @@ int af_filter_szxform(const FLOAT_TYPE* a, const FLOAT_TYPE* b, FLOAT_TYPE Q, FL
 
   return 0;
 }
+
+
+#ifdef TEST
+
+#include <stdio.h>
+#include <time.h>
+
+CpuCaps gCpuCaps;
+
+#define FRAMES (48000 * 10)
+
+// The scalar band loop af_equalizer used before the biquad bank
+static void eq_ref(float* data, int nch, int frames, const float* c,
+                   float (*q)[10][2], int sections)
+{
+  int ch,i,k;
+  for(ch=0;ch<nch;ch++){
+    float* p = data + ch;
+    for(i=0;i<frames;i++){
+      float x = *p;
+      for(k=0;k<sections;k++){
+        const float* ck = c + k*AF_BIQUAD_COEFS;
+        float* wq = q[ch][k];
+        float w = x*ck[0] + wq[0]*ck[1] + wq[1]*ck[2];
+        x = ck[3]*x + ck[4]*w + ck[5]*wq[0] + ck[6]*wq[1];
+        wq[1] = wq[0];
+        wq[0] = w;
+      }
+      *p = x;
+      p += nch;
+    }
+  }
+}
+
+// Seconds of 48 kHz audio processed per second of CPU time
+static double rate(clock_t start)
+{
+  return (double)FRAMES / 48000 / ((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+static void bench_biquad(const char* name, int nch, int sections)
+{
+  float* in  = malloc(FRAMES * nch * sizeof(float));
+  float* ref = malloc(FRAMES * nch * sizeof(float));
+  float* out = malloc(FRAMES * nch * sizeof(float));
+  float (*q)[10][2] = calloc(nch, sizeof(*q));
+  float c[10][AF_BIQUAD_COEFS];
+  af_biquad_t bq = {0};
+  double t_ref, t_c, t_simd, err = 0;
+  clock_t start;
+  int i,k;
+
+  for(i=0;i<FRAMES*nch;i++)
+    in[i] = 2.0 * rand() / RAND_MAX - 1.0;
+  // Band-pass sections with gain, as set up by af_equalizer
+  for(k=0;k<sections;k++){
+    float w = M_PI * (k + 1) / (sections + 2);
+    float r = 0.9;
+    float cf[AF_BIQUAD_COEFS] = {0.05, 2*r*cos(w), -r*r, 1.0, 0.5, 0.0, -0.5};
+    memcpy(c[k], cf, sizeof(cf));
+  }
+
+  memcpy(ref, in, FRAMES * nch * sizeof(float));
+  start = clock();
+  eq_ref(ref, nch, FRAMES, c[0], q, sections);
+  t_ref = rate(start);
+
+  af_biquad_init(&bq, nch, sections);
+  for(i=0;i<nch;i++)
+    for(k=0;k<sections;k++)
+      af_biquad_set(&bq, i, k, c[k]);
+
+  bq.run = biquad_run_c;
+  memcpy(out, in, FRAMES * nch * sizeof(float));
+  start = clock();
+  af_biquad_process(&bq, out, FRAMES, 1, nch);
+  t_c = rate(start);
+
+  t_simd = 0;
+#if HAVE_SSE
+  bq.run = biquad_run_sse;
+  af_biquad_reset(&bq);
+  memcpy(out, in, FRAMES * nch * sizeof(float));
+  start = clock();
+  af_biquad_process(&bq, out, FRAMES, 1, nch);
+  t_simd = rate(start);
+#endif
+  for(i=0;i<FRAMES*nch;i++)
+    err = max(err, fabs(out[i] - ref[i]));
+
+  printf("%-26s scalar %6.0fx  C %6.0fx  SSE %6.0fx realtime  max err %g\n",
+         name, t_ref, t_c, t_simd, err);
+  af_biquad_free(&bq);
+  free(in); free(ref); free(out); free(q);
+}
+
+static float dot_ref(const float* a, const float* b, int len)
+{
+  float y = 0;
+  int i;
+  for(i=0;i<len;i++)
+    y += a[i]*b[i];
+  return y;
+}
+
+static void bench_fir(const char* name, int n)
+{
+  float* w = malloc(n * sizeof(float));
+  float* x = malloc((FRAMES + n) * sizeof(float));
+  af_dot_product_t dot;
+  double t_ref, t_simd, err = 0;
+  volatile float sink;
+  clock_t start;
+  int i;
+
+  for(i=0;i<n;i++)
+    w[i] = 1.0 / (i + 1);
+  for(i=0;i<FRAMES+n;i++)
+    x[i] = 2.0 * rand() / RAND_MAX - 1.0;
+
+  start = clock();
+  for(i=0;i<FRAMES;i++)
+    sink = af_filter_fir(dot_ref, n, w, x + i);
+  t_ref = rate(start);
+
+  gCpuCaps.hasSSE = HAVE_SSE;
+  dot = af_get_dot_product();
+  start = clock();
+  for(i=0;i<FRAMES;i++)
+    sink = af_filter_fir(dot, n, w, x + i);
+  t_simd = rate(start);
+  for(i=0;i<FRAMES;i+=97)
+    err = max(err, fabs(af_filter_fir(dot, n, w, x + i) -
+                        af_filter_fir(dot_ref, n, w, x + i)));
+  (void)sink;
+
+  printf("%-26s scalar %6.0fx  SSE %6.0fx realtime  max err %g\n",
+         name, t_ref, t_simd, err);
+  free(w); free(x);
+}
+
+int main(void)
+{
+  srand(1);
+  bench_biquad("equalizer 10 bands 2ch", 2, 10);
+  bench_biquad("equalizer 10 bands 6ch", 6, 10);
+  bench_biquad("equalizer 10 bands 8ch", 8, 10);
+  bench_biquad("sub low-pass 1ch", 1, 2);
+  bench_fir("surround FIR 32 taps", 32);
+  bench_fir("hrtf FIR 64 taps", 64);
+  bench_fir("hrtf bass FIR 193 taps", 193);
+  return 0;
+}
+
+#endif
@@ -25,6 +25,7 @@
 #ifndef MPLAYER_FILTER_H
 #define MPLAYER_FILTER_H
 
+#include "af.h"
 
 // Design and implementation of different types of digital filters
 
@@ -54,7 +55,9 @@
 #define ODD         0x00000010 // Make filter HP
 
 // Exported functions
-FLOAT_TYPE af_filter_fir(unsigned int n, const FLOAT_TYPE* w, const FLOAT_TYPE* x);
+// dot is the result of af_get_dot_product(), looked up once by the caller
+FLOAT_TYPE af_filter_fir(af_dot_product_t dot, unsigned int n,
+                         const FLOAT_TYPE* w, const FLOAT_TYPE* x);
 
 int af_filter_design_fir(unsigned int n, FLOAT_TYPE* w, const FLOAT_TYPE* fc,
                          unsigned int flags, FLOAT_TYPE opt);
@@ -63,6 +66,39 @@ int af_filter_szxform(const FLOAT_TYPE* a, const FLOAT_TYPE* b, FLOAT_TYPE Q,
                       FLOAT_TYPE fc, FLOAT_TYPE fs, FLOAT_TYPE *k,
                       FLOAT_TYPE *coef);
 
+/* Bank of cascaded biquad (2nd order IIR) sections, one cascade per
+   channel. Four channels are processed in parallel, one per SIMD lane.
+   Each section computes
+
+     w  = c[0]*x + c[1]*q0 + c[2]*q1
+     y  = c[3]*x + c[4]*w  + c[5]*q0 + c[6]*q1
+     q1 = q0, q0 = w
+
+   and feeds y to the next section. Denormal filter state is flushed to
+   zero after each block.
+*/
+#define AF_BIQUAD_COEFS 7
+
+typedef struct af_biquad_s
+{
+  int channels;
+  int sections;
+  FLOAT_TYPE* coef;  // [channels/4][sections][AF_BIQUAD_COEFS][4]
+  FLOAT_TYPE* state; // [channels/4][sections][2][4]
+  void (*run)(FLOAT_TYPE* x, const FLOAT_TYPE* coef, FLOAT_TYPE* state,
+              int sections);
+} af_biquad_t;
+
+int af_biquad_init(af_biquad_t* bq, int channels, int sections);
+void af_biquad_free(af_biquad_t* bq);
+void af_biquad_reset(af_biquad_t* bq);
+void af_biquad_set(af_biquad_t* bq, int ch, int section, const FLOAT_TYPE* c);
+
+/* Filter frames samples in place. Channel ch starts at data[ch*chstep],
+   consecutive samples of a channel are stride values apart. */
+void af_biquad_process(af_biquad_t* bq, FLOAT_TYPE* data, int frames,
+                       int chstep, int stride);
+
 /* Add new data to circular queue designed to be used with a FIR
    filter. xq is the circular queue, in pointing at the new sample, xi
    current index for xq and n the length of the filter. xq must be n*2
@@ -97,6 +97,7 @@ const struct af_fmt_entry af_fmtstr_table[] = {
     { "floatle", AF_FORMAT_FLOAT_LE },
     { "floatbe", AF_FORMAT_FLOAT_BE },
     { "floatne", AF_FORMAT_FLOAT_NE },
+    { "floatp", AF_FORMAT_FLOATP },
 
     {0}
 };
@@ -66,7 +66,12 @@
 #define AF_FORMAT_IEC61937      (6<<6)
 #define AF_FORMAT_SPECIAL_MASK	(7<<6)
 
-#define AF_FORMAT_MASK          ((1<<9)-1)
+// Sample layout (see af_data_t)
+#define AF_FORMAT_INTERLEAVED	(0<<9)
+#define AF_FORMAT_PLANAR	(1<<9) // Only valid with AF_FORMAT_FLOAT_NE
+#define AF_FORMAT_LAYOUT_MASK	(1<<9)
+
+#define AF_FORMAT_MASK          ((1<<10)-1)
 
 // PREDEFINED formats
 
@@ -116,10 +121,13 @@
 #define AF_FORMAT_IEC61937_NE AF_FORMAT_IEC61937_LE
 #endif
 
+#define AF_FORMAT_FLOATP	(AF_FORMAT_FLOAT_NE|AF_FORMAT_PLANAR)
+
 #define AF_FORMAT_UNKNOWN (-1)
 
 #define AF_FORMAT_IS_AC3(fmt) (((fmt) & AF_FORMAT_SPECIAL_MASK) == AF_FORMAT_AC3)
 #define AF_FORMAT_IS_IEC61937(fmt) (((fmt) & AF_FORMAT_SPECIAL_MASK) == AF_FORMAT_IEC61937)
+#define AF_FORMAT_IS_PLANAR(fmt) (((fmt) & AF_FORMAT_LAYOUT_MASK) == AF_FORMAT_PLANAR)
 
 struct af_fmt_entry {
     const char *name;
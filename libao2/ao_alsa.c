@@ -34,8 +34,14 @@
 #include <math.h>
 #include <string.h>
 #include <alloca.h>
+#include <stdbool.h>
+
+#include <libavutil/common.h>
 
 #include "config.h"
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include "subopt-helper.h"
 #include "mixer.h"
 #include "mp_msg.h"
@@ -66,12 +72,93 @@ static snd_pcm_sw_params_t *alsa_swparams;
 
 #define BUFFER_TIME 500000  // 0.5 s
 #define FRAGCOUNT 16
+// Defaults with the lowlatency suboption (in microseconds)
+#define LOWLATENCY_BUFFER_TIME 50000
+#define LOWLATENCY_PERIOD_TIME 10000
 
 static size_t bytes_per_sample;
 
 static int alsa_can_pause;
 static snd_pcm_sframes_t prepause_frames;
 
+// Number of times the device ran out of data (and played silence).
+static int underruns;
+
+/* The feeder thread writes the audio from a ring buffer to the device, so
+ * that playback doesn't underrun while the playloop is blocked (e.g. on
+ * video decoding). play() only copies data into the ring buffer.
+ *
+ * When both locks are needed, device_lock is taken first. lock is never
+ * held across ALSA calls, so play() and get_space() don't wait for the
+ * device. Without pthreads, the thread is never started.
+ */
+static struct {
+    bool running;
+#if HAVE_PTHREADS
+    pthread_t thread;
+    // Serializes all use of alsa_handler (and underruns) while the thread
+    // is running.
+    pthread_mutex_t device_lock;
+    // Protects the fields below
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // new data, unpausing, quit request
+    pthread_cond_t drained;     // ring buffer became empty
+#endif
+    bool quit;
+    bool paused;
+    unsigned char *ring;
+    int ring_size;
+    int read_pos;               // first byte that can be read
+    int read_len;               // number of bytes that can be read
+    unsigned char *chunk;       // one period of data being written
+    snd_pcm_uframes_t period_frames;
+    snd_pcm_uframes_t buffer_frames;
+} feeder;
+
+static void lock_device(void)
+{
+#if HAVE_PTHREADS
+    if (feeder.running)
+        pthread_mutex_lock(&feeder.device_lock);
+#endif
+}
+
+static void unlock_device(void)
+{
+#if HAVE_PTHREADS
+    if (feeder.running)
+        pthread_mutex_unlock(&feeder.device_lock);
+#endif
+}
+
+static void lock_ring(void)
+{
+#if HAVE_PTHREADS
+    if (feeder.running)
+        pthread_mutex_lock(&feeder.lock);
+#endif
+}
+
+static void unlock_ring(void)
+{
+#if HAVE_PTHREADS
+    if (feeder.running)
+        pthread_mutex_unlock(&feeder.lock);
+#endif
+}
+
+// Tell the feeder thread that there is new data or it was unpaused
+static void wake_feeder(void)
+{
+#if HAVE_PTHREADS
+    if (feeder.running)
+        pthread_cond_signal(&feeder.wakeup);
+#endif
+}
+
+// Size of the ring buffer. It adds to the latency of the device buffer.
+#define FEEDER_PERIODS 4
+
 #define ALSA_DEVICE_SIZE 256
 
 static void alsa_error_handler(const char *file, int line, const char *function,
@@ -96,6 +183,11 @@ static void alsa_error_handler(const char *file, int line, const char *function,
 static int control(int cmd, void *arg)
 {
   switch(cmd) {
+  case AOCONTROL_GET_UNDERRUNS:
+    lock_device();
+    *(int *)arg = underruns;
+    unlock_device();
+    return CONTROL_OK;
   case AOCONTROL_GET_MUTE:
   case AOCONTROL_SET_MUTE:
   case AOCONTROL_GET_VOLUME:
@@ -275,7 +367,15 @@ static void print_help (void)
     "[AO_ALSA]   noblock\n"\
     "[AO_ALSA]     Opens device in non-blocking mode.\n"\
     "[AO_ALSA]   device=<device-name>\n"\
-    "[AO_ALSA]     Sets device (change , to . and : to =)\n");
+    "[AO_ALSA]     Sets device (change , to . and : to =)\n"\
+    "[AO_ALSA]   nothread\n"\
+    "[AO_ALSA]     Write to the device from the main thread.\n"\
+    "[AO_ALSA]   buffer-time=<ms>\n"\
+    "[AO_ALSA]     Size of the device buffer.\n"\
+    "[AO_ALSA]   period-time=<ms>\n"\
+    "[AO_ALSA]     Size of a device period.\n"\
+    "[AO_ALSA]   lowlatency\n"\
+    "[AO_ALSA]     Use small buffer and period sizes by default.\n");
 }
 
 static int str_maxlen(void *strp) {
@@ -328,6 +428,197 @@ static int try_open_device(const char *device, int open_mode, int try_ac3)
                       open_mode);
 }
 
+/* Write the given frames to the device, blocking until done. Returns the
+ * number of frames written, or <= 0 on error.
+ */
+static snd_pcm_sframes_t write_frames(void *data, int num_frames)
+{
+  snd_pcm_sframes_t res = 0;
+
+  do {
+    res = snd_pcm_writei(alsa_handler, data, num_frames);
+
+      if (res == -EINTR) {
+	/* nothing to do */
+	res = 0;
+      }
+      else if (res == -ESTRPIPE) {	/* suspend */
+	mp_tmsg(MSGT_AO,MSGL_INFO,"[AO_ALSA] Pcm in suspend mode, trying to resume.\n");
+	while ((res = snd_pcm_resume(alsa_handler)) == -EAGAIN) {
+	  unlock_device();
+	  sleep(1);
+	  lock_device();
+	}
+      }
+      if (res < 0) {
+	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Write error: %s\n", snd_strerror(res));
+	mp_tmsg(MSGT_AO,MSGL_INFO,"[AO_ALSA] Trying to reset soundcard.\n");
+	if ((res = snd_pcm_prepare(alsa_handler)) < 0) {
+	  mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm prepare error: %s\n", snd_strerror(res));
+	  return 0;
+	}
+      }
+  } while (res == 0);
+
+  return res;
+}
+
+static int ring_write(unsigned char *data, int len)
+{
+    int free = feeder.ring_size - feeder.read_len;
+    int write_pos = (feeder.read_pos + feeder.read_len) % feeder.ring_size;
+    int write_len = FFMIN(len, free);
+    int len1 = FFMIN(feeder.ring_size - write_pos, write_len);
+    int len2 = write_len - len1;
+
+    memcpy(feeder.ring + write_pos, data, len1);
+    memcpy(feeder.ring, data + len1, len2);
+
+    feeder.read_len += write_len;
+
+    return write_len;
+}
+
+#if HAVE_PTHREADS
+static int ring_read(unsigned char *data, int len)
+{
+    int read_len = FFMIN(len, feeder.read_len);
+    int len1 = FFMIN(feeder.ring_size - feeder.read_pos, read_len);
+    int len2 = read_len - len1;
+
+    memcpy(data, feeder.ring + feeder.read_pos, len1);
+    memcpy(data + len1, feeder.ring, len2);
+
+    feeder.read_len -= read_len;
+    feeder.read_pos = (feeder.read_pos + read_len) % feeder.ring_size;
+
+    return read_len;
+}
+
+// Wait on feeder.wakeup, but at most the given time (in seconds).
+static void feeder_wait(double seconds)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long long usec = now.tv_usec + (long long)(seconds * 1e6);
+    struct timespec until = {
+        .tv_sec = now.tv_sec + usec / 1000000,
+        .tv_nsec = (usec % 1000000) * 1000,
+    };
+    pthread_cond_timedwait(&feeder.wakeup, &feeder.lock, &until);
+}
+
+static void *feeder_thread(void *arg)
+{
+    pthread_mutex_lock(&feeder.lock);
+    while (!feeder.quit) {
+        int frames = feeder.read_len / bytes_per_sample;
+        if (!frames)
+            feeder.read_len = 0;  // drop incomplete frame at the end
+        if (!feeder.read_len)
+            pthread_cond_broadcast(&feeder.drained);
+        if (feeder.paused || !frames) {
+            pthread_cond_wait(&feeder.wakeup, &feeder.lock);
+            continue;
+        }
+        frames = FFMIN(frames, feeder.period_frames);
+        pthread_mutex_unlock(&feeder.lock);
+
+        // Write only if it won't block, so that device_lock is never held
+        // for long. On errors, let write_frames() do the recovery.
+        pthread_mutex_lock(&feeder.device_lock);
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa_handler);
+        if (avail < 0)
+            avail = frames;
+        if ((snd_pcm_uframes_t)avail > feeder.buffer_frames) {
+            // Ran out of data; move the application pointer forward.
+            underruns++;
+            snd_pcm_forward(alsa_handler, avail - feeder.buffer_frames);
+            avail = feeder.buffer_frames;
+        }
+        if (avail >= frames) {
+            // reset() or audio_pause() may have run since the check above
+            pthread_mutex_lock(&feeder.lock);
+            if (feeder.paused)
+                frames = 0;
+            frames = FFMIN(frames, feeder.read_len / bytes_per_sample);
+            ring_read(feeder.chunk, frames * bytes_per_sample);
+            pthread_mutex_unlock(&feeder.lock);
+            if (frames)
+                write_frames(feeder.chunk, frames);
+        }
+        pthread_mutex_unlock(&feeder.device_lock);
+
+        pthread_mutex_lock(&feeder.lock);
+        if (avail < frames)
+            feeder_wait((frames - avail) / (double)ao_data.samplerate);
+    }
+    pthread_mutex_unlock(&feeder.lock);
+    return NULL;
+}
+
+static int start_feeder(snd_pcm_uframes_t period_frames,
+                        snd_pcm_uframes_t buffer_frames)
+{
+    feeder.quit = false;
+    feeder.paused = false;
+    feeder.period_frames = period_frames;
+    feeder.buffer_frames = buffer_frames;
+    feeder.ring_size = FFMIN(buffer_frames, FEEDER_PERIODS * period_frames)
+                       * bytes_per_sample;
+    feeder.read_pos = feeder.read_len = 0;
+    feeder.ring = malloc(feeder.ring_size);
+    feeder.chunk = malloc(period_frames * bytes_per_sample);
+    if (!feeder.ring || !feeder.chunk)
+        goto error;
+    pthread_mutex_init(&feeder.device_lock, NULL);
+    pthread_mutex_init(&feeder.lock, NULL);
+    pthread_cond_init(&feeder.wakeup, NULL);
+    pthread_cond_init(&feeder.drained, NULL);
+    if (pthread_create(&feeder.thread, NULL, feeder_thread, NULL)) {
+        pthread_cond_destroy(&feeder.drained);
+        pthread_cond_destroy(&feeder.wakeup);
+        pthread_mutex_destroy(&feeder.lock);
+        pthread_mutex_destroy(&feeder.device_lock);
+        goto error;
+    }
+    feeder.running = true;
+    return 1;
+error:
+    mp_tmsg(MSGT_AO, MSGL_ERR, "[AO_ALSA] Could not start feeder thread.\n");
+    free(feeder.ring);
+    free(feeder.chunk);
+    feeder.ring = feeder.chunk = NULL;
+    return 0;
+}
+
+// Stop the feeder thread. If drain is set, write the buffered data first.
+static void stop_feeder(bool drain)
+{
+    if (!feeder.running)
+        return;
+    pthread_mutex_lock(&feeder.lock);
+    while (drain && feeder.read_len && !feeder.paused)
+        pthread_cond_wait(&feeder.drained, &feeder.lock);
+    feeder.quit = true;
+    pthread_cond_signal(&feeder.wakeup);
+    pthread_mutex_unlock(&feeder.lock);
+    pthread_join(feeder.thread, NULL);
+    feeder.running = false;
+    pthread_cond_destroy(&feeder.drained);
+    pthread_cond_destroy(&feeder.wakeup);
+    pthread_mutex_destroy(&feeder.lock);
+    pthread_mutex_destroy(&feeder.device_lock);
+    free(feeder.ring);
+    free(feeder.chunk);
+    feeder.ring = feeder.chunk = NULL;
+}
+#else
+static void stop_feeder(bool drain)
+{
+}
+#endif /* HAVE_PTHREADS */
+
 /*
     open & setup audio device
     return: 1=success 0=fail
@@ -336,6 +627,10 @@ static int init(int rate_hz, int channels, int format, int flags)
 {
     int err;
     int block;
+    int use_thread;
+    int lowlatency;
+    int buffer_time_ms;
+    int period_time_ms;
     strarg_t device;
     snd_pcm_uframes_t chunk_size;
     snd_pcm_uframes_t bufsize;
@@ -343,6 +638,10 @@ static int init(int rate_hz, int channels, int format, int flags)
     const opt_t subopts[] = {
       {"block", OPT_ARG_BOOL, &block, NULL},
       {"device", OPT_ARG_STR, &device, str_maxlen},
+      {"thread", OPT_ARG_BOOL, &use_thread, NULL},
+      {"lowlatency", OPT_ARG_BOOL, &lowlatency, NULL},
+      {"buffer-time", OPT_ARG_INT, &buffer_time_ms, int_non_neg},
+      {"period-time", OPT_ARG_INT, &period_time_ms, int_non_neg},
       {NULL}
     };
 
@@ -356,6 +655,7 @@ static int init(int rate_hz, int channels, int format, int flags)
     mp_msg(MSGT_AO,MSGL_V,"alsa-init: using ALSA %s\n", snd_asoundlib_version());
 
     prepause_frames = 0;
+    underruns = 0;
 
     snd_lib_error_set_handler(alsa_error_handler);
 
@@ -432,6 +732,10 @@ static int init(int rate_hz, int channels, int format, int flags)
     //subdevice parsing
     // set defaults
     block = 1;
+    use_thread = 1;
+    lowlatency = 0;
+    buffer_time_ms = 0;
+    period_time_ms = 0;
     /* switch for spdif
      * sets opening sequence for SPDIF
      * sets also the playback and other switches 'on the fly'
@@ -585,21 +889,34 @@ static int init(int rate_hz, int channels, int format, int flags)
       bytes_per_sample *= ao_data.channels;
       ao_data.bps = ao_data.samplerate * bytes_per_sample;
 
-	if ((err = snd_pcm_hw_params_set_buffer_time_near(alsa_handler, alsa_hwparams,
-							  &(unsigned int){BUFFER_TIME}, NULL)) < 0)
-	  {
-	    mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set buffer time near: %s\n",
-		   snd_strerror(err));
-	    return 0;
-	  }
+      unsigned int buffer_time = lowlatency ? LOWLATENCY_BUFFER_TIME
+                                            : BUFFER_TIME;
+      unsigned int period_time = lowlatency ? LOWLATENCY_PERIOD_TIME : 0;
+      if (buffer_time_ms)
+        buffer_time = buffer_time_ms * 1000;
+      if (period_time_ms)
+        period_time = period_time_ms * 1000;
 
-	if ((err = snd_pcm_hw_params_set_periods_near(alsa_handler, alsa_hwparams,
-						      &(unsigned int){FRAGCOUNT}, NULL)) < 0) {
-	  mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set periods: %s\n",
+      if ((err = snd_pcm_hw_params_set_buffer_time_near(alsa_handler, alsa_hwparams,
+							&buffer_time, NULL)) < 0)
+	{
+	  mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set buffer time near: %s\n",
 		 snd_strerror(err));
 	  return 0;
 	}
 
+      if (period_time)
+	err = snd_pcm_hw_params_set_period_time_near(alsa_handler, alsa_hwparams,
+						     &period_time, NULL);
+      else
+	err = snd_pcm_hw_params_set_periods_near(alsa_handler, alsa_hwparams,
+						 &(unsigned int){FRAGCOUNT}, NULL);
+      if (err < 0) {
+	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set periods: %s\n",
+	       snd_strerror(err));
+	return 0;
+      }
+
       /* finally install hardware parameters */
       if ((err = snd_pcm_hw_params(alsa_handler, alsa_hwparams)) < 0)
 	{
@@ -669,6 +986,13 @@ static int init(int rate_hz, int channels, int format, int flags)
 	     ao_data.samplerate, ao_data.channels, (int)bytes_per_sample, ao_data.buffersize,
 	     snd_pcm_format_description(alsa_format));
 
+#if HAVE_PTHREADS
+      if (use_thread && !start_feeder(chunk_size, bufsize))
+        return 0;
+#endif
+      mp_msg(MSGT_AO, MSGL_V, "alsa-init: %s feeder thread\n",
+             feeder.running ? "using" : "not using");
+
     } // end switch alsa_handler (spdif)
     alsa_can_pause = snd_pcm_hw_params_can_pause(alsa_hwparams);
     return 1;
@@ -682,6 +1006,8 @@ static void uninit(int immed)
   if (alsa_handler) {
     int err;
 
+    stop_feeder(!immed);
+
     if (!immed)
       snd_pcm_drain(alsa_handler);
 
@@ -704,11 +1030,15 @@ static void audio_pause(void)
 {
     int err;
 
+    lock_device();
+    lock_ring();
+    feeder.paused = true;
+    unlock_ring();
     if (alsa_can_pause) {
         if ((err = snd_pcm_pause(alsa_handler, 1)) < 0)
         {
             mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm pause error: %s\n", snd_strerror(err));
-            return;
+            goto done;
         }
           mp_msg(MSGT_AO,MSGL_V,"alsa-pause: pause supported by hardware\n");
     } else {
@@ -719,15 +1049,22 @@ static void audio_pause(void)
         if ((err = snd_pcm_drop(alsa_handler)) < 0)
         {
             mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm drop error: %s\n", snd_strerror(err));
-            return;
+            goto done;
         }
     }
+done:
+    unlock_device();
 }
 
 static void audio_resume(void)
 {
     int err;
 
+    lock_device();
+    lock_ring();
+    feeder.paused = false;
+    wake_feeder();
+    unlock_ring();
     if (snd_pcm_state(alsa_handler) == SND_PCM_STATE_SUSPENDED) {
         mp_tmsg(MSGT_AO,MSGL_INFO,"[AO_ALSA] Pcm in suspend mode, trying to resume.\n");
         while ((err = snd_pcm_resume(alsa_handler)) == -EAGAIN) sleep(1);
@@ -736,21 +1073,23 @@ static void audio_resume(void)
         if ((err = snd_pcm_pause(alsa_handler, 0)) < 0)
         {
             mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm resume error: %s\n", snd_strerror(err));
-            return;
+            goto done;
         }
           mp_msg(MSGT_AO,MSGL_V,"alsa-resume: resume supported by hardware\n");
     } else {
         if ((err = snd_pcm_prepare(alsa_handler)) < 0)
         {
            mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm prepare error: %s\n", snd_strerror(err));
-            return;
+            goto done;
         }
         if (prepause_frames) {
             void *silence = calloc(prepause_frames, bytes_per_sample);
-            play(silence, prepause_frames * bytes_per_sample, 0);
+            write_frames(silence, prepause_frames);
             free(silence);
         }
     }
+done:
+    unlock_device();
 }
 
 /* stop playing and empty buffers (for seeking/pause) */
@@ -758,18 +1097,23 @@ static void reset(void)
 {
     int err;
 
+    lock_device();
     prepause_frames = 0;
+    lock_ring();
+    feeder.read_pos = feeder.read_len = 0;
+    unlock_ring();
     if ((err = snd_pcm_drop(alsa_handler)) < 0)
     {
 	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm prepare error: %s\n", snd_strerror(err));
-	return;
+	goto done;
     }
     if ((err = snd_pcm_prepare(alsa_handler)) < 0)
     {
 	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm prepare error: %s\n", snd_strerror(err));
-	return;
+	goto done;
     }
-    return;
+done:
+    unlock_device();
 }
 
 /*
@@ -794,31 +1138,18 @@ static int play(void* data, int len, int flags)
     return 0;
   }
 
+  if (feeder.running) {
+    lock_ring();
+    int written = ring_write(data, len);
+    wake_feeder();
+    unlock_ring();
+    return written;
+  }
+
   if (num_frames == 0)
     return 0;
 
-  do {
-    res = snd_pcm_writei(alsa_handler, data, num_frames);
-
-      if (res == -EINTR) {
-	/* nothing to do */
-	res = 0;
-      }
-      else if (res == -ESTRPIPE) {	/* suspend */
-	mp_tmsg(MSGT_AO,MSGL_INFO,"[AO_ALSA] Pcm in suspend mode, trying to resume.\n");
-	while ((res = snd_pcm_resume(alsa_handler)) == -EAGAIN)
-	  sleep(1);
-      }
-      if (res < 0) {
-	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Write error: %s\n", snd_strerror(res));
-	mp_tmsg(MSGT_AO,MSGL_INFO,"[AO_ALSA] Trying to reset soundcard.\n");
-	if ((res = snd_pcm_prepare(alsa_handler)) < 0) {
-	  mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] pcm prepare error: %s\n", snd_strerror(res));
-	  return 0;
-	  break;
-	}
-      }
-  } while (res == 0);
+  res = write_frames(data, num_frames);
 
   return res < 0 ? res : res * bytes_per_sample;
 }
@@ -829,6 +1160,13 @@ static int get_space(void)
     snd_pcm_status_t *status;
     int ret;
 
+    if (feeder.running) {
+        lock_ring();
+        ret = feeder.ring_size - feeder.read_len;
+        unlock_ring();
+        return ret;
+    }
+
     snd_pcm_status_alloca(&status);
 
     if ((ret = snd_pcm_status(alsa_handler, status)) < 0)
@@ -849,14 +1187,21 @@ static float get_delay(void)
   if (alsa_handler) {
     snd_pcm_sframes_t delay;
 
+    lock_device();
     if (snd_pcm_delay(alsa_handler, &delay) < 0)
-      return 0;
+      delay = 0;
 
     if (delay < 0) {
       /* underrun - move the application pointer forward to catch up */
       snd_pcm_forward(alsa_handler, -delay);
       delay = 0;
+      underruns++;
     }
+    unlock_device();
+    // data still in the ring buffer (always 0 without feeder thread)
+    lock_ring();
+    delay += feeder.read_len / bytes_per_sample;
+    unlock_ring();
     return (float)delay / (float)ao_data.samplerate;
   } else {
     return 0;
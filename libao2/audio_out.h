@@ -38,6 +38,8 @@ enum aocontrol {
     // _MUTE commands take a pointer to bool
     AOCONTROL_GET_MUTE,
     AOCONTROL_SET_MUTE,
+    // Takes a pointer to int: number of buffer underruns since init
+    AOCONTROL_GET_UNDERRUNS,
 };
 
 #define AOPLAY_FINAL_CHUNK 1
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #include "config.h"
 #include "mp_msg.h"
@@ -93,10 +94,19 @@ static int init_audio_codec(sh_audio_t *sh_audio)
     mp_tmsg(MSGT_DECAUDIO, MSGL_V, "dec_audio: Allocating %d + %d = %d bytes for output buffer.\n",
 	   sh_audio->audio_out_minsize, base_size, sh_audio->a_buffer_size);
 
-    sh_audio->a_buffer = av_mallocz(sh_audio->a_buffer_size);
+    /* The decoded data slides forward through the buffer as the filters
+     * consume it, and is only moved back to the start when there is not
+     * enough room left behind it. Allocating twice the needed size makes
+     * that rare and keeps the amount moved down to the leftover of one
+     * decoder call. */
+    sh_audio->a_buffer_alloc = 2 * sh_audio->a_buffer_size;
+    sh_audio->a_buffer = av_mallocz(sh_audio->a_buffer_alloc);
     if (!sh_audio->a_buffer)
         abort();
+    sh_audio->a_buffer_pos = 0;
     sh_audio->a_buffer_len = 0;
+    sh_audio->a_buffer_moved = 0;
+    sh_audio->a_buffer_total = 0;
 
     if (!sh_audio->ad_driver->init(sh_audio)) {
 	mp_tmsg(MSGT_DECAUDIO, MSGL_V, "ADecoder init failed :(\n");
@@ -265,11 +275,31 @@ void uninit_audio(sh_audio_t *sh_audio)
 	sh_audio->ad_driver->uninit(sh_audio);
 	sh_audio->initialized = 0;
     }
+    if (sh_audio->a_buffer_total)
+        mp_msg(MSGT_DECAUDIO, MSGL_V, "Decoded audio: moved %"PRId64" of "
+               "%"PRId64" bytes in the decoder buffer.\n",
+               sh_audio->a_buffer_moved, sh_audio->a_buffer_total);
     av_freep(&sh_audio->a_buffer);
     av_freep(&sh_audio->a_in_buffer);
 }
 
 
+/* True if the chain can't change compressed audio in any way, i.e. it only
+ * consists of dummy filters and the output format is the input format. */
+static int is_passthrough_chain(af_stream_t *afs)
+{
+    if (!(afs->input.format & AF_FORMAT_SPECIAL_MASK))
+        return 0;
+    if (afs->input.format != afs->output.format
+        || afs->input.rate != afs->output.rate
+        || afs->input.nch != afs->output.nch)
+        return 0;
+    for (af_instance_t *af = afs->first; af; af = af->next)
+        if (strcmp(af->info->name, "dummy"))
+            return 0;
+    return 1;
+}
+
 int init_audio_filters(sh_audio_t *sh_audio, int in_samplerate,
 		       int *out_samplerate, int *out_channels, int *out_format)
 {
@@ -299,6 +329,8 @@ int init_audio_filters(sh_audio_t *sh_audio, int in_samplerate,
 	   afs->output.nch, af_fmt2str_short(afs->output.format));
 
     // let's autoprobe it!
+    sh_audio->passthrough = 0;
+    sh_audio->export_pts = 0;
     if (0 != af_init(afs)) {
 	sh_audio->afilter = NULL;
 	free(afs);
@@ -311,6 +343,11 @@ int init_audio_filters(sh_audio_t *sh_audio, int in_samplerate,
 
     // ok!
     sh_audio->afilter = (void *) afs;
+    sh_audio->passthrough = is_passthrough_chain(afs);
+    sh_audio->export_pts = af_get(afs, "export") != NULL;
+    if (sh_audio->passthrough)
+        mp_msg(MSGT_DECAUDIO, MSGL_V, "dec_audio: Using passthrough without "
+               "audio filters.\n");
     return 1;
 }
 
@@ -335,8 +372,23 @@ static int filter_n_bytes(sh_audio_t *sh, struct bstr *outbuf, int len)
     int old_samplerate = sh->samplerate;
     int old_channels = sh->channels;
     int old_sample_format = sh->sample_format;
+
+    /* Make sure the decoder can write len bytes plus its possible overshoot
+     * behind the data still in the buffer. Only the leftover of earlier
+     * calls is ever moved; the usual case is a plain pointer bump. */
+    if (!sh->a_buffer_len)
+        sh->a_buffer_pos = 0;
+    if (sh->a_buffer_len < len &&
+        sh->a_buffer_pos + sh->a_buffer_size > sh->a_buffer_alloc) {
+        memmove(sh->a_buffer, sh->a_buffer + sh->a_buffer_pos,
+                sh->a_buffer_len);
+        sh->a_buffer_moved += sh->a_buffer_len;
+        sh->a_buffer_pos = 0;
+    }
+    unsigned char *start = sh->a_buffer + sh->a_buffer_pos;
+
     while (sh->a_buffer_len < len) {
-	unsigned char *buf = sh->a_buffer + sh->a_buffer_len;
+	unsigned char *buf = start + sh->a_buffer_len;
 	int minlen = len - sh->a_buffer_len;
 	int maxlen = sh->a_buffer_size - sh->a_buffer_len;
 	int ret = sh->ad_driver->decode_audio(sh, buf, minlen, maxlen);
@@ -354,13 +406,20 @@ static int filter_n_bytes(sh_audio_t *sh, struct bstr *outbuf, int len)
 
     // Filter
     af_data_t filter_input = {
-	.audio = sh->a_buffer,
+	.audio = start,
 	.len = len,
 	.rate = sh->samplerate,
 	.nch = sh->channels,
 	.format = sh->sample_format
     };
     af_fix_parameters(&filter_input);
+    // The export filter publishes timestamps along with the samples
+    if (sh->export_pts && sh->pts != MP_NOPTS_VALUE && sh->o_bps) {
+        double pts = sh->pts + (sh->pts_bytes - sh->a_buffer_len)
+                               / (double)sh->o_bps;
+        af_control_any_rev(sh->afilter, AF_CONTROL_EXPORT_PTS | AF_CONTROL_SET,
+                           &pts);
+    }
     af_data_t *filter_output = af_play(sh->afilter, &filter_input);
     if (!filter_output)
 	return -1;
@@ -371,11 +430,49 @@ static int filter_n_bytes(sh_audio_t *sh, struct bstr *outbuf, int len)
 
     // remove processed data from decoder buffer:
     sh->a_buffer_len -= len;
-    memmove(sh->a_buffer, sh->a_buffer + len, sh->a_buffer_len);
+    sh->a_buffer_pos = sh->a_buffer_len ? sh->a_buffer_pos + len : 0;
+    sh->a_buffer_total += len;
 
     return error;
 }
 
+/* Passthrough: let the decoder (normally ad_spdif) write its IEC 61937
+ * bursts straight into the output buffer. Only whole bursts are written,
+ * and no more than minlen plus the remainder of the last burst, so no audio
+ * accumulates between the decoder and the AO. */
+static int decode_passthrough(sh_audio_t *sh, struct bstr *outbuf, int minlen)
+{
+    int old_samplerate = sh->samplerate;
+    int old_channels = sh->channels;
+    int old_sample_format = sh->sample_format;
+
+    // Leftover from before the chain was set up
+    if (sh->a_buffer_len) {
+        set_min_out_buffer_size(outbuf, outbuf->len + sh->a_buffer_len);
+        memcpy(outbuf->start + outbuf->len, sh->a_buffer + sh->a_buffer_pos,
+               sh->a_buffer_len);
+        outbuf->len += sh->a_buffer_len;
+        sh->a_buffer_total += sh->a_buffer_len;
+        sh->a_buffer_len = 0;
+        sh->a_buffer_pos = 0;
+    }
+
+    while (outbuf->len < minlen) {
+        int maxlen = sh->a_buffer_size;
+        set_min_out_buffer_size(outbuf, outbuf->len + maxlen);
+        int ret = sh->ad_driver->decode_audio(sh, outbuf->start + outbuf->len,
+                                              minlen - outbuf->len, maxlen);
+        if (sh->samplerate != old_samplerate || sh->channels != old_channels
+            || sh->sample_format != old_sample_format)
+            return -2;  // samples from format-changing call get discarded
+        if (ret <= 0)
+            return -1;
+        outbuf->len += ret;
+        sh->a_buffer_total += ret;
+    }
+    return 0;
+}
+
 /* Try to get at least minlen decoded+filtered bytes in outbuf
  * (total length including possible existing data).
  * Return 0 on success, -1 on error/EOF (not distinguished).
@@ -385,6 +482,9 @@ static int filter_n_bytes(sh_audio_t *sh, struct bstr *outbuf, int len)
  * if needed to fit all filter output. */
 int decode_audio(sh_audio_t *sh_audio, struct bstr *outbuf, int minlen)
 {
+    if (sh_audio->passthrough)
+        return decode_passthrough(sh_audio, outbuf, minlen);
+
     // Indicates that a filter seems to be buffering large amounts of data
     int huge_filter_buffer = 0;
     // Decoded audio must be cut at boundaries of this many bytes
@@ -19,6 +19,7 @@
 #ifndef MPLAYER_STHEADER_H
 #define MPLAYER_STHEADER_H
 
+#include <stdint.h>
 #include <stdbool.h>
 
 #include "aviheader.h"
@@ -109,9 +110,18 @@ typedef struct sh_audio {
     // decoder buffers:
     int audio_out_minsize;  // minimal output from decoder may be this much
     char *a_buffer;         // buffer for decoder output
-    int a_buffer_len;
-    int a_buffer_size;
+    int a_buffer_pos;       // offset of the first decoded byte in a_buffer
+    int a_buffer_len;       // decoded bytes starting at a_buffer_pos
+    int a_buffer_size;      // max. decoded data + decoder overshoot
+    int a_buffer_alloc;     // allocated size, >= a_buffer_size
+    int64_t a_buffer_moved; // statistics: leftover bytes moved to the front
+    int64_t a_buffer_total; // statistics: bytes fed to the filters
     struct af_stream *afilter;          // the audio filter stream
+    // Compressed (S/PDIF) passthrough with a no-op filter chain: the decoder
+    // writes directly to the output buffer, bypassing a_buffer and libaf.
+    int passthrough;
+    // The filter chain contains af_export, which is passed timestamps
+    int export_pts;
     const struct ad_functions *ad_driver;
     // win32-compatible codec parameters:
     AVIStreamHeader audio;
@@ -373,6 +373,12 @@ static const extfunc_desc_t extfuncs[] = {
                   "wglSwapInterval", "wglSwapIntervalEXT")),
     DEF_EXT_DESC(TexImage3D, NULL,
                  ("glTexImage3D")),
+    DEF_EXT_DESC(GetProgramBinary, "_get_program_binary",
+                 ("glGetProgramBinary")),
+    DEF_EXT_DESC(ProgramBinary, "_get_program_binary",
+                 ("glProgramBinary")),
+    DEF_EXT_DESC(ProgramParameteri, "_get_program_binary",
+                 ("glProgramParameteri")),
 
     // ancient ATI extensions
     DEF_EXT_DESC(BeginFragmentShader, "ATI_fragment_shader",
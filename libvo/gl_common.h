@@ -303,6 +303,10 @@ struct GL {
     void (GLAPIENTRY *TexImage3D)(GLenum, GLint, GLenum, GLsizei, GLsizei,
                                   GLsizei, GLint, GLenum, GLenum,
                                   const GLvoid *);
+    void (GLAPIENTRY *GetProgramBinary)(GLuint, GLsizei, GLsizei *, GLenum *,
+                                        GLvoid *);
+    void (GLAPIENTRY *ProgramBinary)(GLuint, GLenum, const GLvoid *, GLsizei);
+    void (GLAPIENTRY *ProgramParameteri)(GLuint, GLenum, GLint);
 
     // ancient ATI extensions
     void (GLAPIENTRY *BeginFragmentShader)(void);
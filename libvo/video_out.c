@@ -43,6 +43,9 @@
 #include "x11_common.h"
 #endif
 
+// How often to call check_events() for VOs which have no event fd (seconds).
+#define VO_EVENT_POLL_PERIOD 0.5
+
 int xinerama_screen = -1;
 int xinerama_x;
 int xinerama_y;
@@ -253,8 +256,11 @@ void vo_check_events(struct vo *vo)
         if (vo->registered_fd != -1)
             mp_input_rm_key_fd(vo->input_ctx, vo->registered_fd);
         vo->registered_fd = -1;
+        vo->wakeup_period = 0;
         return;
     }
+    // VOs without an event fd can't wake up the playloop on their own.
+    vo->wakeup_period = vo->registered_fd == -1 ? VO_EVENT_POLL_PERIOD : 0;
     vo->driver->check_events(vo);
 }
 
@@ -253,6 +253,9 @@ struct vo {
     struct input_ctx *input_ctx;
     int event_fd;  // check_events() should be called when this has input
     int registered_fd;  // set to event_fd when registered in input system
+    // Set by vo_check_events(): if > 0, check_events() should be called
+    // again after at most this many seconds (e.g. to hide the mouse cursor).
+    double wakeup_period;
 
     // requested position/resolution
     int dx;
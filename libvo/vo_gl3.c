@@ -33,12 +33,14 @@
 
 #ifdef CONFIG_LCMS2
 #include <lcms2.h>
-#include "stream/stream.h"
 #endif
 
 #include "talloc.h"
 #include "bstr.h"
 #include "mp_msg.h"
+#include "mpcommon.h"
+#include "path.h"
+#include "stream/stream.h"
 #include "subopt-helper.h"
 #include "video_out.h"
 #include "libmpcodecs/vfcap.h"
@@ -103,6 +105,16 @@ struct lut_tex_format lut_tex_formats[] = {
 // must be sorted, and terminated with 0
 static const int filter_sizes[] = {2, 4, 6, 8, 12, 16, 0};
 
+// How many linked shader programs are kept for reuse on reconfiguration.
+#define MAX_SHADER_CACHE_ENTRIES 32
+
+#define SHADER_CACHE_HEADER "mplayer2 shader cache 1.0\n"
+
+struct shader_cache_entry {
+    char *key;          // complete program source (header and all stages)
+    GLuint program;
+};
+
 struct vertex {
     float position[2];
     uint8_t color[4];
@@ -177,6 +189,13 @@ struct gl_priv {
     GLuint osd_program, eosd_program;
     GLuint indirect_program, scale_sep_program, final_program;
 
+    // Owns all programs above; ordered from least to most recently used.
+    struct shader_cache_entry *shader_cache;
+    int shader_cache_num;
+    // Directory for program binaries, or NULL to only cache in memory.
+    char *shader_cache_dir;
+    bool use_program_binary;
+
     GLuint osd_textures[MAX_OSD_PARTS];
     int osd_textures_count;
     struct vertex osd_va[MAX_OSD_PARTS * VERTICES_PER_QUAD];
@@ -263,6 +282,8 @@ static const char help_text[];
 static void uninit_rendering(struct gl_priv *p);
 static void delete_shaders(struct gl_priv *p);
 static bool reparse_cmdline(struct gl_priv *p, char *arg);
+static struct bstr load_file(struct gl_priv *p, void *talloc_ctx,
+                             const char *filename);
 
 
 static void default_tex_params(struct GL *gl, GLenum target, GLint filter)
@@ -544,7 +565,7 @@ static void prog_create_shader(GL *gl, GLuint program, GLenum type,
     gl->DeleteShader(shader);
 }
 
-static void link_shader(GL *gl, GLuint program)
+static bool link_shader(GL *gl, GLuint program)
 {
     gl->LinkProgram(program);
     GLint status;
@@ -560,6 +581,7 @@ static void link_shader(GL *gl, GLuint program)
                status, log);
         talloc_free(log);
     }
+    return status;
 }
 
 static void bind_attrib_locs(GL *gl, GLuint program)
@@ -569,17 +591,198 @@ static void bind_attrib_locs(GL *gl, GLuint program)
     gl->BindAttribLocation(program, VERTEX_ATTRIB_TEXCOORD, "vertex_texcoord");
 }
 
-static GLuint create_program(GL *gl, const char *name, const char *header,
-                             const char *vertex, const char *frag)
+static GLuint shader_cache_find(struct gl_priv *p, const char *key)
+{
+    for (int n = 0; n < p->shader_cache_num; n++) {
+        struct shader_cache_entry e = p->shader_cache[n];
+        if (strcmp(e.key, key) == 0) {
+            // move to the end, so that programs in use are never evicted
+            memmove(&p->shader_cache[n], &p->shader_cache[n + 1],
+                    (p->shader_cache_num - n - 1) * sizeof(e));
+            p->shader_cache[p->shader_cache_num - 1] = e;
+            return e.program;
+        }
+    }
+    return 0;
+}
+
+static void shader_cache_add(struct gl_priv *p, const char *key, GLuint prog)
+{
+    if (p->shader_cache_num == MAX_SHADER_CACHE_ENTRIES) {
+        p->gl->DeleteProgram(p->shader_cache[0].program);
+        talloc_free(p->shader_cache[0].key);
+        p->shader_cache_num--;
+        memmove(&p->shader_cache[0], &p->shader_cache[1],
+                p->shader_cache_num * sizeof(p->shader_cache[0]));
+    }
+    MP_TARRAY_APPEND(p, p->shader_cache, p->shader_cache_num,
+                     (struct shader_cache_entry) {
+                         .key = talloc_strdup(p, key),
+                         .program = prog,
+                     });
+}
+
+static void shader_cache_flush(struct gl_priv *p)
+{
+    for (int n = 0; n < p->shader_cache_num; n++) {
+        p->gl->DeleteProgram(p->shader_cache[n].program);
+        talloc_free(p->shader_cache[n].key);
+    }
+    p->shader_cache_num = 0;
+}
+
+// 64 bit FNV-1a; only used to derive file names, collisions are detected by
+// comparing the full key stored in the file.
+static uint64_t hash_string(uint64_t h, const char *s)
+{
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+    return h;
+}
+
+// The binary is only valid for the exact driver it was created with.
+static char *get_driver_info(void *talloc_ctx, GL *gl)
+{
+    return talloc_asprintf(talloc_ctx, "%s\n%s\n%s\n",
+                           gl->GetString(GL_VENDOR), gl->GetString(GL_RENDERER),
+                           gl->GetString(GL_VERSION));
+}
+
+static char *get_binary_filename(struct gl_priv *p, void *talloc_ctx,
+                                 const char *driver, const char *key)
 {
-    mp_msg(MSGT_VO, MSGL_V, "[gl] compiling shader program '%s'\n", name);
-    mp_msg(MSGT_VO, MSGL_V, "[gl] header:\n");
-    mp_log_source(MSGT_VO, MSGL_V, header);
-    GLuint prog = gl->CreateProgram();
-    prog_create_shader(gl, prog, GL_VERTEX_SHADER, header, vertex);
-    prog_create_shader(gl, prog, GL_FRAGMENT_SHADER, header, frag);
-    bind_attrib_locs(gl, prog);
-    link_shader(gl, prog);
+    uint64_t h = hash_string(hash_string(0xcbf29ce484222325ULL, driver), key);
+    char *name = talloc_asprintf(talloc_ctx, "%016llx.bin",
+                                 (unsigned long long)h);
+    return mp_path_join(talloc_ctx, bstr0(p->shader_cache_dir), bstr0(name));
+}
+
+// Cache file layout: SHADER_CACHE_HEADER, driver info, key, '\0', binary
+// format as native endian uint32_t, program binary.
+static GLuint load_program_binary(struct gl_priv *p, const char *name,
+                                  const char *key)
+{
+    GL *gl = p->gl;
+    GLuint prog = 0;
+
+    if (!p->use_program_binary)
+        return 0;
+
+    void *tmp = talloc_new(NULL);
+    char *driver = get_driver_info(tmp, gl);
+    char *filename = get_binary_filename(p, tmp, driver, key);
+    if (!mp_path_exists(filename))
+        goto done;
+
+    struct bstr data = load_file(p, tmp, filename);
+    uint32_t format;
+    if (!(bstr_eatstart0(&data, SHADER_CACHE_HEADER)
+          && bstr_eatstart0(&data, driver)
+          && bstr_eatstart0(&data, (char *)key)
+          && bstr_eatstart(&data, (struct bstr){"", 1})
+          && data.len > sizeof(format)))
+    {
+        mp_msg(MSGT_VO, MSGL_V, "[gl] Shader cache file '%s' invalid.\n",
+               filename);
+        goto done;
+    }
+    memcpy(&format, data.start, sizeof(format));
+    data = bstr_cut(data, sizeof(format));
+
+    prog = gl->CreateProgram();
+    gl->ProgramBinary(prog, format, data.start, data.len);
+    GLint status;
+    gl->GetProgramiv(prog, GL_LINK_STATUS, &status);
+    if (!status) {
+        // happens e.g. after driver updates; the binary is simply recreated
+        mp_msg(MSGT_VO, MSGL_V, "[gl] Shader cache file '%s' rejected by "
+               "the driver.\n", filename);
+        gl->DeleteProgram(prog);
+        prog = 0;
+        goto done;
+    }
+
+    mp_msg(MSGT_VO, MSGL_V, "[gl] loaded shader program '%s' from '%s'\n",
+           name, filename);
+
+done:
+    talloc_free(tmp);
+    return prog;
+}
+
+static void save_program_binary(struct gl_priv *p, const char *key,
+                                GLuint prog)
+{
+    GL *gl = p->gl;
+
+    if (!p->use_program_binary)
+        return;
+
+    GLint size = 0;
+    gl->GetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+
+    void *tmp = talloc_new(NULL);
+    void *binary = talloc_size(tmp, size);
+    GLenum format = 0;
+    gl->GetProgramBinary(prog, size, &size, &format, binary);
+    uint32_t format32 = format;
+
+    char *driver = get_driver_info(tmp, gl);
+    char *filename = get_binary_filename(p, tmp, driver, key);
+    FILE *out = fopen(filename, "wb");
+    if (out) {
+        fprintf(out, "%s%s%s", SHADER_CACHE_HEADER, driver, key);
+        fputc('\0', out);
+        fwrite(&format32, sizeof(format32), 1, out);
+        fwrite(binary, size, 1, out);
+        fclose(out);
+    } else {
+        mp_msg(MSGT_VO, MSGL_WARN, "[gl] Can't write shader cache file "
+               "'%s'.\n", filename);
+    }
+
+    talloc_free(tmp);
+}
+
+// Return a linked program for the given sources. The program is owned by the
+// shader cache, and must not be deleted by the caller.
+static GLuint create_program(struct gl_priv *p, const char *name,
+                             const char *header, const char *vertex,
+                             const char *frag)
+{
+    GL *gl = p->gl;
+
+    char *key = talloc_asprintf(NULL, "%s//vertex\n%s//fragment\n%s",
+                                header, vertex, frag);
+
+    GLuint prog = shader_cache_find(p, key);
+    if (prog) {
+        mp_msg(MSGT_VO, MSGL_V, "[gl] reusing shader program '%s'\n", name);
+        goto done;
+    }
+
+    prog = load_program_binary(p, name, key);
+    if (!prog) {
+        mp_msg(MSGT_VO, MSGL_V, "[gl] compiling shader program '%s'\n", name);
+        mp_msg(MSGT_VO, MSGL_V, "[gl] header:\n");
+        mp_log_source(MSGT_VO, MSGL_V, header);
+        prog = gl->CreateProgram();
+        prog_create_shader(gl, prog, GL_VERTEX_SHADER, header, vertex);
+        prog_create_shader(gl, prog, GL_FRAGMENT_SHADER, header, frag);
+        bind_attrib_locs(gl, prog);
+        if (p->use_program_binary)
+            gl->ProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                  GL_TRUE);
+        if (link_shader(gl, prog))
+            save_program_binary(p, key, prog);
+    }
+
+    shader_cache_add(p, key, prog);
+
+done:
+    talloc_free(key);
     return prog;
 }
 
@@ -629,8 +832,6 @@ static bool input_is_subsampled(struct gl_priv *p)
 
 static void compile_shaders(struct gl_priv *p)
 {
-    GL *gl = p->gl;
-
     delete_shaders(p);
 
     void *tmp = talloc_new(NULL);
@@ -649,10 +850,10 @@ static void compile_shaders(struct gl_priv *p)
     shader_def_opt(&header_eosd, "USE_3DLUT", p->use_lut_3d);
 
     p->eosd_program =
-        create_program(gl, "eosd", header_eosd, vertex_shader, s_eosd);
+        create_program(p, "eosd", header_eosd, vertex_shader, s_eosd);
 
     p->osd_program =
-        create_program(gl, "osd", header, vertex_shader, s_osd);
+        create_program(p, "osd", header, vertex_shader, s_osd);
 
     char *header_conv = talloc_strdup(tmp, "");
     char *header_final = talloc_strdup(tmp, "");
@@ -721,7 +922,7 @@ static void compile_shaders(struct gl_priv *p)
         shader_def_opt(&header_conv, "FIXED_SCALE", true);
         header_conv = t_concat(tmp, header, header_conv);
         p->indirect_program =
-            create_program(gl, "indirect", header_conv, vertex_shader, s_video);
+            create_program(p, "indirect", header_conv, vertex_shader, s_video);
     } else if (header_sep) {
         header_sep = t_concat(tmp, header_sep, header_conv);
     } else {
@@ -731,33 +932,27 @@ static void compile_shaders(struct gl_priv *p)
     if (header_sep) {
         header_sep = t_concat(tmp, header, header_sep);
         p->scale_sep_program =
-            create_program(gl, "scale_sep", header_sep, vertex_shader, s_video);
+            create_program(p, "scale_sep", header_sep, vertex_shader, s_video);
     }
 
     header_final = t_concat(tmp, header, header_final);
     p->final_program =
-        create_program(gl, "final", header_final, vertex_shader, s_video);
+        create_program(p, "final", header_final, vertex_shader, s_video);
 
     debug_check_gl(p, "shader compilation");
 
     talloc_free(tmp);
 }
 
-static void delete_program(GL *gl, GLuint *prog)
-{
-    gl->DeleteProgram(*prog);
-    *prog = 0;
-}
-
+// The programs themselves are owned by the shader cache, and are only deleted
+// when the cache is flushed.
 static void delete_shaders(struct gl_priv *p)
 {
-    GL *gl = p->gl;
-
-    delete_program(gl, &p->osd_program);
-    delete_program(gl, &p->eosd_program);
-    delete_program(gl, &p->indirect_program);
-    delete_program(gl, &p->scale_sep_program);
-    delete_program(gl, &p->final_program);
+    p->osd_program = 0;
+    p->eosd_program = 0;
+    p->indirect_program = 0;
+    p->scale_sep_program = 0;
+    p->final_program = 0;
 }
 
 static double get_scale_factor(struct gl_priv *p)
@@ -1626,6 +1821,18 @@ static int init_gl(struct gl_priv *p)
     if (MPGL_VER(major, minor) >= MPGL_VER(3, 2))
         p->shader_version = "150";
 
+    p->use_program_binary = false;
+    if (p->shader_cache_dir) {
+        GLint formats = 0;
+        if (gl->GetProgramBinary && gl->ProgramBinary && gl->ProgramParameteri)
+            gl->GetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        p->use_program_binary = formats > 0;
+        if (!p->use_program_binary) {
+            mp_msg(MSGT_VO, MSGL_V, "[gl] Program binaries not supported, "
+                   "shader cache is kept in memory only.\n");
+        }
+    }
+
     gl->Disable(GL_DITHER);
     gl->Disable(GL_BLEND);
     gl->Disable(GL_DEPTH_TEST);
@@ -1664,6 +1871,8 @@ static void uninit_gl(struct gl_priv *p)
 
     uninit_video(p);
 
+    shader_cache_flush(p);
+
     gl->DeleteVertexArrays(1, &p->vao);
     p->vao = 0;
     gl->DeleteBuffers(1, &p->vertex_buffer);
@@ -1937,14 +2146,6 @@ static void uninit(struct vo *vo)
     p->gl = NULL;
 }
 
-#ifdef CONFIG_LCMS2
-
-static void lcms2_error_handler(cmsContext ctx, cmsUInt32Number code,
-                                const char *msg)
-{
-    mp_msg(MSGT_VO, MSGL_ERR, "[gl] lcms2: %s\n", msg);
-}
-
 static struct bstr load_file(struct gl_priv *p, void *talloc_ctx,
                              const char *filename)
 {
@@ -1957,6 +2158,14 @@ static struct bstr load_file(struct gl_priv *p, void *talloc_ctx,
     return res;
 }
 
+#ifdef CONFIG_LCMS2
+
+static void lcms2_error_handler(cmsContext ctx, cmsUInt32Number code,
+                                const char *msg)
+{
+    mp_msg(MSGT_VO, MSGL_ERR, "[gl] lcms2: %s\n", msg);
+}
+
 #define LUT3D_CACHE_HEADER "mplayer2 3dlut cache 1.0\n"
 
 static bool load_icc(struct gl_priv *p, const char *icc_file,
@@ -2259,6 +2468,7 @@ static int preinit(struct vo *vo, const char *arg)
     char *icc_cache = NULL;
     int icc_intent = -1;
     char *icc_size_str = NULL;
+    char *shader_cache = NULL;
 
     const opt_t subopts[] = {
         {"gamma",               OPT_ARG_BOOL,   &p->use_gamma},
@@ -2286,6 +2496,7 @@ static int preinit(struct vo *vo, const char *arg)
         {"3dlut-size",          OPT_ARG_MSTRZ,  &icc_size_str,
          lut3d_size_valid},
         {"dither-depth",        OPT_ARG_INT,    &p->dither_depth},
+        {"shader-cache",        OPT_ARG_MSTRZ,  &shader_cache},
         {NULL}
     };
 
@@ -2320,6 +2531,16 @@ static int preinit(struct vo *vo, const char *arg)
     free(icc_profile);
     free(icc_cache);
 
+    if (shader_cache) {
+        if (mp_path_isdir(shader_cache)) {
+            p->shader_cache_dir = talloc_strdup(p, shader_cache);
+        } else {
+            mp_msg(MSGT_VO, MSGL_ERR, "[gl] Shader cache directory '%s' "
+                   "doesn't exist.\n", shader_cache);
+        }
+    }
+    free(shader_cache);
+
     if (!success)
         goto err_out;
 
@@ -2489,4 +2710,11 @@ static const char help_text[] =
 "    Size of the 3D LUT generated from the ICC profile in each\n"
 "    dimension. Default is 128x256x64.\n"
 "    Sizes must be a power of two, and 256 at most.\n"
+"Shader cache:\n"
+"  shader-cache=<dir>\n"
+"    Store linked shader programs as program binaries in this\n"
+"    directory, and load them instead of compiling the shaders on\n"
+"    later starts. The directory must exist. Requires support for\n"
+"    ARB_get_program_binary. Compiled programs are always reused\n"
+"    in memory on reconfiguration, even without this option.\n"
 "\n";
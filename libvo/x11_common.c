@@ -796,10 +796,15 @@ int vo_x11_check_events(struct vo *vo)
     int ret = 0;
     XEvent Event;
 
-    if (x11->mouse_waiting_hide && opts->cursor_autohide_delay != -1 &&
-        (GetTimerMS() - x11->mouse_timer >= opts->cursor_autohide_delay)) {
-        vo_hidecursor(display, x11->window);
-        x11->mouse_waiting_hide = 0;
+    if (x11->mouse_waiting_hide && opts->cursor_autohide_delay != -1) {
+        unsigned int elapsed = GetTimerMS() - x11->mouse_timer;
+        if (elapsed >= opts->cursor_autohide_delay) {
+            vo_hidecursor(display, x11->window);
+            x11->mouse_waiting_hide = 0;
+        } else {
+            int left = opts->cursor_autohide_delay - elapsed;
+            vo->wakeup_period = left / 1000.0;
+        }
     }
 
     if (WinID > 0)
@@ -27,12 +27,14 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "talloc.h"
 
 #include "m_config.h"
 #include "m_option.h"
 #include "mp_msg.h"
+#include "mpcommon.h"
 
 #define MAX_PROFILE_DEPTH 20
 
@@ -157,6 +159,136 @@ static void m_config_add_option(struct m_config *config,
                                 struct m_config_option *parent,
                                 const struct m_option *arg);
 
+/* Lookup tables for config->opts. Options registered later take precedence
+ * over earlier ones (the list is kept newest first), so every entry carries
+ * its registration order. Options with a wildcard name ("af*") can't be
+ * hashed and are kept in a separate, usually tiny, array.
+ */
+struct index_entry {
+    struct m_config_option *co;
+    unsigned int hash;
+    int seq;
+};
+
+struct m_config_index {
+    int seq;
+    // Open addressing tables, the size is a power of 2 (or 0)
+    struct index_entry *names;
+    int names_size, names_count;
+    struct m_config_option **datas;
+    int datas_size, datas_count;
+    struct index_entry *wildcards;
+    int num_wildcards;
+};
+
+static bool is_wildcard(const struct m_config_option *co)
+{
+    return (co->opt->type->flags & M_OPT_TYPE_ALLOW_WILDCARD)
+           && bstr_endswith0(bstr0(co->name), "*");
+}
+
+static unsigned int hash_ptr(const void *p)
+{
+    return ((uintptr_t)p >> 3) * 2654435761u;
+}
+
+static void index_put_name(struct m_config_index *idx, struct index_entry e)
+{
+    unsigned int mask = idx->names_size - 1;
+    for (unsigned int i = e.hash & mask; ; i = (i + 1) & mask) {
+        struct index_entry *slot = &idx->names[i];
+        if (!slot->co) {
+            *slot = e;
+            idx->names_count++;
+            return;
+        }
+        if (slot->hash == e.hash
+                && bstrcasecmp(bstr0(slot->co->name), bstr0(e.co->name)) == 0) {
+            *slot = e;
+            return;
+        }
+    }
+}
+
+static void index_put_data(struct m_config_index *idx,
+                           struct m_config_option *co)
+{
+    unsigned int mask = idx->datas_size - 1;
+    for (unsigned int i = hash_ptr(co->data) & mask; ; i = (i + 1) & mask) {
+        struct m_config_option **slot = &idx->datas[i];
+        if (!*slot || (*slot)->data == co->data) {
+            idx->datas_count += !*slot;
+            *slot = co;
+            return;
+        }
+    }
+}
+
+static void index_add(struct m_config *config, struct m_config_option *co)
+{
+    struct m_config_index *idx = config->index;
+    if (!idx)
+        idx = config->index = talloc_zero(config, struct m_config_index);
+    struct index_entry e = {
+        .co = co,
+        .hash = bstr_case_hash(bstr0(co->name)),
+        .seq = idx->seq++,
+    };
+
+    if (is_wildcard(co)) {
+        MP_TARRAY_APPEND(idx, idx->wildcards, idx->num_wildcards, e);
+    } else {
+        if ((idx->names_count + 1) * 2 > idx->names_size) {
+            struct index_entry *old = idx->names;
+            int old_size = idx->names_size;
+            idx->names_size = old_size ? old_size * 2 : 256;
+            idx->names = talloc_zero_array(idx, struct index_entry,
+                                           idx->names_size);
+            idx->names_count = 0;
+            for (int i = 0; i < old_size; i++) {
+                if (old[i].co)
+                    index_put_name(idx, old[i]);
+            }
+            talloc_free(old);
+        }
+        index_put_name(idx, e);
+    }
+
+    if (co->data) {
+        if ((idx->datas_count + 1) * 2 > idx->datas_size) {
+            struct m_config_option **old = idx->datas;
+            int old_size = idx->datas_size;
+            idx->datas_size = old_size ? old_size * 2 : 256;
+            idx->datas = talloc_zero_array(idx, struct m_config_option *,
+                                           idx->datas_size);
+            idx->datas_count = 0;
+            for (int i = 0; i < old_size; i++) {
+                if (old[i])
+                    index_put_data(idx, old[i]);
+            }
+            talloc_free(old);
+        }
+        index_put_data(idx, co);
+    }
+}
+
+// Return the most recently added option with the given data pointer.
+static struct m_config_option *index_find_data(const struct m_config *config,
+                                               void *data)
+{
+    const struct m_config_index *idx = config->index;
+    if (!idx || !idx->datas_size)
+        return NULL;
+    unsigned int mask = idx->datas_size - 1;
+    for (unsigned int i = hash_ptr(data) & mask; idx->datas[i];
+         i = (i + 1) & mask)
+    {
+        if (idx->datas[i]->data == data)
+            return idx->datas[i];
+    }
+    return NULL;
+}
+
 static int config_destroy(void *p)
 {
     struct m_config *config = p;
@@ -315,15 +447,9 @@ static void m_config_add_option(struct m_config *config,
         }
     } else {
         // Check if there is already an option pointing to this address
-        if (co->data) {
-            for (struct m_config_option *i = config->opts; i; i = i->next) {
-                if (co->data == i->data) {
-                    // So we don't save the same vars more than 1 time
-                    co->alias_owner = i;
-                    break;
-                }
-            }
-        }
+        // So we don't save the same vars more than 1 time
+        if (co->data)
+            co->alias_owner = index_find_data(config, co->data);
         if (co->alias_owner) {
             assert(!arg->defval);
         } else {
@@ -351,6 +477,7 @@ static void m_config_add_option(struct m_config *config,
     if (!(arg->flags & M_OPT_MERGE)) {
         co->next = config->opts;
         config->opts = co;
+        index_add(config, co);
     }
 }
 
@@ -368,19 +495,37 @@ int m_config_register_options(struct m_config *config,
 static struct m_config_option *m_config_get_co(const struct m_config *config,
                                                struct bstr name)
 {
-    struct m_config_option *co;
+    const struct m_config_index *idx = config->index;
+    if (!idx)
+        return NULL;
 
-    for (co = config->opts; co; co = co->next) {
-        struct bstr coname = bstr0(co->name);
-        if ((co->opt->type->flags & M_OPT_TYPE_ALLOW_WILDCARD)
-                && bstr_endswith0(coname, "*")) {
-            coname.len--;
-            if (bstrcasecmp(bstr_splice(name, 0, coname.len), coname) == 0)
-                return co;
-        } else if (bstrcasecmp(coname, name) == 0)
-            return co;
+    const struct index_entry *best = NULL;
+    if (idx->names_size) {
+        unsigned int hash = bstr_case_hash(name);
+        unsigned int mask = idx->names_size - 1;
+        for (unsigned int i = hash & mask; idx->names[i].co;
+             i = (i + 1) & mask)
+        {
+            const struct index_entry *e = &idx->names[i];
+            if (e->hash == hash && bstrcasecmp(bstr0(e->co->name), name) == 0) {
+                best = e;
+                break;
+            }
+        }
     }
-    return NULL;
+    // A wildcard option added after the exact match shadows it
+    for (int i = idx->num_wildcards - 1; i >= 0; i--) {
+        const struct index_entry *e = &idx->wildcards[i];
+        if (best && e->seq < best->seq)
+            break;
+        struct bstr coname = bstr0(e->co->name);
+        coname.len--;
+        if (bstrcasecmp(bstr_splice(name, 0, coname.len), coname) == 0) {
+            best = e;
+            break;
+        }
+    }
+    return best ? best->co : NULL;
 }
 
 static int parse_subopts(struct m_config *config, void *optstruct, char *name,
@@ -31,6 +31,7 @@ typedef struct m_profile m_profile_t;
 struct m_option;
 struct m_option_type;
 struct m_sub_options;
+struct m_config_index;
 
 // Config option
 struct m_config_option {
@@ -78,6 +79,8 @@ typedef struct m_config {
     /** This contains all options and suboptions.
      */
     struct m_config_option *opts;
+    // Hash tables over opts, private to m_config.c.
+    struct m_config_index *index;
     enum option_source mode;
     // When options are set (via m_config_set_option or m_config_set_profile),
     // back up the old value (unless it's already backed up). Used for restoring
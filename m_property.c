@@ -33,28 +33,139 @@
 #include "mp_msg.h"
 #include "mpcommon.h"
 
-static int do_action(const m_option_t *prop_list, const char *name,
+/* Property lookup goes through a hash table built on first use of a
+ * property list. The property lists are static tables, so the tables are
+ * kept for the lifetime of the process in a small cache keyed by the list.
+ * Like the rest of the property code, this must be used from the playback
+ * thread only.
+ */
+
+#define PROP_INDEX_CACHE 4
+
+struct prop_slot {
+    const m_option_t *prop;
+    unsigned int hash;
+};
+
+struct prop_index {
+    const m_option_t *list;
+    unsigned int mask;
+    struct prop_slot *slots;
+    // Wildcard properties ("name*"), in list order
+    const m_option_t **wildcards;
+    int num_wildcards;
+};
+
+static struct prop_index prop_indexes[PROP_INDEX_CACHE];
+static int prop_index_next;
+
+static bool is_wildcard(const m_option_t *prop)
+{
+    return (prop->type->flags & M_OPT_TYPE_ALLOW_WILDCARD)
+           && bstr_endswith0(bstr0(prop->name), "*");
+}
+
+static struct prop_index *get_prop_index(const m_option_t *list)
+{
+    for (int n = 0; n < PROP_INDEX_CACHE; n++) {
+        if (prop_indexes[n].list == list)
+            return &prop_indexes[n];
+    }
+
+    struct prop_index *idx = &prop_indexes[prop_index_next];
+    prop_index_next = (prop_index_next + 1) % PROP_INDEX_CACHE;
+    talloc_free(idx->slots);
+    talloc_free(idx->wildcards);
+    *idx = (struct prop_index){ .list = list };
+
+    int count = 0;
+    while (list[count].name)
+        count++;
+    int size = 16;
+    while (size < count * 2)
+        size *= 2;
+    idx->mask = size - 1;
+    idx->slots = talloc_zero_array(NULL, struct prop_slot, size);
+    for (int n = 0; n < count; n++) {
+        const m_option_t *prop = &list[n];
+        if (is_wildcard(prop)) {
+            MP_TARRAY_APPEND(NULL, idx->wildcards, idx->num_wildcards, prop);
+            continue;
+        }
+        unsigned int hash = bstr_case_hash(bstr0(prop->name));
+        for (unsigned int i = hash & idx->mask; ; i = (i + 1) & idx->mask) {
+            struct prop_slot *slot = &idx->slots[i];
+            if (!slot->prop) {
+                *slot = (struct prop_slot){ prop, hash };
+                break;
+            }
+            // The first of several properties with the same name wins
+            if (slot->hash == hash
+                    && bstrcasecmp0(bstr0(slot->prop->name), prop->name) == 0)
+                break;
+        }
+    }
+    return idx;
+}
+
+// Same result as m_option_list_find(), without the linear search.
+static const m_option_t *find_prop(const m_option_t *prop_list,
+                                   struct bstr name)
+{
+    struct prop_index *idx = get_prop_index(prop_list);
+    const m_option_t *prop = NULL;
+    unsigned int hash = bstr_case_hash(name);
+    for (unsigned int i = hash & idx->mask; idx->slots[i].prop;
+         i = (i + 1) & idx->mask)
+    {
+        struct prop_slot *slot = &idx->slots[i];
+        if (slot->hash == hash && bstrcasecmp(bstr0(slot->prop->name), name) == 0)
+        {
+            prop = slot->prop;
+            break;
+        }
+    }
+    // A wildcard property before the exact match in the list shadows it
+    for (int n = 0; n < idx->num_wildcards; n++) {
+        const m_option_t *w = idx->wildcards[n];
+        if (prop && w > prop)
+            break;
+        struct bstr wname = bstr0(w->name);
+        wname.len--;
+        if (bstrcasecmp(bstr_splice(name, 0, wname.len), wname) == 0)
+            return w;
+    }
+    return prop;
+}
+
+// Split "name/key" and look up the property. *key is set to NULL if the
+// name has no key part.
+static const m_option_t *resolve_prop(const m_option_t *prop_list,
+                                      const char *name, const char **key)
+{
+    const char *sep = strchr(name, '/');
+    *key = NULL;
+    if (sep && sep[1]) {
+        *key = sep + 1;
+        return find_prop(prop_list, (struct bstr){(char *)name, sep - name});
+    }
+    return find_prop(prop_list, bstr0(name));
+}
+
+static int do_action(const m_option_t *prop, const char *key,
                      int action, void *arg, void *ctx)
 {
-    const char *sep;
-    const m_option_t *prop;
     m_property_action_t ka;
     int r;
-    if ((sep = strchr(name, '/')) && sep[1]) {
-        int len = sep - name;
-        char base[len + 1];
-        memcpy(base, name, len);
-        base[len] = 0;
-        prop = m_option_list_find(prop_list, base);
-        ka.key = sep + 1;
+    if (!prop)
+        return M_PROPERTY_UNKNOWN;
+    if (key) {
+        ka.key = key;
         ka.action = action;
         ka.arg = arg;
         action = M_PROPERTY_KEY_ACTION;
         arg = &ka;
-    } else
-        prop = m_option_list_find(prop_list, name);
-    if (!prop)
-        return M_PROPERTY_UNKNOWN;
+    }
     r = ((m_property_ctrl_f)prop->p)(prop, action, arg, ctx);
     if (action == M_PROPERTY_GET_TYPE && r < 0) {
         if (!arg)
@@ -65,8 +176,8 @@ static int do_action(const m_option_t *prop_list, const char *name,
     return r;
 }
 
-int m_property_do(const m_option_t *prop_list, const char *name,
-                  int action, void *arg, void *ctx)
+static int property_do(const m_option_t *prop, const char *key,
+                       int action, void *arg, void *ctx)
 {
     const m_option_t *opt;
     union m_option_value val = {0};
@@ -74,18 +185,17 @@ int m_property_do(const m_option_t *prop_list, const char *name,
 
     switch (action) {
     case M_PROPERTY_PRINT:
-        if ((r = do_action(prop_list, name, M_PROPERTY_PRINT, arg, ctx)) >= 0)
+        if ((r = do_action(prop, key, M_PROPERTY_PRINT, arg, ctx)) >= 0)
             return r;
     // fallback on the default print for this type
     case M_PROPERTY_TO_STRING:
-        if ((r = do_action(prop_list, name, M_PROPERTY_TO_STRING, arg, ctx)) !=
+        if ((r = do_action(prop, key, M_PROPERTY_TO_STRING, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
         // fallback on the options API. Get the type, value and print.
-        if ((r =
-             do_action(prop_list, name, M_PROPERTY_GET_TYPE, &opt, ctx)) <= 0)
+        if ((r = do_action(prop, key, M_PROPERTY_GET_TYPE, &opt, ctx)) <= 0)
             return r;
-        if ((r = do_action(prop_list, name, M_PROPERTY_GET, &val, ctx)) <= 0)
+        if ((r = do_action(prop, key, M_PROPERTY_GET, &val, ctx)) <= 0)
             return r;
         if (!arg)
             return M_PROPERTY_ERROR;
@@ -94,100 +204,222 @@ int m_property_do(const m_option_t *prop_list, const char *name,
         return str != NULL;
     case M_PROPERTY_PARSE:
         // try the property own parsing func
-        if ((r = do_action(prop_list, name, M_PROPERTY_PARSE, arg, ctx)) !=
+        if ((r = do_action(prop, key, M_PROPERTY_PARSE, arg, ctx)) !=
             M_PROPERTY_NOT_IMPLEMENTED)
             return r;
         // fallback on the options API, get the type and parse.
-        if ((r =
-             do_action(prop_list, name, M_PROPERTY_GET_TYPE, &opt, ctx)) <= 0)
+        if ((r = do_action(prop, key, M_PROPERTY_GET_TYPE, &opt, ctx)) <= 0)
             return r;
         if (!arg)
             return M_PROPERTY_ERROR;
         if ((r = m_option_parse(opt, bstr0(opt->name), bstr0(arg), &val)) <= 0)
             return r;
-        r = do_action(prop_list, name, M_PROPERTY_SET, &val, ctx);
+        r = do_action(prop, key, M_PROPERTY_SET, &val, ctx);
         m_option_free(opt, &val);
         return r;
     }
-    return do_action(prop_list, name, action, arg, ctx);
+    return do_action(prop, key, action, arg, ctx);
 }
 
-char *m_properties_expand_string(const m_option_t *prop_list, char *str,
-                                 void *ctx)
+int m_property_do(const m_option_t *prop_list, const char *name,
+                  int action, void *arg, void *ctx)
+{
+    const char *key;
+    const m_option_t *prop = resolve_prop(prop_list, name, &key);
+    return property_do(prop, key, action, arg, ctx);
+}
+
+/* Expansion strings are compiled into a list of operations, with the
+ * property names already looked up. The same few strings (OSD messages,
+ * slave mode queries) tend to be expanded over and over, so the compiled
+ * form of the most recently used ones is cached.
+ */
+
+#define TEMPLATE_CACHE 8
+
+enum expand_op_type {
+    EXPAND_TEXT,        // append text[0..len)
+    EXPAND_PROP,        // append the value of prop/key (method)
+    EXPAND_IF,          // if prop/key is (not) available continue, else
+                        // resume at op skip_to
+};
+
+struct expand_op {
+    enum expand_op_type type;
+    int method;
+    bool is_not;
+    int skip_to;
+    int text, len;      // offset into expand_template.text
+    const m_option_t *prop;
+    const char *key;
+};
+
+struct expand_template {
+    const m_option_t *prop_list;
+    char *src;
+    struct expand_op *ops;
+    int num_ops;
+    char *text;
+    int text_len;
+    // While compiling: first op that text can be merged into (ops before
+    // the end of a conditional must not grow)
+    int merge_from;
+};
+
+static struct expand_template *template_cache[TEMPLATE_CACHE];
+
+static struct expand_op *add_op(struct expand_template *t,
+                                enum expand_op_type type)
 {
-    int l, fr = 0, pos = 0, size = strlen(str) + 512;
-    char *p = NULL, *e, *ret = malloc(size), num_val;
-    int skip = 0, lvl = 0, skip_lvl = 0;
+    MP_TARRAY_APPEND(t, t->ops, t->num_ops, (struct expand_op){ .type = type });
+    return &t->ops[t->num_ops - 1];
+}
+
+static void add_char(struct expand_template *t, char c)
+{
+    if (t->num_ops <= t->merge_from
+            || t->ops[t->num_ops - 1].type != EXPAND_TEXT) {
+        struct expand_op *op = add_op(t, EXPAND_TEXT);
+        op->text = t->text_len;
+    }
+    t->ops[t->num_ops - 1].len++;
+    MP_TARRAY_APPEND(t, t->text, t->text_len, c);
+}
+
+static void set_op_prop(struct expand_template *t, struct expand_op *op,
+                        const char *name, int len)
+{
+    char *pname = talloc_strndup(t, name, len);
+    op->prop = resolve_prop(t->prop_list, pname, &op->key);
+}
+
+static struct expand_template *compile_template(const m_option_t *prop_list,
+                                                const char *str)
+{
+    struct expand_template *t = talloc_zero(NULL, struct expand_template);
+    t->prop_list = prop_list;
+    t->src = talloc_strdup(t, str);
+    int *ifs = NULL;    // EXPAND_IF ops of the enclosing ?( ... )
+    int lvl = 0;
+    const char *e;
 
     while (str[0]) {
         if (str[0] == '\\') {
-            int sl = 1;
+            char c;
             switch (str[1]) {
             case 'e':
-                p = "\x1b", l = 1; break;
+                c = '\x1b'; break;
             case 'n':
-                p = "\n", l = 1; break;
+                c = '\n'; break;
             case 'r':
-                p = "\r", l = 1; break;
+                c = '\r'; break;
             case 't':
-                p = "\t", l = 1; break;
-            case 'x':
-                if (str[2]) {
-                    char num[3] = { str[2], str[3], 0 };
-                    char *end = num;
-                    num_val = strtol(num, &end, 16);
-                    sl = end - num + 1;
-                    l = 1;
-                    p = &num_val;
-                } else
-                    l = 0;
-                break;
+                c = '\t'; break;
+            case 'x': {
+                if (!str[2]) {
+                    str += 2;
+                    continue;
+                }
+                char num[3] = { str[2], str[3], 0 };
+                char *end = num;
+                add_char(t, strtol(num, &end, 16));
+                str += 2 + (end - num);
+                continue;
+            }
+            case '\0':
+                str += 1;
+                continue;
             default:
-                p = str + 1, l = 1;
+                c = str[1];
             }
-            str += 1 + sl;
+            add_char(t, c);
+            str += 2;
         } else if (lvl > 0 && str[0] == ')') {
-            if (skip && lvl <= skip_lvl)
-                skip = 0;
-            lvl--, str++, l = 0;
+            lvl--, str++;
+            t->ops[ifs[lvl]].skip_to = t->num_ops;
+            t->merge_from = t->num_ops;
         } else if (str[0] == '$' && str[1] == '{'
                    && (e = strchr(str + 2, '}'))) {
             str += 2;
-            int method = M_PROPERTY_PRINT;
+            struct expand_op *op = add_op(t, EXPAND_PROP);
+            op->method = M_PROPERTY_PRINT;
             if (str[0] == '=') {
                 str += 1;
-                method = M_PROPERTY_TO_STRING;
+                op->method = M_PROPERTY_TO_STRING;
             }
-            int pl = e - str;
-            char pname[pl + 1];
-            memcpy(pname, str, pl);
-            pname[pl] = 0;
-            if (m_property_do(prop_list, pname, method, &p, ctx) >= 0 && p)
-                l = strlen(p), fr = 1;
-            else
-                l = 0;
+            set_op_prop(t, op, str, e - str);
             str = e + 1;
         } else if (str[0] == '?' && str[1] == '('
                    && (e = strchr(str + 2, ':'))) {
-            lvl++;
-            if (!skip) {
-                int is_not = str[2] == '!';
-                int pl = e - str - (is_not ? 3 : 2);
-                char pname[pl + 1];
-                memcpy(pname, str + (is_not ? 3 : 2), pl);
-                pname[pl] = 0;
-                if (m_property_do(prop_list, pname, M_PROPERTY_GET, NULL, ctx) < 0) {
-                    if (!is_not)
-                        skip = 1, skip_lvl = lvl;
-                } else if (is_not)
-                    skip = 1, skip_lvl = lvl;
-            }
-            str = e + 1, l = 0;
-        } else
-            p = str, l = 1, str++;
+            struct expand_op *op = add_op(t, EXPAND_IF);
+            op->is_not = str[2] == '!';
+            str += op->is_not ? 3 : 2;
+            set_op_prop(t, op, str, e - str);
+            MP_TARRAY_APPEND(t, ifs, lvl, t->num_ops - 1);
+            str = e + 1;
+        } else {
+            add_char(t, str[0]);
+            str++;
+        }
+    }
+    // Unclosed conditionals extend to the end of the string
+    while (lvl > 0)
+        t->ops[ifs[--lvl]].skip_to = t->num_ops;
+    return t;
+}
 
-        if (skip || l <= 0)
+static struct expand_template *get_template(const m_option_t *prop_list,
+                                            const char *str)
+{
+    int n;
+    for (n = 0; n < TEMPLATE_CACHE && template_cache[n]; n++) {
+        struct expand_template *t = template_cache[n];
+        if (t->prop_list == prop_list && strcmp(t->src, str) == 0)
+            break;
+    }
+    struct expand_template *t;
+    if (n < TEMPLATE_CACHE && template_cache[n]) {
+        t = template_cache[n];
+    } else {
+        n = TEMPLATE_CACHE - 1;
+        talloc_free(template_cache[n]);
+        t = compile_template(prop_list, str);
+    }
+    // Move to the front
+    memmove(template_cache + 1, template_cache, n * sizeof(template_cache[0]));
+    template_cache[0] = t;
+    return t;
+}
+
+char *m_properties_expand_string(const m_option_t *prop_list, char *str,
+                                 void *ctx)
+{
+    struct expand_template *t = get_template(prop_list, str);
+    int pos = 0, size = t->text_len + 512;
+    char *ret = malloc(size);
+
+    for (int n = 0; n < t->num_ops; n++) {
+        struct expand_op *op = &t->ops[n];
+        char *p = NULL;
+        int l = 0;
+        switch (op->type) {
+        case EXPAND_TEXT:
+            p = t->text + op->text;
+            l = op->len;
+            break;
+        case EXPAND_PROP:
+            if (property_do(op->prop, op->key, op->method, &p, ctx) < 0 || !p)
+                continue;
+            l = strlen(p);
+            break;
+        case EXPAND_IF: {
+            bool available =
+                property_do(op->prop, op->key, M_PROPERTY_GET, NULL, ctx) >= 0;
+            if (available == op->is_not)
+                n = op->skip_to - 1;
             continue;
+        }
+        }
 
         if (pos + l + 1 > size) {
             size = pos + l + 512;
@@ -195,8 +427,8 @@ char *m_properties_expand_string(const m_option_t *prop_list, char *str,
         }
         memcpy(ret + pos, p, l);
         pos += l;
-        if (fr)
-            talloc_free(p), fr = 0;
+        if (op->type == EXPAND_PROP)
+            talloc_free(p);
     }
 
     ret[pos] = 0;
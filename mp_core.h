@@ -26,6 +26,7 @@
 #include "sub/subreader.h"
 #include "sub/find_subfiles.h"
 #include "libmpdemux/demuxer.h"
+#include "frame_stats.h"
 
 // definitions used internally by the core player code
 
@@ -122,6 +123,12 @@ typedef struct MPContext {
     struct m_config *mconfig;
     struct mp_fifo *key_fifo;
     struct input_ctx *input;
+    struct mp_ipc *ipc;
+    // talloc pools for short-lived allocations. Children of frame_pool are
+    // freed at the start of each playloop iteration, children of file_pool
+    // when playback of the current file ends.
+    void *frame_pool;
+    void *file_pool;
     struct osd_state *osd;
     struct mp_osd_msg *osd_msg_stack;
     char *terminal_osd_text;
@@ -130,6 +137,10 @@ typedef struct MPContext {
     bool add_osd_seek_info;
     unsigned int osd_visible;
 
+    // Maximum time (in seconds) run_playloop() may block waiting for input
+    // before something needs to be updated. Lowered with schedule_wakeup().
+    double sleeptime;
+
     int osd_function;
     struct playlist *playlist;
     char *filename; // currently playing file
@@ -211,9 +222,26 @@ typedef struct MPContext {
     unsigned int start_timestamp;
 
     // Timestamp from the last time some timing functions read the
-    // current time, in (occasionally wrapping) microseconds. Used
-    // to turn a new time value to a delta from last time.
-    unsigned int last_time;
+    // current time, in nanoseconds (see mp_time_ns()). Used to turn a new
+    // time value to a delta from last time.
+    int64_t last_time;
+
+    // Intended vs. actual presentation time of video frames.
+    struct frame_stats frame_stats;
+
+    // --video-sync=display-resample state
+    // Whether the audio filter chain has a resampler with a settable ratio,
+    // checked each time the chain is built
+    bool display_sync_resampler;
+    // Smoothed difference between audio and video position, in seconds
+    double display_sync_drift;
+    // Resample ratio currently set in the audio filter chain
+    double display_sync_ratio;
+    // How much faster than nominal video is played by rounding frame
+    // durations to whole display refreshes
+    double display_sync_speed;
+    // Rounding error of the frame durations, in display refreshes
+    double display_sync_error;
 
     // Used to communicate the parameters of a seek between parts
     struct seek_params {
@@ -266,6 +294,7 @@ void uninit_player(struct MPContext *mpctx, unsigned int mask);
 void reinit_audio_chain(struct MPContext *mpctx);
 void init_vo_spudec(struct MPContext *mpctx);
 double playing_audio_pts(struct MPContext *mpctx);
+bool display_sync_active(struct MPContext *mpctx);
 void add_subtitles(struct MPContext *mpctx, char *filename, float fps, int noerr);
 int reinit_video_chain(struct MPContext *mpctx);
 void pause_player(struct MPContext *mpctx);
@@ -20,12 +20,21 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "config.h"
+#include "libavutil/common.h"
+#include "osdep/atomics.h"
 #include "osdep/getch2.h"
 #include "osdep/io.h"
 
+#if HAVE_PTHREADS
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
 #ifdef CONFIG_TRANSLATION
 #include <locale.h>
 #include <libintl.h>
@@ -63,6 +72,14 @@ int verbose = 0;
 int mp_msg_color = 1;
 int mp_msg_module = 0;
 int mp_msg_cancolor = 0;
+int mp_msg_async = 0;
+int mp_msg_rate_limit = 0;
+
+// -msgratelimit state per module: messages printed in the current second,
+// and messages dropped but not reported yet
+static time_t rate_second[MSGT_MAX];
+static unsigned int rate_count[MSGT_MAX];
+static unsigned int rate_dropped[MSGT_MAX];
 
 static int mp_msg_docolor(void) {
 	return mp_msg_cancolor && mp_msg_color;
@@ -198,18 +215,33 @@ static void print_msg_module(FILE* stream, int mod)
     fprintf(stream, ": ");
 }
 
-void mp_msg_va(int mod, int lev, const char *format, va_list va)
+static void print_msg(int mod, int lev, const char *tmp, bool flush);
+
+// Print the number of messages of the module dropped by -msgratelimit.
+static void print_rate_dropped(int mod, int lev)
+{
+    unsigned int n = rate_dropped[mod];
+    if (!n)
+        return;
+    __sync_fetch_and_sub(&rate_dropped[mod], n);
+    char tmp[80];
+    snprintf(tmp, sizeof(tmp), "[mp_msg] %u messages dropped by "
+             "-msgratelimit.\n", n);
+    print_msg(mod, lev, tmp, false);
+}
+
+/* Print a formatted message. The header and statusline state below is only
+ * touched from here, so with -msgasync only the writer thread calls this.
+ */
+static void print_msg(int mod, int lev, const char *tmp, bool flush)
 {
-    char tmp[MSGSIZE_MAX];
     FILE *stream = lev == MSGL_STATUS ? stderr : stdout;
     static int header = 1;
     // indicates if last line printed was a status line
     static int statusline;
 
-    if (!mp_msg_test(mod, lev)) return; // do not display
-    vsnprintf(tmp, MSGSIZE_MAX, format, va);
-    tmp[MSGSIZE_MAX-2] = '\n';
-    tmp[MSGSIZE_MAX-1] = 0;
+    if (header && rate_dropped[mod])
+        print_rate_dropped(mod, lev);
 
     /* A status line is normally intended to be overwritten by the next
      * status line, and does not end with a '\n'. If we're printing a normal
@@ -236,7 +268,259 @@ void mp_msg_va(int mod, int lev, const char *format, va_list va)
         fprintf(stream, "\033[0m");
 #endif
     }
-    fflush(stream);
+    if (flush)
+        fflush(stream);
+}
+
+// Return whether the message exceeds -msgratelimit. Only verbose levels
+// are limited. Races between threads only make the limit inexact.
+static bool rate_limited(int mod, int lev)
+{
+    if (mp_msg_rate_limit <= 0 || lev <= MSGL_STATUS)
+        return false;
+    time_t now = time(NULL);
+    if (rate_second[mod] != now) {
+        rate_second[mod] = now;
+        rate_count[mod] = 0;
+    }
+    if (__sync_add_and_fetch(&rate_count[mod], 1) <= mp_msg_rate_limit)
+        return false;
+    __sync_fetch_and_add(&rate_dropped[mod], 1);
+    return true;
+}
+
+#if HAVE_PTHREADS
+
+/* Asynchronous output (-msgasync).
+ *
+ * Callers format the message and copy it into a ring of fixed-size slots;
+ * a writer thread prints the messages and flushes the streams whenever the
+ * ring runs empty. Writing a message takes no lock: a caller reserves a
+ * run of slots by advancing head with a compare-and-swap, and each slot
+ * carries a sequence number telling whether it is free, written or read
+ * (as in a bounded MPMC queue, but with a single reader). If the ring is
+ * full, messages of verbose levels are dropped and counted; other levels
+ * wait for space.
+ */
+
+#define RING_SLOTS 1024         // must be a power of 2
+#define SLOT_TEXT 240
+
+struct msg_slot {
+    // position + 1 when written, position + RING_SLOTS when free again
+    unsigned long seq;
+    // Only used in the first slot of a message
+    short mod, lev;
+    short num_slots;
+    short len;
+    char text[SLOT_TEXT];
+};
+
+static struct msg_slot *ring;
+static unsigned long ring_head;     // next position to reserve
+static unsigned long ring_tail;     // next position to read (writer only)
+static unsigned int ring_dropped;
+
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wakeup = PTHREAD_COND_INITIALIZER;
+static int writer_sleeping;
+static int writer_quit;
+static int async_running;
+
+static bool ring_read(char *buf)
+{
+    unsigned long pos = ring_tail;
+    struct msg_slot *first = &ring[pos & (RING_SLOTS - 1)];
+    if (first->seq != pos + 1)
+        return false;
+    mp_memory_barrier();
+    int mod = first->mod, lev = first->lev, num = first->num_slots;
+    int len = first->len;
+    for (int n = 0; n < num; n++) {
+        struct msg_slot *slot = &ring[(pos + n) & (RING_SLOTS - 1)];
+        int chunk = FFMIN(len - n * SLOT_TEXT, SLOT_TEXT);
+        memcpy(buf + n * SLOT_TEXT, slot->text, chunk);
+    }
+    buf[len] = 0;
+    // In order, so that a free slot implies free slots before it
+    for (int n = 0; n < num; n++) {
+        mp_memory_barrier();
+        ring[(pos + n) & (RING_SLOTS - 1)].seq = pos + n + RING_SLOTS;
+    }
+    print_msg(mod, lev, buf, lev == MSGL_FATAL);
+    mp_memory_barrier();
+    ring_tail = pos + num;
+    return true;
+}
+
+static void *writer_thread_fn(void *arg)
+{
+    char buf[MSGSIZE_MAX];
+    for (;;) {
+        while (ring_read(buf));
+        unsigned int dropped = ring_dropped;
+        if (dropped) {
+            __sync_fetch_and_sub(&ring_dropped, dropped);
+            snprintf(buf, sizeof(buf), "[mp_msg] %u messages dropped, "
+                     "output is too slow.\n", dropped);
+            print_msg(MSGT_GLOBAL, MSGL_WARN, buf, false);
+        }
+        fflush(stdout);
+        fflush(stderr);
+
+        pthread_mutex_lock(&writer_lock);
+        writer_sleeping = 1;
+        mp_memory_barrier();
+        bool empty = ring[ring_tail & (RING_SLOTS - 1)].seq != ring_tail + 1;
+        if (empty && writer_quit) {
+            pthread_mutex_unlock(&writer_lock);
+            break;
+        }
+        if (empty && !ring_dropped) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec until = {
+                .tv_sec = now.tv_sec + 1,
+                .tv_nsec = now.tv_usec * 1000,
+            };
+            pthread_cond_timedwait(&writer_wakeup, &writer_lock, &until);
+        }
+        writer_sleeping = 0;
+        pthread_mutex_unlock(&writer_lock);
+    }
+    return NULL;
+}
+
+static void wake_writer(void)
+{
+    mp_memory_barrier();
+    if (writer_sleeping) {
+        pthread_mutex_lock(&writer_lock);
+        pthread_cond_signal(&writer_wakeup);
+        pthread_mutex_unlock(&writer_lock);
+    }
+}
+
+/* Queue the message. Returns the position after it, or 0 if it was
+ * dropped. */
+static unsigned long ring_write(int mod, int lev, const char *text)
+{
+    int len = strlen(text);
+    int num = FFMAX((len + SLOT_TEXT - 1) / SLOT_TEXT, 1);
+    unsigned long pos;
+    for (;;) {
+        pos = ring_head;
+        mp_memory_barrier();
+        struct msg_slot *last = &ring[(pos + num - 1) & (RING_SLOTS - 1)];
+        long diff = (long)(last->seq - (pos + num - 1));
+        if (diff == 0) {
+            if (__sync_bool_compare_and_swap(&ring_head, pos, pos + num))
+                break;
+        } else if (diff < 0) {
+            // Full
+            if (lev > MSGL_STATUS) {
+                __sync_fetch_and_add(&ring_dropped, 1);
+                wake_writer();
+                return 0;
+            }
+            wake_writer();
+            usleep(1000);
+        }
+    }
+    struct msg_slot *first = &ring[pos & (RING_SLOTS - 1)];
+    first->mod = mod;
+    first->lev = lev;
+    first->num_slots = num;
+    first->len = len;
+    for (int n = 0; n < num; n++) {
+        struct msg_slot *slot = &ring[(pos + n) & (RING_SLOTS - 1)];
+        memcpy(slot->text, text + n * SLOT_TEXT,
+               FFMIN(len - n * SLOT_TEXT, SLOT_TEXT));
+    }
+    mp_memory_barrier();
+    // The first slot last, the writer takes the message once it is set
+    for (int n = num - 1; n >= 0; n--)
+        ring[(pos + n) & (RING_SLOTS - 1)].seq = pos + n + 1;
+    wake_writer();
+    return pos + num;
+}
+
+// Wait (at most a second) until the writer has printed everything up to end.
+static void wait_written(unsigned long end)
+{
+    for (int n = 0; n < 1000 && (long)(ring_tail - end) < 0; n++) {
+        wake_writer();
+        usleep(1000);
+        mp_memory_barrier();
+    }
+}
+
+static void stop_async(void)
+{
+    if (!async_running)
+        return;
+    async_running = 0;
+    mp_memory_barrier();
+    pthread_mutex_lock(&writer_lock);
+    writer_quit = 1;
+    pthread_cond_signal(&writer_wakeup);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_thread, NULL);
+}
+
+static void start_async(void)
+{
+    ring = malloc(RING_SLOTS * sizeof(*ring));
+    if (!ring)
+        return;
+    for (int n = 0; n < RING_SLOTS; n++)
+        ring[n].seq = n;
+    if (pthread_create(&writer_thread, NULL, writer_thread_fn, NULL)) {
+        free(ring);
+        ring = NULL;
+        return;
+    }
+    async_running = 1;
+    atexit(stop_async);
+}
+
+static bool write_async(int mod, int lev, const char *text)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, start_async);
+    if (!async_running)
+        return false;
+    unsigned long end = ring_write(mod, lev, text);
+    // Make sure fatal errors are visible before the player exits or aborts
+    if (end && lev == MSGL_FATAL)
+        wait_written(end);
+    return true;
+}
+
+#else
+
+static bool write_async(int mod, int lev, const char *text)
+{
+    return false;
+}
+
+#endif /* HAVE_PTHREADS */
+
+void mp_msg_va(int mod, int lev, const char *format, va_list va)
+{
+    char tmp[MSGSIZE_MAX];
+
+    if (!mp_msg_test(mod, lev)) return; // do not display
+    if (rate_limited(mod, lev))
+        return;
+    vsnprintf(tmp, MSGSIZE_MAX, format, va);
+    tmp[MSGSIZE_MAX-2] = '\n';
+    tmp[MSGSIZE_MAX-1] = 0;
+
+    if (mp_msg_async && write_async(mod, lev, tmp))
+        return;
+    print_msg(mod, lev, tmp, true);
 }
 
 void mp_msg(int mod, int lev, const char *format, ...)
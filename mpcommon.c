@@ -19,18 +19,23 @@
 #include "talloc.h"
 #include "mpcommon.h"
 
-char *mp_format_time(double time, bool fractions)
+char *mp_format_time_ctx(void *talloc_ctx, double time, bool fractions)
 {
     if (time < 0)
-        return talloc_strdup(NULL, "unknown");
+        return talloc_strdup(talloc_ctx, "unknown");
     int h, m, s = time;
     h = s / 3600;
     s -= h * 3600;
     m = s / 60;
     s -= m * 60;
-    char *res = talloc_asprintf(NULL, "%02d:%02d:%02d", h, m, s);
+    char *res = talloc_asprintf(talloc_ctx, "%02d:%02d:%02d", h, m, s);
     if (fractions)
         res = talloc_asprintf_append(res, ".%03d",
                                      (int)((time - (int)time) * 1000));
     return res;
 }
+
+char *mp_format_time(double time, bool fractions)
+{
+    return mp_format_time_ctx(NULL, time, fractions);
+}
@@ -79,5 +79,6 @@
 extern const char *mplayer_version;
 
 char *mp_format_time(double time, bool fractions);
+char *mp_format_time_ctx(void *talloc_ctx, double time, bool fractions);
 
 #endif /* MPLAYER_MPCOMMON_H */
@@ -34,13 +34,13 @@
 // No proper file descriptor event handling; keep waking up to poll input
 #define WAKEUP_PERIOD 0.02
 #else
-/* Even if we can immediately wake up in response to most input events,
- * there are some timers which are not registered to the event loop
- * and need to be checked periodically (like automatic mouse cursor hiding).
- * OSD content updates behave similarly. Also some uncommon input devices
- * may not have proper FD event support.
+/* Timers which are not driven by file descriptor events (OSD message
+ * expiration, automatic mouse cursor hiding, audio buffer refilling) are
+ * scheduled with schedule_wakeup(), and input devices without proper FD
+ * event support are polled by the input code. If nothing is scheduled,
+ * block until an input event or mp_input_wakeup() arrives.
  */
-#define WAKEUP_PERIOD 0.5
+#define WAKEUP_PERIOD INFINITY
 #endif
 #include <string.h>
 #include <unistd.h>
@@ -246,6 +246,7 @@ int use_filedir_conf;
 
 #include "mpcommon.h"
 #include "command.h"
+#include "ipc.h"
 
 #include "metadata.h"
 
@@ -254,10 +255,10 @@ static void reinit_subs(struct MPContext *mpctx);
 
 static float get_relative_time(struct MPContext *mpctx)
 {
-    unsigned int new_time = GetTimer();
-    unsigned int delta = new_time - mpctx->last_time;
+    int64_t new_time = mp_time_ns();
+    int64_t delta = new_time - mpctx->last_time;
     mpctx->last_time = new_time;
-    return delta * 0.000001;
+    return delta * 1e-9;
 }
 
 static int is_valid_metadata_type(struct MPContext *mpctx, metadata_t type)
@@ -596,6 +597,10 @@ void uninit_player(struct MPContext *mpctx, unsigned int mask)
 
     if (mask & INITIALIZED_ACODEC) {
         mpctx->initialized_flags &= ~INITIALIZED_ACODEC;
+        if (mpctx->sh_audio && mpctx->sh_audio->afilter &&
+            mpctx->stop_play == AT_END_OF_FILE && !mpctx->timeline)
+            af_control_any_rev(mpctx->sh_audio->afilter,
+                               AF_CONTROL_LOUDNESS_DONE | AF_CONTROL_SET, NULL);
         if (mpctx->sh_audio)
             uninit_audio(mpctx->sh_audio);
         cleanup_demux_stream(mpctx, STREAM_AUDIO);
@@ -716,6 +721,7 @@ static void exit_player(struct MPContext *mpctx, enum exit_reason how, int rc)
     timeEndPeriod(1);
 #endif
 
+    mp_ipc_uninit(mpctx->ipc);
     mp_input_uninit(mpctx->input);
 
     osd_free(mpctx->osd);
@@ -981,7 +987,7 @@ static struct track *add_stream_track(struct MPContext *mpctx,
         }
     }
 
-    struct track *track = talloc_ptrtype(NULL, track);
+    struct track *track = talloc_ptrtype(mpctx->file_pool, track);
     *track = (struct track) {
         .type = stream->type,
         .user_tid = find_new_tid(mpctx, stream->type),
@@ -1023,7 +1029,7 @@ static void add_dvd_tracks(struct MPContext *mpctx)
     if (stream->type == STREAMTYPE_DVD) {
         int n_subs = dvd_number_of_subs(stream);
         for (int n = 0; n < n_subs; n++) {
-            struct track *track = talloc_ptrtype(NULL, track);
+            struct track *track = talloc_ptrtype(mpctx->file_pool, track);
             *track = (struct track) {
                 .type = STREAM_SUB,
                 .user_tid = find_new_tid(mpctx, STREAM_SUB),
@@ -1076,7 +1082,7 @@ void add_subtitles(struct MPContext *mpctx, char *filename, float fps,
         return;
     }
 
-    struct track *track = talloc_ptrtype(NULL, track);
+    struct track *track = talloc_ptrtype(mpctx->file_pool, track);
     *track = (struct track) {
         .type = STREAM_SUB,
         .title = talloc_strdup(track, filename),
@@ -1152,9 +1158,10 @@ static void saddf(char *buf, int len, const char *format, ...)
   * \param len maximum number of characters in buf, not including terminating 0
  * \param time time value to convert/append
  */
-static void sadd_hhmmssff(char *buf, int len, double time, bool fractions)
+static void sadd_hhmmssff(struct MPContext *mpctx, char *buf, int len,
+                         double time, bool fractions)
 {
-    char *s = mp_format_time(time, fractions);
+    char *s = mp_format_time_ctx(mpctx->frame_pool, time, fractions);
     saddf(buf, len, "%s", s);
     talloc_free(s);
 }
@@ -1199,7 +1206,8 @@ static void print_status(struct MPContext *mpctx, double a_pos, bool at_frame)
      * should not depend on that). */
     width--;
 #endif
-    line = malloc(width + 1); // one additional char for the terminating null
+    // one additional char for the terminating null
+    line = talloc_size(mpctx->frame_pool, width + 1);
     line[0] = '\0';
 
     // Playback status
@@ -1221,7 +1229,7 @@ static void print_status(struct MPContext *mpctx, double a_pos, bool at_frame)
     if (cur != MP_NOPTS_VALUE) {
         saddf(line, width, " %.1f ", cur);
         saddf(line, width, "(");
-        sadd_hhmmssff(line, width, cur, mpctx->opts.osd_fractions);
+        sadd_hhmmssff(mpctx, line, width, cur, mpctx->opts.osd_fractions);
         saddf(line, width, ")");
     } else
         saddf(line, width, " ???");
@@ -1229,7 +1237,7 @@ static void print_status(struct MPContext *mpctx, double a_pos, bool at_frame)
     double len = get_time_length(mpctx);
     if (len >= 0) {
         saddf(line, width, " / %.1f (", len);
-        sadd_hhmmssff(line, width, len, mpctx->opts.osd_fractions);
+        sadd_hhmmssff(mpctx, line, width, len, mpctx->opts.osd_fractions);
         saddf(line, width, ")");
     }
 
@@ -1287,7 +1295,7 @@ static void print_status(struct MPContext *mpctx, double a_pos, bool at_frame)
         line[width] = 0;
         mp_msg(MSGT_STATUSLINE, MSGL_STATUS, "%s\r", line);
     }
-    free(line);
+    talloc_free(line);
 }
 
 /**
@@ -1325,6 +1333,14 @@ static int build_afilter_chain(struct MPContext *mpctx)
     result =  init_audio_filters(sh_audio, new_srate,
                                  &ao->samplerate, &ao->channels, &ao->format);
     mpctx->mixer.afilter = sh_audio->afilter;
+    double ratio;
+    mpctx->display_sync_resampler = result &&
+        af_control_any_rev(sh_audio->afilter,
+                           AF_CONTROL_RESAMPLE_RATIO | AF_CONTROL_GET, &ratio);
+    if (result)
+        af_control_any_rev(sh_audio->afilter,
+                           AF_CONTROL_LOUDNESS_FILE | AF_CONTROL_SET,
+                           mpctx->filename);
     return result;
 }
 
@@ -1416,6 +1432,21 @@ void rm_osd_msg(struct MPContext *mpctx, int id)
  *
  */
 
+// Make sure the playloop wakes up after at most delay seconds, e.g. to remove
+// an OSD message once it expires.
+static void schedule_wakeup(struct MPContext *mpctx, double delay)
+{
+    mpctx->sleeptime = FFMIN(mpctx->sleeptime, FFMAX(delay, 0));
+}
+
+// Convert a sleep time to the timeout argument of mp_input_get_cmd().
+static int wakeup_timeout_ms(double sleeptime)
+{
+    if (isinf(sleeptime))
+        return -1;
+    return FFMIN(sleeptime, INT_MAX / 1000) * 1000;
+}
+
 static mp_osd_msg_t *get_osd_msg(struct MPContext *mpctx)
 {
     struct MPOpts *opts = &mpctx->opts;
@@ -1433,7 +1464,8 @@ static mp_osd_msg_t *get_osd_msg(struct MPContext *mpctx)
             vo_osd_progbar_type = -1; // disable
             vo_osd_changed(OSDTYPE_PROGBAR);
             mpctx->osd_function = mpctx->paused ? OSD_PAUSE : OSD_PLAY;
-        }
+        } else
+            schedule_wakeup(mpctx, (mpctx->osd_visible - now) / 1000.0);
     }
 
     if (!last_update)
@@ -1455,8 +1487,10 @@ static mp_osd_msg_t *get_osd_msg(struct MPContext *mpctx)
             else
                 msg->started = 1;
             // display it
-            if (msg->level <= opts->osd_level)
+            if (msg->level <= opts->osd_level) {
+                schedule_wakeup(mpctx, msg->time / 1000.0);
                 return msg;
+            }
             hidden_dec_done = 1;
             continue;
         }
@@ -1537,10 +1571,10 @@ static void sadd_osd_status(char *buffer, int len, struct MPContext *mpctx,
 {
     bool fractions = mpctx->opts.osd_fractions;
     saddf_osd_function_sym(buffer, len, mpctx->osd_function);
-    sadd_hhmmssff(buffer, len, get_current_time(mpctx), fractions);
+    sadd_hhmmssff(mpctx, buffer, len, get_current_time(mpctx), fractions);
     if (full) {
         saddf(buffer, len, " / ");
-        sadd_hhmmssff(buffer, len, get_time_length(mpctx), fractions);
+        sadd_hhmmssff(mpctx, buffer, len, get_time_length(mpctx), fractions);
         sadd_percentage(buffer, len, get_percent_pos(mpctx));
     }
 }
@@ -1679,6 +1713,10 @@ void reinit_audio_chain(struct MPContext *mpctx)
     mpctx->mixer.softvol_max = opts->softvol_max;
     mixer_reinit(&mpctx->mixer, ao);
     mpctx->syncing_audio = true;
+    mpctx->display_sync_ratio = 1;
+    if (opts->video_sync == VIDEO_SYNC_DISPLAY_RESAMPLE && vo_refresh_rate <= 0)
+        mp_msg(MSGT_CPLAYER, MSGL_WARN, "--video-sync=display-resample needs "
+               "the display refresh rate (--refreshrate), using audio sync.\n");
     return;
 
 init_error:
@@ -1916,6 +1954,8 @@ static int check_framedrop(struct MPContext *mpctx, double frame_time)
             && !mpctx->restart_playback) {
             ++drop_frame_cnt;
             ++dropped_frames;
+            if (frame_dropping)
+                frame_stats_dropped(&mpctx->frame_stats);
             return frame_dropping;
         } else
             dropped_frames = 0;
@@ -2054,6 +2094,62 @@ struct track *mp_track_by_tid(struct MPContext *mpctx, enum stream_type type,
     return NULL;
 }
 
+/* With --video-sync=display-resample, video frames are shown for a whole
+ * number of display refreshes and timed by the system clock, and the
+ * audio is resampled to keep up with the video. This only works if the
+ * refresh rate is known and there is a resampler in the audio chain.
+ */
+bool display_sync_active(struct MPContext *mpctx)
+{
+    return mpctx->opts.video_sync == VIDEO_SYNC_DISPLAY_RESAMPLE &&
+           vo_refresh_rate > 0 && mpctx->sh_audio && !mpctx->ao->untimed &&
+           mpctx->display_sync_resampler;
+}
+
+// Round the display duration of a frame to whole display refreshes
+static double display_sync_duration(struct MPContext *mpctx, double duration)
+{
+    double ideal = duration * vo_refresh_rate;  // in refreshes
+    /* Frame rates that are close to a multiple of half the refresh rate
+     * are played slightly faster or slower to match it exactly; a half
+     * multiple alternates the number of refreshes per frame (3:2 pulldown).
+     * Anything further off is played at its real speed. */
+    double target = FFMAX(floor(ideal * 2 + 0.5) / 2, 1);
+    double speed = ideal / target;
+    if (fabs(speed - 1) > 0.05) {
+        target = ideal;
+        speed = 1;
+    }
+    mpctx->display_sync_speed = speed;
+    mpctx->display_sync_error += target;
+    double refreshes = floor(mpctx->display_sync_error + 0.5);
+    mpctx->display_sync_error -= refreshes;
+    return refreshes / vo_refresh_rate;
+}
+
+// Measure the A/V drift and correct it with the audio resample ratio
+static void adjust_sync_resample(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = &mpctx->opts;
+    // Audio and video positions at the current time, in stream time
+    double a_pts = written_audio_pts(mpctx) - opts->playback_speed *
+                   mpctx->display_sync_ratio * ao_get_delay(mpctx->ao);
+    double v_pts = mpctx->sh_video->pts - opts->playback_speed *
+                   mpctx->display_sync_speed * mpctx->time_frame;
+    double drift = a_pts - v_pts - audio_delay;
+    mpctx->display_sync_drift += (drift - mpctx->display_sync_drift) * 0.1;
+
+    /* Correct 10% of the drift per second, but do not change the speed by
+     * more than 2% to keep the pitch change inaudible */
+    double correction = -0.1 * mpctx->display_sync_drift;
+    correction = FFMAX(FFMIN(correction, 0.02), -0.02);
+    double ratio = mpctx->display_sync_speed * (1 + correction);
+    if (ratio != mpctx->display_sync_ratio &&
+        af_control_any_rev(mpctx->sh_audio->afilter,
+                           AF_CONTROL_RESAMPLE_RATIO | AF_CONTROL_SET, &ratio))
+        mpctx->display_sync_ratio = ratio;
+}
+
 /* Modify video timing to match the audio timeline. There are two main
  * reasons this is needed. First, video and audio can start from different
  * positions at beginning of file or after a seek (MPlayer starts both
@@ -2068,6 +2164,11 @@ static void adjust_sync(struct MPContext *mpctx, double frame_time)
     if (!mpctx->sh_audio || mpctx->syncing_audio)
         return;
 
+    if (display_sync_active(mpctx)) {
+        adjust_sync_resample(mpctx);
+        return;
+    }
+
     double a_pts = written_audio_pts(mpctx) - mpctx->delay;
     double v_pts = mpctx->sh_video->pts;
     double av_delay = a_pts - v_pts;
@@ -2698,6 +2799,8 @@ static void seek_reset(struct MPContext *mpctx, bool reset_ao, bool reset_ac)
     mpctx->hrseek_active = false;
     mpctx->hrseek_framedrop = false;
     mpctx->total_avsync_change = 0;
+    mpctx->display_sync_drift = 0;
+    mpctx->display_sync_error = 0;
     drop_frame_cnt = 0;
 
 #ifdef CONFIG_ENCODING
@@ -3101,9 +3204,11 @@ static void run_playloop(struct MPContext *mpctx)
     bool audio_left = false, video_left = false;
     double endpts = end_at.type == END_AT_TIME ? end_at.pos : MP_NOPTS_VALUE;
     bool end_is_chapter = false;
-    double sleeptime = WAKEUP_PERIOD;
     bool was_restart = mpctx->restart_playback;
 
+    talloc_free_children(mpctx->frame_pool);
+    mpctx->sleeptime = WAKEUP_PERIOD;
+
 #ifdef CONFIG_ENCODING
     if (encode_lavc_didfail(mpctx->encode_lavc_ctx)) {
         mpctx->stop_play = PT_QUIT;
@@ -3175,7 +3280,10 @@ static void run_playloop(struct MPContext *mpctx)
             }
             video_left = frame_time >= 0;
             if (video_left && !mpctx->restart_playback) {
-                mpctx->time_frame += frame_time / opts->playback_speed;
+                double duration = frame_time / opts->playback_speed;
+                if (display_sync_active(mpctx))
+                    duration = display_sync_duration(mpctx, duration);
+                mpctx->time_frame += duration;
                 adjust_sync(mpctx, frame_time);
             }
         }
@@ -3185,10 +3293,13 @@ static void run_playloop(struct MPContext *mpctx)
 
         // ================================================================
         vo_check_events(vo);
+        if (vo->wakeup_period > 0)
+            schedule_wakeup(mpctx, vo->wakeup_period);
 
 #ifdef CONFIG_X11
         if (stop_xscreensaver && vo->x11) {
             xscreensaver_heartbeat(vo->x11);
+            schedule_wakeup(mpctx, 30);
         }
 #endif
         if (heartbeat_cmd) {
@@ -3198,17 +3309,19 @@ static void run_playloop(struct MPContext *mpctx)
                 last_heartbeat = now;
                 system(heartbeat_cmd);
             }
+            schedule_wakeup(mpctx, (30000 - (now - last_heartbeat)) / 1000.0);
         }
 
         if (!video_left || (mpctx->paused && !mpctx->restart_playback))
             break;
         if (!vo->frame_loaded) {
-            sleeptime = 0;
+            mpctx->sleeptime = 0;
             break;
         }
 
         mpctx->time_frame -= get_relative_time(mpctx);
-        if (full_audio_buffers && !mpctx->restart_playback) {
+        if (full_audio_buffers && !mpctx->restart_playback &&
+            !display_sync_active(mpctx)) {
             buffered_audio = ao_get_delay(mpctx->ao);
             mp_dbg(MSGT_AVSYNC, MSGL_DBG2, "delay=%f\n", buffered_audio);
 
@@ -3242,10 +3355,10 @@ static void run_playloop(struct MPContext *mpctx)
 
         double vsleep = mpctx->time_frame - vo->flip_queue_offset;
         if (vsleep > 0.050) {
-            sleeptime = FFMIN(sleeptime, vsleep - 0.040);
+            schedule_wakeup(mpctx, vsleep - 0.040);
             break;
         }
-        sleeptime = 0;
+        mpctx->sleeptime = 0;
 
         //=================== FLIP PAGE (VIDEO BLT): ======================
 
@@ -3269,12 +3382,15 @@ static void run_playloop(struct MPContext *mpctx)
             mpctx->time_frame = timing_sleep(mpctx, mpctx->time_frame);
         mpctx->time_frame += vo->flip_queue_offset;
 
-        unsigned int t2 = GetTimer();
+        int64_t t2 = mp_time_ns();
         /* Playing with playback speed it's possible to get pathological
          * cases with mpctx->time_frame negative enough to cause an
          * overflow in pts_us calculation, thus the FFMAX. */
         double time_frame = FFMAX(mpctx->time_frame, -1);
-        unsigned int pts_us = mpctx->last_time + time_frame * 1e6;
+        unsigned int pts_us = mpctx->last_time / 1000 + time_frame * 1e6;
+        // The flip is expected to take as long as the previous one.
+        int64_t intended_ns = mpctx->last_time + (mpctx->time_frame +
+                              mpctx->last_vo_flip_duration) * 1e9;
         int duration = -1;
         double pts2 = vo->next_pts2;
         if (pts2 != MP_NOPTS_VALUE && opts->correct_pts &&
@@ -3292,7 +3408,16 @@ static void run_playloop(struct MPContext *mpctx)
         }
         vo_flip_page(vo, pts_us | 1, duration);
 
-        mpctx->last_vo_flip_duration = (GetTimer() - t2) * 0.000001;
+        int64_t flip_done = mp_time_ns();
+        if (mpctx->restart_playback) {
+            frame_stats_discontinuity(&mpctx->frame_stats);
+        } else {
+            double vsync_interval = vo_refresh_rate > 0 ?
+                                    1.0 / vo_refresh_rate : 0;
+            frame_stats_presented(&mpctx->frame_stats, intended_ns,
+                                  flip_done, vsync_interval);
+        }
+        mpctx->last_vo_flip_duration = (flip_done - t2) * 1e-9;
         if (vo->driver->flip_page_timed) {
             // No need to adjust sync based on flip speed
             mpctx->last_vo_flip_duration = 0;
@@ -3340,8 +3465,11 @@ static void run_playloop(struct MPContext *mpctx)
 
 #ifdef CONFIG_STREAM_CACHE
     // The cache status is part of the status line. Possibly update it.
-    if (mpctx->paused && opts->stream_cache_size > 0)
+    // The cache doesn't signal fill level changes, so poll while paused.
+    if (mpctx->paused && opts->stream_cache_size > 0) {
         print_status(mpctx, MP_NOPTS_VALUE, false);
+        schedule_wakeup(mpctx, 0.5);
+    }
 #endif
 
     if (!video_left && (!mpctx->paused || was_restart)) {
@@ -3383,7 +3511,7 @@ static void run_playloop(struct MPContext *mpctx)
         } else
             mpctx->stop_play = AT_END_OF_FILE;
     } else if (!mpctx->stop_play) {
-        double audio_sleep = 9;
+        double audio_sleep = INFINITY;
         if (mpctx->sh_audio && !mpctx->paused) {
             if (mpctx->ao->untimed) {
                 if (!video_left)
@@ -3398,8 +3526,8 @@ static void run_playloop(struct MPContext *mpctx)
             } else
                 audio_sleep = 0.020;
         }
-        sleeptime = FFMIN(sleeptime, audio_sleep);
-        if (sleeptime > 0) {
+        schedule_wakeup(mpctx, audio_sleep);
+        if (mpctx->sleeptime > 0) {
             if (!mpctx->sh_video)
                 goto novideo;
             if (vo_osd_has_changed(mpctx->osd) || mpctx->video_out->want_redraw)
@@ -3412,7 +3540,8 @@ static void run_playloop(struct MPContext *mpctx)
                 }
             } else {
             novideo:
-                mp_input_get_cmd(mpctx->input, sleeptime * 1000, true);
+                mp_input_get_cmd(mpctx->input,
+                                 wakeup_timeout_ms(mpctx->sleeptime), true);
             }
         }
     }
@@ -3436,6 +3565,8 @@ static void run_playloop(struct MPContext *mpctx)
         if (mpctx->stop_play)
             break;
     }
+    if (!mpctx->stop_play)
+        mp_ipc_update(mpctx->ipc);
 
     // handle -sstep
     if (step_sec > 0 && !mpctx->paused && !mpctx->restart_playback) {
@@ -3583,6 +3714,7 @@ static void init_input(struct MPContext *mpctx)
         mp_input_add_key_fd(mpctx->input, 0, 1, read_keys, NULL, mpctx->key_fifo);
     // Set the libstream interrupt callback
     stream_set_interrupt_callback(mp_input_check_interrupt, mpctx->input);
+    mpctx->ipc = mp_ipc_init(mpctx, mpctx->opts.input.ipc_path);
 }
 
 static void open_vobsubs_from_options(struct MPContext *mpctx)
@@ -3610,7 +3742,7 @@ static void open_vobsubs_from_options(struct MPContext *mpctx)
 
         for (int i = 0; i < vobsub_get_indexes_count(vo_vobsub); i++) {
             int id = vobsub_get_id_by_index(vo_vobsub, i);
-            struct track *track = talloc_ptrtype(NULL, track);
+            struct track *track = talloc_ptrtype(mpctx->file_pool, track);
             *track = (struct track) {
                 .type = STREAM_SUB,
                 .user_tid = find_new_tid(mpctx, STREAM_SUB),
@@ -3771,14 +3903,26 @@ static void idle_loop(struct MPContext *mpctx)
            && mpctx->stop_play != PT_QUIT)
     {
         uninit_player(mpctx, INITIALIZED_AO | INITIALIZED_VO);
-        mp_cmd_t *cmd;
-        while (!(cmd = mp_input_get_cmd(mpctx->input, WAKEUP_PERIOD * 1000,
-                                        false)));
-        run_command(mpctx, cmd);
-        mp_cmd_free(cmd);
+        mp_cmd_t *cmd = mp_input_get_cmd(mpctx->input,
+                                         wakeup_timeout_ms(WAKEUP_PERIOD),
+                                         false);
+        if (cmd) {
+            run_command(mpctx, cmd);
+            mp_cmd_free(cmd);
+        }
+        mp_ipc_update(mpctx->ipc);
     }
 }
 
+static void print_pool_stats(const char *name, void *pool)
+{
+    struct talloc_pool_stats st;
+    talloc_pool_get_stats(pool, &st);
+    mp_msg(MSGT_CPLAYER, MSGL_V, "%s allocations: %u from the pool, %u did "
+           "not fit, at most %zu of %zu bytes used.\n", name, st.allocs,
+           st.fallbacks, st.peak, st.size);
+}
+
 // Start playing the current playlist entry.
 // Handle initialization and deinitialization.
 static void play_current_file(struct MPContext *mpctx)
@@ -4044,6 +4188,7 @@ goto_enable_cache:
     mp_tmsg(MSGT_CPLAYER, MSGL_V, "Starting playback...\n");
 
     drop_frame_cnt = 0;          // fix for multifile fps benchmark
+    frame_stats_reset(&mpctx->frame_stats);
     play_n_frames = play_n_frames_mf;
 
     if (play_n_frames == 0) {
@@ -4060,6 +4205,8 @@ goto_enable_cache:
     mpctx->hrseek_framedrop = false;
     mpctx->step_frames = 0;
     mpctx->total_avsync_change = 0;
+    mpctx->display_sync_drift = 0;
+    mpctx->display_sync_error = 0;
     mpctx->last_chapter_seek = -2;
 
     // If there's a timeline force an absolute seek to initialize state
@@ -4093,8 +4240,15 @@ goto_enable_cache:
     if (mpctx->opts.start_paused)
         pause_player(mpctx);
 
-    while (!mpctx->stop_play)
+    // Count the mallocs that the pools didn't avoid
+    unsigned long mallocs = talloc_malloc_count();
+    int iterations = 0;
+    while (!mpctx->stop_play) {
         run_playloop(mpctx);
+        iterations++;
+    }
+    mp_msg(MSGT_CPLAYER, MSGL_V, "talloc did %lu mallocs in %d playloop "
+           "iterations.\n", talloc_malloc_count() - mallocs, iterations);
 
     mp_msg(MSGT_GLOBAL, MSGL_V, "EOF code: %d  \n", mpctx->stop_play);
 
@@ -4123,6 +4277,10 @@ terminate_playback:  // don't jump here after ao/vo/getch initialization!
         uninitialize_parts -= INITIALIZED_AO;
     uninit_player(mpctx, uninitialize_parts);
 
+    print_pool_stats("Per-frame", mpctx->frame_pool);
+    print_pool_stats("Per-file", mpctx->file_pool);
+    talloc_free_children(mpctx->file_pool);
+
     mpctx->filename = NULL;
 
     vo_sub = NULL;
@@ -4327,9 +4485,13 @@ int main(int argc, char *argv[])
         .begin_skip = MP_NOPTS_VALUE,
         .file_format = DEMUXER_TYPE_UNKNOWN,
         .last_dvb_step = 1,
+        .display_sync_ratio = 1,
+        .display_sync_speed = 1,
         .terminal_osd_text = talloc_strdup(mpctx, ""),
         .playlist = talloc_struct(mpctx, struct playlist, {0}),
     };
+    mpctx->frame_pool = talloc_pool(mpctx, 8192);
+    mpctx->file_pool = talloc_pool(mpctx, 16384);
 
     mp_msg_init();
     init_libav();
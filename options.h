@@ -1,6 +1,11 @@
 #ifndef MPLAYER_OPTIONS_H
 #define MPLAYER_OPTIONS_H
 
+// Values of MPOpts.video_sync
+#define VIDEO_SYNC_AUDIO             0  // time video frames to the audio
+#define VIDEO_SYNC_DISPLAY_RESAMPLE  1  // time video to the display refresh
+                                        // and resample audio to match
+
 typedef struct MPOpts {
     char **video_driver_list;
     char **audio_driver_list;
@@ -60,6 +65,7 @@ typedef struct MPOpts {
     int hr_seek;
     float hr_seek_demuxer_offset;
     int autosync;
+    int video_sync;  // see VIDEO_SYNC_*
     int softsleep;
     int term_osd;
     char *term_osd_esc;
@@ -116,6 +122,7 @@ typedef struct MPOpts {
     char *ass_border_color;
     char *ass_styles_file;
     int ass_hinting;
+    int ass_prerender;
     struct lavc_param {
         int workaround_bugs;
         int error_resilience;
@@ -153,6 +160,7 @@ typedef struct MPOpts {
         char *js_dev;
         char *ar_dev;
         char *in_file;
+        char *ipc_path;
         int use_joystick;
         int use_lirc;
         int use_lircc;
@@ -0,0 +1,29 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_ATOMICS_H
+#define MPLAYER_ATOMICS_H
+
+// Full memory barrier: no load or store is moved across it, by either the
+// compiler or the CPU.
+#define mp_memory_barrier() __sync_synchronize()
+
+// Add v to the integer *p as one indivisible operation.
+#define mp_atomic_add(p, v) ((void)__sync_fetch_and_add(p, v))
+
+#endif /* MPLAYER_ATOMICS_H */
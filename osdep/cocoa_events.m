@@ -60,11 +60,12 @@ static struct priv *p;
 
 static void cocoa_wait_events(int mssleeptime)
 {
-    NSTimeInterval sleeptime = mssleeptime / 1000.0;
+    NSDate *until = mssleeptime < 0 ? [NSDate distantFuture] :
+        [NSDate dateWithTimeIntervalSinceNow:mssleeptime / 1000.0];
     NSEvent *event;
     p->is_runloop_polling = YES;
     event = [NSApp nextEventMatchingMask:NSAnyEventMask
-           untilDate:[NSDate dateWithTimeIntervalSinceNow:sleeptime]
+           untilDate:until
            inMode:NSEventTrackingRunLoopMode dequeue:NO];
 
     // dequeue the next event if it is a fake to wake the cocoa polling
@@ -120,7 +121,7 @@ void cocoa_events_read_all_events(struct input_ctx *ictx, int time)
 {
     // don't bother delegating the select to the async queue if the blocking
     // time is really low or if we are not running a GUI
-    if (time > MP_ASYNC_THRESHOLD && vo_cocoa_gui_running()) {
+    if ((time < 0 || time > MP_ASYNC_THRESHOLD) && vo_cocoa_gui_running()) {
         dispatch_async(p->select_queue, ^{
             p->read_all_fd_events(ictx, time);
             cocoa_wake_runloop();
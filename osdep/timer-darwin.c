@@ -48,16 +48,22 @@ int usec_sleep(int usec_delay)
 }
 
 
+/* current time in nanoseconds */
+int64_t mp_time_ns(void)
+{
+  return mach_absolute_time() * timebase_ratio * 1e9;
+}
+
 /* current time in microseconds */
 unsigned int GetTimer(void)
 {
-  return (unsigned int)(uint64_t)(mach_absolute_time() * timebase_ratio * 1e6);
+  return mp_time_ns() / 1000;
 }
 
 /* current time in milliseconds */
 unsigned int GetTimerMS(void)
 {
-  return (unsigned int)(uint64_t)(mach_absolute_time() * timebase_ratio * 1e3);
+  return mp_time_ns() / 1000000;
 }
 
 /* initialize timer, must be called at least once at start */
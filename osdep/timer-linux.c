@@ -38,20 +38,30 @@ int usec_sleep(int usec_delay)
 #endif
 }
 
+// Returns current time in nanoseconds
+int64_t mp_time_ns(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * INT64_C(1000000000) + tv.tv_usec * INT64_C(1000);
+#endif
+}
+
 // Returns current time in microseconds
 unsigned int GetTimer(void)
 {
-  struct timeval tv;
-  gettimeofday(&tv,NULL);
-  return tv.tv_sec * 1000000 + tv.tv_usec;
+  return mp_time_ns() / 1000;
 }
 
 // Returns current time in milliseconds
 unsigned int GetTimerMS(void)
 {
-  struct timeval tv;
-  gettimeofday(&tv,NULL);
-  return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  return mp_time_ns() / 1000000;
 }
 
 // Initialize timer, must be called at least once at start
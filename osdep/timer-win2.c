@@ -22,16 +22,39 @@
 #include <mmsystem.h>
 #include "timer.h"
 
+static int64_t perf_freq;
+
+static void init_perf_freq(void)
+{
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  perf_freq = freq.QuadPart;
+}
+
+// Returns current time in nanoseconds
+int64_t mp_time_ns(void)
+{
+  LARGE_INTEGER count;
+  // may be called before InitTimer(); the frequency never changes, so
+  // racing threads all store the same value
+  if(!perf_freq)
+    init_perf_freq();
+  QueryPerformanceCounter(&count);
+  // split to avoid overflowing the multiplication
+  return count.QuadPart / perf_freq * INT64_C(1000000000) +
+         count.QuadPart % perf_freq * INT64_C(1000000000) / perf_freq;
+}
+
 // Returns current time in microseconds
 unsigned int GetTimer(void)
 {
-  return timeGetTime() * 1000;
+  return mp_time_ns() / 1000;
 }
 
 // Returns current time in milliseconds
 unsigned int GetTimerMS(void)
 {
-  return timeGetTime() ;
+  return mp_time_ns() / 1000000;
 }
 
 int usec_sleep(int usec_delay){
@@ -45,4 +68,5 @@ int usec_sleep(int usec_delay){
 
 void InitTimer(void)
 {
+  init_perf_freq();
 }
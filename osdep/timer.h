@@ -19,7 +19,15 @@
 #ifndef MPLAYER_TIMER_H
 #define MPLAYER_TIMER_H
 
+#include <stdint.h>
+
 void InitTimer(void);
+
+// Return a monotonic time in nanoseconds. The absolute value is meaningless,
+// only differences between two calls should be used.
+int64_t mp_time_ns(void);
+
+// Same clock as mp_time_ns(), truncated to 32 bit (wraps around).
 unsigned int GetTimer(void);
 unsigned int GetTimerMS(void);
 
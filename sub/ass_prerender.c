@@ -0,0 +1,381 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <ass/ass.h>
+
+#include "talloc.h"
+#include "options.h"
+#include "mp_msg.h"
+#include "ass_mp.h"
+#include "ass_prerender.h"
+
+// A request this close (in ms) to a rendered time uses its images
+#define TOLERANCE 2
+// Larger distances between requests are not taken as the frame interval
+#define MAX_INTERVAL 1000
+
+#define ALIGN(x) (((x) + 15) & ~(size_t)15)
+
+struct frame {
+    long long start, end;   // first and last time the images were rendered at
+    ASS_Image *imgs;        // in the same allocation as the frame
+    bool cached;            // still in the cache
+};
+
+struct ass_prerender {
+    ASS_Library *library;
+    ASS_Track *track;
+    pthread_t thread;
+    pthread_mutex_t track_lock;
+    pthread_mutex_t lock;       // protects everything below
+    pthread_cond_t wakeup;
+    bool quit;
+    int ahead;
+    struct ass_prerender_params params;
+    bool have_params;
+    unsigned int generation;    // changes when params change or on flush
+    long long request;          // time of the last request
+    double interval;            // estimated frame interval, 0 if unknown
+    struct frame **frames;
+    int num_frames, max_frames;
+    struct frame *shown;        // returned by the last ass_prerender_get()
+};
+
+void ass_prerender_configure(ASS_Renderer *renderer,
+                             const struct ass_prerender_params *p)
+{
+    struct MPOpts opts = {
+        .ass_font_scale = p->font_scale,
+        .ass_line_spacing = p->line_spacing,
+        .ass_use_margins = p->use_margins,
+        .ass_hinting = p->hinting,
+    };
+    struct mp_eosd_res dim = p->dim;
+    mp_ass_configure(renderer, &opts, &dim, p->unscaled);
+    ass_set_aspect_ratio(renderer, p->aspect, 1);
+}
+
+static bool params_equal(const struct ass_prerender_params *a,
+                         const struct ass_prerender_params *b)
+{
+    return a->dim.w == b->dim.w && a->dim.h == b->dim.h
+        && a->dim.mt == b->dim.mt && a->dim.mb == b->dim.mb
+        && a->dim.ml == b->dim.ml && a->dim.mr == b->dim.mr
+        && a->aspect == b->aspect && a->unscaled == b->unscaled
+        && a->font_scale == b->font_scale
+        && a->line_spacing == b->line_spacing
+        && a->use_margins == b->use_margins && a->hinting == b->hinting;
+}
+
+// Copy the image list returned by libass, which is only valid until the
+// next ass_render_frame() call on the same renderer.
+static struct frame *frame_new(ASS_Image *imgs, long long t)
+{
+    size_t size = ALIGN(sizeof(struct frame));
+    for (ASS_Image *img = imgs; img; img = img->next)
+        size += ALIGN(sizeof(ASS_Image)) + ALIGN((size_t)img->w * img->h);
+    struct frame *f = malloc(size);
+    if (!f)
+        return NULL;
+    f->start = f->end = t;
+    f->imgs = NULL;
+    f->cached = false;
+    ASS_Image **next = &f->imgs;
+    unsigned char *p = (unsigned char *)f + ALIGN(sizeof(struct frame));
+    for (ASS_Image *img = imgs; img; img = img->next) {
+        ASS_Image *copy = (ASS_Image *)p;
+        p += ALIGN(sizeof(ASS_Image));
+        *copy = *img;
+        copy->bitmap = p;
+        copy->stride = img->w;
+        copy->next = NULL;
+        for (int y = 0; y < img->h; y++)
+            memcpy(p + y * img->w, img->bitmap + y * img->stride, img->w);
+        p += ALIGN((size_t)img->w * img->h);
+        *next = copy;
+        next = &copy->next;
+    }
+    return f;
+}
+
+// Same meaning as the detect_change result of ass_render_frame()
+static int compare_images(ASS_Image *a, ASS_Image *b)
+{
+    int changed = 0;
+    for (; a && b; a = a->next, b = b->next) {
+        if (a->w != b->w || a->h != b->h || a->color != b->color)
+            return 2;
+        for (int y = 0; y < a->h; y++)
+            if (memcmp(a->bitmap + y * a->stride, b->bitmap + y * b->stride,
+                       a->w))
+                return 2;
+        if (a->dst_x != b->dst_x || a->dst_y != b->dst_y)
+            changed = 1;
+    }
+    return a || b ? 2 : changed;
+}
+
+static void frame_remove(struct ass_prerender *pr, int index)
+{
+    struct frame *f = pr->frames[index];
+    pr->frames[index] = pr->frames[--pr->num_frames];
+    f->cached = false;
+    if (f != pr->shown)
+        free(f);
+}
+
+static bool frame_insert(struct ass_prerender *pr, struct frame *f)
+{
+    if (pr->num_frames >= pr->max_frames)
+        return false;
+    pr->frames[pr->num_frames++] = f;
+    f->cached = true;
+    return true;
+}
+
+static struct frame *frame_find(struct ass_prerender *pr, long long t)
+{
+    for (int i = 0; i < pr->num_frames; i++) {
+        struct frame *f = pr->frames[i];
+        if (f->start - TOLERANCE <= t && t <= f->end + TOLERANCE)
+            return f;
+    }
+    return NULL;
+}
+
+static void flush_locked(struct ass_prerender *pr)
+{
+    while (pr->num_frames)
+        frame_remove(pr, pr->num_frames - 1);
+    pr->generation++;
+}
+
+// Next time to render: the first of the frames expected after the last
+// request that is not in the cache.
+static bool next_target(struct ass_prerender *pr, long long *t)
+{
+    if (!pr->have_params || pr->interval <= 0
+        || pr->num_frames >= pr->max_frames)
+        return false;
+    for (int k = 1; k <= pr->ahead; k++) {
+        long long next = llrint(pr->request + k * pr->interval);
+        if (!frame_find(pr, next)) {
+            *t = next;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *prerender_thread(void *arg)
+{
+    struct ass_prerender *pr = arg;
+    ASS_Renderer *renderer = NULL;
+    unsigned int generation = 0;
+    long long last = LLONG_MIN; // time of the previous render
+
+    pthread_mutex_lock(&pr->lock);
+    while (!pr->quit) {
+        long long t;
+        if (!next_target(pr, &t)) {
+            pthread_cond_wait(&pr->wakeup, &pr->lock);
+            continue;
+        }
+        struct ass_prerender_params params = pr->params;
+        unsigned int gen = pr->generation;
+        pthread_mutex_unlock(&pr->lock);
+
+        // Font setup can take long (fontconfig cache update), so it's done
+        // without track_lock, which decode() and get_bitmaps() need.
+        if (!renderer) {
+            renderer = ass_renderer_init(pr->library);
+            if (!renderer) {
+                mp_msg(MSGT_ASS, MSGL_ERR, "[ass] Can't create prerender "
+                       "renderer, rendering synchronously.\n");
+                pthread_mutex_lock(&pr->lock);
+                pr->ahead = 0;
+                continue;
+            }
+            mp_ass_configure_fonts(renderer);
+            generation = gen - 1;
+        }
+        pthread_mutex_lock(&pr->track_lock);
+        if (generation != gen) {
+            ass_prerender_configure(renderer, &params);
+            generation = gen;
+            last = LLONG_MIN;
+        }
+        int changed;
+        ASS_Image *imgs = ass_render_frame(renderer, pr->track, t, &changed);
+
+        pthread_mutex_lock(&pr->lock);
+        if (pr->generation == gen) {
+            struct frame *prev = NULL;
+            if (last != LLONG_MIN && !changed
+                && t - last <= pr->interval + TOLERANCE)
+                for (int i = 0; i < pr->num_frames; i++)
+                    if (pr->frames[i]->end == last)
+                        prev = pr->frames[i];
+            if (prev) {
+                prev->end = t;
+            } else {
+                struct frame *f = frame_new(imgs, t);
+                if (!f)
+                    pr->ahead = 0; // out of memory, stop rendering ahead
+                else if (!frame_insert(pr, f))
+                    free(f);
+            }
+        }
+        last = t;
+        pthread_mutex_unlock(&pr->track_lock);
+    }
+    pthread_mutex_unlock(&pr->lock);
+
+    if (renderer) {
+        pthread_mutex_lock(&pr->track_lock);
+        ass_renderer_done(renderer);
+        pthread_mutex_unlock(&pr->track_lock);
+    }
+    return NULL;
+}
+
+struct ass_prerender *ass_prerender_new(ASS_Library *library,
+                                        ASS_Track *track, int frames)
+{
+    struct ass_prerender *pr = talloc_zero(NULL, struct ass_prerender);
+    pr->library = library;
+    pr->track = track;
+    pr->ahead = frames;
+    pr->max_frames = frames + 2;
+    pr->frames = talloc_array(pr, struct frame *, pr->max_frames);
+    pr->request = LLONG_MIN;
+    pthread_mutex_init(&pr->track_lock, NULL);
+    pthread_mutex_init(&pr->lock, NULL);
+    pthread_cond_init(&pr->wakeup, NULL);
+    if (pthread_create(&pr->thread, NULL, prerender_thread, pr)) {
+        mp_msg(MSGT_ASS, MSGL_WARN, "[ass] Can't create prerender thread.\n");
+        pthread_mutex_destroy(&pr->track_lock);
+        pthread_mutex_destroy(&pr->lock);
+        pthread_cond_destroy(&pr->wakeup);
+        talloc_free(pr);
+        return NULL;
+    }
+    return pr;
+}
+
+void ass_prerender_free(struct ass_prerender *pr)
+{
+    if (!pr)
+        return;
+    pthread_mutex_lock(&pr->lock);
+    pr->quit = true;
+    pthread_cond_signal(&pr->wakeup);
+    pthread_mutex_unlock(&pr->lock);
+    pthread_join(pr->thread, NULL);
+
+    flush_locked(pr);
+    free(pr->shown);
+    pthread_mutex_destroy(&pr->track_lock);
+    pthread_mutex_destroy(&pr->lock);
+    pthread_cond_destroy(&pr->wakeup);
+    talloc_free(pr);
+}
+
+void ass_prerender_lock_track(struct ass_prerender *pr)
+{
+    pthread_mutex_lock(&pr->track_lock);
+}
+
+void ass_prerender_unlock_track(struct ass_prerender *pr)
+{
+    pthread_mutex_unlock(&pr->track_lock);
+}
+
+void ass_prerender_invalidate(struct ass_prerender *pr, long long from)
+{
+    pthread_mutex_lock(&pr->lock);
+    for (int i = pr->num_frames - 1; i >= 0; i--)
+        if (pr->frames[i]->end >= from)
+            frame_remove(pr, i);
+    pthread_cond_signal(&pr->wakeup);
+    pthread_mutex_unlock(&pr->lock);
+}
+
+ASS_Image *ass_prerender_get(struct ass_prerender *pr, ASS_Renderer *renderer,
+                             const struct ass_prerender_params *params,
+                             long long now, int *changed)
+{
+    pthread_mutex_lock(&pr->lock);
+    if (!pr->have_params || !params_equal(&pr->params, params)) {
+        flush_locked(pr);
+        pr->params = *params;
+        pr->have_params = true;
+    }
+    if (pr->request != LLONG_MIN) {
+        // Smooth the interval, as timestamps are often rounded to ms
+        long long d = now - pr->request;
+        if (d > 0 && d <= MAX_INTERVAL) {
+            if (d > pr->interval / 2 && d < pr->interval * 2)
+                pr->interval += (d - pr->interval) / 8;
+            else
+                pr->interval = d;
+        }
+    }
+    pr->request = now;
+    for (int i = pr->num_frames - 1; i >= 0; i--)
+        if (pr->frames[i]->end + TOLERANCE < now)
+            frame_remove(pr, i);
+    struct frame *f = frame_find(pr, now);
+    pthread_cond_signal(&pr->wakeup);
+    pthread_mutex_unlock(&pr->lock);
+
+    if (!f) {
+        // Not rendered ahead (yet), do it now
+        int dummy;
+        pthread_mutex_lock(&pr->track_lock);
+        ass_prerender_configure(renderer, params);
+        f = frame_new(ass_render_frame(renderer, pr->track, now, &dummy), now);
+        pthread_mutex_lock(&pr->lock);
+        if (f && !frame_insert(pr, f)) {
+            // evict the frame furthest ahead
+            int last = 0;
+            for (int i = 1; i < pr->num_frames; i++)
+                if (pr->frames[i]->start > pr->frames[last]->start)
+                    last = i;
+            frame_remove(pr, last);
+            frame_insert(pr, f);
+        }
+        pthread_mutex_unlock(&pr->lock);
+        pthread_mutex_unlock(&pr->track_lock);
+    }
+
+    struct frame *old = pr->shown;
+    if (!old || !f)
+        *changed = 2;
+    else
+        *changed = old == f ? 0 : compare_images(old->imgs, f->imgs);
+    if (old && old != f && !old->cached)
+        free(old);
+    pr->shown = f;
+    return f ? f->imgs : NULL;
+}
@@ -0,0 +1,77 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_ASS_PRERENDER_H
+#define MPLAYER_ASS_PRERENDER_H
+
+#include <stdbool.h>
+#include <ass/ass.h>
+
+#include "dec_sub.h"
+
+/* Render-ahead cache for libass subtitles.
+ *
+ * A worker thread renders the track with its own ASS_Renderer at the
+ * times of the frames following the last requested one (extrapolated from
+ * the distance between the last two requests) and keeps copies of the
+ * images. Consecutive frames with identical images share one cache entry.
+ *
+ * The track is shared with the worker: everything modifying it must be
+ * done between ass_prerender_lock_track() and ass_prerender_unlock_track(),
+ * together with ass_prerender_invalidate() for the affected times.
+ */
+
+struct ass_prerender;
+
+// Everything the rendered images depend on besides the track and the time.
+struct ass_prerender_params {
+    struct mp_eosd_res dim;
+    double aspect;
+    bool unscaled;
+    float font_scale;
+    float line_spacing;
+    int use_margins;
+    int hinting;
+};
+
+void ass_prerender_configure(ASS_Renderer *renderer,
+                             const struct ass_prerender_params *p);
+
+/* Start the worker, caching up to frames frames ahead. Returns NULL if the
+ * thread could not be created. */
+struct ass_prerender *ass_prerender_new(ASS_Library *library,
+                                        ASS_Track *track, int frames);
+void ass_prerender_free(struct ass_prerender *pr);
+
+void ass_prerender_lock_track(struct ass_prerender *pr);
+void ass_prerender_unlock_track(struct ass_prerender *pr);
+
+/* Drop everything rendered for times >= from (in ms). Must be called with
+ * the track locked, so that no frame rendered from the old track state can
+ * be added afterwards. */
+void ass_prerender_invalidate(struct ass_prerender *pr, long long from);
+
+/* Return the images for time now (in ms), from the cache if possible,
+ * otherwise rendered with renderer. *changed is set like the detect_change
+ * argument of ass_render_frame(), relative to the previously returned
+ * images. The images stay valid until the next call. */
+ASS_Image *ass_prerender_get(struct ass_prerender *pr, ASS_Renderer *renderer,
+                             const struct ass_prerender_params *params,
+                             long long now, int *changed);
+
+#endif /* MPLAYER_ASS_PRERENDER_H */
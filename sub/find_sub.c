@@ -21,71 +21,67 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include "libvo/video_out.h"
 #include "sub.h"
 #include "subreader.h"
+#include "sub_index.h"
 
 #include "mp_msg.h"
 #include "mpcommon.h"
 #include "mplayer.h"
 
-static int current_sub=0;
-
-//static subtitle* subtitles=NULL;
-static int nosub_range_start=-1;
-static int nosub_range_end=-1;
-static const sub_data *last_sub_data = NULL;
+// Result of the last lookup, valid for keys in [cache_start, cache_end)
+static const sub_data *cache_subd;
+static unsigned long cache_start, cache_end;
+static subtitle *cache_result;
+// Active subtitles combined into one if several overlap
+static subtitle combined;
 
 void step_sub(sub_data *subd, float pts, int movement) {
     subtitle *subs;
-    int key;
+    int key, pos, cur, target;
 
-    if (subd == NULL) return;
+    if (subd == NULL || !subd->index || subd->sub_num == 0) return;
     subs = subd->subtitles;
     key = (pts+sub_delay) * (subd->sub_uses_time ? 100 : sub_fps);
 
     /* Tell the OSD subsystem that the OSD contents will change soon */
     vo_osd_changed(OSDTYPE_SUBTITLE);
 
-    /* If we are moving forward, don't count the next (current) subtitle
-     * if we haven't displayed it yet. Same when moving other direction.
+    /* The current subtitle is the last one that has started. If we are
+     * moving forward the next one is the one after it; when moving back,
+     * the current one counts as a step only if it is already over.
      */
-    if (movement > 0 && key < subs[current_sub].start)
-    	movement--;
-    if (movement < 0 && key >= subs[current_sub].end)
-    	movement++;
+    pos = sub_index_position(subd->index, key > 0 ? key : 0);
+    cur = pos - 1;
+    target = cur + movement;
+    if (movement < 0 && cur >= 0 &&
+        key >= subs[sub_index_nth(subd->index, cur)].end)
+        target++;
 
     /* Never move beyond first or last subtitle. */
-    if (current_sub+movement < 0)
-    	movement = 0-current_sub;
-    if (current_sub+movement >= subd->sub_num)
-    	movement = subd->sub_num - current_sub - 1;
+    if (target < 0)
+        target = 0;
+    if (target >= subd->sub_num)
+        target = subd->sub_num - 1;
 
-    current_sub += movement;
-    sub_delay = subs[current_sub].start / (subd->sub_uses_time ? 100 : sub_fps) - pts;
+    target = sub_index_nth(subd->index, target);
+    sub_delay = subs[target].start / (subd->sub_uses_time ? 100 : sub_fps) - pts;
 }
 
 void find_sub(struct MPContext *mpctx, sub_data* subd,int key){
-    subtitle *subs;
     subtitle *new_sub = NULL;
-    int i,j;
+    int active[SUB_MAX_TEXT];
+    int i, n, lines;
+    unsigned long next_change;
 
-    if ( !subd || subd->sub_num == 0) return;
-    subs = subd->subtitles;
-
-    if (last_sub_data != subd) {
-        // Sub data changed, reset nosub range.
-        last_sub_data = subd;
-        nosub_range_start = -1;
-        nosub_range_end = -1;
-    }
+    if ( !subd || subd->sub_num == 0 || !subd->index) return;
 
-    if(vo_sub){
-      if(key>=vo_sub->start && key<=vo_sub->end) return; // OK!
-    } else {
-      if(key>nosub_range_start && key<nosub_range_end) return; // OK!
-    }
+    if (cache_subd == subd && vo_sub == cache_result &&
+        key >= 0 && key >= cache_start && key < cache_end)
+        return; // OK!
     // sub changed!
 
     /* Tell the OSD subsystem that the OSD contents will change soon */
@@ -93,83 +89,35 @@ void find_sub(struct MPContext *mpctx, sub_data* subd,int key){
 
     if(key<=0){
       // no sub here
+      cache_subd = NULL;
       goto update;
     }
 
-//    printf("\r---- sub changed ----\n");
-
-    // check next sub.
-    if(current_sub>=0 && current_sub+1 < subd->sub_num){
-      if(key>subs[current_sub].end && key<subs[current_sub+1].start){
-          // no sub
-          nosub_range_start=subs[current_sub].end;
-          nosub_range_end=subs[current_sub+1].start;
-          goto update;
-      }
-      // next sub?
-      ++current_sub;
-      new_sub=&subs[current_sub];
-      if(key>=new_sub->start && key<=new_sub->end) goto update; // OK!
-    }
-
-//    printf("\r---- sub log search... ----\n");
-
-    // use logarithmic search:
-    i=0;
-    j = subd->sub_num - 1;
-//    printf("Searching %d in %d..%d\n",key,subs[i].start,subs[j].end);
-    while(j>=i){
-        current_sub=(i+j+1)/2;
-        new_sub=&subs[current_sub];
-        if(key<new_sub->start) j=current_sub-1;
-        else if(key>new_sub->end) i=current_sub+1;
-        else goto update; // found!
+    n = sub_index_find(subd->index, key, active, SUB_MAX_TEXT, &next_change);
+    if (n > SUB_MAX_TEXT)
+        n = SUB_MAX_TEXT;
+    if (n == 1) {
+        new_sub = &subd->subtitles[active[0]];
+    } else if (n > 1) {
+        // Overlapping subtitles that were not merged at load time: show
+        // them together, earliest on top.
+        memset(&combined, 0, sizeof(combined));
+        combined.start = key;
+        combined.end = next_change - 1;
+        combined.alignment = subd->subtitles[active[0]].alignment;
+        for (i = 0, lines = 0; i < n; i++) {
+            subtitle *sub = &subd->subtitles[active[i]];
+            for (int l = 0; l < sub->lines && lines < SUB_MAX_TEXT; l++)
+                combined.text[lines++] = sub->text[l];
+        }
+        combined.lines = lines;
+        new_sub = &combined;
     }
-//    if(key>=new_sub->start && key<=new_sub->end) return; // OK!
-
-    // check where are we...
-    if(key<new_sub->start){
-      if(current_sub<=0){
-          // before the first sub
-          nosub_range_start=key-1; // tricky
-          nosub_range_end=new_sub->start;
-//          printf("FIRST...  key=%d  end=%d  \n",key,new_sub->start);
-          new_sub=NULL;
-          goto update;
-      }
-      --current_sub;
-      if(key>subs[current_sub].end && key<subs[current_sub+1].start){
-          // no sub
-          nosub_range_start=subs[current_sub].end;
-          nosub_range_end=subs[current_sub+1].start;
-//          printf("No sub... 1 \n");
-          new_sub=NULL;
-          goto update;
-      }
-      printf("HEH????  ");
-    } else {
-      if(key<=new_sub->end) printf("JAJJ!  "); else
-      if(current_sub+1 >= subd->sub_num){
-          // at the end?
-          nosub_range_start=new_sub->end;
-          nosub_range_end=0x7FFFFFFF; // MAXINT
-//          printf("END!?\n");
-          new_sub=NULL;
-          goto update;
-      } else
-      if(key>subs[current_sub].end && key<subs[current_sub+1].start){
-          // no sub
-          nosub_range_start=subs[current_sub].end;
-          nosub_range_end=subs[current_sub+1].start;
-//          printf("No sub... 2 \n");
-          new_sub=NULL;
-          goto update;
-      }
-    }
-
-    mp_msg(MSGT_FIXME,MSGL_FIXME,"SUB ERROR:  %d  ?  %d --- %d  [%d]  \n",key,(int)new_sub->start,(int)new_sub->end,current_sub);
 
-    new_sub=NULL; // no sub here
+    cache_subd = subd;
+    cache_start = key;
+    cache_end = next_change;
+    cache_result = new_sub;
 update:
     set_osd_subtitle(mpctx, new_sub);
 }
@@ -17,6 +17,7 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
 #include <ass/ass.h>
 #include <assert.h>
 #include <string.h>
@@ -29,6 +30,9 @@
 #include "libmpdemux/stheader.h"
 #include "sub.h"
 #include "ass_mp.h"
+#if HAVE_PTHREADS
+#include "ass_prerender.h"
+#endif
 #include "sd.h"
 #include "subassconvert.h"
 
@@ -36,8 +40,32 @@ struct sd_ass_priv {
     struct ass_track *ass_track;
     bool vsfilter_aspect;
     bool incomplete_event;
+#if HAVE_PTHREADS
+    struct ass_prerender *prerender;
+    bool prerender_failed;
+#endif
 };
 
+static void lock_track(struct sd_ass_priv *ctx)
+{
+#if HAVE_PTHREADS
+    if (ctx->prerender)
+        ass_prerender_lock_track(ctx->prerender);
+#endif
+}
+
+// Unlock after modifying the track, which may change rendering from time
+// changed_from (in ms) on.
+static void unlock_track(struct sd_ass_priv *ctx, long long changed_from)
+{
+#if HAVE_PTHREADS
+    if (ctx->prerender) {
+        ass_prerender_invalidate(ctx->prerender, changed_from);
+        ass_prerender_unlock_track(ctx->prerender);
+    }
+#endif
+}
+
 static void free_last_event(ASS_Track *track)
 {
     assert(track->n_events > 0);
@@ -67,8 +95,9 @@ static int init(struct sh_sub *sh, struct osd_state *osd)
     return 0;
 }
 
-static void decode(struct sh_sub *sh, struct osd_state *osd, void *data,
-                   int data_len, double pts, double duration)
+static void decode_locked(struct sh_sub *sh, struct osd_state *osd,
+                          void *data, int data_len, double pts,
+                          double duration)
 {
     unsigned char *text = data;
     struct sd_ass_priv *ctx = sh->context;
@@ -125,6 +154,17 @@ static void decode(struct sh_sub *sh, struct osd_state *osd, void *data,
     event->Text = strdup(buf);
 }
 
+static void decode(struct sh_sub *sh, struct osd_state *osd, void *data,
+                   int data_len, double pts, double duration)
+{
+    struct sd_ass_priv *ctx = sh->context;
+
+    lock_track(ctx);
+    decode_locked(sh, osd, data, data_len, pts, duration);
+    unlock_track(ctx, pts == MP_NOPTS_VALUE ? LLONG_MIN
+                                            : (long long)(pts * 1000 + 0.5));
+}
+
 static void get_bitmaps(struct sh_sub *sh, struct osd_state *osd,
                         struct sub_bitmaps *res)
 {
@@ -138,11 +178,33 @@ static void get_bitmaps(struct sh_sub *sh, struct osd_state *osd,
     if (ctx->vsfilter_aspect && opts->ass_vsfilter_aspect_compat)
         scale = osd->vsfilter_scale;
     ASS_Renderer *renderer = osd->ass_renderer;
-    mp_ass_configure(renderer, opts, &osd->dim, osd->unscaled);
-    ass_set_aspect_ratio(renderer, scale, 1);
+    long long now = osd->sub_pts * 1000 + .5;
     int changed;
-    res->imgs = ass_render_frame(renderer, ctx->ass_track,
-                                 osd->sub_pts * 1000 + .5, &changed);
+#if HAVE_PTHREADS
+    if (!ctx->prerender && !ctx->prerender_failed && opts->ass_prerender > 0) {
+        ctx->prerender = ass_prerender_new(osd->ass_library, ctx->ass_track,
+                                           opts->ass_prerender);
+        ctx->prerender_failed = !ctx->prerender;
+    }
+    if (ctx->prerender) {
+        struct ass_prerender_params params = {
+            .dim = osd->dim,
+            .aspect = scale,
+            .unscaled = osd->unscaled,
+            .font_scale = opts->ass_font_scale,
+            .line_spacing = opts->ass_line_spacing,
+            .use_margins = opts->ass_use_margins,
+            .hinting = opts->ass_hinting,
+        };
+        res->imgs = ass_prerender_get(ctx->prerender, renderer, &params, now,
+                                      &changed);
+    } else
+#endif
+    {
+        mp_ass_configure(renderer, opts, &osd->dim, osd->unscaled);
+        ass_set_aspect_ratio(renderer, scale, 1);
+        res->imgs = ass_render_frame(renderer, ctx->ass_track, now, &changed);
+    }
     if (changed == 2)
         res->bitmap_id = ++res->bitmap_pos_id;
     else if (changed)
@@ -153,15 +215,20 @@ static void get_bitmaps(struct sh_sub *sh, struct osd_state *osd,
 static void reset(struct sh_sub *sh, struct osd_state *osd)
 {
     struct sd_ass_priv *ctx = sh->context;
+    lock_track(ctx);
     if (ctx->incomplete_event)
         free_last_event(ctx->ass_track);
     ctx->incomplete_event = false;
+    unlock_track(ctx, LLONG_MIN);
 }
 
 static void uninit(struct sh_sub *sh)
 {
     struct sd_ass_priv *ctx = sh->context;
 
+#if HAVE_PTHREADS
+    ass_prerender_free(ctx->prerender);
+#endif
     ass_free_track(ctx->ass_track);
     talloc_free(ctx);
 }
@@ -41,6 +41,7 @@
 
 #include "config.h"
 #include "mp_msg.h"
+#include "cpudetect.h"
 
 #include "spudec.h"
 #include "vobsub.h"
@@ -78,6 +79,23 @@ struct spu_packet_t {
   packet_t *next;
 };
 
+/* A scaled version of the current image, for one output size */
+struct scaled_image {
+  unsigned int frame_width, frame_height; /* 0 if the entry is unused */
+  int aamode;
+  float gaussvar;
+  unsigned int start_col, start_row;
+  unsigned int width, height, stride;
+  size_t size;			/* size of each of image and aimage */
+  unsigned char *image;
+  unsigned char *aimage;
+  unsigned int last_use;
+};
+
+/* Number of output sizes the scaled image is kept for, e.g. for the
+   window and fullscreen size, or for OSD and a video filter. */
+#define SCALED_CACHE_SIZE 4
+
 struct palette_crop_cache {
   int valid;
   uint32_t palette;
@@ -110,12 +128,8 @@ typedef struct {
   unsigned int pal_start_col, pal_start_row;
   unsigned int pal_width, pal_height;
   unsigned char *pal_image;	/* palette entry value */
-  unsigned int scaled_frame_width, scaled_frame_height;
-  unsigned int scaled_start_col, scaled_start_row;
-  unsigned int scaled_width, scaled_height, scaled_stride;
-  size_t scaled_image_size;
-  unsigned char *scaled_image;
-  unsigned char *scaled_aimage;
+  struct scaled_image scaled[SCALED_CACHE_SIZE];
+  unsigned int scaled_clock;
   int auto_palette; /* 1 if we lack a palette and must use an heuristic. */
   int font_start_level;  /* Darkest value used for the computed font */
   int spu_changed;
@@ -219,6 +233,14 @@ static inline void spudec_cut_image(spudec_handle_t *this)
 }
 
 
+/* The image changed, all scaled versions must be redone */
+static void spudec_invalidate_scaled(spudec_handle_t *this)
+{
+  int i;
+  for (i = 0; i < SCALED_CACHE_SIZE; i++)
+    this->scaled[i].frame_width = this->scaled[i].frame_height = 0;
+}
+
 static int spudec_alloc_image(spudec_handle_t *this, int stride, int height)
 {
   if (this->width > stride) // just a safeguard
@@ -248,21 +270,79 @@ static int spudec_alloc_image(spudec_handle_t *this, int stride, int height)
  *            alpha == 0 means transparent, 1 fully opaque,
  *            gray value <= 256 - alpha.
  */
-static void pal2gray_alpha(const uint16_t *pal,
+#if HAVE_SSE2
+/* Expand n (a multiple of 16) pixels with a 4 entry palette. tab holds the
+   indices 0 to 3, the gray values and the alpha values, each broadcast to
+   16 bytes: every pixel is compared with the 4 indices and the resulting
+   masks select the gray and alpha values. */
+static void pal4_to_gray_alpha_sse2(const uint8_t (*tab)[16],
+                                    const uint8_t *src, uint8_t *dst,
+                                    uint8_t *dsta, int n)
+{
+  intptr_t i = -(intptr_t)n;
+#define PAL4_ENTRY(k) \
+        "movdqa    %%xmm0, %%xmm3 \n" \
+        "pcmpeqb   " #k "*16(%4), %%xmm3 \n" \
+        "movdqa    %%xmm3, %%xmm4 \n" \
+        "pand      " #k "*16+64(%4), %%xmm3 \n" \
+        "pand      " #k "*16+128(%4), %%xmm4 \n" \
+        "por       %%xmm3, %%xmm1 \n" \
+        "por       %%xmm4, %%xmm2 \n"
+  __asm__ volatile(
+        "1: \n"
+        "movdqu    (%1,%0), %%xmm0 \n"
+        "pxor      %%xmm1, %%xmm1 \n"
+        "pxor      %%xmm2, %%xmm2 \n"
+        PAL4_ENTRY(0)
+        PAL4_ENTRY(1)
+        PAL4_ENTRY(2)
+        PAL4_ENTRY(3)
+        "movdqu    %%xmm1, (%2,%0) \n"
+        "movdqu    %%xmm2, (%3,%0) \n"
+        "add          $16, %0 \n"
+        "jl 1b \n"
+        : "+&r"(i)
+        : "r"(src + n), "r"(dst + n), "r"(dsta + n), "r"(tab)
+        : "memory"
+  );
+#undef PAL4_ENTRY
+}
+#endif
+
+/* Convert the palette indices to the gray and alpha planes, clearing the
+   padding up to dst_stride. colors is the size of the palette. */
+static void pal2gray_alpha(const uint16_t *pal, int colors,
                            const uint8_t *src, int src_stride,
                            uint8_t *dst, uint8_t *dsta,
                            int dst_stride, int w, int h)
 {
-  int x, y;
+  int x, y, simd_w = 0;
+#if HAVE_SSE2
+  uint8_t tab[12][16] __attribute__((aligned(16)));
+  if (colors == 4 && gCpuCaps.hasSSE2 && w >= 16) {
+    for (x = 0; x < 4; x++) {
+      memset(tab[x], x, 16);
+      memset(tab[x + 4], pal[x] & 0xff, 16);
+      memset(tab[x + 8], pal[x] >> 8, 16);
+    }
+    simd_w = w & ~15;
+  }
+#endif
   for (y = 0; y < h; y++) {
-    for (x = 0; x < w; x++) {
+#if HAVE_SSE2
+    if (simd_w)
+      pal4_to_gray_alpha_sse2(tab, src, dst, dsta, simd_w);
+#endif
+    for (x = simd_w; x < w; x++) {
       uint16_t pixel = pal[src[x]];
-      *dst++  = pixel;
-      *dsta++ = pixel >> 8;
+      dst[x]  = pixel;
+      dsta[x] = pixel >> 8;
     }
     for (; x < dst_stride; x++)
-      *dsta++ = *dst++ = 0;
-    src += src_stride;
+      dsta[x] = dst[x] = 0;
+    src  += src_stride;
+    dst  += dst_stride;
+    dsta += dst_stride;
   }
 }
 
@@ -295,7 +375,7 @@ static int apply_palette_crop(spudec_handle_t *this,
     pal[i] = (-alpha << 8) | color;
   }
   src = this->pal_image + crop_y * this->pal_width + crop_x;
-  pal2gray_alpha(pal, src, this->pal_width,
+  pal2gray_alpha(pal, 4, src, this->pal_width,
                  this->image, this->aimage, stride,
                  crop_w, crop_h);
   this->width  = crop_w;
@@ -305,9 +385,7 @@ static int apply_palette_crop(spudec_handle_t *this,
   this->start_row = this->pal_start_row + crop_y;
   spudec_cut_image(this);
 
-  // reset scaled image
-  this->scaled_frame_width = 0;
-  this->scaled_frame_height = 0;
+  spudec_invalidate_scaled(this);
   this->palette_crop_cache.valid = 0;
   return 1;
 }
@@ -692,9 +770,7 @@ void spudec_heartbeat(void *this, unsigned int pts100)
       spu->start_col  = packet->start_col;
       spu->start_row  = packet->start_row;
 
-      // reset scaled image
-      spu->scaled_frame_width = 0;
-      spu->scaled_frame_height = 0;
+      spudec_invalidate_scaled(spu);
     } else {
       if (spu->auto_palette)
         compute_palette(spu, packet);
@@ -810,13 +886,19 @@ static void scale_table(unsigned int start_src, unsigned int start_tar, unsigned
 }
 
 /* bilinear scale, similar to vobsub's code */
-static void scale_image(int x, int y, scale_pixel* table_x, scale_pixel* table_y, spudec_handle_t * spu)
+static void scale_image(int x, int y, scale_pixel* table_x, scale_pixel* table_y, spudec_handle_t * spu, struct scaled_image *s)
 {
   int alpha[4];
   int color[4];
   unsigned int scale[4];
   int base = table_y[y].position * spu->stride + table_x[x].position;
-  int scaled = y * spu->scaled_stride + x;
+  int scaled = y * s->stride + x;
+  // most of a subtitle is transparent, which always gives 0 for both
+  if (!(spu->aimage[base] | spu->aimage[base + 1] |
+        spu->aimage[base + spu->stride] | spu->aimage[base + spu->stride + 1])) {
+    s->image[scaled] = s->aimage[scaled] = 0;
+    return;
+  }
   alpha[0] = canon_alpha(spu->aimage[base]);
   alpha[1] = canon_alpha(spu->aimage[base + 1]);
   alpha[2] = canon_alpha(spu->aimage[base + spu->stride]);
@@ -831,13 +913,13 @@ static void scale_image(int x, int y, scale_pixel* table_x, scale_pixel* table_y
   scale[1] = (table_x[x].right_down * table_y[y].left_up >>16) * alpha[1];
   scale[2] = (table_x[x].left_up * table_y[y].right_down >> 16) * alpha[2];
   scale[3] = (table_x[x].right_down * table_y[y].right_down >> 16) * alpha[3];
-  spu->scaled_image[scaled] = (color[0] * scale[0] + color[1] * scale[1] + color[2] * scale[2] + color[3] * scale[3])>>24;
-  spu->scaled_aimage[scaled] = (scale[0] + scale[1] + scale[2] + scale[3]) >> 16;
-  if (spu->scaled_aimage[scaled]){
+  s->image[scaled] = (color[0] * scale[0] + color[1] * scale[1] + color[2] * scale[2] + color[3] * scale[3])>>24;
+  s->aimage[scaled] = (scale[0] + scale[1] + scale[2] + scale[3]) >> 16;
+  if (s->aimage[scaled]){
     // ensure that MPlayer's simplified alpha-blending can not overflow
-    spu->scaled_image[scaled] = FFMIN(spu->scaled_image[scaled], spu->scaled_aimage[scaled]);
+    s->image[scaled] = FFMIN(s->image[scaled], s->aimage[scaled]);
     // convert to MPlayer-style alpha
-    spu->scaled_aimage[scaled] = -spu->scaled_aimage[scaled];
+    s->aimage[scaled] = -s->aimage[scaled];
   }
 }
 
@@ -868,11 +950,329 @@ static void sws_spu_image(unsigned char *d1, unsigned char *d2, int dw, int dh,
 	sws_freeContext(ctx);
 }
 
-void spudec_draw_scaled(void *me, unsigned int dxs, unsigned int dys, void (*draw_alpha)(void *ctx, int x0,int y0, int w,int h, unsigned char* src, unsigned char *srca, int stride), void *ctx)
+/* Scale the current image to the output size dxs x dys into s, which may
+   still hold another size. Returns 0 if memory could not be allocated. */
+static int spudec_scale(spudec_handle_t *spu, struct scaled_image *s,
+                        unsigned int dxs, unsigned int dys)
 {
-  spudec_handle_t *spu = me;
+  /* scaled_x = scalex * x / 0x100
+     scaled_y = scaley * y / 0x100
+     order of operations is important because of rounding. */
+  unsigned int scalex = 0x100 * dxs / spu->orig_frame_width;
+  unsigned int scaley = 0x100 * dys / spu->orig_frame_height;
   scale_pixel *table_x;
   scale_pixel *table_y;
+  unsigned int x, y;
+  s->start_col = spu->start_col * scalex / 0x100;
+  s->start_row = spu->start_row * scaley / 0x100;
+  s->width = spu->width * scalex / 0x100;
+  s->height = spu->height * scaley / 0x100;
+  /* Kludge: draw_alpha needs width multiple of 8 */
+  s->stride = (s->width + 7) & ~7;
+  if (s->size < s->stride * s->height) {
+    free(s->image);
+    s->size = 0;
+    s->image = malloc(2 * s->stride * s->height);
+    if (!s->image)
+      return 0;
+    s->size = s->stride * s->height;
+  }
+  s->aimage = s->image + s->size;
+  // needs to be 0-initialized because draw_alpha draws always a
+  // multiple of 8 pixels. TODO: optimize
+  if (s->width & 7)
+    memset(s->image, 0, 2 * s->size);
+  if (s->width <= 1 || s->height <= 1) {
+    goto nothing_to_do;
+  }
+  switch(spu_aamode&15) {
+  case 4:
+  sws_spu_image(s->image, s->aimage,
+	  s->width, s->height, s->stride,
+	  spu->image, spu->aimage, spu->width, spu->height, spu->stride);
+  break;
+  case 3:
+  table_x = calloc(s->width, sizeof(scale_pixel));
+  table_y = calloc(s->height, sizeof(scale_pixel));
+  if (!table_x || !table_y) {
+    mp_msg(MSGT_SPUDEC, MSGL_FATAL, "Fatal: spudec_scale: calloc failed\n");
+    free(table_x);
+    free(table_y);
+    return 0;
+  }
+  scale_table(0, 0, spu->width - 1, s->width - 1, table_x);
+  scale_table(0, 0, spu->height - 1, s->height - 1, table_y);
+  for (y = 0; y < s->height; y++)
+    for (x = 0; x < s->width; x++)
+      scale_image(x, y, table_x, table_y, spu, s);
+  free(table_x);
+  free(table_y);
+  break;
+  case 0:
+  /* no antialiasing */
+  for (y = 0; y < s->height; ++y) {
+    int unscaled_y = y * 0x100 / scaley;
+    int strides = spu->stride * unscaled_y;
+    int scaled_strides = s->stride * y;
+    for (x = 0; x < s->width; ++x) {
+      int unscaled_x = x * 0x100 / scalex;
+      s->image[scaled_strides + x] = spu->image[strides + unscaled_x];
+      s->aimage[scaled_strides + x] = spu->aimage[strides + unscaled_x];
+    }
+  }
+  break;
+  case 1:
+  {
+    /* Intermediate antialiasing. */
+    for (y = 0; y < s->height; ++y) {
+      const unsigned int unscaled_top = y * spu->orig_frame_height / dys;
+      unsigned int unscaled_bottom = (y + 1) * spu->orig_frame_height / dys;
+      if (unscaled_bottom >= spu->height)
+	unscaled_bottom = spu->height - 1;
+      for (x = 0; x < s->width; ++x) {
+	const unsigned int unscaled_left = x * spu->orig_frame_width / dxs;
+	unsigned int unscaled_right = (x + 1) * spu->orig_frame_width / dxs;
+	unsigned int color = 0;
+	unsigned int alpha = 0;
+	unsigned int walkx, walky;
+	unsigned int base, tmp;
+	if (unscaled_right >= spu->width)
+	  unscaled_right = spu->width - 1;
+	for (walky = unscaled_top; walky <= unscaled_bottom; ++walky)
+	  for (walkx = unscaled_left; walkx <= unscaled_right; ++walkx) {
+	    base = walky * spu->stride + walkx;
+	    tmp = canon_alpha(spu->aimage[base]);
+	    alpha += tmp;
+	    color += tmp * spu->image[base];
+	  }
+	base = y * s->stride + x;
+	s->image[base] = alpha ? color / alpha : 0;
+	s->aimage[base] =
+	  alpha * (1 + unscaled_bottom - unscaled_top) * (1 + unscaled_right - unscaled_left);
+	/* s->aimage[base] =
+	  alpha * dxs * dys / spu->orig_frame_width / spu->orig_frame_height; */
+	if (s->aimage[base]) {
+	  s->aimage[base] = 256 - s->aimage[base];
+	  if (s->aimage[base] + s->image[base] > 255)
+	    s->image[base] = 256 - s->aimage[base];
+	}
+      }
+    }
+  }
+  break;
+  case 2:
+  {
+    /* Best antialiasing.  Very slow. */
+    /* Any pixel (x, y) represents pixels from the original
+       rectangular region comprised between the columns
+       unscaled_y and unscaled_y + 0x100 / scaley and the rows
+       unscaled_x and unscaled_x + 0x100 / scalex
+
+       The original rectangular region that the scaled pixel
+       represents is cut in 9 rectangular areas like this:
+
+       +---+-----------------+---+
+       | 1 |        2        | 3 |
+       +---+-----------------+---+
+       |   |                 |   |
+       | 4 |        5        | 6 |
+       |   |                 |   |
+       +---+-----------------+---+
+       | 7 |        8        | 9 |
+       +---+-----------------+---+
+
+       The width of the left column is at most one pixel and
+       it is never null and its right column is at a pixel
+       boundary.  The height of the top row is at most one
+       pixel it is never null and its bottom row is at a
+       pixel boundary. The width and height of region 5 are
+       integral values.  The width of the right column is
+       what remains and is less than one pixel.  The height
+       of the bottom row is what remains and is less than
+       one pixel.
+
+       The row above 1, 2, 3 is unscaled_y.  The row between
+       1, 2, 3 and 4, 5, 6 is top_low_row.  The row between 4,
+       5, 6 and 7, 8, 9 is (unsigned int)unscaled_y_bottom.
+       The row beneath 7, 8, 9 is unscaled_y_bottom.
+
+       The column left of 1, 4, 7 is unscaled_x.  The column
+       between 1, 4, 7 and 2, 5, 8 is left_right_column.  The
+       column between 2, 5, 8 and 3, 6, 9 is (unsigned
+       int)unscaled_x_right.  The column right of 3, 6, 9 is
+       unscaled_x_right. */
+    const double inv_scalex = (double) 0x100 / scalex;
+    const double inv_scaley = (double) 0x100 / scaley;
+    for (y = 0; y < s->height; ++y) {
+      const double unscaled_y = y * inv_scaley;
+      const double unscaled_y_bottom = unscaled_y + inv_scaley;
+      const unsigned int top_low_row = FFMIN(unscaled_y_bottom, unscaled_y + 1.0);
+      const double top = top_low_row - unscaled_y;
+      const unsigned int height = unscaled_y_bottom > top_low_row
+	? (unsigned int) unscaled_y_bottom - top_low_row
+	: 0;
+      const double bottom = unscaled_y_bottom > top_low_row
+	? unscaled_y_bottom - floor(unscaled_y_bottom)
+	: 0.0;
+      for (x = 0; x < s->width; ++x) {
+	const double unscaled_x = x * inv_scalex;
+	const double unscaled_x_right = unscaled_x + inv_scalex;
+	const unsigned int left_right_column = FFMIN(unscaled_x_right, unscaled_x + 1.0);
+	const double left = left_right_column - unscaled_x;
+	const unsigned int width = unscaled_x_right > left_right_column
+	  ? (unsigned int) unscaled_x_right - left_right_column
+	  : 0;
+	const double right = unscaled_x_right > left_right_column
+	  ? unscaled_x_right - floor(unscaled_x_right)
+	  : 0.0;
+	double color = 0.0;
+	double alpha = 0.0;
+	double tmp;
+	unsigned int base;
+	/* Now use these informations to compute a good alpha,
+	   and lightness.  The sum is on each of the 9
+	   region's surface and alpha and lightness.
+
+	  transformed alpha = sum(surface * alpha) / sum(surface)
+	  transformed color = sum(surface * alpha * color) / sum(surface * alpha)
+	*/
+	/* 1: top left part */
+	base = spu->stride * (unsigned int) unscaled_y;
+	tmp = left * top * canon_alpha(spu->aimage[base + (unsigned int) unscaled_x]);
+	alpha += tmp;
+	color += tmp * spu->image[base + (unsigned int) unscaled_x];
+	/* 2: top center part */
+	if (width > 0) {
+	  unsigned int walkx;
+	  for (walkx = left_right_column; walkx < (unsigned int) unscaled_x_right; ++walkx) {
+	    base = spu->stride * (unsigned int) unscaled_y + walkx;
+	    tmp = /* 1.0 * */ top * canon_alpha(spu->aimage[base]);
+	    alpha += tmp;
+	    color += tmp * spu->image[base];
+	  }
+	}
+	/* 3: top right part */
+	if (right > 0.0) {
+	  base = spu->stride * (unsigned int) unscaled_y + (unsigned int) unscaled_x_right;
+	  tmp = right * top * canon_alpha(spu->aimage[base]);
+	  alpha += tmp;
+	  color += tmp * spu->image[base];
+	}
+	/* 4: center left part */
+	if (height > 0) {
+	  unsigned int walky;
+	  for (walky = top_low_row; walky < (unsigned int) unscaled_y_bottom; ++walky) {
+	    base = spu->stride * walky + (unsigned int) unscaled_x;
+	    tmp = left /* * 1.0 */ * canon_alpha(spu->aimage[base]);
+	    alpha += tmp;
+	    color += tmp * spu->image[base];
+	  }
+	}
+	/* 5: center part */
+	if (width > 0 && height > 0) {
+	  unsigned int walky;
+	  for (walky = top_low_row; walky < (unsigned int) unscaled_y_bottom; ++walky) {
+	    unsigned int walkx;
+	    base = spu->stride * walky;
+	    for (walkx = left_right_column; walkx < (unsigned int) unscaled_x_right; ++walkx) {
+	      tmp = /* 1.0 * 1.0 * */ canon_alpha(spu->aimage[base + walkx]);
+	      alpha += tmp;
+	      color += tmp * spu->image[base + walkx];
+	    }
+	  }
+	}
+	/* 6: center right part */
+	if (right > 0.0 && height > 0) {
+	  unsigned int walky;
+	  for (walky = top_low_row; walky < (unsigned int) unscaled_y_bottom; ++walky) {
+	    base = spu->stride * walky + (unsigned int) unscaled_x_right;
+	    tmp = right /* * 1.0 */ * canon_alpha(spu->aimage[base]);
+	    alpha += tmp;
+	    color += tmp * spu->image[base];
+	  }
+	}
+	/* 7: bottom left part */
+	if (bottom > 0.0) {
+	  base = spu->stride * (unsigned int) unscaled_y_bottom + (unsigned int) unscaled_x;
+	  tmp = left * bottom * canon_alpha(spu->aimage[base]);
+	  alpha += tmp;
+	  color += tmp * spu->image[base];
+	}
+	/* 8: bottom center part */
+	if (width > 0 && bottom > 0.0) {
+	  unsigned int walkx;
+	  base = spu->stride * (unsigned int) unscaled_y_bottom;
+	  for (walkx = left_right_column; walkx < (unsigned int) unscaled_x_right; ++walkx) {
+	    tmp = /* 1.0 * */ bottom * canon_alpha(spu->aimage[base + walkx]);
+	    alpha += tmp;
+	    color += tmp * spu->image[base + walkx];
+	  }
+	}
+	/* 9: bottom right part */
+	if (right > 0.0 && bottom > 0.0) {
+	  base = spu->stride * (unsigned int) unscaled_y_bottom + (unsigned int) unscaled_x_right;
+	  tmp = right * bottom * canon_alpha(spu->aimage[base]);
+	  alpha += tmp;
+	  color += tmp * spu->image[base];
+	}
+	/* Finally mix these transparency and brightness information suitably */
+	base = s->stride * y + x;
+	s->image[base] = alpha > 0 ? color / alpha : 0;
+	s->aimage[base] = alpha * scalex * scaley / 0x10000;
+	if (s->aimage[base]) {
+	  s->aimage[base] = 256 - s->aimage[base];
+	  if (s->aimage[base] + s->image[base] > 255)
+	    s->image[base] = 256 - s->aimage[base];
+	}
+      }
+    }
+  }
+  }
+nothing_to_do:
+  /* Kludge: draw_alpha needs width multiple of 8. */
+  if (s->width < s->stride)
+    for (y = 0; y < s->height; ++y) {
+      memset(s->aimage + y * s->stride + s->width, 0,
+	     s->stride - s->width);
+    }
+  return 1;
+}
+
+/* Return the image scaled to dxs x dys with the current scaling mode, from
+   the cache if possible. Returns NULL if memory could not be allocated. */
+static struct scaled_image *spudec_get_scaled(spudec_handle_t *spu,
+                                              unsigned int dxs, unsigned int dys)
+{
+  struct scaled_image *s, *victim = &spu->scaled[0];
+  int i;
+  spu->scaled_clock++;
+  for (i = 0; i < SCALED_CACHE_SIZE; i++) {
+    s = &spu->scaled[i];
+    if (s->frame_width == dxs && s->frame_height == dys &&
+	s->aamode == spu_aamode && s->gaussvar == spu_gaussvar) {
+      s->last_use = spu->scaled_clock;
+      return s;
+    }
+    // prefer unused entries, then the least recently used one
+    if (victim->frame_width &&
+	(!s->frame_width || s->last_use < victim->last_use))
+      victim = s;
+  }
+  s = victim;
+  s->frame_width = s->frame_height = 0;
+  if (!spudec_scale(spu, s, dxs, dys))
+    return NULL;
+  s->frame_width = dxs;
+  s->frame_height = dys;
+  s->aamode = spu_aamode;
+  s->gaussvar = spu_gaussvar;
+  s->last_use = spu->scaled_clock;
+  return s;
+}
+
+void spudec_draw_scaled(void *me, unsigned int dxs, unsigned int dys, void (*draw_alpha)(void *ctx, int x0,int y0, int w,int h, unsigned char* src, unsigned char *srca, int stride), void *ctx)
+{
+  spudec_handle_t *spu = me;
 
   if (spudec_visible(spu)) {
 
@@ -886,307 +1286,26 @@ void spudec_draw_scaled(void *me, unsigned int dxs, unsigned int dys, void (*dra
         spudec_draw(spu, draw_alpha, ctx);
     }
     else {
-      if (spu->scaled_frame_width != dxs || spu->scaled_frame_height != dys) {	/* Resizing is needed */
-	/* scaled_x = scalex * x / 0x100
-	   scaled_y = scaley * y / 0x100
-	   order of operations is important because of rounding. */
-	unsigned int scalex = 0x100 * dxs / spu->orig_frame_width;
-	unsigned int scaley = 0x100 * dys / spu->orig_frame_height;
-	spu->scaled_start_col = spu->start_col * scalex / 0x100;
-	spu->scaled_start_row = spu->start_row * scaley / 0x100;
-	spu->scaled_width = spu->width * scalex / 0x100;
-	spu->scaled_height = spu->height * scaley / 0x100;
-	/* Kludge: draw_alpha needs width multiple of 8 */
-	spu->scaled_stride = (spu->scaled_width + 7) & ~7;
-	if (spu->scaled_image_size < spu->scaled_stride * spu->scaled_height) {
-	  if (spu->scaled_image) {
-	    free(spu->scaled_image);
-	    spu->scaled_image_size = 0;
-	  }
-	  spu->scaled_image = malloc(2 * spu->scaled_stride * spu->scaled_height);
-	  if (spu->scaled_image) {
-	    spu->scaled_image_size = spu->scaled_stride * spu->scaled_height;
-	    spu->scaled_aimage = spu->scaled_image + spu->scaled_image_size;
-	  }
-	}
-	if (spu->scaled_image) {
-	  unsigned int x, y;
-	  // needs to be 0-initialized because draw_alpha draws always a
-	  // multiple of 8 pixels. TODO: optimize
-	  if (spu->scaled_width & 7)
-	    memset(spu->scaled_image, 0, 2 * spu->scaled_image_size);
-	  if (spu->scaled_width <= 1 || spu->scaled_height <= 1) {
-	    goto nothing_to_do;
-	  }
-	  switch(spu_aamode&15) {
-	  case 4:
-	  sws_spu_image(spu->scaled_image, spu->scaled_aimage,
-		  spu->scaled_width, spu->scaled_height, spu->scaled_stride,
-		  spu->image, spu->aimage, spu->width, spu->height, spu->stride);
-	  break;
-	  case 3:
-	  table_x = calloc(spu->scaled_width, sizeof(scale_pixel));
-	  table_y = calloc(spu->scaled_height, sizeof(scale_pixel));
-	  if (!table_x || !table_y) {
-	    mp_msg(MSGT_SPUDEC, MSGL_FATAL, "Fatal: spudec_draw_scaled: calloc failed\n");
-	  }
-	  scale_table(0, 0, spu->width - 1, spu->scaled_width - 1, table_x);
-	  scale_table(0, 0, spu->height - 1, spu->scaled_height - 1, table_y);
-	  for (y = 0; y < spu->scaled_height; y++)
-	    for (x = 0; x < spu->scaled_width; x++)
-	      scale_image(x, y, table_x, table_y, spu);
-	  free(table_x);
-	  free(table_y);
-	  break;
-	  case 0:
-	  /* no antialiasing */
-	  for (y = 0; y < spu->scaled_height; ++y) {
-	    int unscaled_y = y * 0x100 / scaley;
-	    int strides = spu->stride * unscaled_y;
-	    int scaled_strides = spu->scaled_stride * y;
-	    for (x = 0; x < spu->scaled_width; ++x) {
-	      int unscaled_x = x * 0x100 / scalex;
-	      spu->scaled_image[scaled_strides + x] = spu->image[strides + unscaled_x];
-	      spu->scaled_aimage[scaled_strides + x] = spu->aimage[strides + unscaled_x];
-	    }
-	  }
-	  break;
-	  case 1:
-	  {
-	    /* Intermediate antialiasing. */
-	    for (y = 0; y < spu->scaled_height; ++y) {
-	      const unsigned int unscaled_top = y * spu->orig_frame_height / dys;
-	      unsigned int unscaled_bottom = (y + 1) * spu->orig_frame_height / dys;
-	      if (unscaled_bottom >= spu->height)
-		unscaled_bottom = spu->height - 1;
-	      for (x = 0; x < spu->scaled_width; ++x) {
-		const unsigned int unscaled_left = x * spu->orig_frame_width / dxs;
-		unsigned int unscaled_right = (x + 1) * spu->orig_frame_width / dxs;
-		unsigned int color = 0;
-		unsigned int alpha = 0;
-		unsigned int walkx, walky;
-		unsigned int base, tmp;
-		if (unscaled_right >= spu->width)
-		  unscaled_right = spu->width - 1;
-		for (walky = unscaled_top; walky <= unscaled_bottom; ++walky)
-		  for (walkx = unscaled_left; walkx <= unscaled_right; ++walkx) {
-		    base = walky * spu->stride + walkx;
-		    tmp = canon_alpha(spu->aimage[base]);
-		    alpha += tmp;
-		    color += tmp * spu->image[base];
-		  }
-		base = y * spu->scaled_stride + x;
-		spu->scaled_image[base] = alpha ? color / alpha : 0;
-		spu->scaled_aimage[base] =
-		  alpha * (1 + unscaled_bottom - unscaled_top) * (1 + unscaled_right - unscaled_left);
-		/* spu->scaled_aimage[base] =
-		  alpha * dxs * dys / spu->orig_frame_width / spu->orig_frame_height; */
-		if (spu->scaled_aimage[base]) {
-		  spu->scaled_aimage[base] = 256 - spu->scaled_aimage[base];
-		  if (spu->scaled_aimage[base] + spu->scaled_image[base] > 255)
-		    spu->scaled_image[base] = 256 - spu->scaled_aimage[base];
-		}
-	      }
-	    }
-	  }
-	  break;
-	  case 2:
-	  {
-	    /* Best antialiasing.  Very slow. */
-	    /* Any pixel (x, y) represents pixels from the original
-	       rectangular region comprised between the columns
-	       unscaled_y and unscaled_y + 0x100 / scaley and the rows
-	       unscaled_x and unscaled_x + 0x100 / scalex
-
-	       The original rectangular region that the scaled pixel
-	       represents is cut in 9 rectangular areas like this:
-
-	       +---+-----------------+---+
-	       | 1 |        2        | 3 |
-	       +---+-----------------+---+
-	       |   |                 |   |
-	       | 4 |        5        | 6 |
-	       |   |                 |   |
-	       +---+-----------------+---+
-	       | 7 |        8        | 9 |
-	       +---+-----------------+---+
-
-	       The width of the left column is at most one pixel and
-	       it is never null and its right column is at a pixel
-	       boundary.  The height of the top row is at most one
-	       pixel it is never null and its bottom row is at a
-	       pixel boundary. The width and height of region 5 are
-	       integral values.  The width of the right column is
-	       what remains and is less than one pixel.  The height
-	       of the bottom row is what remains and is less than
-	       one pixel.
-
-	       The row above 1, 2, 3 is unscaled_y.  The row between
-	       1, 2, 3 and 4, 5, 6 is top_low_row.  The row between 4,
-	       5, 6 and 7, 8, 9 is (unsigned int)unscaled_y_bottom.
-	       The row beneath 7, 8, 9 is unscaled_y_bottom.
-
-	       The column left of 1, 4, 7 is unscaled_x.  The column
-	       between 1, 4, 7 and 2, 5, 8 is left_right_column.  The
-	       column between 2, 5, 8 and 3, 6, 9 is (unsigned
-	       int)unscaled_x_right.  The column right of 3, 6, 9 is
-	       unscaled_x_right. */
-	    const double inv_scalex = (double) 0x100 / scalex;
-	    const double inv_scaley = (double) 0x100 / scaley;
-	    for (y = 0; y < spu->scaled_height; ++y) {
-	      const double unscaled_y = y * inv_scaley;
-	      const double unscaled_y_bottom = unscaled_y + inv_scaley;
-	      const unsigned int top_low_row = FFMIN(unscaled_y_bottom, unscaled_y + 1.0);
-	      const double top = top_low_row - unscaled_y;
-	      const unsigned int height = unscaled_y_bottom > top_low_row
-		? (unsigned int) unscaled_y_bottom - top_low_row
-		: 0;
-	      const double bottom = unscaled_y_bottom > top_low_row
-		? unscaled_y_bottom - floor(unscaled_y_bottom)
-		: 0.0;
-	      for (x = 0; x < spu->scaled_width; ++x) {
-		const double unscaled_x = x * inv_scalex;
-		const double unscaled_x_right = unscaled_x + inv_scalex;
-		const unsigned int left_right_column = FFMIN(unscaled_x_right, unscaled_x + 1.0);
-		const double left = left_right_column - unscaled_x;
-		const unsigned int width = unscaled_x_right > left_right_column
-		  ? (unsigned int) unscaled_x_right - left_right_column
-		  : 0;
-		const double right = unscaled_x_right > left_right_column
-		  ? unscaled_x_right - floor(unscaled_x_right)
-		  : 0.0;
-		double color = 0.0;
-		double alpha = 0.0;
-		double tmp;
-		unsigned int base;
-		/* Now use these informations to compute a good alpha,
-                   and lightness.  The sum is on each of the 9
-                   region's surface and alpha and lightness.
-
-		  transformed alpha = sum(surface * alpha) / sum(surface)
-		  transformed color = sum(surface * alpha * color) / sum(surface * alpha)
-		*/
-		/* 1: top left part */
-		base = spu->stride * (unsigned int) unscaled_y;
-		tmp = left * top * canon_alpha(spu->aimage[base + (unsigned int) unscaled_x]);
-		alpha += tmp;
-		color += tmp * spu->image[base + (unsigned int) unscaled_x];
-		/* 2: top center part */
-		if (width > 0) {
-		  unsigned int walkx;
-		  for (walkx = left_right_column; walkx < (unsigned int) unscaled_x_right; ++walkx) {
-		    base = spu->stride * (unsigned int) unscaled_y + walkx;
-		    tmp = /* 1.0 * */ top * canon_alpha(spu->aimage[base]);
-		    alpha += tmp;
-		    color += tmp * spu->image[base];
-		  }
-		}
-		/* 3: top right part */
-		if (right > 0.0) {
-		  base = spu->stride * (unsigned int) unscaled_y + (unsigned int) unscaled_x_right;
-		  tmp = right * top * canon_alpha(spu->aimage[base]);
-		  alpha += tmp;
-		  color += tmp * spu->image[base];
-		}
-		/* 4: center left part */
-		if (height > 0) {
-		  unsigned int walky;
-		  for (walky = top_low_row; walky < (unsigned int) unscaled_y_bottom; ++walky) {
-		    base = spu->stride * walky + (unsigned int) unscaled_x;
-		    tmp = left /* * 1.0 */ * canon_alpha(spu->aimage[base]);
-		    alpha += tmp;
-		    color += tmp * spu->image[base];
-		  }
-		}
-		/* 5: center part */
-		if (width > 0 && height > 0) {
-		  unsigned int walky;
-		  for (walky = top_low_row; walky < (unsigned int) unscaled_y_bottom; ++walky) {
-		    unsigned int walkx;
-		    base = spu->stride * walky;
-		    for (walkx = left_right_column; walkx < (unsigned int) unscaled_x_right; ++walkx) {
-		      tmp = /* 1.0 * 1.0 * */ canon_alpha(spu->aimage[base + walkx]);
-		      alpha += tmp;
-		      color += tmp * spu->image[base + walkx];
-		    }
-		  }
-		}
-		/* 6: center right part */
-		if (right > 0.0 && height > 0) {
-		  unsigned int walky;
-		  for (walky = top_low_row; walky < (unsigned int) unscaled_y_bottom; ++walky) {
-		    base = spu->stride * walky + (unsigned int) unscaled_x_right;
-		    tmp = right /* * 1.0 */ * canon_alpha(spu->aimage[base]);
-		    alpha += tmp;
-		    color += tmp * spu->image[base];
-		  }
-		}
-		/* 7: bottom left part */
-		if (bottom > 0.0) {
-		  base = spu->stride * (unsigned int) unscaled_y_bottom + (unsigned int) unscaled_x;
-		  tmp = left * bottom * canon_alpha(spu->aimage[base]);
-		  alpha += tmp;
-		  color += tmp * spu->image[base];
-		}
-		/* 8: bottom center part */
-		if (width > 0 && bottom > 0.0) {
-		  unsigned int walkx;
-		  base = spu->stride * (unsigned int) unscaled_y_bottom;
-		  for (walkx = left_right_column; walkx < (unsigned int) unscaled_x_right; ++walkx) {
-		    tmp = /* 1.0 * */ bottom * canon_alpha(spu->aimage[base + walkx]);
-		    alpha += tmp;
-		    color += tmp * spu->image[base + walkx];
-		  }
-		}
-		/* 9: bottom right part */
-		if (right > 0.0 && bottom > 0.0) {
-		  base = spu->stride * (unsigned int) unscaled_y_bottom + (unsigned int) unscaled_x_right;
-		  tmp = right * bottom * canon_alpha(spu->aimage[base]);
-		  alpha += tmp;
-		  color += tmp * spu->image[base];
-		}
-		/* Finally mix these transparency and brightness information suitably */
-		base = spu->scaled_stride * y + x;
-		spu->scaled_image[base] = alpha > 0 ? color / alpha : 0;
-		spu->scaled_aimage[base] = alpha * scalex * scaley / 0x10000;
-		if (spu->scaled_aimage[base]) {
-		  spu->scaled_aimage[base] = 256 - spu->scaled_aimage[base];
-		  if (spu->scaled_aimage[base] + spu->scaled_image[base] > 255)
-		    spu->scaled_image[base] = 256 - spu->scaled_aimage[base];
-		}
-	      }
-	    }
-	  }
-	  }
-nothing_to_do:
-	  /* Kludge: draw_alpha needs width multiple of 8. */
-	  if (spu->scaled_width < spu->scaled_stride)
-	    for (y = 0; y < spu->scaled_height; ++y) {
-	      memset(spu->scaled_aimage + y * spu->scaled_stride + spu->scaled_width, 0,
-		     spu->scaled_stride - spu->scaled_width);
-	    }
-	  spu->scaled_frame_width = dxs;
-	  spu->scaled_frame_height = dys;
-	}
-      }
-      if (spu->scaled_image){
+      struct scaled_image *scaled = spudec_get_scaled(spu, dxs, dys);
+      if (scaled) {
+        unsigned int start_row = scaled->start_row;
         switch (spu_alignment) {
         case 0:
-          spu->scaled_start_row = dys*sub_pos/100;
-	  if (spu->scaled_start_row + spu->scaled_height > dys)
-	    spu->scaled_start_row = dys - spu->scaled_height;
+          start_row = dys*sub_pos/100;
+	  if (start_row + scaled->height > dys)
+	    start_row = dys - scaled->height;
 	  break;
 	case 1:
-          spu->scaled_start_row = dys*sub_pos/100 - spu->scaled_height/2;
-	  if (sub_pos >= 50 && spu->scaled_start_row + spu->scaled_height > dys)
-	      spu->scaled_start_row = dys - spu->scaled_height;
+          start_row = dys*sub_pos/100 - scaled->height/2;
+	  if (sub_pos >= 50 && start_row + scaled->height > dys)
+	      start_row = dys - scaled->height;
 	  break;
         case 2:
-          spu->scaled_start_row = dys*sub_pos/100 - spu->scaled_height;
+          start_row = dys*sub_pos/100 - scaled->height;
 	  break;
 	}
-	draw_alpha(ctx, spu->scaled_start_col, spu->scaled_start_row, spu->scaled_width, spu->scaled_height,
-		   spu->scaled_image, spu->scaled_aimage, spu->scaled_stride);
+	draw_alpha(ctx, scaled->start_col, start_row, scaled->width, scaled->height,
+		   scaled->image, scaled->aimage, scaled->stride);
 	spu->spu_changed = 0;
       }
     }
@@ -1295,13 +1414,14 @@ void *spudec_new(unsigned int *palette)
 void spudec_free(void *this)
 {
   spudec_handle_t *spu = this;
+  int i;
   if (spu) {
     while (spu->queue_head)
       spudec_free_packet(spudec_dequeue_packet(spu));
     free(spu->packet);
     spu->packet = NULL;
-    free(spu->scaled_image);
-    spu->scaled_image = NULL;
+    for (i = 0; i < SCALED_CACHE_SIZE; i++)
+      free(spu->scaled[i].image);
     free(spu->image);
     spu->image = NULL;
     spu->aimage = NULL;
@@ -1365,7 +1485,7 @@ void spudec_packet_fill(packet_t *packet,
       gray = FFMIN(gray, alpha);
       g8a8_pal[i] = (-alpha << 8) | gray;
   }
-  pal2gray_alpha(g8a8_pal, pal_img, pal_stride,
+  pal2gray_alpha(g8a8_pal, 256, pal_img, pal_stride,
                  img, aimg, packet->stride, w, h);
 }
 
@@ -269,8 +269,11 @@ void osd_set_text(struct osd_state *osd, const char *text)
         text = "";
     if (strcmp(osd->osd_text, text) == 0)
         return;
-    talloc_free(osd->osd_text);
-    osd->osd_text = talloc_strdup(osd, text);
+    // The time display changes the text on every update, so keep the buffer
+    size_t len = strlen(text) + 1;
+    if (talloc_get_size(osd->osd_text) < len)
+        osd->osd_text = talloc_realloc_size(osd, osd->osd_text, len);
+    memcpy(osd->osd_text, text, len);
     vo_osd_changed(OSDTYPE_OSD);
 }
 
@@ -0,0 +1,258 @@
+/*
+ * Interval index for text subtitles.
+ *
+ * The subtitles are sorted by start time and viewed as an implicit balanced
+ * binary tree: the root of the range [lo, hi) is its middle element, and
+ * the left and right halves are its subtrees. Every node stores the
+ * maximum end time within its subtree, so a lookup can skip subtrees that
+ * end before the key and, as the tree is ordered by start time, right
+ * subtrees starting after it.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "subreader.h"
+#include "sub_index.h"
+
+struct sub_index {
+    int num;
+    int *order;             // subtitle index, sorted by start time
+    unsigned long *start;   // start[i] == subs[order[i]].start
+    unsigned long *end;
+    unsigned long *maxend;  // maximum end in the subtree rooted at i
+};
+
+struct query {
+    const struct sub_index *idx;
+    unsigned long key;
+    int *res;
+    int maxres;
+    int count;
+    unsigned long min_end;
+};
+
+static const struct subtitle *sort_subs;
+
+static int cmp_start(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+    unsigned long sa = sort_subs[ia].start, sb = sort_subs[ib].start;
+    if (sa != sb)
+        return sa < sb ? -1 : 1;
+    return ia - ib;
+}
+
+static unsigned long build_maxend(struct sub_index *idx, int lo, int hi)
+{
+    if (lo >= hi)
+        return 0;
+    int mid = lo + (hi - lo) / 2;
+    unsigned long m = idx->end[mid];
+    unsigned long l = build_maxend(idx, lo, mid);
+    unsigned long r = build_maxend(idx, mid + 1, hi);
+    if (l > m)
+        m = l;
+    if (r > m)
+        m = r;
+    idx->maxend[mid] = m;
+    return m;
+}
+
+struct sub_index *sub_index_build(const struct subtitle *subs, int num)
+{
+    struct sub_index *idx = calloc(1, sizeof(*idx));
+    if (!idx)
+        return NULL;
+    idx->num = num;
+    idx->order = malloc(num * sizeof(int));
+    idx->start = malloc(num * sizeof(unsigned long));
+    idx->end = malloc(num * sizeof(unsigned long));
+    idx->maxend = malloc(num * sizeof(unsigned long));
+    if (num && (!idx->order || !idx->start || !idx->end || !idx->maxend)) {
+        sub_index_free(idx);
+        return NULL;
+    }
+    for (int i = 0; i < num; i++)
+        idx->order[i] = i;
+    // Already sorted in the common case, which qsort handles quickly too
+    sort_subs = subs;
+    qsort(idx->order, num, sizeof(int), cmp_start);
+    sort_subs = NULL;
+    for (int i = 0; i < num; i++) {
+        idx->start[i] = subs[idx->order[i]].start;
+        idx->end[i] = subs[idx->order[i]].end;
+    }
+    build_maxend(idx, 0, num);
+    return idx;
+}
+
+void sub_index_free(struct sub_index *idx)
+{
+    if (!idx)
+        return;
+    free(idx->order);
+    free(idx->start);
+    free(idx->end);
+    free(idx->maxend);
+    free(idx);
+}
+
+static void query(struct query *q, int lo, int hi)
+{
+    const struct sub_index *idx = q->idx;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (idx->maxend[mid] < q->key)
+            return;
+        query(q, lo, mid);
+        if (idx->start[mid] > q->key)
+            return;
+        if (idx->end[mid] >= q->key) {
+            if (q->count < q->maxres)
+                q->res[q->count] = idx->order[mid];
+            q->count++;
+            if (idx->end[mid] < q->min_end)
+                q->min_end = idx->end[mid];
+        }
+        lo = mid + 1;
+    }
+}
+
+int sub_index_position(const struct sub_index *idx, unsigned long key)
+{
+    int lo = 0, hi = idx->num;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (idx->start[mid] <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int sub_index_nth(const struct sub_index *idx, int n)
+{
+    return idx->order[n];
+}
+
+int sub_index_find(const struct sub_index *idx, unsigned long key, int *res,
+                   int maxres, unsigned long *next_change)
+{
+    struct query q = {
+        .idx = idx,
+        .key = key,
+        .res = res,
+        .maxres = maxres,
+        .min_end = ULONG_MAX,
+    };
+    query(&q, 0, idx->num);
+    if (next_change) {
+        // Either an active subtitle ends or the next one starts
+        int pos = sub_index_position(idx, key);
+        unsigned long next = q.min_end < ULONG_MAX ? q.min_end + 1 : ULONG_MAX;
+        if (pos < idx->num && idx->start[pos] < next)
+            next = idx->start[pos];
+        *next_change = next;
+    }
+    return q.count;
+}
+
+#ifdef TEST
+
+/* Benchmark: gcc -DTEST -O2 -I.. sub_index.c -o sub_index_test
+ * Builds the index over 100000 randomly overlapping subtitles and compares
+ * lookups with a linear scan. Only the index is timed here; file loading
+ * needs subreader.c and the stream layer, which this file does not link. */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM 100000
+#define LOOKUPS 200000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+    static struct subtitle subs[NUM];
+    static int res[16], ref[16];
+    unsigned long t = 0;
+
+    srand(1);
+    for (int i = 0; i < NUM; i++) {
+        // mostly sequential with some long overlapping events
+        t += rand() % 300;
+        subs[i].start = t;
+        subs[i].end = t + 100 + (rand() % 20 ? rand() % 400 : rand() % 30000);
+    }
+
+    double t0 = now();
+    struct sub_index *idx = sub_index_build(subs, NUM);
+    double t1 = now();
+    printf("build: %d subtitles in %.2f ms\n", NUM, (t1 - t0) * 1e3);
+
+    long found = 0;
+    int errors = 0;
+    t0 = now();
+    for (int n = 0; n < LOOKUPS; n++) {
+        unsigned long key = (unsigned long)rand() * 7 % (t + 1000);
+        found += sub_index_find(idx, key, res, 16, NULL);
+    }
+    t1 = now();
+    printf("lookup: %.3f us per lookup, %.2f active on average\n",
+           (t1 - t0) * 1e6 / LOOKUPS, (double)found / LOOKUPS);
+
+    t0 = now();
+    for (int n = 0; n < LOOKUPS / 100; n++) {
+        unsigned long key = (unsigned long)rand() * 7 % (t + 1000);
+        unsigned long next, ref_next = ULONG_MAX;
+        int k = sub_index_find(idx, key, res, 16, &next), m = 0;
+        for (int i = 0; i < NUM; i++) {
+            if (subs[i].start <= key && subs[i].end >= key) {
+                if (m < 16)
+                    ref[m] = i;
+                m++;
+                if (subs[i].end + 1 < ref_next)
+                    ref_next = subs[i].end + 1;
+            } else if (subs[i].start > key && subs[i].start < ref_next) {
+                ref_next = subs[i].start;
+            }
+        }
+        if (k != m || memcmp(res, ref, (k < 16 ? k : 16) * sizeof(int))
+            || next != ref_next)
+            errors++;
+    }
+    t1 = now();
+    printf("linear scan: %.3f us per lookup\n",
+           (t1 - t0) * 1e6 / (LOOKUPS / 100));
+    printf("%s\n", errors ? "MISMATCH" : "ok");
+
+    sub_index_free(idx);
+    return !!errors;
+}
+
+#endif
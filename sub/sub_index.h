@@ -0,0 +1,47 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_SUB_INDEX_H
+#define MPLAYER_SUB_INDEX_H
+
+struct subtitle;
+
+/* Static interval index over the [start, end] ranges of a subtitle array.
+ * The subtitles need not be sorted and may overlap. */
+struct sub_index;
+
+struct sub_index *sub_index_build(const struct subtitle *subs, int num);
+void sub_index_free(struct sub_index *idx);
+
+/* Find the subtitles shown at time key (start <= key <= end), in order of
+ * their start time. Up to maxres indexes into the subtitle array are stored
+ * in res; the return value is the total number of active subtitles.
+ * If next_change is not NULL, it is set to the smallest time after key at
+ * which the set of active subtitles changes (ULONG_MAX if never).
+ * Costs O(log n + k) for k results. */
+int sub_index_find(const struct sub_index *idx, unsigned long key, int *res,
+                   int maxres, unsigned long *next_change);
+
+/* Number of subtitles starting at or before key, i.e. the position key
+ * would be inserted at in start time order. */
+int sub_index_position(const struct sub_index *idx, unsigned long key);
+
+/* Index into the subtitle array of the n-th subtitle in start time order. */
+int sub_index_nth(const struct sub_index *idx, int n);
+
+#endif /* MPLAYER_SUB_INDEX_H */
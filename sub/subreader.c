@@ -24,17 +24,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <dirent.h>
 
 #include "config.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "talloc.h"
 #include "mp_msg.h"
+#include "cpudetect.h"
 #include "subreader.h"
+#include "sub_index.h"
 #include "mpcommon.h"
 #include "subassconvert.h"
 #include "options.h"
 #include "stream/stream.h"
 #include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
 #include "libavutil/avstring.h"
 
 #ifdef CONFIG_ENCA
@@ -54,12 +64,40 @@ int suboverlap_enabled = 1;
 
 // Parameter struct for the format-specific readline functions
 struct readline_args {
-    int utf16;
     struct MPOpts *opts;
 };
 
+// The whole subtitle file in memory, already converted to UTF-8 if needed
+struct sub_text {
+    const char *data;
+    size_t size;
+    size_t pos;
+};
+
 /* Maximal length of line of a subtitle */
 #define LINE_LEN 1000
+
+/* Read the next line including its newline into line, like
+ * stream_read_line(): at most max - 1 bytes are stored, the rest of a longer
+ * line is skipped. Returns NULL at the end of the text. */
+static char *sub_text_gets(struct sub_text *st, char *line, int max)
+{
+    const char *start = st->data + st->pos;
+    size_t left = st->size - st->pos;
+    const char *end;
+    size_t len;
+    if (!left || max < 1)
+        return NULL;
+    end = memchr(start, '\n', left);
+    len = end ? end - start + 1 : left;
+    st->pos += len;
+    if (len > max - 1)
+        len = max - 1;
+    memcpy(line, start, len);
+    line[len] = 0;
+    return line;
+}
+
 static float mpsub_position=0;
 static float mpsub_multiplier=1.;
 static int sub_slacktime = 20000; //20 sec
@@ -123,10 +161,9 @@ static void sami_add_line(subtitle *current, char *buffer, char **pos) {
     *pos = buffer;
 }
 
-static subtitle *sub_read_line_sami(stream_t* st, subtitle *current,
+static subtitle *sub_read_line_sami(struct sub_text *st, subtitle *current,
                                     struct readline_args *args)
 {
-    int utf16 = args->utf16;
     static char line[LINE_LEN+1];
     static char *s = NULL, *slacktime_s;
     char text[LINE_LEN+1], *p=NULL, *q;
@@ -138,7 +175,7 @@ static subtitle *sub_read_line_sami(stream_t* st, subtitle *current,
 
     /* read the first line */
     if (!s)
-	    if (!(s = stream_read_line(st, line, LINE_LEN, utf16))) return 0;
+	    if (!(s = sub_text_gets(st, line, LINE_LEN))) return 0;
 
     do {
 	switch (state) {
@@ -245,7 +282,7 @@ static subtitle *sub_read_line_sami(stream_t* st, subtitle *current,
 	}
 
 	/* read next line */
-	if (state != 99 && !(s = stream_read_line (st, line, LINE_LEN, utf16))) {
+	if (state != 99 && !(s = sub_text_gets(st, line, LINE_LEN))) {
 	    if (current->start > 0) {
 		break; // if it is the last subtitle
 	    } else {
@@ -303,16 +340,15 @@ static subtitle *set_multiline_text(subtitle *current, const char *text, int sta
     return current;
 }
 
-static subtitle *sub_read_line_microdvd(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_microdvd(struct sub_text *st,subtitle *current,
                                         struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
     char line2[LINE_LEN+1];
     char *p;
 
     do {
-	if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+	if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
     } while ((sscanf (line,
 		      "{%ld}{}%[^\r\n]",
 		      &(current->start), line2) < 2) &&
@@ -329,15 +365,14 @@ static subtitle *sub_read_line_microdvd(stream_t *st,subtitle *current,
     return set_multiline_text(current, p, 0);
 }
 
-static subtitle *sub_read_line_mpl2(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_mpl2(struct sub_text *st,subtitle *current,
                                     struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
     char line2[LINE_LEN+1];
 
     do {
-	if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+	if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
     } while ((sscanf (line,
 		      "[%ld][%ld]%[^\r\n]",
 		      &(current->start), &(current->end), line2) < 3));
@@ -347,22 +382,21 @@ static subtitle *sub_read_line_mpl2(stream_t *st,subtitle *current,
     return set_multiline_text(current, line2, 0);
 }
 
-static subtitle *sub_read_line_subrip(stream_t* st, subtitle *current,
+static subtitle *sub_read_line_subrip(struct sub_text *st, subtitle *current,
                                     struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
     int a1,a2,a3,a4,b1,b2,b3,b4;
     char *p=NULL, *q=NULL;
     int len;
 
     while (1) {
-	if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+	if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 	if (sscanf (line, "%d:%d:%d.%d,%d:%d:%d.%d",&a1,&a2,&a3,&a4,&b1,&b2,&b3,&b4) < 8) continue;
 	current->start = a1*360000+a2*6000+a3*100+a4;
 	current->end   = b1*360000+b2*6000+b3*100+b4;
 
-	if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+	if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 
 	p=q=line;
 	for (current->lines=1; current->lines < SUB_MAX_TEXT; current->lines++) {
@@ -380,10 +414,9 @@ static subtitle *sub_read_line_subrip(stream_t* st, subtitle *current,
     return current;
 }
 
-static subtitle *sub_ass_read_line_subviewer(stream_t *st, subtitle *current,
+static subtitle *sub_ass_read_line_subviewer(struct sub_text *st, subtitle *current,
                                              struct readline_args *args)
 {
-    int utf16 = args->utf16;
     int a1, a2, a3, a4, b1, b2, b3, b4, j = 0;
 
     while (!current->text[0]) {
@@ -391,7 +424,7 @@ static subtitle *sub_ass_read_line_subviewer(stream_t *st, subtitle *current,
         int i;
 
         /* Parse SubRip header */
-        if (!stream_read_line(st, line, LINE_LEN, utf16))
+        if (!sub_text_gets(st, line, LINE_LEN))
             return NULL;
         if (sscanf(line, "%d:%d:%d%[,.:]%d --> %d:%d:%d%[,.:]%d",
                      &a1, &a2, &a3, &sep, &a4, &b1, &b2, &b3, &sep, &b4) < 10)
@@ -406,7 +439,7 @@ static subtitle *sub_ass_read_line_subviewer(stream_t *st, subtitle *current,
             int blank = 1, len = 0;
             char *p;
 
-            if (!stream_read_line(st, line, LINE_LEN, utf16))
+            if (!sub_text_gets(st, line, LINE_LEN))
                 break;
 
             for (p = line; *p != '\n' && *p != '\r' && *p; p++, len++)
@@ -438,10 +471,9 @@ static subtitle *sub_ass_read_line_subviewer(stream_t *st, subtitle *current,
     return current;
 }
 
-static subtitle *sub_read_line_subviewer(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_subviewer(struct sub_text *st,subtitle *current,
                                          struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
     int a1,a2,a3,a4,b1,b2,b3,b4;
     char *p=NULL;
@@ -450,14 +482,14 @@ static subtitle *sub_read_line_subviewer(stream_t *st,subtitle *current,
     if (args->opts->ass_enabled)
         return sub_ass_read_line_subviewer(st, current, args);
     while (!current->text[0]) {
-	if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+	if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 	if ((len=sscanf (line, "%d:%d:%d%[,.:]%d --> %d:%d:%d%[,.:]%d",&a1,&a2,&a3,(char *)&i,&a4,&b1,&b2,&b3,(char *)&i,&b4)) < 10)
 	    continue;
 	current->start = a1*360000+a2*6000+a3*100+a4/10;
 	current->end   = b1*360000+b2*6000+b3*100+b4/10;
 	for (i=0; i<SUB_MAX_TEXT;) {
 	    int blank = 1;
-	    if (!stream_read_line (st, line, LINE_LEN, utf16)) break;
+	    if (!sub_text_gets(st, line, LINE_LEN)) break;
 	    len=0;
 	    for (p=line; *p!='\n' && *p!='\r' && *p; p++,len++)
 		if (*p != ' ' && *p != '\t')
@@ -495,24 +527,23 @@ static subtitle *sub_read_line_subviewer(stream_t *st,subtitle *current,
     return current;
 }
 
-static subtitle *sub_read_line_subviewer2(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_subviewer2(struct sub_text *st,subtitle *current,
                                           struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
     int a1,a2,a3,a4;
     char *p=NULL;
     int i,len;
 
     while (!current->text[0]) {
-        if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+        if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 	if (line[0]!='{')
 	    continue;
         if ((len=sscanf (line, "{T %d:%d:%d:%d",&a1,&a2,&a3,&a4)) < 4)
             continue;
         current->start = a1*360000+a2*6000+a3*100+a4/10;
         for (i=0; i<SUB_MAX_TEXT;) {
-            if (!stream_read_line (st, line, LINE_LEN, utf16)) break;
+            if (!sub_text_gets(st, line, LINE_LEN)) break;
             if (line[0]=='}') break;
             len=0;
             for (p=line; *p!='\n' && *p!='\r' && *p; ++p,++len);
@@ -531,17 +562,16 @@ static subtitle *sub_read_line_subviewer2(stream_t *st,subtitle *current,
 }
 
 
-static subtitle *sub_read_line_vplayer(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_vplayer(struct sub_text *st,subtitle *current,
                                        struct readline_args *args)
 {
-        int utf16 = args->utf16;
 	char line[LINE_LEN+1];
 	int a1,a2,a3;
 	char *p=NULL, separator;
 	int len,plen;
 
 	while (!current->text[0]) {
-		if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+		if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 		if ((len=sscanf (line, "%d:%d:%d%c%n",&a1,&a2,&a3,&separator,&plen)) < 4)
 			continue;
 
@@ -573,10 +603,9 @@ static subtitle *sub_read_line_vplayer(stream_t *st,subtitle *current,
 	return current;
 }
 
-static subtitle *sub_read_line_rt(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_rt(struct sub_text *st,subtitle *current,
                                     struct readline_args *args)
 {
-    int utf16 = args->utf16;
 
 	//TODO: This format uses quite rich (sub/super)set of xhtml
 	// I couldn't check it since DTD is not included.
@@ -587,7 +616,7 @@ static subtitle *sub_read_line_rt(stream_t *st,subtitle *current,
     int len,plen;
 
     while (!current->text[0]) {
-	if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+	if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 	//TODO: it seems that format of time is not easily determined, it may be 1:12, 1:12.0 or 0:1:12.0
 	//to describe the same moment in time. Maybe there are even more formats in use.
 	//if ((len=sscanf (line, "<Time Begin=\"%d:%d:%d.%d\" End=\"%d:%d:%d.%d\"",&a1,&a2,&a3,&a4,&b1,&b2,&b3,&b4)) < 8)
@@ -622,7 +651,7 @@ static subtitle *sub_read_line_rt(stream_t *st,subtitle *current,
     return current;
 }
 
-static subtitle *sub_read_line_ssa(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_ssa(struct sub_text *st,subtitle *current,
                                     struct readline_args *args)
 {
 /*
@@ -634,7 +663,6 @@ static subtitle *sub_read_line_ssa(stream_t *st,subtitle *current,
  * http://www.scriptclub.org is a good place to find more examples
  * http://www.eswat.demon.co.uk is where the SSA specs can be found
  */
-        int utf16 = args->utf16;
         int comma;
         static int max_comma = 32; /* let's use 32 for the case that the */
                     /*  amount of commas increase with newer SSA versions */
@@ -650,7 +678,7 @@ static subtitle *sub_read_line_ssa(stream_t *st,subtitle *current,
 	const char *brace;
 
 	do {
-		if (!stream_read_line (st, line, LINE_LEN, utf16)) return NULL;
+		if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 	} while (sscanf (line, "Dialogue: Marked=%d,%d:%d:%d.%d,%d:%d:%d.%d"
 			"%[^\n\r]", &nothing,
 			&hour1, &min1, &sec1, &hunsec1,
@@ -730,14 +758,13 @@ static void sub_pp_ssa(subtitle *sub) {
  *
  * by set, based on code by szabi (dunnowhat sub format ;-)
  */
-static subtitle *sub_read_line_pjs(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_pjs(struct sub_text *st,subtitle *current,
                                    struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
     char text[LINE_LEN+1], *s, *d;
 
-    if (!stream_read_line (st, line, LINE_LEN, utf16))
+    if (!sub_text_gets(st, line, LINE_LEN))
 	return NULL;
     /* skip spaces */
     for (s=line; *s && isspace(*s); s++);
@@ -771,10 +798,9 @@ static subtitle *sub_read_line_pjs(stream_t *st,subtitle *current,
     return current;
 }
 
-static subtitle *sub_read_line_mpsub(stream_t *st, subtitle *current,
+static subtitle *sub_read_line_mpsub(struct sub_text *st, subtitle *current,
                                      struct readline_args *args)
 {
-        int utf16 = args->utf16;
 	char line[LINE_LEN+1];
 	float a,b;
 	int num=0;
@@ -782,7 +808,7 @@ static subtitle *sub_read_line_mpsub(stream_t *st, subtitle *current,
 
 	do
 	{
-		if (!stream_read_line(st, line, LINE_LEN, utf16)) return NULL;
+		if (!sub_text_gets(st, line, LINE_LEN)) return NULL;
 	} while (sscanf (line, "%f %f", &a, &b) !=2);
 
 	mpsub_position += a*mpsub_multiplier;
@@ -791,7 +817,7 @@ static subtitle *sub_read_line_mpsub(stream_t *st, subtitle *current,
 	current->end=(int) mpsub_position;
 
 	while (num < SUB_MAX_TEXT) {
-		if (!stream_read_line (st, line, LINE_LEN, utf16)) {
+		if (!sub_text_gets(st, line, LINE_LEN)) {
 			if (num == 0) return NULL;
 			else return current;
 		}
@@ -819,16 +845,15 @@ static subtitle *sub_read_line_mpsub(stream_t *st, subtitle *current,
 subtitle *previous_aqt_sub = NULL;
 #endif
 
-static subtitle *sub_read_line_aqt(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_aqt(struct sub_text *st,subtitle *current,
                                    struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
 
 retry:
     while (1) {
     // try to locate next subtitle
-        if (!stream_read_line (st, line, LINE_LEN, utf16))
+        if (!sub_text_gets(st, line, LINE_LEN))
 		return NULL;
         if (!(sscanf (line, "-->> %ld", &(current->start)) <1))
 		break;
@@ -844,14 +869,14 @@ retry:
     previous_aqt_sub = current;
 #endif
 
-    if (!stream_read_line (st, line, LINE_LEN, utf16))
+    if (!sub_text_gets(st, line, LINE_LEN))
 	return NULL;
 
     sub_readtext((char *) &line,&current->text[0]);
     current->lines = 1;
     current->end = current->start; // will be corrected by next subtitle
 
-    if (!stream_read_line (st, line, LINE_LEN, utf16))
+    if (!sub_text_gets(st, line, LINE_LEN))
 	return current;
 
     if (set_multiline_text(current, line, 1) == ERR)
@@ -872,10 +897,9 @@ retry:
 subtitle *previous_subrip09_sub = NULL;
 #endif
 
-static subtitle *sub_read_line_subrip09(stream_t *st,subtitle *current,
+static subtitle *sub_read_line_subrip09(struct sub_text *st,subtitle *current,
                                     struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line[LINE_LEN+1];
     int a1,a2,a3;
     int len;
@@ -883,7 +907,7 @@ static subtitle *sub_read_line_subrip09(stream_t *st,subtitle *current,
 retry:
     while (1) {
     // try to locate next subtitle
-        if (!stream_read_line (st, line, LINE_LEN, utf16))
+        if (!sub_text_gets(st, line, LINE_LEN))
 		return NULL;
         if (!((len=sscanf (line, "[%d:%d:%d]",&a1,&a2,&a3)) < 3))
 		break;
@@ -901,7 +925,7 @@ retry:
     previous_subrip09_sub = current;
 #endif
 
-    if (!stream_read_line (st, line, LINE_LEN, utf16))
+    if (!sub_text_gets(st, line, LINE_LEN))
 	return NULL;
 
     current->text[0]=""; // just to be sure that string is clear
@@ -920,10 +944,9 @@ retry:
     return current;
 }
 
-static subtitle *sub_read_line_jacosub(stream_t* st, subtitle * current,
+static subtitle *sub_read_line_jacosub(struct sub_text *st, subtitle * current,
                                        struct readline_args *args)
 {
-    int utf16 = args->utf16;
     char line1[LINE_LEN], line2[LINE_LEN], directive[LINE_LEN], *p, *q;
     unsigned a1, a2, a3, a4, b1, b2, b3, b4, comment = 0;
     static unsigned jacoTimeres = 30;
@@ -934,7 +957,7 @@ static subtitle *sub_read_line_jacosub(stream_t* st, subtitle * current,
     memset(line2, 0, LINE_LEN);
     memset(directive, 0, LINE_LEN);
     while (!current->text[0]) {
-	if (!stream_read_line(st, line1, LINE_LEN, utf16)) {
+	if (!sub_text_gets(st, line1, LINE_LEN)) {
 	    return NULL;
 	}
 	if (sscanf
@@ -1092,7 +1115,7 @@ static subtitle *sub_read_line_jacosub(stream_t* st, subtitle * current,
 		    (*(p + 1) == '~') || (*(p + 1) == '{')) {
 		    ++p;
 		} else if (eol(*(p + 1))) {
-		    if (!stream_read_line(st, directive, LINE_LEN, utf16))
+		    if (!sub_text_gets(st, directive, LINE_LEN))
 			return NULL;
 		    trail_space(directive);
 		    av_strlcat(line2, directive, LINE_LEN);
@@ -1112,13 +1135,13 @@ static subtitle *sub_read_line_jacosub(stream_t* st, subtitle * current,
     return current;
 }
 
-static int sub_autodetect (stream_t* st, int *uses_time, int utf16) {
+static int sub_autodetect (struct sub_text* st, int *uses_time) {
     char line[LINE_LEN+1];
     int i,j=0;
 
     while (j < 100) {
 	j++;
-	if (!stream_read_line (st, line, LINE_LEN, utf16))
+	if (!sub_text_gets(st, line, LINE_LEN))
 	    return SUB_INVALID;
 
 	if (sscanf (line, "{%d}{%d}", &i, &i)==2)
@@ -1305,7 +1328,7 @@ static void adjust_subs_time(subtitle* sub, float subtime, float fps, int block,
 }
 
 struct subreader {
-    subtitle * (*read)(stream_t *st, subtitle *dest,
+    subtitle * (*read)(struct sub_text *st, subtitle *dest,
                        struct readline_args *args);
     void       (*post)(subtitle *dest);
     const char *name;
@@ -1369,14 +1392,285 @@ const char* guess_cp(stream_t *st, const char *preferred_language, const char *f
 
     return detected_sub_cp;
 }
-#undef MAX_GUESS_BUFFER_SIZE
 #endif
 
+// Make room for at least needed subtitles, growing geometrically
+static subtitle *grow_subs(subtitle *subs, int *alloc, int needed)
+{
+    if (needed > *alloc) {
+        *alloc = FFMAX(needed, *alloc * 2);
+        subs = realloc(subs, *alloc * sizeof(subtitle));
+    }
+    return subs;
+}
+
+/* Subtitle files are read completely into memory (mapped if they are plain
+ * files), and UTF-16 and codepage conversions are done once on the whole
+ * text instead of line by line. */
+#define MAX_SUB_FILE_SIZE (64 * 1024 * 1024)
+
+struct sub_source {
+    struct sub_text text;
+    void *map;              // mmap()ed file, or NULL
+    size_t map_size;
+    char *buf;              // talloc allocated text, or NULL
+};
+
+static int sub_source_load(struct sub_source *src, stream_t *st)
+{
+    struct bstr data;
+#ifdef HAVE_SYS_MMAN_H
+    if (st->type == STREAMTYPE_FILE && st->fd >= 0 && st->end_pos > 0 &&
+        st->end_pos <= MAX_SUB_FILE_SIZE) {
+        void *map = mmap(NULL, st->end_pos, PROT_READ, MAP_PRIVATE, st->fd, 0);
+        if (map != MAP_FAILED) {
+            src->map = map;
+            src->map_size = st->end_pos;
+            src->text = (struct sub_text){ .data = map, .size = st->end_pos };
+            return 0;
+        }
+        mp_msg(MSGT_SUBREADER, MSGL_V, "SUB: mmap failed, reading file\n");
+    }
+#endif
+    data = stream_read_complete(st, NULL, MAX_SUB_FILE_SIZE, 0);
+    if (!data.start) {
+        mp_msg(MSGT_SUBREADER, MSGL_ERR, "SUB: Could not read file "
+               "(larger than %d MB?)\n", MAX_SUB_FILE_SIZE >> 20);
+        return -1;
+    }
+    src->buf = data.start;
+    src->text = (struct sub_text){ .data = src->buf, .size = data.len };
+    return 0;
+}
+
+static void sub_source_set_buf(struct sub_source *src, char *buf, size_t size)
+{
+    talloc_free(src->buf);
+    src->buf = buf;
+    src->text = (struct sub_text){ .data = buf, .size = size };
+}
+
+static void sub_source_free(struct sub_source *src)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (src->map)
+        munmap(src->map, src->map_size);
+#endif
+    talloc_free(src->buf);
+}
+
+/* Convert UTF-16 (utf16: 1 = little endian, 2 = big endian) to UTF-8.
+ * Unpaired surrogates are dropped. */
+static char *utf16_to_utf8(const uint8_t *in, size_t len, int utf16,
+                           size_t *out_len)
+{
+    const uint8_t *end = in + (len & ~1);
+    // one 16 bit unit gives at most 3 bytes, a surrogate pair 4
+    char *out = talloc_size(NULL, len / 2 * 3 + 1), *p = out;
+    while (in < end) {
+        uint32_t c;
+        uint8_t tmp;
+        GET_UTF16(c, in < end ? (in += 2, utf16 == 1 ? AV_RL16(in - 2)
+                                                      : AV_RB16(in - 2)) : 0,
+                  continue;)
+        PUT_UTF8(c, tmp, *p++ = tmp;)
+    }
+    *out_len = p - out;
+    return out;
+}
+
+#ifdef CONFIG_ICONV
+#if HAVE_SSE2
+// Length of the leading run of 16 byte blocks that contain only ASCII
+static size_t ascii_prefix_sse2(const uint8_t *s, size_t len)
+{
+    intptr_t i = -(intptr_t)(len & ~15);
+    int mask;
+    if (!i)
+        return 0;
+    __asm__ volatile(
+        "1: \n"
+        "movdqu    (%2,%0), %%xmm0 \n"
+        "pmovmskb  %%xmm0, %1 \n"
+        "test      %1, %1 \n"
+        "jnz 2f \n"
+        "add          $16, %0 \n"
+        "jl 1b \n"
+        "2: \n"
+        : "+&r"(i), "=&r"(mask)
+        : "r"(s + (len & ~15))
+        : "memory"
+    );
+    return (len & ~15) + i;
+}
+#endif
+
+/* Check whether s is valid UTF-8. Returns -1 if not, 0 if it is plain ASCII
+ * and 1 if it is valid and contains multibyte sequences. */
+static int check_utf8(const uint8_t *s, size_t len)
+{
+    size_t i = 0;
+    int multibyte = 0;
+    while (i < len) {
+        uint32_t c, min;
+        int n, k;
+#if HAVE_SSE2
+        if (gCpuCaps.hasSSE2)
+            i += ascii_prefix_sse2(s + i, len - i);
+#endif
+        while (i < len && s[i] < 0x80)
+            i++;
+        if (i == len)
+            break;
+        c = s[i];
+        if (c >= 0xc2 && c <= 0xdf) {
+            n = 1; c &= 0x1f; min = 0x80;
+        } else if ((c & 0xf0) == 0xe0) {
+            n = 2; c &= 0x0f; min = 0x800;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            n = 3; c &= 0x07; min = 0x10000;
+        } else
+            return -1;
+        if (len - i - 1 < n)
+            return -1;
+        for (k = 1; k <= n; k++) {
+            if ((s[i + k] & 0xc0) != 0x80)
+                return -1;
+            c = c << 6 | (s[i + k] & 0x3f);
+        }
+        if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+            return -1;
+        i += n + 1;
+        multibyte = 1;
+    }
+    return multibyte;
+}
+
+/* Convert len bytes from codepage cp to UTF-8 with a single iconv
+ * descriptor. Bytes that can't be converted are copied unchanged. */
+static char *recode_text(const char *cp, const char *in, size_t len,
+                         size_t *out_len)
+{
+    iconv_t icd = iconv_open("UTF-8", cp);
+    char *ip = (char *)in;
+    size_t ileft = len;
+    size_t size = len + len / 2 + 64, pos = 0;
+    int errors = 0, flushed = 0;
+    char *out;
+
+    if (icd == (iconv_t)(-1)) {
+        mp_msg(MSGT_SUBREADER, MSGL_ERR, "SUB: error opening iconv descriptor.\n");
+        return NULL;
+    }
+    mp_msg(MSGT_SUBREADER, MSGL_V, "SUB: opened iconv descriptor.\n");
+    out = talloc_size(NULL, size);
+    while (!flushed) {
+        char *op = out + pos;
+        size_t oleft = size - pos;
+        size_t res;
+        if (ileft) {
+            res = iconv(icd, &ip, &ileft, &op, &oleft);
+        } else {
+            // In some stateful encodings, we must clear the state to
+            // handle the last character
+            res = iconv(icd, NULL, NULL, &op, &oleft);
+            flushed = res != (size_t)(-1);
+        }
+        pos = op - out;
+        if (res != (size_t)(-1))
+            continue;
+        if (errno == E2BIG) {
+            size *= 2;
+            out = talloc_realloc_size(NULL, out, size);
+            continue;
+        }
+        if (!ileft) {
+            mp_msg(MSGT_SUBREADER, MSGL_WARN, "SUB: error recoding, "
+                   "can't clear encoding state.\n");
+            break;
+        }
+        // invalid or truncated input sequence
+        if (pos == size) {
+            size *= 2;
+            out = talloc_realloc_size(NULL, out, size);
+        }
+        out[pos++] = *ip++;
+        ileft--;
+        errors++;
+        iconv(icd, NULL, NULL, NULL, NULL);
+    }
+    iconv_close(icd);
+    if (errors)
+        mp_msg(MSGT_SUBREADER, MSGL_WARN, "SUB: %d byte(s) could not be "
+               "recoded from %s.\n", errors, cp);
+    *out_len = pos;
+    return out;
+}
+
+/* Recode the text from the --subcp codepage to UTF-8. Text that is valid
+ * UTF-8 and not plain ASCII is left alone: text in a legacy 8 bit codepage
+ * is practically never valid UTF-8, so recoding it could only break it. */
+static void sub_source_recode(struct sub_source *src)
+{
+    const char *cp = sub_cp;
+    size_t len;
+    char *out;
+#ifdef CONFIG_ENCA
+    char enca_lang[3], enca_fallback[100];
+    if (sscanf(sub_cp, "enca:%2s:%99s", enca_lang, enca_fallback) == 2
+         || sscanf(sub_cp, "ENCA:%2s:%99s", enca_lang, enca_fallback) == 2) {
+        cp = guess_buffer_cp((unsigned char *)src->text.data,
+                             FFMIN(src->text.size, MAX_GUESS_BUFFER_SIZE),
+                             enca_lang, enca_fallback);
+    }
+#endif
+    if (check_utf8(src->text.data, src->text.size) > 0) {
+        mp_msg(MSGT_SUBREADER, MSGL_V, "SUB: File is valid UTF-8, "
+               "not recoding from %s.\n", cp);
+        return;
+    }
+    out = recode_text(cp, src->text.data, src->text.size, &len);
+    if (out)
+        sub_source_set_buf(src, out, len);
+}
+#endif
+
+/* Move the text of all subtitles into one allocation, which replaces
+ * thousands of small blocks for a typical file. Returns NULL (leaving the
+ * text as it is) if there is no memory. */
+static char *pack_text(subtitle *subs, int num)
+{
+    size_t total = 1;
+    char *pool, *p;
+    int i, l;
+    for (i = 0; i < num; i++)
+        for (l = 0; l < subs[i].lines; l++)
+            if (subs[i].text[l])
+                total += strlen(subs[i].text[l]) + 1;
+    pool = p = malloc(total);
+    if (!pool)
+        return NULL;
+    for (i = 0; i < num; i++)
+        for (l = 0; l < subs[i].lines; l++) {
+            char *text = subs[i].text[l];
+            size_t len;
+            if (!text)
+                continue;
+            len = strlen(text) + 1;
+            memcpy(p, text, len);
+            free(text);
+            subs[i].text[l] = p;
+            p += len;
+        }
+    return pool;
+}
+
 sub_data* sub_read_file(char *filename, float fps, struct MPOpts *opts)
 {
     int utf16;
     stream_t* fd;
-    int n_max, n_first, i, j, sub_first, sub_orig;
+    struct sub_source src = {{0}};
+    int n_max, n_first, i, j, sub_first, sub_orig, second_max;
     subtitle *first, *second, *sub, *return_sub, *alloced_sub = NULL;
     sub_data *subt_data;
     int uses_time = 0, sub_num = 0, sub_errs = 0;
@@ -1401,19 +1695,31 @@ sub_data* sub_read_file(char *filename, float fps, struct MPOpts *opts)
 
     if(filename==NULL) return NULL; //qnx segfault
     fd=open_stream (filename, NULL, NULL); if (!fd) return NULL;
+    if (sub_source_load(&src, fd) < 0) {
+        free_stream(fd);
+        return NULL;
+    }
+    free_stream(fd);
 
-    sub_format = SUB_INVALID;
-    for (utf16 = 0; sub_format == SUB_INVALID && utf16 < 3; utf16++) {
-        sub_format=sub_autodetect (fd, &uses_time, utf16);
-        stream_reset(fd);
-        stream_seek(fd,0);
+    sub_format=sub_autodetect (&src.text, &uses_time);
+    // maybe UTF-16, try both byte orders
+    for (utf16 = 1; sub_format == SUB_INVALID && utf16 < 3; utf16++) {
+        struct sub_text conv = {0};
+        char *buf = utf16_to_utf8(src.text.data, src.text.size, utf16,
+                                  &conv.size);
+        conv.data = buf;
+        sub_format = sub_autodetect(&conv, &uses_time);
+        if (sub_format != SUB_INVALID)
+            sub_source_set_buf(&src, buf, conv.size);
+        else
+            talloc_free(buf);
     }
-    utf16--;
+    src.text.pos = 0;
 
     mpsub_multiplier = (uses_time ? 100.0 : 1.0);
     if (sub_format==SUB_INVALID) {
         mp_msg(MSGT_SUBREADER,MSGL_WARN,"SUB: Could not determine file format\n");
-        free_stream(fd);
+        sub_source_free(&src);
         return NULL;
     }
     srp=sr+sub_format;
@@ -1432,7 +1738,7 @@ sub_data* sub_read_file(char *filename, float fps, struct MPOpts *opts)
 			    break;
 			}
 	    }
-	    if (k<0) subcp_open(fd);
+	    if (k<0 && sub_cp) sub_source_recode(&src);
     }
 #endif
 
@@ -1440,10 +1746,9 @@ sub_data* sub_read_file(char *filename, float fps, struct MPOpts *opts)
     first=malloc(n_max*sizeof(subtitle));
     if(!first){
 #ifdef CONFIG_ICONV
-	  subcp_close();
           sub_utf8=sub_utf8_prev;
 #endif
-          free_stream(fd);
+          sub_source_free(&src);
 	  return NULL;
     }
 
@@ -1456,26 +1761,20 @@ sub_data* sub_read_file(char *filename, float fps, struct MPOpts *opts)
 #endif
     while(1){
         if(sub_num>=n_max){
-            n_max+=16;
+            n_max*=2;
             first=realloc(first,n_max*sizeof(subtitle));
         }
 #ifndef CONFIG_SORTSUB
 	sub = &first[sub_num];
 #endif
 	memset(sub, '\0', sizeof(subtitle));
-        sub=srp->read(fd, sub, &(struct readline_args){utf16, opts});
+        sub=srp->read(&src.text, sub, &(struct readline_args){opts});
         if(!sub) break;   // EOF
-#ifdef CONFIG_ICONV
-	if ((sub!=ERR) && sub_utf8 == 2) sub=subcp_recode(sub);
-#endif
 	if ( sub == ERR )
 	 {
-#ifdef CONFIG_ICONV
-          subcp_close();
-#endif
 	  free(first);
 	  free(alloced_sub);
-          free_stream(fd);
+          sub_source_free(&src);
 	  return NULL;
 	 }
         // Apply any post processing that needs recoding first
@@ -1523,11 +1822,7 @@ sub_data* sub_read_file(char *filename, float fps, struct MPOpts *opts)
         if(sub==ERR) ++sub_errs; else ++sub_num; // Error vs. Valid
     }
 
-    free_stream(fd);
-
-#ifdef CONFIG_ICONV
-    subcp_close();
-#endif
+    sub_source_free(&src);
     free(alloced_sub);
 
 //    printf ("SUB: Subtitle format %s time.\n", uses_time?"uses":"doesn't use");
@@ -1551,6 +1846,7 @@ if ((suboverlap_enabled == 2) ||
     n_first = sub_num;
     sub_num = 0;
     second = NULL;
+    second_max = 0;
     // for each subtitle in first[] we deal with its 'block' of
     // bonded subtitles
     for (sub_first = 0; sub_first < n_first; ++sub_first) {
@@ -1691,7 +1987,7 @@ if ((suboverlap_enabled == 2) ||
 	    if (higher_line >= SUB_MAX_TEXT) {
 		// the 'block' has too much lines, so we don't overlap the
 		// subtitles
-		second = realloc(second, (sub_num + sub_to_add + 1) * sizeof(subtitle));
+		second = grow_subs(second, &second_max, sub_num + sub_to_add + 1);
 		for (j = 0; j <= sub_to_add; ++j) {
 		    int ls;
 		    memset(&second[sub_num + j], '\0', sizeof(subtitle));
@@ -1711,7 +2007,7 @@ if ((suboverlap_enabled == 2) ||
 
 	    // we read the placeholder structure and create the new
 	    // subs.
-	    second = realloc(second, (sub_num + 1) * sizeof(subtitle));
+	    second = grow_subs(second, &second_max, sub_num + 1);
 	    memset(&second[sub_num], '\0', sizeof(subtitle));
 	    second[sub_num].start = local_start;
 	    second[sub_num].end   = local_end;
@@ -1762,6 +2058,8 @@ if ((suboverlap_enabled == 2) ||
     subt_data->sub_num = sub_num;
     subt_data->sub_errs = sub_errs;
     subt_data->subtitles = return_sub;
+    subt_data->text_pool = pack_text(return_sub, sub_num);
+    subt_data->index = sub_index_build(return_sub, sub_num);
     return subt_data;
 }
 
@@ -1771,10 +2069,14 @@ void sub_free( sub_data * subd )
 
     if ( !subd ) return;
 
-    for (i = 0; i < subd->sub_num; i++)
-        for (j = 0; j < subd->subtitles[i].lines; j++)
-            free( subd->subtitles[i].text[j] );
+    if (subd->text_pool)
+        free( subd->text_pool );
+    else
+        for (i = 0; i < subd->sub_num; i++)
+            for (j = 0; j < subd->subtitles[i].lines; j++)
+                free( subd->subtitles[i].text[j] );
     free( subd->subtitles );
+    sub_index_free( subd->index );
     free( subd->filename );
     free( subd );
 }
@@ -77,6 +77,8 @@ typedef struct sub_data {
     int sub_uses_time;
     int sub_num;          // number of subtitle structs
     int sub_errs;
+    char *text_pool;      // text of all subtitles, if packed by sub_read_file
+    struct sub_index *index; // lookup by time, see sub_index.h
 } sub_data;
 
 struct MPOpts;
@@ -32,6 +32,9 @@
 #include <sys/types.h>
 
 #include "config.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include "mpcommon.h"
 #include "vobsub.h"
 #include "spudec.h"
@@ -44,6 +47,10 @@ extern int vobsub_id;
 // overridden if slang match any of vobsub streams.
 static int vobsubid = -2;
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 typedef FILE rar_stream_t;
 #define rar_open        fopen
 #define rar_close       fclose
@@ -97,81 +104,68 @@ static ssize_t vobsub_getline(char **lineptr, size_t *n, rar_stream_t *stream)
  * MPEG parsing
  **********************************************************************/
 
+/* Parser state over the .sub file, which is kept in memory as a whole
+ * (normally mmapped). packet points into that buffer. */
 typedef struct {
-    rar_stream_t *stream;
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
     unsigned int pts;
     int aid;
-    unsigned char *packet;
-    unsigned int packet_reserve;
+    const unsigned char *packet;
     unsigned int packet_size;
-    int padding_was_here;
-    int merge;
 } mpeg_t;
 
-static mpeg_t *mpeg_open(const char *filename)
-{
-    mpeg_t *res = malloc(sizeof(mpeg_t));
-    int err = res == NULL;
-    if (!err) {
-        res->pts            = 0;
-        res->aid            = -1;
-        res->packet         = NULL;
-        res->packet_size    = 0;
-        res->packet_reserve = 0;
-        res->padding_was_here = 1;
-        res->merge          = 0;
-        res->stream         = rar_open(filename, "rb");
-        err = res->stream == NULL;
-        if (err)
-            perror("fopen Vobsub file failed");
-        if (err)
-            free(res);
-    }
-    return err ? NULL : res;
+static int mpeg_eof(mpeg_t *mpeg)
+{
+    return mpeg->pos >= mpeg->size;
 }
 
-static void mpeg_free(mpeg_t *mpeg)
+static int mpeg_getc(mpeg_t *mpeg)
 {
-    free(mpeg->packet);
-    if (mpeg->stream)
-        rar_close(mpeg->stream);
-    free(mpeg);
+    return mpeg->pos < mpeg->size ? mpeg->data[mpeg->pos++] : -1;
 }
 
-static int mpeg_eof(mpeg_t *mpeg)
+static int mpeg_read(mpeg_t *mpeg, unsigned char *buf, size_t len)
 {
-    return rar_eof(mpeg->stream);
+    if (mpeg->size - mpeg->pos < len)
+        return -1;
+    memcpy(buf, mpeg->data + mpeg->pos, len);
+    mpeg->pos += len;
+    return 0;
 }
 
-static off_t mpeg_tell(mpeg_t *mpeg)
+static int mpeg_skip(mpeg_t *mpeg, size_t len)
 {
-    return rar_tell(mpeg->stream);
+    if (mpeg->size - mpeg->pos < len)
+        return -1;
+    mpeg->pos += len;
+    return 0;
 }
 
 static int mpeg_run(mpeg_t *mpeg)
 {
     unsigned int len, idx, version;
     int c;
-    /* Goto start of a packet, it starts with 0x000001?? */
-    const unsigned char wanted[] = { 0, 0, 1 };
+    const unsigned char *d = mpeg->data;
     unsigned char buf[5];
 
     mpeg->aid = -1;
+    mpeg->packet = NULL;
     mpeg->packet_size = 0;
-    if (rar_read(buf, 4, 1, mpeg->stream) != 1)
+    /* Goto start of a packet, it starts with 0x000001?? */
+    while (mpeg->size - mpeg->pos >= 4
+           && (d[mpeg->pos] || d[mpeg->pos + 1] || d[mpeg->pos + 2] != 1))
+        ++mpeg->pos;
+    if (mpeg_read(mpeg, buf, 4) < 0) {
+        mpeg->pos = mpeg->size;
         return -1;
-    while (memcmp(buf, wanted, sizeof(wanted)) != 0) {
-        c = rar_getc(mpeg->stream);
-        if (c < 0)
-            return -1;
-        memmove(buf, buf + 1, 3);
-        buf[3] = c;
     }
     switch (buf[3]) {
     case 0xb9:                  /* System End Code */
         break;
     case 0xba:                  /* Packet start code */
-        c = rar_getc(mpeg->stream);
+        c = mpeg_getc(mpeg);
         if (c < 0)
             return -1;
         if ((c & 0xc0) == 0x40)
@@ -182,57 +176,45 @@ static int mpeg_run(mpeg_t *mpeg)
             mp_msg(MSGT_VOBSUB, MSGL_ERR, "VobSub: Unsupported MPEG version: 0x%02x\n", c);
             return -1;
         }
-        if (version == 4) {
-            if (rar_seek(mpeg->stream, 9, SEEK_CUR))
-                return -1;
-        } else if (version == 2) {
-            if (rar_seek(mpeg->stream, 7, SEEK_CUR))
-                return -1;
-        } else
-            abort();
-        if (!mpeg->padding_was_here)
-            mpeg->merge = 1;
+        if (mpeg_skip(mpeg, version == 4 ? 9 : 7) < 0)
+            return -1;
         break;
     case 0xbd:                  /* packet */
-        if (rar_read(buf, 2, 1, mpeg->stream) != 1)
+        if (mpeg_read(mpeg, buf, 2) < 0)
             return -1;
-        mpeg->padding_was_here = 0;
         len = buf[0] << 8 | buf[1];
-        idx = mpeg_tell(mpeg);
-        c = rar_getc(mpeg->stream);
+        idx = mpeg->pos;
+        c = mpeg_getc(mpeg);
         if (c < 0)
             return -1;
         if ((c & 0xC0) == 0x40) { /* skip STD scale & size */
-            if (rar_getc(mpeg->stream) < 0)
+            if (mpeg_getc(mpeg) < 0)
                 return -1;
-            c = rar_getc(mpeg->stream);
+            c = mpeg_getc(mpeg);
             if (c < 0)
                 return -1;
         }
-        if ((c & 0xf0) == 0x20) { /* System-1 stream timestamp */
-            /* Do we need this? */
-            abort();
-        } else if ((c & 0xf0) == 0x30) {
-            /* Do we need this? */
-            abort();
+        if ((c & 0xe0) == 0x20) { /* System-1 stream timestamp */
+            mp_msg(MSGT_VOBSUB, MSGL_ERR, "VobSub: MPEG-1 system streams are not supported\n");
+            return -1;
         } else if ((c & 0xc0) == 0x80) { /* System-2 (.VOB) stream */
             unsigned int pts_flags, hdrlen, dataidx;
-            c = rar_getc(mpeg->stream);
+            c = mpeg_getc(mpeg);
             if (c < 0)
                 return -1;
             pts_flags = c;
-            c = rar_getc(mpeg->stream);
+            c = mpeg_getc(mpeg);
             if (c < 0)
                 return -1;
             hdrlen = c;
-            dataidx = mpeg_tell(mpeg) + hdrlen;
+            dataidx = mpeg->pos + hdrlen;
             if (dataidx > idx + len) {
                 mp_msg(MSGT_VOBSUB, MSGL_ERR, "Invalid header length: %d (total length: %d, idx: %d, dataidx: %d)\n",
                        hdrlen, len, idx, dataidx);
                 return -1;
             }
             if ((pts_flags & 0xc0) == 0x80) {
-                if (rar_read(buf, 5, 1, mpeg->stream) != 1)
+                if (mpeg_read(mpeg, buf, 5) < 0)
                     return -1;
                 if (!(((buf[0] & 0xf0) == 0x20) && (buf[0] & 1) && (buf[2] & 1) &&  (buf[4] & 1))) {
                     mp_msg(MSGT_VOBSUB, MSGL_ERR, "vobsub PTS error: 0x%02x %02x%02x %02x%02x \n",
@@ -243,50 +225,38 @@ static int mpeg_run(mpeg_t *mpeg)
                         | buf[3] << 7 | (buf[4] >> 1));
             } else /* if ((pts_flags & 0xc0) == 0xc0) */ {
                 /* what's this? */
-                /* abort(); */
             }
-            rar_seek(mpeg->stream, dataidx, SEEK_SET);
-            mpeg->aid = rar_getc(mpeg->stream);
+            mpeg->pos = dataidx;
+            mpeg->aid = mpeg_getc(mpeg);
             if (mpeg->aid < 0) {
                 mp_msg(MSGT_VOBSUB, MSGL_ERR, "Bogus aid %d\n", mpeg->aid);
                 return -1;
             }
-            mpeg->packet_size = len - ((unsigned int) mpeg_tell(mpeg) - idx);
-            if (mpeg->packet_reserve < mpeg->packet_size) {
-                free(mpeg->packet);
-                mpeg->packet = malloc(mpeg->packet_size);
-                if (mpeg->packet)
-                    mpeg->packet_reserve = mpeg->packet_size;
-            }
-            if (mpeg->packet == NULL) {
-                mp_msg(MSGT_VOBSUB, MSGL_FATAL, "malloc failure");
-                mpeg->packet_reserve = 0;
+            mpeg->packet_size = len - (mpeg->pos - idx);
+            if (mpeg->size - mpeg->pos < mpeg->packet_size) {
+                mp_msg(MSGT_VOBSUB, MSGL_ERR, "VobSub: truncated packet\n");
                 mpeg->packet_size = 0;
+                mpeg->pos = mpeg->size;
                 return -1;
             }
-            if (rar_read(mpeg->packet, mpeg->packet_size, 1, mpeg->stream) != 1) {
-                mp_msg(MSGT_VOBSUB, MSGL_ERR, "fread failure");
-                mpeg->packet_size = 0;
-                return -1;
-            }
-            idx = len;
+            mpeg->packet = d + mpeg->pos;
+            mpeg->pos += mpeg->packet_size;
         }
         break;
     case 0xbe:                  /* Padding */
-        if (rar_read(buf, 2, 1, mpeg->stream) != 1)
+        if (mpeg_read(mpeg, buf, 2) < 0)
             return -1;
         len = buf[0] << 8 | buf[1];
-        if (len > 0 && rar_seek(mpeg->stream, len, SEEK_CUR))
+        if (mpeg_skip(mpeg, len) < 0)
             return -1;
-        mpeg->padding_was_here = 1;
         break;
     default:
         if (0xc0 <= buf[3] && buf[3] < 0xf0) {
             /* MPEG audio or video */
-            if (rar_read(buf, 2, 1, mpeg->stream) != 1)
+            if (mpeg_read(mpeg, buf, 2) < 0)
                 return -1;
             len = buf[0] << 8 | buf[1];
-            if (len > 0 && rar_seek(mpeg->stream, len, SEEK_CUR))
+            if (mpeg_skip(mpeg, len) < 0)
                 return -1;
         } else {
             mp_msg(MSGT_VOBSUB, MSGL_ERR, "unknown header 0x%02X%02X%02X%02X\n",
@@ -301,11 +271,11 @@ static int mpeg_run(mpeg_t *mpeg)
  * Packet queue
  **********************************************************************/
 
+/* An index entry. The packet data is only read from the .sub file when the
+   packet is needed, see vobsub_get_cached(). */
 typedef struct {
     unsigned int pts100;
     off_t filepos;
-    unsigned int size;
-    unsigned char *data;
 } packet_t;
 
 typedef struct {
@@ -320,13 +290,6 @@ static void packet_construct(packet_t *pkt)
 {
     pkt->pts100 = 0;
     pkt->filepos = 0;
-    pkt->size = 0;
-    pkt->data = NULL;
-}
-
-static void packet_destroy(packet_t *pkt)
-{
-    free(pkt->data);
 }
 
 static void packet_queue_construct(packet_queue_t *queue)
@@ -340,12 +303,8 @@ static void packet_queue_construct(packet_queue_t *queue)
 
 static void packet_queue_destroy(packet_queue_t *queue)
 {
-    if (queue->packets) {
-        while (queue->packets_size--)
-            packet_destroy(queue->packets + queue->packets_size);
-        free(queue->packets);
-    }
-    return;
+    free(queue->id);
+    free(queue->packets);
 }
 
 /* Make sure there is enough room for needed_size packets in the
@@ -383,29 +342,23 @@ static int packet_queue_grow(packet_queue_t *queue)
     return 0;
 }
 
-/* insert a new packet, duplicating pts from the current one */
-static int packet_queue_insert(packet_queue_t *queue)
-{
-    packet_t *pkts;
-    if (packet_queue_ensure(queue, queue->packets_size + 1) < 0)
-        return -1;
-    /* XXX packet_size does not reflect the real thing here, it will be updated a bit later */
-    memmove(queue->packets + queue->current_index + 2,
-            queue->packets + queue->current_index + 1,
-            sizeof(packet_t) * (queue->packets_size - queue->current_index - 1));
-    pkts = queue->packets + queue->current_index;
-    ++queue->packets_size;
-    ++queue->current_index;
-    packet_construct(pkts + 1);
-    pkts[1].pts100 = pkts[0].pts100;
-    pkts[1].filepos = pkts[0].filepos;
-    return 0;
-}
-
 /**********************************************************************
  * Vobsub
  **********************************************************************/
 
+/* Number of assembled packets kept around, so that seeking back or showing
+   the same subtitle again does not need to parse the .sub file again. */
+#define PACKET_CACHE_SIZE 8
+
+typedef struct {
+    int sid;                    // -1 if the entry is unused
+    unsigned int index;         // index of the packet in its queue
+    unsigned int last_use;
+    unsigned char *data;
+    unsigned int size;
+    unsigned int reserve;
+} packet_cache_t;
+
 typedef struct {
     unsigned int palette[16];
     int delay;
@@ -417,6 +370,13 @@ typedef struct {
     unsigned int spu_streams_size;
     unsigned int spu_streams_current;
     unsigned int spu_valid_streams_size;
+    /* the .sub file */
+    unsigned char *sub_data;
+    size_t sub_size;
+    int sub_mapped;
+    /* recently used packets */
+    packet_cache_t cache[PACKET_CACHE_SIZE];
+    unsigned int cache_clock;
 } vobsub_t;
 
 /* Make sure that the spu stream idx exists. */
@@ -710,6 +670,168 @@ int vobsub_parse_ifo(void* this, const char *const name, unsigned int *palette,
     return res;
 }
 
+/* Make the whole .sub file available in memory, mapping it if possible. */
+static int vobsub_load_sub(vobsub_t *vob, const char *filename)
+{
+    struct stat st;
+    int fd = open(filename, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    vob->sub_size = st.st_size;
+    if (vob->sub_size == 0) {
+        close(fd);
+        return 0;
+    }
+#ifdef HAVE_SYS_MMAN_H
+    vob->sub_data = mmap(NULL, vob->sub_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (vob->sub_data != MAP_FAILED) {
+        vob->sub_mapped = 1;
+        close(fd);
+        return 0;
+    }
+    mp_msg(MSGT_VOBSUB, MSGL_V, "[vobsub] mmap failed, reading SUB file\n");
+#endif
+    vob->sub_data = malloc(vob->sub_size);
+    if (vob->sub_data) {
+        size_t done = 0;
+        while (done < vob->sub_size) {
+            ssize_t r = read(fd, vob->sub_data + done, vob->sub_size - done);
+            if (r <= 0)
+                break;
+            done += r;
+        }
+        vob->sub_size = done;
+    } else {
+        mp_msg(MSGT_VOBSUB, MSGL_FATAL, "malloc failure");
+        vob->sub_size = 0;
+    }
+    close(fd);
+    return vob->sub_data ? 0 : -1;
+}
+
+static void vobsub_unload_sub(vobsub_t *vob)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (vob->sub_mapped) {
+        munmap(vob->sub_data, vob->sub_size);
+        vob->sub_data = NULL;
+    }
+#endif
+    free(vob->sub_data);
+    vob->sub_data = NULL;
+    vob->sub_size = 0;
+}
+
+/* Without timestamps in the index, build the index from the .sub file:
+   every SPU becomes a packet with the pts of the PES packet it starts in. */
+static void vobsub_scan_sub(vobsub_t *vob)
+{
+    unsigned int remaining[32] = {0};
+    mpeg_t mpg = { .data = vob->sub_data, .size = vob->sub_size };
+    while (!mpeg_eof(&mpg)) {
+        size_t pos = mpg.pos;
+        unsigned int sid;
+        packet_queue_t *queue;
+        if (mpeg_run(&mpg) < 0) {
+            if (!mpeg_eof(&mpg))
+                mp_msg(MSGT_VOBSUB, MSGL_ERR, "VobSub: mpeg_run error\n");
+            break;
+        }
+        if (!mpg.packet_size || (mpg.aid & 0xe0) != 0x20)
+            continue;
+        sid = mpg.aid & 0x1f;
+        if (vobsub_ensure_spu_stream(vob, sid) < 0) {
+            mp_msg(MSGT_VOBSUB, MSGL_WARN, "don't know what to do with subtitle #%u\n", sid);
+            continue;
+        }
+        if (remaining[sid] == 0 && mpg.packet_size >= 2) {
+            queue = vob->spu_streams + sid;
+            if (packet_queue_grow(queue) < 0)
+                break;
+            queue->packets[queue->packets_size - 1].filepos = pos;
+            queue->packets[queue->packets_size - 1].pts100 = mpg.pts;
+            remaining[sid] = mpg.packet[0] << 8 | mpg.packet[1];
+        }
+        remaining[sid] -= FFMIN(remaining[sid], mpg.packet_size);
+    }
+}
+
+/* Read the SPU of packet index of stream sid from the .sub file. A SPU can
+   be split over several PES packets, which are concatenated until the size
+   stored in the first two bytes of the SPU is reached. */
+static void vobsub_assemble(vobsub_t *vob, unsigned int sid,
+                            unsigned int index, packet_cache_t *c)
+{
+    packet_queue_t *queue = vob->spu_streams + sid;
+    off_t start = queue->packets[index].filepos, end = vob->sub_size;
+    unsigned int spu_size = 0, i;
+    mpeg_t mpg = { .data = vob->sub_data, .size = vob->sub_size };
+
+    c->size = 0;
+    if (start < 0 || start >= vob->sub_size)
+        return;
+    /* the data of this SPU starts before the next index entry */
+    for (i = index + 1; i < queue->packets_size; i++)
+        if (queue->packets[i].filepos > start) {
+            end = queue->packets[i].filepos;
+            break;
+        }
+    mpg.pos = start;
+    while (!mpeg_eof(&mpg) && (c->size ? c->size < spu_size : mpg.pos < end)) {
+        if (mpeg_run(&mpg) < 0)
+            break;
+        if (!mpg.packet_size || mpg.aid != (0x20 | sid))
+            continue;
+        if (c->size + mpg.packet_size > c->reserve) {
+            unsigned int reserve = FFMAX(2 * c->reserve, c->size + mpg.packet_size);
+            unsigned char *tmp = realloc(c->data, reserve);
+            if (!tmp) {
+                mp_msg(MSGT_VOBSUB, MSGL_FATAL, "realloc failure");
+                c->size = 0;
+                return;
+            }
+            c->data = tmp;
+            c->reserve = reserve;
+        }
+        memcpy(c->data + c->size, mpg.packet, mpg.packet_size);
+        c->size += mpg.packet_size;
+        if (c->size >= 2)
+            spu_size = c->data[0] << 8 | c->data[1];
+    }
+    if (c->size < spu_size)
+        mp_msg(MSGT_VOBSUB, MSGL_V, "[vobsub] incomplete SPU at 0x%"PRIx64"\n",
+               (int64_t)start);
+    else if (c->size > spu_size)
+        c->size = spu_size;
+}
+
+/* Return the data of packet index of stream sid, reading it from the .sub
+   file if it is not in the cache. The data stays valid until the cache
+   entry is reused, i.e. at least until the next call. */
+static packet_cache_t *vobsub_get_cached(vobsub_t *vob, unsigned int sid,
+                                         unsigned int index)
+{
+    packet_cache_t *victim = vob->cache;
+    for (int i = 0; i < PACKET_CACHE_SIZE; i++) {
+        packet_cache_t *c = vob->cache + i;
+        if (c->sid == sid && c->index == index) {
+            c->last_use = ++vob->cache_clock;
+            return c;
+        }
+        if (c->last_use < victim->last_use)
+            victim = c;
+    }
+    victim->sid = sid;
+    victim->index = index;
+    victim->last_use = ++vob->cache_clock;
+    vobsub_assemble(vob, sid, index, victim);
+    return victim;
+}
+
 void *vobsub_open(const char *const name, const char *const ifo,
                   const int force, void** spu)
 {
@@ -725,7 +847,6 @@ void *vobsub_open(const char *const name, const char *const ifo,
         buf = malloc(strlen(name) + 5);
         if (buf) {
             rar_stream_t *fd;
-            mpeg_t *mpg;
             /* read in the info file */
             if (!ifo) {
                 strcpy(buf, name);
@@ -754,70 +875,26 @@ void *vobsub_open(const char *const name, const char *const ifo,
                 *spu = spudec_new_scaled(vob->palette, vob->orig_frame_width, vob->orig_frame_height, extradata, extradata_len);
             free(extradata);
 
-            /* read the indexed mpeg_stream */
+            for (int i = 0; i < PACKET_CACHE_SIZE; i++)
+                vob->cache[i].sid = -1;
+
+            /* map the mpeg stream, packets are read from it when needed */
             strcpy(buf, name);
             strcat(buf, ".sub");
-            mpg = mpeg_open(buf);
-            if (mpg == NULL) {
+            if (vobsub_load_sub(vob, buf) < 0) {
                 if (force)
                     mp_msg(MSGT_VOBSUB, MSGL_ERR, "VobSub: Can't open SUB file\n");
                 else {
+                    vobsub_close(vob);
                     free(buf);
-                    free(vob);
                     return NULL;
                 }
             } else {
-                long last_pts_diff = 0;
-                while (!mpeg_eof(mpg)) {
-                    off_t pos = mpeg_tell(mpg);
-                    if (mpeg_run(mpg) < 0) {
-                        if (!mpeg_eof(mpg))
-                            mp_msg(MSGT_VOBSUB, MSGL_ERR, "VobSub: mpeg_run error\n");
-                        break;
-                    }
-                    if (mpg->packet_size) {
-                        if ((mpg->aid & 0xe0) == 0x20) {
-                            unsigned int sid = mpg->aid & 0x1f;
-                            if (vobsub_ensure_spu_stream(vob, sid) >= 0)  {
-                                packet_queue_t *queue = vob->spu_streams + sid;
-                                /* get the packet to fill */
-                                if (queue->packets_size == 0 && packet_queue_grow(queue)  < 0)
-                                  abort();
-                                while (queue->current_index + 1 < queue->packets_size
-                                       && queue->packets[queue->current_index + 1].filepos <= pos)
-                                    ++queue->current_index;
-                                if (queue->current_index < queue->packets_size) {
-                                    packet_t *pkt;
-                                    if (queue->packets[queue->current_index].data) {
-                                        /* insert a new packet and fix the PTS ! */
-                                        packet_queue_insert(queue);
-                                        queue->packets[queue->current_index].pts100 =
-                                            mpg->pts + last_pts_diff;
-                                    }
-                                    pkt = queue->packets + queue->current_index;
-                                    if (pkt->pts100 != UINT_MAX) {
-                                        if (queue->packets_size > 1)
-                                            last_pts_diff = pkt->pts100 - mpg->pts;
-                                        else
-                                            pkt->pts100 = mpg->pts;
-                                        if (mpg->merge && queue->current_index > 0) {
-                                            packet_t *last = &queue->packets[queue->current_index - 1];
-                                            pkt->pts100 = last->pts100;
-                                        }
-                                        mpg->merge = 0;
-                                        /* FIXME: should not use mpg_sub internal informations, make a copy */
-                                        pkt->data = mpg->packet;
-                                        pkt->size = mpg->packet_size;
-                                        mpg->packet = NULL;
-                                        mpg->packet_reserve = 0;
-                                        mpg->packet_size = 0;
-                                    }
-                                }
-                            } else
-                                mp_msg(MSGT_VOBSUB, MSGL_WARN, "don't know what to do with subtitle #%u\n", sid);
-                        }
-                    }
-                }
+                unsigned int entries = 0;
+                for (int i = 0; i < vob->spu_streams_size; i++)
+                    entries += vob->spu_streams[i].packets_size;
+                if (entries == 0)
+                    vobsub_scan_sub(vob);
                 vob->spu_streams_current = vob->spu_streams_size;
                 while (vob->spu_streams_current-- > 0) {
                     vob->spu_streams[vob->spu_streams_current].current_index = 0;
@@ -825,7 +902,6 @@ void *vobsub_open(const char *const name, const char *const ifo,
                         vob->spu_streams[vob->spu_streams_current].packets_size > 0)
                         ++vob->spu_valid_streams_size;
                 }
-                mpeg_free(mpg);
             }
             free(buf);
         }
@@ -841,6 +917,9 @@ void vobsub_close(void *this)
             packet_queue_destroy(vob->spu_streams + vob->spu_streams_size);
         free(vob->spu_streams);
     }
+    for (int i = 0; i < PACKET_CACHE_SIZE; i++)
+        free(vob->cache[i].data);
+    vobsub_unload_sub(vob);
     free(vob);
 }
 
@@ -950,10 +1029,14 @@ int vobsub_get_packet(void *vobhandle, float pts, void** data, int* timestamp)
             packet_t *pkt = queue->packets + queue->current_index;
             if (pkt->pts100 != UINT_MAX)
                 if (pkt->pts100 <= pts100) {
+                    packet_cache_t *c = vobsub_get_cached(vob, vobsub_id,
+                                                          queue->current_index);
                     ++queue->current_index;
-                    *data = pkt->data;
+                    if (!c->size)
+                        continue;
+                    *data = c->data;
                     *timestamp = pkt->pts100;
-                    return pkt->size;
+                    return c->size;
                 } else
                     break;
             else
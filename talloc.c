@@ -75,6 +75,7 @@ static size_t rep_strnlen(const char *s, size_t max)
 // Workarounds for missing standard features, not used in MPlayer
 // #include "replace.h"
 #include "talloc.h"
+#include "osdep/atomics.h"
 #endif /* not _TALLOC_SAMBA3 */
 
 /* use this to force every realloc to change the pointer, to stress test
@@ -260,13 +261,89 @@ const char *talloc_parent_name(const void *ptr)
   The object count is not put into "struct talloc_chunk" because it is only
   relevant for talloc pools and the alignment to 16 bytes would increase the
   memory footprint of each talloc chunk by those 16 bytes.
+
+  The rest of the 16 bytes holds the counters for talloc_pool_get_stats().
 */
 
 #define TALLOC_POOL_HDR_SIZE 16
 
+struct talloc_pool_hdr {
+	unsigned int object_count;
+	unsigned int num_allocs;	/* allocations served by the pool */
+	unsigned int num_fallbacks;	/* allocations that did not fit */
+	unsigned int peak;		/* highest number of bytes in use */
+};
+
+static struct talloc_pool_hdr *talloc_pool_hdr(struct talloc_chunk *tc)
+{
+	return (struct talloc_pool_hdr *)((char *)tc + sizeof(struct talloc_chunk));
+}
+
 static unsigned int *talloc_pool_objectcount(struct talloc_chunk *tc)
 {
-	return (unsigned int *)((char *)tc + sizeof(struct talloc_chunk));
+	return &talloc_pool_hdr(tc)->object_count;
+}
+
+/* Space a member of the given size takes up in a pool */
+#define TC_POOL_CHUNK_SIZE(size) (((size) + TC_HDR_SIZE + 15) & ~15)
+
+static char *tc_pool_first_chunk(struct talloc_chunk *pool_ctx)
+{
+	return (char *)pool_ctx + TC_HDR_SIZE + TALLOC_POOL_HDR_SIZE;
+}
+
+static char *tc_pool_end(struct talloc_chunk *pool_ctx)
+{
+	return (char *)pool_ctx + TC_HDR_SIZE + pool_ctx->size;
+}
+
+static void tc_pool_update_peak(struct talloc_chunk *pool_ctx)
+{
+	struct talloc_pool_hdr *hdr = talloc_pool_hdr(pool_ctx);
+	size_t used = (char *)pool_ctx->pool - tc_pool_first_chunk(pool_ctx);
+
+	if (used > hdr->peak) {
+		hdr->peak = used;
+	}
+}
+
+/*
+  Drop a member from its pool. The space of the most recently allocated
+  member is reused right away, and once only the pool itself is left the
+  whole pool is reused, so that a pool whose members are freed in time
+  never runs out.
+*/
+static void talloc_pool_release(struct talloc_chunk *pool_ctx,
+				struct talloc_chunk *tc)
+{
+	unsigned int *pool_object_count = talloc_pool_objectcount(pool_ctx);
+
+	if (*pool_object_count == 0) {
+		TALLOC_ABORT("Pool object count zero!");
+	}
+
+	*pool_object_count -= 1;
+
+	if (*pool_object_count == 0) {
+		free(pool_ctx);
+		return;
+	}
+
+	if (pool_ctx->flags & TALLOC_FLAG_FREE) {
+		return;
+	}
+
+	if (*pool_object_count == 1) {
+		pool_ctx->pool = tc_pool_first_chunk(pool_ctx);
+	} else if ((char *)tc + TC_POOL_CHUNK_SIZE(tc->size)
+		   == (char *)pool_ctx->pool) {
+		pool_ctx->pool = tc;
+	}
+
+#if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_NOACCESS)
+	VALGRIND_MAKE_MEM_NOACCESS(pool_ctx->pool,
+				   tc_pool_end(pool_ctx) - (char *)pool_ctx->pool);
+#endif
 }
 
 /*
@@ -296,8 +373,7 @@ static struct talloc_chunk *talloc_alloc_pool(struct talloc_chunk *parent,
 		return NULL;
 	}
 
-	space_left = ((char *)pool_ctx + TC_HDR_SIZE + pool_ctx->size)
-		- ((char *)pool_ctx->pool);
+	space_left = tc_pool_end(pool_ctx) - ((char *)pool_ctx->pool);
 
 	/*
 	 * Align size to 16 bytes
@@ -305,6 +381,7 @@ static struct talloc_chunk *talloc_alloc_pool(struct talloc_chunk *parent,
 	chunk_size = ((size + 15) & ~15);
 
 	if (space_left < chunk_size) {
+		talloc_pool_hdr(pool_ctx)->num_fallbacks++;
 		return NULL;
 	}
 
@@ -315,15 +392,29 @@ static struct talloc_chunk *talloc_alloc_pool(struct talloc_chunk *parent,
 #endif
 
 	pool_ctx->pool = (void *)((char *)result + chunk_size);
+	tc_pool_update_peak(pool_ctx);
 
 	result->flags = TALLOC_MAGIC | TALLOC_FLAG_POOLMEM;
 	result->pool = pool_ctx;
 
 	*talloc_pool_objectcount(pool_ctx) += 1;
+	talloc_pool_hdr(pool_ctx)->num_allocs++;
 
 	return result;
 }
 
+/* number of malloc() and realloc() calls made, see talloc_malloc_count() */
+static unsigned long malloc_count;
+
+/*
+  Return how many times talloc called malloc() or realloc() so far, in all
+  threads. Allocations served from a pool are not counted.
+*/
+unsigned long talloc_malloc_count(void)
+{
+	return malloc_count;
+}
+
 /* 
    Allocate a bit of memory as a child of an existing pointer
 */
@@ -347,6 +438,7 @@ static inline void *__talloc(const void *context, size_t size)
 	if (tc == NULL) {
 		tc = (struct talloc_chunk *)malloc(TC_HDR_SIZE+size);
 		if (unlikely(tc == NULL)) abort(); // return NULL;
+		mp_atomic_add(&malloc_count, 1);
 		tc->flags = TALLOC_MAGIC;
 		tc->pool  = NULL;
 	}
@@ -395,7 +487,7 @@ void *talloc_pool(const void *context, size_t size)
 	tc->flags |= TALLOC_FLAG_POOL;
 	tc->pool = (char *)result + TALLOC_POOL_HDR_SIZE;
 
-	*talloc_pool_objectcount(tc) = 1;
+	*talloc_pool_hdr(tc) = (struct talloc_pool_hdr){ .object_count = 1 };
 
 #if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_NOACCESS)
 	VALGRIND_MAKE_MEM_NOACCESS(tc->pool, size);
@@ -404,6 +496,31 @@ void *talloc_pool(const void *context, size_t size)
 	return result;
 }
 
+/*
+  Get the allocation counters of a pool. Allocations made as children of
+  pool members count as allocations from the pool.
+*/
+void talloc_pool_get_stats(const void *pool, struct talloc_pool_stats *stats)
+{
+	struct talloc_chunk *tc = talloc_chunk_from_ptr(pool);
+	struct talloc_pool_hdr *hdr;
+
+	if (!(tc->flags & TALLOC_FLAG_POOL)) {
+		*stats = (struct talloc_pool_stats){0};
+		return;
+	}
+
+	hdr = talloc_pool_hdr(tc);
+	*stats = (struct talloc_pool_stats){
+		.size = tc_pool_end(tc) - tc_pool_first_chunk(tc),
+		.used = (char *)tc->pool - tc_pool_first_chunk(tc),
+		.peak = hdr->peak,
+		.objects = hdr->object_count - 1,
+		.allocs = hdr->num_allocs,
+		.fallbacks = hdr->num_fallbacks,
+	};
+}
+
 /*
   setup a destructor to be called on free of a pointer
   the destructor should return 0 on success, or -1 on failure.
@@ -581,24 +698,11 @@ static inline int _talloc_free(void *ptr)
 
 	tc->flags |= TALLOC_FLAG_FREE;
 
-	if (tc->flags & (TALLOC_FLAG_POOL|TALLOC_FLAG_POOLMEM)) {
-		struct talloc_chunk *pool;
-		unsigned int *pool_object_count;
-
-		pool = (tc->flags & TALLOC_FLAG_POOL)
-			? tc : (struct talloc_chunk *)tc->pool;
-
-		pool_object_count = talloc_pool_objectcount(pool);
-
-		if (*pool_object_count == 0) {
-			TALLOC_ABORT("Pool object count zero!");
-		}
-
-		*pool_object_count -= 1;
-
-		if (*pool_object_count == 0) {
-			free(pool);
-		}
+	if (tc->flags & TALLOC_FLAG_POOL) {
+		talloc_pool_release(tc, tc);
+	}
+	else if (tc->flags & TALLOC_FLAG_POOLMEM) {
+		talloc_pool_release((struct talloc_chunk *)tc->pool, tc);
 	}
 	else {
 		free(tc);
@@ -903,7 +1007,7 @@ void talloc_free_children(void *ptr)
 
 	if ((tc->flags & TALLOC_FLAG_POOL)
 	    && (*talloc_pool_objectcount(tc) == 1)) {
-		tc->pool = ((char *)tc + TC_HDR_SIZE + TALLOC_POOL_HDR_SIZE);
+		tc->pool = tc_pool_first_chunk(tc);
 #if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_NOACCESS)
 		VALGRIND_MAKE_MEM_NOACCESS(
 			tc->pool, tc->size - TALLOC_POOL_HDR_SIZE);
@@ -984,6 +1088,24 @@ void *_talloc_realloc(const void *context, void *ptr, size_t size, const char *n
 		abort(); // return NULL;
 	}
 
+#if !ALWAYS_REALLOC
+	/* resize the most recently allocated member of a pool in place */
+	if (tc->flags & TALLOC_FLAG_POOLMEM) {
+		struct talloc_chunk *pool_ctx = (struct talloc_chunk *)tc->pool;
+		char *end = (char *)tc + TC_POOL_CHUNK_SIZE(tc->size);
+		char *new_end = (char *)tc + TC_POOL_CHUNK_SIZE(size);
+
+		if (end == (char *)pool_ctx->pool
+		    && new_end <= tc_pool_end(pool_ctx)) {
+			pool_ctx->pool = new_end;
+			tc_pool_update_peak(pool_ctx);
+			tc->size = size;
+			_talloc_set_name_const(ptr, name);
+			return ptr;
+		}
+	}
+#endif
+
 	/* don't shrink if we have less than 1k to gain */
 	if ((size < tc->size) && ((tc->size - size) < 1024)) {
 		tc->size = size;
@@ -995,6 +1117,7 @@ void *_talloc_realloc(const void *context, void *ptr, size_t size, const char *n
 
 #if ALWAYS_REALLOC
 	new_ptr = malloc(size + TC_HDR_SIZE);
+	mp_atomic_add(&malloc_count, 1);
 	if (new_ptr) {
 		memcpy(new_ptr, tc, tc->size + TC_HDR_SIZE);
 		free(tc);
@@ -1003,20 +1126,22 @@ void *_talloc_realloc(const void *context, void *ptr, size_t size, const char *n
 	if (tc->flags & TALLOC_FLAG_POOLMEM) {
 
 		new_ptr = talloc_alloc_pool(tc, size + TC_HDR_SIZE);
-		*talloc_pool_objectcount((struct talloc_chunk *)
-					 (tc->pool)) -= 1;
 
 		if (new_ptr == NULL) {
 			new_ptr = malloc(TC_HDR_SIZE+size);
+			mp_atomic_add(&malloc_count, 1);
 			malloced = true;
 		}
 
 		if (new_ptr) {
 			memcpy(new_ptr, tc, MIN(tc->size,size) + TC_HDR_SIZE);
+			talloc_pool_release((struct talloc_chunk *)tc->pool,
+					    tc);
 		}
 	}
 	else {
 		new_ptr = realloc(tc, size + TC_HDR_SIZE);
+		mp_atomic_add(&malloc_count, 1);
 	}
 #endif
 	if (unlikely(!new_ptr)) {	
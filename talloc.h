@@ -42,6 +42,16 @@
 /* this is only needed for compatibility with the old talloc */
 typedef void TALLOC_CTX;
 
+/* counters of a talloc_pool(), see talloc_pool_get_stats() */
+struct talloc_pool_stats {
+	size_t size;		/* usable size of the pool */
+	size_t used;		/* bytes currently taken by members */
+	size_t peak;		/* highest value of used so far */
+	unsigned int objects;	/* members currently in the pool */
+	unsigned int allocs;	/* allocations served by the pool so far */
+	unsigned int fallbacks;	/* allocations that went to malloc() */
+};
+
 /*
   this uses a little trick to allow __LINE__ to be stringified
 */
@@ -110,6 +120,8 @@ typedef void TALLOC_CTX;
 /* The following definitions come from talloc.c  */
 void *_talloc(const void *context, size_t size);
 void *talloc_pool(const void *context, size_t size);
+void talloc_pool_get_stats(const void *pool, struct talloc_pool_stats *stats);
+unsigned long talloc_malloc_count(void);
 void _talloc_set_destructor(const void *ptr, int (*destructor)(void *));
 int talloc_increase_ref_count(const void *ptr);
 size_t talloc_reference_count(const void *ptr);